@@ -10,11 +10,15 @@ USING_BOOST_IPC = false
 USING_BOOST_NET = false
 USING_OPENSSL_NET = false
 USING_MEMORY_DEBUGGING = false
+USING_HEAP_PROFILER = false
+USING_POOL_ALLOCATOR = false
 USING_DEFAULT_QT5_GUI = false
 USING_JSON_SPIRIT_RPC = false
 USING_LIBCONFIG = false
 USING_JSON_CONFIG = false
+USING_ZLIB_LOG = false
 USING_API_WARNINGS = false
+LOG_COMPILE_LEVEL = ""
 SET_COMPILER = "clang++"
 BUILDCONFIG_FILE = "../src/build_config.h"
 # The remainder of these are non-modifiable (or should be, depending).
@@ -64,9 +68,24 @@ def print_help()
 	puts "USING_JSON_CONFIG  (define)"
 	puts "    - Uses JSON as the configuration file parser."
 	puts "    - No alternative config libraries (xxx_CONFIG) can be provided."
+	puts "USING_ZLIB_LOG  (define)"
+	puts "    - Uses zlib to compress rotated log segments."
+	puts "    - Without it, segments are rotated uncompressed."
 	puts "USING_MEMORY_DEBUGGING  (define)"
         puts "    - Activates memory debugging"
 	puts "    - In brief, acts as a memory leak checker."
+	puts "USING_HEAP_PROFILER  (define)"
+	puts "    - Samples allocations by call site; light enough for release builds"
+	puts "    - Profiles are dumped on SIGUSR2 or the heap_profile RPC"
+	puts "    - Ignored with USING_MEMORY_DEBUGGING, which tracks everything"
+	puts "USING_POOL_ALLOCATOR  (define)"
+	puts "    - Serves small allocations from per-thread size classes, not malloc"
+	puts "    - For the many short-lived string copies made while parsing"
+	puts "    - Ignored with USING_MEMORY_DEBUGGING or USING_HEAP_PROFILER"
+	puts "LOG_COMPILE_LEVEL  (value)"
+	puts "    - The most detailed log level compiled in; Error, Warn, Info or Debug"
+	puts "    - Statements above it are removed entirely, rather than filtered at runtime"
+	puts "    - e.g. LOG_COMPILE_LEVEL=Info"
 	puts "SET_COMPILER  (value)"
 	puts "    - Overrides the default compiler (clang++)"
 	puts "    - e.g. SET_COMPILER=g++"
@@ -111,12 +130,24 @@ if ARGV.length > 0
 		elsif arg == "USING_JSON_CONFIG"
 			USING_JSON_CONFIG = true
 			puts "  -> " + "Enabled JSON configuration".fg_yellow.bold
+		elsif arg == "USING_ZLIB_LOG"
+			USING_ZLIB_LOG = true
+			puts "  -> " + "Enabled zlib log compression".fg_yellow.bold
 		elsif arg == "USING_MEMORY_DEBUGGING"
 			USING_MEMORY_DEBUGGING = true
 			puts "  -> " + "Enabled memory debugging".fg_yellow.bold
+		elsif arg == "USING_HEAP_PROFILER"
+			USING_HEAP_PROFILER = true
+			puts "  -> " + "Enabled heap profiling".fg_yellow.bold
+		elsif arg == "USING_POOL_ALLOCATOR"
+			USING_POOL_ALLOCATOR = true
+			puts "  -> " + "Enabled pool allocator".fg_yellow.bold
 		elsif arg == "USING_API_WARNINGS"
 			USING_API_WARNINGS = true
 			puts "  -> " + "Enabled API warnings".fg_yellow.bold
+		elsif arg.start_with?("LOG_COMPILE_LEVEL=")
+			LOG_COMPILE_LEVEL = arg.split("=", 2)[1]
+			puts "  -> " + "Compiling in log levels up to #{LOG_COMPILE_LEVEL}".fg_yellow.bold
 		
 	# 'App' arguments
 		elsif arg == "--force-rebuild"
@@ -184,6 +215,14 @@ if USING_JSON_CONFIG
 	content.push("");
 end
 #******************************************************************************
+# Compression library
+#******************************************************************************
+if USING_ZLIB_LOG
+	content.push("// uses zlib to compress rotated log segments");
+	content.push("#define USING_ZLIB_LOG");
+	content.push("");
+end
+#******************************************************************************
 # Networking library
 #******************************************************************************
 if USING_BOOST_NET
@@ -238,6 +277,27 @@ if USING_MEMORY_DEBUGGING
 	content.push("#define USING_MEMORY_DEBUGGING");
 	content.push("");
 end
+if USING_HEAP_PROFILER && !USING_MEMORY_DEBUGGING
+	content.push("// samples allocations by call site, for heap profiles");
+	content.push("#define USING_HEAP_PROFILER");
+	content.push("");
+end
+if USING_POOL_ALLOCATOR && !USING_MEMORY_DEBUGGING && !USING_HEAP_PROFILER
+	content.push("// serves small allocations from per-thread size classes");
+	content.push("#define USING_POOL_ALLOCATOR");
+	content.push("");
+end
+if LOG_COMPILE_LEVEL != ""
+	# values match ELogLevel
+	levels = { "Error" => 1, "Warn" => 2, "Info" => 3, "Debug" => 4 }
+	if levels.has_key?(LOG_COMPILE_LEVEL)
+		content.push("// the most detailed log level compiled in");
+		content.push("#define LOG_COMPILE_LEVEL #{levels[LOG_COMPILE_LEVEL]}");
+		content.push("");
+	else
+		puts "  -> " + "Unknown LOG_COMPILE_LEVEL: #{LOG_COMPILE_LEVEL}".fg_red.bold
+	end
+end
 if IS_WINDOWS_BUILD
 	content.push("// prevent windows warnings with certain headers");
 	content.push("#define _WIN32_WINNT 0x0600");
@@ -107,6 +107,10 @@ if USING_LIBCONFIG
 end
 if USING_JSON_CONFIG
 end
+if USING_ZLIB_LOG
+	# system library; not in third-party
+	zlib_libraries = [ "z" ]
+end
 if USING_JSON_SPIRIT_RPC
 	# There's no need to build this library, is header-only
 	json_spirit_include_path = "../third-party/json_spirit"
@@ -163,6 +167,9 @@ if USING_LIBCONFIG
 	sbi.add_link_library_path(libconfig_library_path)
 	sbi.add_link_libraries(libconfig_libraries)
 end
+if USING_ZLIB_LOG
+	sbi.add_link_libraries(zlib_libraries)
+end
 if USING_JSON_SPIRIT_RPC
 	sbi.add_include_path(json_spirit_include_path)
 	sbi.add_link_library_path(boost_rpc_library_path)
@@ -191,6 +198,9 @@ if USING_LIBCONFIG
 	api.add_link_library_path(libconfig_library_path)
 	api.add_link_library(libconfig_libraries)
 end
+if USING_ZLIB_LOG
+	api.add_link_libraries(zlib_libraries)
+end
 if USING_JSON_SPIRIT_RPC
 	api.add_include_path(json_spirit_include_path)
 	api.add_include_path(boost_rpc_include_path)
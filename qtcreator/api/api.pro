@@ -63,7 +63,14 @@ SOURCES += ../../src/api/Allocator.cc \
     ../../src/api/rpc_commands.cc \
     ../../src/api/RpcServer.cc \
     ../../src/api/RpcTable.cc \
-    ../../src/api/JsonRpc.cc
+    ../../src/api/JsonRpc.cc \
+    ../../src/api/TimerWheel.cc \
+    ../../src/api/log_binary.cc \
+    ../../src/api/Diagnostics.cc \
+    ../../src/api/HeapProfiler.cc \
+    ../../src/api/ScratchArena.cc \
+    ../../src/api/MemoryAccounting.cc \
+    ../../src/api/PoolAllocator.cc
 
 HEADERS += ../../src/api/Allocator.h \
     ../../src/api/char_helper.h \
@@ -89,4 +96,12 @@ HEADERS += ../../src/api/Allocator.h \
     ../../src/api/RpcCommand.h \
     ../../src/api/RpcServer.h \
     ../../src/api/RpcTable.h \
-    ../../src/api/JsonRpc.h
+    ../../src/api/JsonRpc.h \
+    ../../src/api/TimerWheel.h \
+    ../../src/api/log_binary.h \
+    ../../src/api/Diagnostics.h \
+    ../../src/api/HeapProfiler.h \
+    ../../src/api/ScratchArena.h \
+    ../../src/api/MemoryAccounting.h \
+    ../../src/api/PoolAllocator.h \
+    ../../src/api/ThreadSlots.h
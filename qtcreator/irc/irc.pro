@@ -66,7 +66,13 @@ SOURCES += ../../src/irc/interface.cc \
     ../../src/irc/IrcUser.cc \
     ../../src/irc/nethelper.cc \
     ../../src/irc/win32.cc \
-    ../../src/irc/IrcGui.cc
+    ../../src/irc/IrcGui.cc \
+    ../../src/irc/rpc_commands.cc \
+    ../../src/irc/SslCache.cc \
+    ../../src/irc/DnsResolver.cc \
+    ../../src/irc/ReconnectManager.cc \
+    ../../src/irc/PresenceTracker.cc \
+    ../../src/irc/NetsplitTracker.cc
 
 HEADERS += ../../src/irc/config_structs.h \
     ../../src/irc/irc_channel_modes.h \
@@ -89,4 +95,14 @@ HEADERS += ../../src/irc/config_structs.h \
     ../../src/irc/nethelper.h \
     ../../src/irc/rfc1459.h \
     ../../src/irc/rfc2812.h \
-    ../../src/irc/IrcGui.h
+    ../../src/irc/IrcGui.h \
+    ../../src/irc/rpc_commands.h \
+    ../../src/irc/SslCache.h \
+    ../../src/irc/DnsResolver.h \
+    ../../src/irc/ReconnectManager.h \
+    ../../src/irc/irc_capabilities.h \
+    ../../src/irc/PresenceTracker.h \
+    ../../src/irc/NetsplitTracker.h \
+    ../../src/irc/irc_fast_path.h \
+    ../../src/irc/irc_line_split.h \
+    ../../src/irc/irc_send_batch.h
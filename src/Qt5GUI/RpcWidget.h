@@ -28,6 +28,7 @@
 
 #include <api/definitions.h>
 #include <api/Log.h>
+#include <api/MemoryAccounting.h>
 
 #include "UI.h"
 
@@ -75,6 +76,14 @@ public:
 		}
 
 		LOG(ELogLevel::Debug) << "New RpcWidget created (id=" << _id << ")\n";
+
+		MEM_ACCOUNT(Gui, sizeof(RpcWidget<T>), 1);
+	}
+
+
+	~RpcWidget()
+	{
+		MEM_ACCOUNT(Gui, -(int64_t)sizeof(RpcWidget<T>), -1);
 	}
 
 
@@ -13,16 +13,15 @@
 // This file is only valid if USING_MEMORY_DEBUGGING is enabled
 #if defined(USING_MEMORY_DEBUGGING)
 
-#if !defined(DISABLE_MEMORY_CHECK_TO_STDOUT) || !defined(DISABLE_MEMORY_OP_TO_STDOUT)
-#	include <cstdio>		// printf
-#endif
+#include <cstdio>			// printf, fprintf
+#include <new>				// std::nothrow
 
 #if defined(__linux__) || defined(BSD)
 #	include <string.h>		// memcmp, memset, memmove
-#	include <algorithm>		// std::find
 #endif
 
 #include "char_helper.h"		// text handling
+#include "ThreadSlots.h"		// per-thread statistics
 #include "utils.h"			// strlcpy
 
 
@@ -36,6 +35,8 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 // Magic values, assigned and checked with memory operations
 #define MEM_HEADER_MAGIC	0xCAFEFACE
 #define MEM_FOOTER_MAGIC	0xDEADBEEF
+// Header magic once freed; a second free fails validation
+#define MEM_FREED_MAGIC		0xFEEDDEAD
 // Memory-fill values, used before and after alloc/free
 #define MEM_ON_INIT		0x0F
 #define MEM_AFTER_FREE		0xFF
@@ -57,25 +58,109 @@ const unsigned	mem_footer_magic = MEM_FOOTER_MAGIC;
 
 
 
-Allocator::Allocator() :
-	_allocs(0), _frees(0), _current_allocated(0), _total_allocated(0)
+/**
+ * Invoked as a thread exits; its statistics are released for the next new
+ * thread to carry on with.
+ *
+ * @param[in] stats The exiting threads mem_thread_stats
+ */
+static void
+release_stats(
+	mem_thread_stats* stats
+)
+{
+	stats->in_use = false;
+}
+
+
+/* the statistics of every thread that has allocated or freed; only ever
+ * added to, until destruction, as those of exited threads are reused */
+static ThreadSlots<mem_thread_stats, &release_stats>	thread_stats;
+
+
+
+/**
+ * Creates the statistics for a thread with none to adopt.
+ *
+ * @param[in] index The number created before these; spreads threads over
+ * the shards in turn
+ * @return The new statistics, zeroed and in use; nullptr on allocation
+ * failure
+ */
+static mem_thread_stats*
+create_stats(
+	uint32_t index
+)
+{
+	mem_thread_stats*	stats;
+
+	if (( stats = new (std::nothrow) mem_thread_stats) == nullptr )
+		return nullptr;
+
+	stats->allocs = 0;
+	stats->frees = 0;
+	stats->current_allocated = 0;
+	stats->total_allocated = 0;
+	stats->sample_countdown = 0;
+	stats->shard = index % MEM_SHARD_COUNT;
+	stats->in_use = true;
+
+	return stats;
+}
+
+
+
+/**
+ * Adds to a per-thread counter. Only the owning thread writes to it, so
+ * there's no need for an atomic read-modify-write; just untorn values for
+ * the reader.
+ *
+ * @param[in] counter The counter to add to
+ * @param[in] value The amount to add
+ */
+template <typename T>
+static void
+stat_add(
+	std::atomic<T>& counter,
+	T value
+)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+
+
+Allocator::Allocator()
 {
-	/* reserve 100 internal allocations. Will breach, but should cause the
-	 * expansions to be 200, 400, 800, etc. */
-	_memblocks.reserve(100);
+	_sample_rate = MEM_SAMPLE_RATE;
+
+	for ( auto& shard : _shards )
+		shard.head = nullptr;
+
+	thread_stats.Attach();
 }
 
 
 
 Allocator::~Allocator()
 {
-	if ( !_memblocks.empty() )
+	for ( auto& shard : _shards )
 	{
-		printf("Memory Leak Detected\n\nCheck '%s' for details\n",
-		       MEM_LEAK_LOG_NAME);
+		if ( shard.head != nullptr )
+		{
+			printf("Memory Leak Detected\n\nCheck '%s' for details\n",
+			       MEM_LEAK_LOG_NAME);
+			break;
+		}
 	}
 
 	OutputMemoryInfo();
+
+	/* threads still running keep their pointer; detach the exit
+	 * notification first, so it doesn't run on freed memory. Anything
+	 * allocating this late is broken anyway */
+	thread_stats.Detach();
+	thread_stats.Clear();
 }
 
 
@@ -90,10 +175,10 @@ Allocator::CheckBlock(
 	if ( memory_block == nullptr )
 		goto null_block;
 
-#if !defined(DISABLE_MEMORY_CHECK_TO_STDOUT)
-	printf("\tChecking Memory Block %p..\n"), memory_block);
-	printf("\t\tGlobal Header magic number is %lu bytes in size :: %#x\n"), sizeof(mem_header_magic), mem_header_magic);
-	printf("\t\tGlobal Footer magic number is %lu bytes in size :: %#x\n"), sizeof(mem_footer_magic), mem_footer_magic);
+#if defined(MEMORY_CHECK_TO_STDOUT)
+	printf("\tChecking Memory Block %p..\n", memory_block);
+	printf("\t\tGlobal Header magic number is %lu bytes in size :: %#x\n", (unsigned long)sizeof(mem_header_magic), mem_header_magic);
+	printf("\t\tGlobal Footer magic number is %lu bytes in size :: %#x\n", (unsigned long)sizeof(mem_footer_magic), mem_footer_magic);
 #endif
 
 	if ( memcmp(&memory_block->magic,
@@ -105,10 +190,10 @@ Allocator::CheckBlock(
 		goto corrupt_header;
 	}
 
-#if !defined(DISABLE_MEMORY_CHECK_TO_STDOUT)
-	printf("\t\tHas a valid header (%lu bytes, %#x)...\n"),
-		sizeof(memory_block->magic), memory_block->magic);
-	printf("\t\tHeader Info:: %u (%u requested) bytes, line %u in %s\n"),
+#if defined(MEMORY_CHECK_TO_STDOUT)
+	printf("\t\tHas a valid header (%lu bytes, %#x)...\n",
+		(unsigned long)sizeof(memory_block->magic), memory_block->magic);
+	printf("\t\tHeader Info:: %u (%u requested) bytes, line %u in %s\n",
 		memory_block->real_size, memory_block->requested_size,
 		memory_block->line, memory_block->file);
 #endif
@@ -121,17 +206,17 @@ Allocator::CheckBlock(
 		goto corrupt_footer;
 	}
 
-#if !defined(DISABLE_MEMORY_CHECK_TO_STDOUT)
+#if defined(MEMORY_CHECK_TO_STDOUT)
 	printf("\t\tHas a valid footer (%lu bytes, %#x)...\n",
-		sizeof(memory_block->footer->magic),
+		(unsigned long)sizeof(memory_block->footer->magic),
 		memory_block->footer->magic);
 #endif
 
 	// calculate the size requested by removing the header + footer
 	block_size = ((uint8_t*)memory_block->footer) - ((uint8_t*)memory_block + sizeof(memblock_header));
 
-#if !defined(DISABLE_MEMORY_CHECK_TO_STDOUT)
-	printf("\t\tCalculated block_size is %u bytes\n"), block_size);
+#if defined(MEMORY_CHECK_TO_STDOUT)
+	printf("\t\tCalculated block_size is %u bytes\n", block_size);
 #endif
 
 	if ( memory_block->requested_size != block_size )
@@ -142,8 +227,8 @@ Allocator::CheckBlock(
 		goto invalid_size;
 	}
 
-#if !defined(DISABLE_MEMORY_CHECK_TO_STDOUT)
-	printf("\t\tHas a valid app_mem size (%u bytes)\n\t\tValidated!\n"),
+#if defined(MEMORY_CHECK_TO_STDOUT)
+	printf("\t\tHas a valid app_mem size (%u bytes)\n\t\tValidated!\n",
 	       block_size);
 #endif
 
@@ -174,6 +259,10 @@ Allocator::OutputMemoryInfo()
 	bool		close_file = true;
 	uint32_t	i = 0;
 	E_MEMORY_ERROR	result;
+	uint64_t	allocs = 0;
+	uint64_t	frees = 0;
+	int64_t		current_allocated = 0;
+	uint64_t	total_allocated = 0;
 	// we don't store/track the user-requested amounts, only the real
 	uint32_t	requested_alloc;
 	uint32_t	requested_unfreed;
@@ -184,12 +273,21 @@ Allocator::OutputMemoryInfo()
 		close_file = false;
 	}
 
+	// sum up every threads statistics
+	for ( mem_thread_stats* s = thread_stats.First(); s != nullptr; s = s->next )
+	{
+		allocs += s->allocs.load(std::memory_order_relaxed);
+		frees += s->frees.load(std::memory_order_relaxed);
+		current_allocated += s->current_allocated.load(std::memory_order_relaxed);
+		total_allocated += s->total_allocated.load(std::memory_order_relaxed);
+	}
+
 	/* Remove memory block sizes, multiplied by the number of allocations,
 	 * which is taken away from the total amount allocated. */
-	requested_alloc		= _total_allocated - (HEADER_FOOTER_SIZE * _allocs);
+	requested_alloc		= (uint32_t)(total_allocated - (HEADER_FOOTER_SIZE * allocs));
 	/* Remove memory block sizes, multiplied by the number of pending frees,
 	 * which is to be taken away from the current amount still allocated. */
-	requested_unfreed	= _current_allocated - (HEADER_FOOTER_SIZE * (_allocs - _frees));
+	requested_unfreed	= (uint32_t)(current_allocated - (int64_t)(HEADER_FOOTER_SIZE * (allocs - frees)));
 
 	fprintf(leak_file,
 		"# Details\n"
@@ -210,88 +308,92 @@ Allocator::OutputMemoryInfo()
 		"\n"
 		"##################\n"
 		"  Unfreed Blocks  \n",
-		HEADER_FOOTER_SIZE,
-		_allocs, _frees, (_allocs - _frees),
-		_total_allocated, _current_allocated,
+		(unsigned long)HEADER_FOOTER_SIZE,
+		(uint32_t)allocs, (uint32_t)frees, (uint32_t)(allocs - frees),
+		(uint32_t)total_allocated, (uint32_t)current_allocated,
 		requested_alloc, requested_unfreed
 		);
 
 
-	for ( auto block_ptr : _memblocks )
+	for ( auto& shard : _shards )
 	{
-		i++;
-
-		fprintf(leak_file,
-			"##################\n"
-			"%u)\n"
-			"Block...: " PRINT_POINTER
-			"\n",
-			i, (uintptr_t)block_ptr
-		);
+		std::lock_guard<std::mutex>	lock(shard.mutex);
 
-		result = CheckBlock(block_ptr);
-		switch ( result )
+		for ( memblock_header* block_ptr = shard.head; block_ptr != nullptr; block_ptr = block_ptr->next )
 		{
-		case E_MEMORY_ERROR::EC_NoMemoryBlock:
-			{
-				fprintf(leak_file,
-					"Error...: Block Pointer was NULL\n"
-				);
-				break;
-			}
-		case E_MEMORY_ERROR::EC_CorruptFooter:
-			{
-				fprintf(leak_file,
-					"Error...: Corrupt Footer\n"
-				);
-				break;
-			}
-		case E_MEMORY_ERROR::EC_CorruptHeader:
-			{
-				fprintf(leak_file,
-					"Error...: Corrupt Header\n"
-				);
-				break;
-			}
-		case E_MEMORY_ERROR::EC_SizeMismatch:
+			i++;
+
+			fprintf(leak_file,
+				"##################\n"
+				"%u)\n"
+				"Block...: " PRINT_POINTER
+				"\n",
+				i, (uintptr_t)block_ptr
+			);
+
+			result = CheckBlock(block_ptr);
+			switch ( result )
 			{
-				fprintf(leak_file,
-					"Error...: Size Mismatch (%u actual bytes)\n",
-					block_ptr->requested_size
-				);
+			case E_MEMORY_ERROR::EC_NoMemoryBlock:
+				{
+					fprintf(leak_file,
+						"Error...: Block Pointer was NULL\n"
+					);
+					break;
+				}
+			case E_MEMORY_ERROR::EC_CorruptFooter:
+				{
+					fprintf(leak_file,
+						"Error...: Corrupt Footer\n"
+					);
+					break;
+				}
+			case E_MEMORY_ERROR::EC_CorruptHeader:
+				{
+					fprintf(leak_file,
+						"Error...: Corrupt Header\n"
+					);
+					break;
+				}
+			case E_MEMORY_ERROR::EC_SizeMismatch:
+				{
+					fprintf(leak_file,
+						"Error...: Size Mismatch (%u actual bytes)\n",
+						block_ptr->requested_size
+					);
+					break;
+				}
+			default:
 				break;
 			}
-		default:
-			break;
-		}
 
-		/* can't fall through in switch, so have to do a secondary check
-		 * as we can't print data that's corrupt or a nullptr */
-		if ( result != EC_NoMemoryBlock && result != EC_CorruptHeader )
-		{
-			fprintf(leak_file,
-				"Size....: %u\n"
-				"Function: %s\n"
-				"File....: %s\n"
-				"Line....: %u\n"
-				"Owner...: %p\n",
-				block_ptr->requested_size,
-				block_ptr->function,
-				block_ptr->file,
-				block_ptr->line,
-				block_ptr->owner
-			);
-			fprintf(leak_file, "Data....: ");
-			for ( uint32_t j = 0;
-				j < block_ptr->requested_size && j < MEM_OUTPUT_LIMIT;
-				j++ )
+			/* can't fall through in switch, so have to do a secondary check
+			 * as we can't print data that's corrupt or a nullptr */
+			if ( result != EC_NoMemoryBlock && result != EC_CorruptHeader )
 			{
-				/** @todo causes warning 'cast to pointer from integer of different size' */
 				fprintf(leak_file,
-					"%02x ",
-					block_offset_realmem(block_ptr)[j]);
+					"Size....: %u\n"
+					"Function: %s\n"
+					"File....: %s\n"
+					"Line....: %u\n"
+					"Owner...: %p\n",
+					block_ptr->requested_size,
+					block_ptr->function,
+					block_ptr->file,
+					block_ptr->line,
+					block_ptr->owner
+				);
+				fprintf(leak_file, "Data....: ");
+				for ( uint32_t j = 0;
+					j < block_ptr->requested_size && j < MEM_OUTPUT_LIMIT;
+					j++ )
+				{
+					fprintf(leak_file,
+						"%02x ",
+						((uint8_t*)block_offset_realmem(block_ptr))[j]);
+				}
+				fprintf(leak_file, "\n");
 			}
-			fprintf(leak_file, "\n");
 		}
 	}
 
@@ -300,15 +402,30 @@ Allocator::OutputMemoryInfo()
 
 	/* try to free whatever we didn't during runtime; if any of these are
 	 * screwed (heap corruption) then this will probably trigger a crash */
-	while ( _memblocks.size() > 0 )
+	for ( auto& shard : _shards )
 	{
-		free(_memblocks.back());
-		_memblocks.pop_back();
+		std::lock_guard<std::mutex>	lock(shard.mutex);
+
+		while ( shard.head != nullptr )
+		{
+			memblock_header*	next = shard.head->next;
+
+			free(shard.head);
+			shard.head = next;
+		}
 	}
 }
 
 
 
+mem_thread_stats*
+Allocator::ThreadStats()
+{
+	return thread_stats.Get(nullptr, &create_stats);
+}
+
+
+
 void*
 Allocator::TrackedAlloc(
 	const uint32_t num_bytes,
@@ -320,10 +437,14 @@ Allocator::TrackedAlloc(
 {
 	memblock_header*	mem_block = nullptr;
 	memblock_footer*	mem_footer = nullptr;
+	mem_thread_stats*	stats = nullptr;
 	void*			mem_return = nullptr;
 	const char*		p = nullptr;
 	uint32_t		patched_alloc = 0;	// num_bytes + memblocks
 
+	if (( stats = ThreadStats()) == nullptr )
+		goto alloc_failure;
+
 	// allocate the requested amount, plus the size of the header & footer memblocks
 	patched_alloc = num_bytes + HEADER_FOOTER_SIZE;
 
@@ -333,12 +454,10 @@ Allocator::TrackedAlloc(
 	if ( mem_block == nullptr )
 		goto alloc_failure;
 
+#if defined(MEM_POISON_FULL)
 	// initialize the value for the new memory
 	memset(mem_block, MEM_ON_INIT, patched_alloc);
-
-	// we don't want the full path information that compilers set
-	if ( (p = strrchr(file, PATH_CHAR)) != nullptr)
-		file = p++;
+#endif
 
 	// calculate the offsets of the return memory and the footer
 	mem_return = block_offset_realmem(mem_block);
@@ -352,6 +471,26 @@ Allocator::TrackedAlloc(
 	mem_block->line		= line;
 	mem_block->real_size		= patched_alloc;
 	mem_block->requested_size	= num_bytes;
+	mem_block->shard	= MEM_UNTRACKED;
+	mem_block->file[0]	= '\0';
+	mem_block->function[0]	= '\0';
+
+	// update the stats, using patched values
+	stat_add<uint64_t>(stats->allocs, 1);
+	stat_add<int64_t>(stats->current_allocated, patched_alloc);
+	stat_add<uint64_t>(stats->total_allocated, patched_alloc);
+
+	// only a sample has their origin recorded and is listed
+	if ( stats->sample_countdown > 0 )
+	{
+		stats->sample_countdown--;
+		return mem_return;
+	}
+	stats->sample_countdown = _sample_rate.load(std::memory_order_relaxed) - 1;
+
+	// we don't want the full path information that compilers set
+	if ( (p = strrchr(file, PATH_CHAR)) != nullptr)
+		file = p + 1;
 
 #if !defined(_WIN32)
 	strlcpy(mem_block->file, file, sizeof(mem_block->file));
@@ -361,19 +500,18 @@ Allocator::TrackedAlloc(
 	mb_to_utf8(mem_block->function, function, _countof(mem_block->function));
 #endif
 
-	/* lock this class, only 1 thread to update sensitive internals at a
-	 * time - lock for as little time as possible! */
-	_mutex.lock();
+	mem_block->shard = stats->shard;
+	mem_block->prev = nullptr;
 
-	// update the stats, using patched values
-	_allocs++;
-	_current_allocated += patched_alloc;
-	_total_allocated += patched_alloc;
-	// append it to the vector
-	_memblocks.push_back(mem_block);
+	{
+		memblock_shard&			shard = _shards[mem_block->shard];
+		std::lock_guard<std::mutex>	lock(shard.mutex);
 
-	// unlock the allocator, other threads can now allocate from this class
-	_mutex.unlock();
+		mem_block->next = shard.head;
+		if ( shard.head != nullptr )
+			shard.head->prev = mem_block;
+		shard.head = mem_block;
+	}
 
 	return mem_return;
 
@@ -389,6 +527,7 @@ Allocator::TrackedFree(
 )
 {
 	memblock_header*	mem_block = nullptr;
+	mem_thread_stats*	stats = nullptr;
 
 	// as per the C standard, if it's a nullptr, do nothing
 	if ( memory == nullptr )
@@ -399,27 +538,45 @@ Allocator::TrackedFree(
 
 	mem_block = block_offset_header(memory);
 
-#if !defined(DISABLE_MEMORY_OP_TO_STDOUT)
-	printf( "free [%s (%u bytes) line %u]\n")
-		"\tBlock: %p | Usable Block: %p\n"),
+#if defined(MEMORY_OP_TO_STDOUT)
+	printf("free [%s (%u bytes) line %u]\n"
+		"\tBlock: %p | Usable Block: %p\n",
 		mem_block->file, mem_block->requested_size, mem_block->line,
 		mem_block, memory);
 #endif
 
-	// stop other class modifications
-	_mutex.lock();
+	if ( mem_block->shard != MEM_UNTRACKED )
+	{
+		memblock_shard&			shard = _shards[mem_block->shard];
+		std::lock_guard<std::mutex>	lock(shard.mutex);
+
+		// unlink from the shard
+		if ( mem_block->prev != nullptr )
+			mem_block->prev->next = mem_block->next;
+		else
+			shard.head = mem_block->next;
+		if ( mem_block->next != nullptr )
+			mem_block->next->prev = mem_block->prev;
+	}
 
-	// remove the mem_block from the vector
-	_memblocks.erase(std::find(_memblocks.begin(), _memblocks.end(), mem_block));
 	// update the context stats
-	_frees++;
-	_current_allocated -= (mem_block->real_size);
+	if (( stats = ThreadStats()) != nullptr )
+	{
+		stat_add<uint64_t>(stats->frees, 1);
+		stat_add<int64_t>(stats->current_allocated, -(int64_t)mem_block->real_size);
+	}
 
-	// we're done with the class internals, open it up again
-	_mutex.unlock();
+	// a second free of this block now fails validation
+	mem_block->magic = MEM_FREED_MAGIC;
 
 	// fill the app-allocated memory (highlights use after free)
-	memset(mem_block, MEM_AFTER_FREE, mem_block->real_size);
+#if defined(MEM_POISON_FULL)
+	memset(memory, MEM_AFTER_FREE, mem_block->requested_size);
+#else
+	memset(memory, MEM_AFTER_FREE,
+		mem_block->requested_size < MEM_POISON_BYTES ? mem_block->requested_size : MEM_POISON_BYTES);
+#endif
+
 	// perform the actual freeing of memory, including our header + footer
 	free(mem_block);
 
@@ -457,12 +614,13 @@ Allocator::TrackedRealloc(
 		return nullptr;
 	}
 
-	_mutex.lock();
+	if ( !ValidateMemory(memory) )
+		return nullptr;
 
-#if !defined(DISABLE_MEMORY_OP_TO_STDOUT)
+#if defined(MEMORY_OP_TO_STDOUT)
 	// since we call TrackedAlloc, make the log info accurate
-	printf( "realloc [%s (%u bytes) line %u]\n")
-		"\tTo be allocated in the following malloc; using memory at: %p\n"),
+	printf("realloc [%s (%u bytes) line %u]\n"
+		"\tTo be allocated in the following malloc; using memory at: %p\n",
 		file, new_num_bytes, line,
 		memory);
 #endif
@@ -473,17 +631,15 @@ Allocator::TrackedRealloc(
 	{
 		mem_block = block_offset_header(memory);
 
-		// move the original data into the new allocation
+		// move the original data into the new allocation; no more than either holds
 		mem_block->requested_size < new_num_bytes ?
-			memmove(mem_return, memory, new_num_bytes) :
-			memmove(mem_return, memory, mem_block->requested_size);
+			memmove(mem_return, memory, mem_block->requested_size) :
+			memmove(mem_return, memory, new_num_bytes);
 
 		// free the original block
 		TrackedFree(memory);
 	}
 
-	_mutex.unlock();
-
 	return mem_return;
 }
 
@@ -496,30 +652,29 @@ Allocator::ValidateMemory(
 {
 	bool	ret = true;
 
-	_mutex.lock();
-
 	// if no pointer was specified, check the entire list
 	if ( memory == nullptr )
 	{
-		for ( auto block : _memblocks )
+		for ( auto& shard : _shards )
 		{
-			// bail if a block is invalid
-			if ( CheckBlock(block) != E_MEMORY_ERROR::EC_NoError )
+			std::lock_guard<std::mutex>	lock(shard.mutex);
+
+			for ( memblock_header* block = shard.head; block != nullptr; block = block->next )
 			{
-				ret = false;
-				break;
+				// bail if a block is invalid
+				if ( CheckBlock(block) != E_MEMORY_ERROR::EC_NoError )
+					return false;
 			}
 		}
 	}
 	else
 	{
+		// a block is only ever checked by its owner; no lock needed
 		memblock_header*	mem_block = block_offset_header(memory);
 
 		ret = (CheckBlock(mem_block) == E_MEMORY_ERROR::EC_NoError);
 	}
 
-	_mutex.unlock();
-
 	return ret;
 }
 
@@ -10,6 +10,7 @@
 
 #if defined(USING_MEMORY_DEBUGGING)
 
+#include <atomic>			// per-thread counters
 #include <mutex>			// C++11 mutex, locking
 #include <vector>			// storage container
 
@@ -28,6 +29,15 @@ class Object;
 #define MEM_LEAK_LOG_NAME		"memdynamic.log"
 #define MEM_MAX_FILENAME_LENGTH		31
 #define MEM_MAX_FUNCTION_LENGTH		31
+/** Number of separately locked lists the tracked blocks are spread over */
+#define MEM_SHARD_COUNT			16
+/** Track 1 in this many allocations by default; 1 tracks them all */
+#if !defined(MEM_SAMPLE_RATE)
+#	define MEM_SAMPLE_RATE		1
+#endif
+/** Bytes poisoned at the start of freed memory; define MEM_POISON_FULL to
+ * fill whole blocks, on allocation and free, instead */
+#define MEM_POISON_BYTES		64
 
 
 
@@ -65,6 +75,12 @@ struct memblock_header
 	/** A pointer to this memory blocks footer */
 	memblock_footer*	footer;
 
+	/** The previous block in the same shard; tracked blocks only */
+	memblock_header*	prev;
+
+	/** The next block in the same shard; tracked blocks only */
+	memblock_header*	next;
+
 	/** A pointer to the object that allocated the memory. Requires manual
 	 * calling, may aid in debugging certain scenarios but not needed in the
 	 * majority of cases. Left here as an example of associating a block of
@@ -73,7 +89,8 @@ struct memblock_header
 
 	/**
 	 * The file this memory block was created in; is not allocated dynamically,
-	 * and so is bound by the MEM_MAX_FILENAME_LENGTH definition.
+	 * and so is bound by the MEM_MAX_FILENAME_LENGTH definition. Only set
+	 * for tracked blocks, as is function.
 	 */
 	CHARTYPE	file[MEM_MAX_FILENAME_LENGTH + 1];
 
@@ -90,6 +107,52 @@ struct memblock_header
 
 	/** The size, in bytes, of the total allocation (header+data+footer) */
 	uint32_t	real_size;
+
+	/** The shard the block is listed in, or MEM_UNTRACKED if it wasn't
+	 * sampled; untracked blocks are counted, but not listed */
+	uint32_t	shard;
+};
+
+
+/** memblock_header::shard for blocks that weren't sampled */
+#define MEM_UNTRACKED		UINT32_MAX
+
+
+
+/**
+ * One of the lists of tracked blocks; each has its own lock, so threads
+ * allocating in different shards don't contend.
+ *
+ * @struct memblock_shard
+ */
+struct memblock_shard
+{
+	std::mutex		mutex;	/**< Lock for the list */
+	memblock_header*	head;	/**< The most recently tracked block */
+};
+
+
+/**
+ * The allocation statistics of a single thread. Only the owning thread
+ * writes to these, so they're never contended; they're summed up for
+ * OutputMemoryInfo(). Frees are counted by the thread doing the freeing,
+ * so a threads current bytes can be negative.
+ *
+ * When the thread exits, the next new thread takes them over and carries on
+ * counting from where they were; the sum is all that matters.
+ *
+ * @struct mem_thread_stats
+ */
+struct mem_thread_stats
+{
+	std::atomic<uint64_t>	allocs;			/**< Successful allocations */
+	std::atomic<uint64_t>	frees;			/**< Successful frees */
+	std::atomic<int64_t>	current_allocated;	/**< Bytes allocated less those freed */
+	std::atomic<uint64_t>	total_allocated;	/**< Bytes allocated */
+	uint32_t		shard;			/**< The shard this threads blocks are listed in */
+	uint32_t		sample_countdown;	/**< Allocations until the next tracked one */
+	std::atomic<bool>	in_use;			/**< Owned by a live thread */
+	mem_thread_stats*	next;			/**< The next thread registered */
 };
 
 
@@ -127,6 +190,16 @@ enum E_MEMORY_ERROR
  * Naturally, anything allocated/freed by new/delete/malloc/realloc/free will
  * not be tracked.
  *
+ * Tracked blocks are kept in intrusive lists, spread over MEM_SHARD_COUNT
+ * shards by thread, so adding and removing one is constant time under a
+ * lock few others want. Statistics are kept per thread. To cut the cost
+ * further, only a sample of allocations can be tracked (SetSampleRate);
+ * the others are still counted and checked for corruption when freed, but
+ * don't record their origin or appear in the leak report.
+ *
+ * Memory isn't filled on allocation, and only the start of it is poisoned
+ * when freed, unless MEM_POISON_FULL is defined.
+ *
  * @class Allocator
  */
 class SBI_API Allocator
@@ -143,25 +216,22 @@ private:
 	Allocator();
 
 
-	uint32_t	_allocs;		/**< The amount of times new has been called successfully */
-	uint32_t	_frees;			/**< The amount of times delete has been called successfully */
-	uint32_t	_current_allocated;	/**< Currently allocated amount of bytes */
-	uint32_t	_total_allocated;	/**< The total amount of allocated bytes */
+	/** The tracked blocks. Mutable to allow constness for retrieval
+	 * functions, which still need to lock */
+	mutable memblock_shard	_shards[MEM_SHARD_COUNT];
+
+	/** Track 1 in this many allocations */
+	std::atomic<uint32_t>	_sample_rate;
 
-	/**
-	 * The lock for making modifications to _memblocks. Mutable to allow
-	 * constness for retrieval functions, recursive for multi-locking.
-	 */
-	mutable std::recursive_mutex	_mutex;
 
 	/**
-	 * Performance benchmarks have shown that a vector is fastest when the
-	 * size of the element is known, for insert, remove, and search!
-	 * http://www.baptiste-wicht.com/2012/12/cpp-benchmark-vector-list-deque/
+	 * Gets the calling threads statistics on its first use, adopting those
+	 * of an exited thread, or creating new ones if there are none.
 	 *
-	 * The small data type (a pointer) is most beneficial here.
+	 * @return The threads statistics; nullptr only on allocation failure
 	 */
-	std::vector<memblock_header*>	_memblocks;
+	mem_thread_stats*
+	ThreadStats();
 
 
 	/**
@@ -169,8 +239,8 @@ private:
 	 * corrupt, and the rest of the block matches the original requestors
 	 * specifications.
 	 *
-	 * Define DISABLE_MEMORY_CHECK_TO_STDOUT to prevent stage-by-stage
-	 * output of the checking process.
+	 * Define MEMORY_CHECK_TO_STDOUT for stage-by-stage output of the
+	 * checking process.
 	 *
 	 * @param[in] memory_block The block of memory to check
 	 * @retval E_MEMORY_ERROR The relevant memory error code as to the block
@@ -219,6 +289,24 @@ public:
 	OutputMemoryInfo();
 
 
+	/**
+	 * Sets how many allocations are tracked - listed with their origin
+	 * for the leak report. Untracked allocations are still counted, and
+	 * checked on free. Applies to each thread from its next tracked
+	 * allocation.
+	 *
+	 * @param[in] every Track 1 in this many allocations; 1 (or 0) tracks
+	 * all of them
+	 */
+	void
+	SetSampleRate(
+		uint32_t every
+	)
+	{
+		_sample_rate = every == 0 ? 1 : every;
+	}
+
+
 	/**
 	 * Tracked version of malloc - use the MALLOC macro to call this, as it
 	 * will setup the parameters for you, barring the num_bytes.
@@ -272,10 +360,10 @@ public:
 	 * The same applies if new_num_bytes is 0 - TrackedFree (i.e. free) 
 	 * will be called on the memory_block.
 	 *
-	 * No validation is performed on the original block of memory, and
-	 * unlike the real realloc, we call TrackedAlloc regardless of size
+	 * Unlike the real realloc, we call TrackedAlloc regardless of size
 	 * differences and other parameters. The previous memory is then moved
-	 * into this newly allocated block, and the original freed.
+	 * into this newly allocated block, and the original freed - which
+	 * validates it.
 	 *
 	 * As a result, a TrackedRealloc guarantees that the returned pointer
 	 * will never be the same as the one passed in.
@@ -329,6 +417,26 @@ public:
 
 END_NAMESPACE
 
+#elif defined(USING_HEAP_PROFILER)
+	/* no debugging, but sample allocations by call site; cheap enough to
+	 * leave on in release builds */
+
+#	include "HeapProfiler.h"
+
+#	define MALLOC(size)		runtime.HeapProfile()->Alloc(size, __FILE__, __FUNCTION__, __LINE__)
+#	define REALLOC(ptr, size)	runtime.HeapProfile()->Realloc(ptr, size, __FILE__, __FUNCTION__, __LINE__)
+#	define FREE(varname)		runtime.HeapProfile()->Free(varname)
+
+#elif defined(USING_POOL_ALLOCATOR)
+	/* no debugging or profiling; serve the small allocations from the
+	 * per-thread size classes */
+
+#	include "PoolAllocator.h"
+
+#	define MALLOC(size)		runtime.PoolAlloc()->Alloc(size)
+#	define REALLOC(ptr, size)	runtime.PoolAlloc()->Realloc(ptr, size)
+#	define FREE(varname)		runtime.PoolAlloc()->Free(varname)
+
 #else
 	/* if we're here, we don't want to debug the memory, so just set the
 	 * macros to call the original, non-hooked functions. */
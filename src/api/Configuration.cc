@@ -43,8 +43,10 @@
 
 #include "Configuration.h"		// prototypes, definitions
 #include "Allocator.h"
-#include "Terminal.h"
+#include "Diagnostics.h"
+#include "HeapProfiler.h"
 #include "Log.h"
+#include "MemoryAccounting.h"
 #include "utils.h"
 
 
@@ -61,12 +63,12 @@ Configuration::CreateDefault()
 {
 	FILE*	default_config;
 
-	std::cout << fg_grey << "Creating default config file\n";
+	DIAG(EDiagCategory::Config, ELogLevel::Info) << fg_grey << "Creating default config file\n";
 
 #if defined(_WIN32)
 	if ( (default_config = _fsopen(_path.c_str(), "w", _SH_DENYWR)) == nullptr )
 	{
-		std::cerr << fg_red << "Could not open " << _path << " to apply the default configuration file\n";
+		DIAG(EDiagCategory::Config, ELogLevel::Error) << fg_red << "Could not open " << _path << " to apply the default configuration file\n";
 		return false;
 	}
 #else
@@ -94,7 +96,7 @@ Configuration::CreateDefault()
 			// create it, skip error handling if it exists
 			if ( mkdir(mkpath, S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH) != 0 && errno != EEXIST )
 			{
-				std::cerr << fg_red << "Failed to create the required path: '"
+				DIAG(EDiagCategory::Config, ELogLevel::Error) << fg_red << "Failed to create the required path: '"
 					  << _path << "'; errno " << errno << " when creating '"
 					  << p << "'\n";
 				return false;
@@ -105,13 +107,13 @@ Configuration::CreateDefault()
 
 	if ( (fd = open(_path.c_str(), O_WRONLY|O_CREAT, O_NOATIME|S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) == -1 )
 	{
-		std::cerr << fg_red << "Could not open " << _path << " to apply the default configuration file; errno " << errno << "\n";
+		DIAG(EDiagCategory::Config, ELogLevel::Error) << fg_red << "Could not open " << _path << " to apply the default configuration file; errno " << errno << "\n";
 		return false;
 	}
 
 	if ( (default_config = fdopen(fd, "w")) == nullptr )
 	{
-		std::cerr << fg_red << "fdopen failed on the file descriptor for " << _path << "; errno " << errno << "\n";
+		DIAG(EDiagCategory::Config, ELogLevel::Error) << fg_red << "fdopen failed on the file descriptor for " << _path << "; errno " << errno << "\n";
 		return false;
 	}
 #endif
@@ -132,6 +134,12 @@ Configuration::CreateDefault()
 #	endif
 		"	// 1=Error,2=Warn,3=Info,4=Debug",
 		"	level = 4;",
+		"	// rotate at this size, and/or age; 0 for never",
+		"	rotate_size_mb = 64;",
+		"	rotate_interval_mins = 1440;",
+		"	// rotated segments retained; 1=compress them (if built with zlib)",
+		"	rotate_keep = 7;",
+		"	compress = 1;",
 		"};",
 		"rpc =",
 		"	use_ssl = 0;",
@@ -150,8 +158,36 @@ Configuration::CreateDefault()
 		"		sha1 = \"d66f4e839ed98f17c8bbcb207397a290f205405d\";",
 		"	};",
 		"};",
+		"diagnostics =",
+		"{",
+		"	// console output per category; 0=None,1=Error,2=Warn,3=Info,4=Debug",
+		"	general = 3;",
+		"	runtime = 3;",
+		"	config = 3;",
+		"	irc = 3;",
+		"	network = 3;",
+		"	parser = 3;",
+		"	rpc = 3;",
+		"	// lines per second, per category; 0 for no limit",
+		"	rate_limit = 50;",
+		"};",
+		"heap_profiler =",
+		"{",
+		"	// mean KiB allocated between samples; 0 disables. Needs USING_HEAP_PROFILER",
+		"	sample_kb = 512;",
+		"	// profiles are written to path.<time>, in collapsed-stack format",
+		"	path = \"heap.collapsed\";",
+		"	// 1=write a profile on SIGUSR2 (not on Windows; use the heap_profile RPC)",
+		"	signal = 1;",
+		"};",
+		"memory =",
+		"{",
+		"	// seconds between per-subsystem memory snapshots in the log; 0 disables",
+		"	snapshot_interval_secs = 0;",
+		"};",
 		"ui =",
 		"{",
+		"	// 0=no console output at all (e.g. running as a daemon)",
 		"	enable_terminal = 1;",
 		"	command_prefix = \"/\";",
 		"	library	= {",
@@ -240,6 +276,11 @@ Configuration::Dump() const
 		<< "\t---- Log Settings ----\n"
 		<< "\t* log.path = " << log.path.data << "\n"
 		<< "\t* log.level = " << log.level << "\n"
+		<< "\t* log.binary = " << log.binary << "\n"
+		<< "\t* log.rotate_size_mb = " << log.rotate_size_mb << "\n"
+		<< "\t* log.rotate_interval_mins = " << log.rotate_interval_mins << "\n"
+		<< "\t* log.rotate_keep = " << log.rotate_keep << "\n"
+		<< "\t* log.compress = " << log.compress << "\n"
 		<< "\t---- Interface Settings ----\n"
 		<< "\t* interfaces.search_current_directory = " << interfaces.search_curdir << "\n"
 		<< "\t* interfaces.search_paths = " << interface_search_paths.str() << "\n"
@@ -254,6 +295,21 @@ Configuration::Dump() const
 		<< "\t* rpc.auth.username = " << rpc.auth.username.data << "\n"
 		<< "\t* rpc.auth.password = " << rpc_pass_msg << "\n"
 		<< "\t* rpc.auth.hash = " << rpc_hash_msg << "\n"
+		<< "\t---- Diagnostics Settings ----\n"
+		<< "\t* diagnostics.general = " << diagnostics.general << "\n"
+		<< "\t* diagnostics.runtime = " << diagnostics.runtime << "\n"
+		<< "\t* diagnostics.config = " << diagnostics.config << "\n"
+		<< "\t* diagnostics.irc = " << diagnostics.irc << "\n"
+		<< "\t* diagnostics.network = " << diagnostics.network << "\n"
+		<< "\t* diagnostics.parser = " << diagnostics.parser << "\n"
+		<< "\t* diagnostics.rpc = " << diagnostics.rpc << "\n"
+		<< "\t* diagnostics.rate_limit = " << diagnostics.rate_limit << "\n"
+		<< "\t---- Heap Profiler Settings ----\n"
+		<< "\t* heap_profiler.sample_kb = " << heap_profiler.sample_kb << "\n"
+		<< "\t* heap_profiler.path = " << heap_profiler.path.data << "\n"
+		<< "\t* heap_profiler.signal = " << heap_profiler.signal << "\n"
+		<< "\t---- Memory Settings ----\n"
+		<< "\t* memory.snapshot_interval_secs = " << memory.snapshot_interval_secs << "\n"
 		<< "\t---- UI Settings ----\n"
 		<< "\t* ui.command_prefix = " << ui.command_prefix.data << "\n"
 		<< "\t* ui.library = " << ui.library.file_name.data << "\n"
@@ -310,13 +366,13 @@ Configuration::Load(
 	catch ( libconfig::FileIOException& e )
 	{
 		// error reading the file.
-		std::cerr << fg_red << "Error attempting to read the configuration file '" << _path << "'; " << e.what() << "\n";
+		DIAG(EDiagCategory::Config, ELogLevel::Error) << fg_red << "Error attempting to read the configuration file '" << _path << "'; " << e.what() << "\n";
 		throw;
 	}
 	catch ( libconfig::ParseException& e )
 	{
 		// error parsing the file.
-		std::cerr << fg_red << e.getError() << " parsing " << e.getFile() << ":" << e.getLine() << "\n";
+		DIAG(EDiagCategory::Config, ELogLevel::Error) << fg_red << e.getError() << " parsing " << e.getFile() << ":" << e.getLine() << "\n";
 		throw;
 	}
 
@@ -330,10 +386,41 @@ Configuration::Load(
 		 * these things in the required order.. */
 		if ( !cfg.lookupValue("log.path", log.path.data) )
 		{
-			std::cerr << fg_yellow << "No log path specified; defaulting to 'app.log'\n";
+			DIAG(EDiagCategory::Config, ELogLevel::Warn) << fg_yellow << "No log path specified; defaulting to 'app.log'\n";
 			log.path = "app.log";
 		}
 
+		// the format can only be chosen before opening
+		{
+			int32_t	binary = 0;
+
+			cfg.lookupValue("log.binary", binary);
+			log.binary = (binary != 0);
+			if ( log.binary )
+				runtime.Logger()->SetBinary(true);
+		}
+
+		// rotation; none unless configured
+		{
+			int32_t	compress = 0;
+
+			log.rotate_size_mb = 0;
+			log.rotate_interval_mins = 0;
+			log.rotate_keep = 5;
+			cfg.lookupValue("log.rotate_size_mb", log.rotate_size_mb.data);
+			cfg.lookupValue("log.rotate_interval_mins", log.rotate_interval_mins.data);
+			cfg.lookupValue("log.rotate_keep", log.rotate_keep.data);
+			cfg.lookupValue("log.compress", compress);
+			log.compress = (compress != 0);
+
+			runtime.Logger()->SetRotation(
+				(uint64_t)log.rotate_size_mb.data * 1024 * 1024,
+				log.rotate_interval_mins.data * 60,
+				log.rotate_keep.data,
+				log.compress.data
+			);
+		}
+
 		// we read the path first, so we know what to open
 		runtime.Logger()->Open(log.path.data.c_str());
 
@@ -489,6 +576,68 @@ Configuration::Load(
 			ui.command_prefix = "/";
 		}
 	}
+	/*---------------------------------------------------------------------
+	 * diagnostics
+	 *--------------------------------------------------------------------*/
+	{
+		struct {
+			const char*		name;
+			proxy<uint32_t>*	level;
+			EDiagCategory		category;
+		} categories[] = {
+			{ "diagnostics.general", &diagnostics.general, EDiagCategory::General },
+			{ "diagnostics.runtime", &diagnostics.runtime, EDiagCategory::Runtime },
+			{ "diagnostics.config", &diagnostics.config, EDiagCategory::Config },
+			{ "diagnostics.irc", &diagnostics.irc, EDiagCategory::Irc },
+			{ "diagnostics.network", &diagnostics.network, EDiagCategory::Network },
+			{ "diagnostics.parser", &diagnostics.parser, EDiagCategory::Parser },
+			{ "diagnostics.rpc", &diagnostics.rpc, EDiagCategory::Rpc }
+		};
+
+		for ( auto& c : categories )
+		{
+			if ( !cfg.lookupValue(c.name, c.level->data) )
+				*c.level = (uint32_t)ELogLevel::Info;
+			else if ( c.level->data > (uint32_t)ELogLevel::Debug )
+				*c.level = (uint32_t)ELogLevel::Debug;
+
+			runtime.Diagnostics()->SetLevel(c.category, (ELogLevel)c.level->data);
+		}
+
+		if ( !cfg.lookupValue("diagnostics.rate_limit", diagnostics.rate_limit.data) )
+			diagnostics.rate_limit = DIAG_DEFAULT_RATE;
+
+		runtime.Diagnostics()->SetRateLimit(diagnostics.rate_limit.data);
+	}
+	/*---------------------------------------------------------------------
+	 * heap_profiler
+	 *--------------------------------------------------------------------*/
+	{
+		int32_t	signal = 1;
+
+		if ( !cfg.lookupValue("heap_profiler.sample_kb", heap_profiler.sample_kb.data) )
+			heap_profiler.sample_kb = 512;
+		if ( !cfg.lookupValue("heap_profiler.path", heap_profiler.path.data) )
+			heap_profiler.path = "heap.collapsed";
+		cfg.lookupValue("heap_profiler.signal", signal);
+		heap_profiler.signal = (signal != 0);
+
+#if defined(USING_HEAP_PROFILER)
+		runtime.HeapProfile()->SetSampleRate((uint64_t)heap_profiler.sample_kb.data * 1024);
+		runtime.HeapProfile()->SetDumpPath(heap_profiler.path.data);
+		if ( heap_profiler.signal && heap_profiler.sample_kb != 0 )
+			runtime.HeapProfile()->InstallSignalHandler();
+#endif
+	}
+	/*---------------------------------------------------------------------
+	 * memory
+	 *--------------------------------------------------------------------*/
+	{
+		if ( !cfg.lookupValue("memory.snapshot_interval_secs", memory.snapshot_interval_secs.data) )
+			memory.snapshot_interval_secs = MEM_ACCOUNT_DEFAULT_INTERVAL;
+
+		runtime.Accounting()->SetSnapshotInterval(memory.snapshot_interval_secs.data);
+	}
 
 
 #else	// !LIBCONFIG
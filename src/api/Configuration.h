@@ -156,6 +156,11 @@ public:
 	struct {
 		proxy<std::string>		path;
 		proxy<uint32_t>			level;
+		proxy<bool>			binary;
+		proxy<uint32_t>			rotate_size_mb;
+		proxy<uint32_t>			rotate_interval_mins;
+		proxy<uint32_t>			rotate_keep;
+		proxy<bool>			compress;
 	} log;
 
 	struct {
@@ -210,6 +215,33 @@ public:
 		} auth;
 	} rpc;
 
+	struct {
+		// console lines per second, per category; 0 for no limit
+		proxy<uint32_t>			rate_limit;
+		// the verbosity of each category, as an ELogLevel
+		proxy<uint32_t>			general;
+		proxy<uint32_t>			runtime;
+		proxy<uint32_t>			config;
+		proxy<uint32_t>			irc;
+		proxy<uint32_t>			network;
+		proxy<uint32_t>			parser;
+		proxy<uint32_t>			rpc;
+	} diagnostics;
+
+	struct {
+		// mean KiB allocated between samples; 0 disables sampling
+		proxy<uint32_t>			sample_kb;
+		// dump file name; each dump appends the time it was written
+		proxy<std::string>		path;
+		// write a live profile on SIGUSR2
+		proxy<bool>			signal;
+	} heap_profiler;
+
+	struct {
+		// seconds between accounting snapshots in the log; 0 for none
+		proxy<uint32_t>			snapshot_interval_secs;
+	} memory;
+
 	struct {
 		proxy<std::string>			command_prefix;
 		proxy<bool>				enable_terminal;
@@ -0,0 +1,267 @@
+
+/**
+ * @file	src/api/Diagnostics.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <iostream>		// std::cout, std::cerr
+
+#include "Diagnostics.h"	// prototypes
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/** Category names, for the suppression reports; matches EDiagCategory */
+static const char*	category_names[] = {
+	"general", "runtime", "config", "irc", "network", "parser", "rpc"
+};
+
+
+
+DiagLine::~DiagLine()
+{
+	runtime.Diagnostics()->Submit(_category, _level, _stream.str());
+}
+
+
+
+DiagnosticsSink::DiagnosticsSink()
+{
+	_enabled = true;
+	_rate = DIAG_DEFAULT_RATE;
+	_dropped = 0;
+	_stopping = false;
+	_closed = false;
+
+	for ( size_t i = 0; i < (size_t)EDiagCategory::Count; i++ )
+	{
+		_levels[i] = ELogLevel::Info;
+		_buckets[i].tokens = _rate;
+		_buckets[i].refilled = std::chrono::steady_clock::now();
+		_buckets[i].suppressed = 0;
+	}
+}
+
+
+
+DiagnosticsSink::~DiagnosticsSink()
+{
+	Close();
+}
+
+
+
+void
+DiagnosticsSink::Close()
+{
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		_stopping = true;
+		_closed = true;
+	}
+	_cond.notify_one();
+
+	if ( _writer.joinable() )
+		_writer.join();
+}
+
+
+
+void
+DiagnosticsSink::RunWriter()
+{
+	std::unique_lock<std::mutex>	lock(_mutex);
+
+	for ( ;; )
+	{
+		std::deque<diag_entry>	writing;
+
+		// wake each second regardless, to report anything suppressed
+		if ( _queue.empty() && !_stopping )
+			_cond.wait_for(lock, std::chrono::seconds(1));
+
+		writing.swap(_queue);
+		QueueSuppressed(writing);
+
+		if ( writing.empty() )
+		{
+			if ( _stopping )
+				break;
+			continue;
+		}
+
+		// the console may block; don't hold up the submitters meanwhile
+		lock.unlock();
+
+		for ( auto& e : writing )
+			Write(e);
+		std::cout.flush();
+
+		lock.lock();
+	}
+}
+
+
+
+void
+DiagnosticsSink::SetRateLimit(
+	uint32_t per_second
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	_rate = per_second;
+
+	for ( size_t i = 0; i < (size_t)EDiagCategory::Count; i++ )
+		_buckets[i].tokens = _rate;
+}
+
+
+
+void
+DiagnosticsSink::Submit(
+	EDiagCategory category,
+	ELogLevel level,
+	std::string&& text
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	diag_bucket&	bucket = _buckets[(size_t)category];
+	diag_entry	entry;
+
+	if ( _rate != 0 )
+	{
+		auto	now = std::chrono::steady_clock::now();
+		double	elapsed = std::chrono::duration<double>(now - bucket.refilled).count();
+
+		bucket.refilled = now;
+		bucket.tokens += elapsed * _rate;
+		if ( bucket.tokens > _rate )
+			bucket.tokens = _rate;
+
+		if ( bucket.tokens < 1.0 )
+		{
+			bucket.suppressed++;
+			return;
+		}
+
+		bucket.tokens -= 1.0;
+	}
+
+	entry.category = category;
+	entry.level = level;
+	entry.text = std::move(text);
+
+	if ( _closed )
+	{
+		// nothing left to hand it to; shutting down, so not a hot path
+		Write(entry);
+		return;
+	}
+
+	if ( _queue.size() >= DIAG_QUEUE_MAX )
+	{
+		_dropped++;
+		return;
+	}
+
+	_queue.push_back(std::move(entry));
+
+	if ( !_writer.joinable() )
+		_writer = std::thread(&DiagnosticsSink::RunWriter, this);
+
+	_cond.notify_one();
+}
+
+
+
+void
+DiagnosticsSink::Write(
+	const diag_entry& entry
+)
+{
+	const terminal_manip*	colours;
+	size_t		count;
+	size_t		start = 0;
+	size_t		pos;
+	bool		coloured = false;
+	std::ostream&	os = (entry.level == ELogLevel::Error || entry.level == ELogLevel::Warn)
+			? std::cerr : std::cout;
+
+	colours = terminal_colours(&count);
+
+	while ( (pos = entry.text.find(DIAG_COLOUR_MARKER, start)) != std::string::npos )
+	{
+		size_t	index;
+
+		os.write(entry.text.data() + start, pos - start);
+
+		if ( pos + 1 >= entry.text.length() )
+		{
+			start = entry.text.length();
+			break;
+		}
+
+		index = (uint8_t)entry.text[pos + 1];
+		if ( index >= 1 && index <= count )
+		{
+			os << colours[index - 1];
+			coloured = true;
+		}
+
+		start = pos + 2;
+	}
+
+	os.write(entry.text.data() + start, entry.text.length() - start);
+
+	// each diagnostic sets its own colours; don't leave them for the next
+	if ( coloured )
+		os << bgfg_default;
+}
+
+
+
+void
+DiagnosticsSink::QueueSuppressed(
+	std::deque<diag_entry>& writing
+)
+{
+	std::ostringstream	ss;
+	diag_entry		entry;
+
+	if ( _dropped != 0 )
+	{
+		ss << "*** " << _dropped << " diagnostics dropped; output is not keeping up ***\n";
+		_dropped = 0;
+	}
+
+	for ( size_t i = 0; i < (size_t)EDiagCategory::Count; i++ )
+	{
+		if ( _buckets[i].suppressed == 0 )
+			continue;
+
+		ss << "*** " << _buckets[i].suppressed << " " << category_names[i]
+			<< " diagnostics suppressed; over " << _rate << " per second ***\n";
+		_buckets[i].suppressed = 0;
+	}
+
+	entry.text = ss.str();
+	if ( entry.text.empty() )
+		return;
+
+	entry.category = EDiagCategory::General;
+	entry.level = ELogLevel::Warn;
+	writing.push_back(std::move(entry));
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,380 @@
+#pragma once
+
+/**
+ * @file	src/api/Diagnostics.h
+ * @author	James Warren
+ * @brief	Asynchronous, rate-limited console diagnostics
+ */
+
+
+
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Terminal.h"		// colour manipulators
+#include "Log.h"		// ELogLevel
+#include "Runtime.h"		// our class exists through Runtime
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/**
+ * The source of a diagnostic; each has its own verbosity and rate limit.
+ */
+enum class EDiagCategory : uint8_t
+{
+	General = 0,	/**< anything not covered below */
+	Runtime,	/**< threads, startup and shutdown */
+	Config,		/**< configuration loading */
+	Irc,		/**< IRC objects; networks, channels, users */
+	Network,	/**< connections, sockets and SSL */
+	Parser,		/**< received data being parsed */
+	Rpc,		/**< the RPC server */
+	Count		/**< number of categories; not a category itself */
+};
+
+
+/** Diagnostics waiting to be written; beyond this, they're dropped */
+#define DIAG_QUEUE_MAX			4096
+/** Default diagnostics per second, per category */
+#define DIAG_DEFAULT_RATE		50
+/** Marks a colour change in the text; followed by the colour position + 1 */
+#define DIAG_COLOUR_MARKER		'\x1b'
+
+
+
+/**
+ * A single DIAG() statement; formats into its own stream, and hands the text
+ * to the sink when it goes out of scope - at the end of the statement.
+ *
+ * Colour manipulators are recorded rather than applied, as the console is
+ * only touched by the sink's thread.
+ *
+ * @class DiagLine
+ */
+class SBI_API DiagLine
+{
+private:
+	NO_CLASS_ASSIGNMENT(DiagLine);
+	NO_CLASS_COPY(DiagLine);
+
+	/** The text being built */
+	std::ostringstream	_stream;
+
+	/** The source of the diagnostic */
+	EDiagCategory		_category;
+
+	/** The criticality of the diagnostic */
+	ELogLevel		_level;
+
+public:
+	DiagLine(
+		EDiagCategory category,
+		ELogLevel level
+	)
+	: _category(category), _level(level)
+	{
+	}
+
+
+	~DiagLine();
+
+
+	/**
+	 * Records a colour manipulator, or applies any other manipulator
+	 * (std::endl, etc.) to the text.
+	 */
+	DiagLine&
+	operator << (
+		terminal_manip manip
+	)
+	{
+		const terminal_manip*	colours;
+		size_t			count;
+
+		colours = terminal_colours(&count);
+
+		for ( size_t i = 0; i < count; i++ )
+		{
+			if ( colours[i] == manip )
+			{
+				_stream << DIAG_COLOUR_MARKER << (char)(i + 1);
+				return *this;
+			}
+		}
+
+		manip(_stream);
+		return *this;
+	}
+
+
+	/**
+	 * Anything else is formatted as it would be to std::cout.
+	 */
+	template <typename T>
+	DiagLine&
+	operator << (
+		const T& value
+	)
+	{
+		_stream << value;
+		return *this;
+	}
+};
+
+
+
+/**
+ * Gives the DIAG() macro a void result, so both sides of its conditional
+ * match; operator& binds looser than operator<<, so takes the line after
+ * every insertion.
+ *
+ * @class DiagVoidify
+ */
+class SBI_API DiagVoidify
+{
+public:
+	void
+	operator & (
+		DiagLine&
+	)
+	{
+	}
+};
+
+
+
+/**
+ * A diagnostic waiting to be written.
+ *
+ * @struct diag_entry
+ */
+struct diag_entry
+{
+	EDiagCategory	category;	/**< The source */
+	ELogLevel	level;		/**< The criticality */
+	std::string	text;		/**< The text, with colour markers */
+};
+
+
+
+/**
+ * Console output for diagnostics; what used to be written directly to
+ * std::cout and std::cerr.
+ *
+ * Writing to the console can block - a slow terminal, or a redirect into a
+ * pipe nothing is reading - and with it, whichever thread was writing; the
+ * parser included. Diagnostics are instead queued, and written out by a
+ * thread of our own.
+ *
+ * Each category has its own verbosity, and is limited to a number of lines
+ * per second; anything beyond is counted, and the count written instead.
+ * The queue is bounded too. With the sink disabled (no terminal, running as
+ * a daemon), nothing is formatted at all.
+ *
+ * Errors and warnings go to std::cerr, everything else to std::cout.
+ *
+ * @class DiagnosticsSink
+ */
+class SBI_API DiagnosticsSink
+{
+	// only the runtime is allowed to construct us
+	friend class Runtime;
+private:
+	NO_CLASS_ASSIGNMENT(DiagnosticsSink);
+	NO_CLASS_COPY(DiagnosticsSink);
+
+	DiagnosticsSink();
+	~DiagnosticsSink();
+
+
+	/**
+	 * A categories rate limit; a token bucket holding up to one seconds
+	 * worth of lines.
+	 *
+	 * @struct diag_bucket
+	 */
+	struct diag_bucket
+	{
+		double		tokens;		/**< Lines that can be written now */
+		std::chrono::steady_clock::time_point	refilled;	/**< When tokens was last topped up */
+		uint64_t	suppressed;	/**< Lines over the limit, not yet reported */
+	};
+
+
+	/** Output at all; false when there's no terminal */
+	std::atomic<bool>	_enabled;
+
+	/** The verbosity of each category */
+	std::atomic<ELogLevel>	_levels[(size_t)EDiagCategory::Count];
+
+	/** Lines per second allowed in each category; 0 for no limit */
+	uint32_t		_rate;
+
+	/** The rate limit state of each category */
+	diag_bucket		_buckets[(size_t)EDiagCategory::Count];
+
+	/** Diagnostics waiting to be written */
+	std::deque<diag_entry>	_queue;
+
+	/** Diagnostics dropped as the queue was full, not yet reported */
+	uint64_t		_dropped;
+
+	/** Lock for everything above that isn't atomic */
+	std::mutex		_mutex;
+
+	/** Signalled when a diagnostic is queued, or on Close() */
+	std::condition_variable	_cond;
+
+	/** The writer thread; started with the first diagnostic */
+	std::thread		_writer;
+
+	/** Set to make the writer thread exit, once the queue is empty */
+	bool			_stopping;
+
+	/** Set once closed; anything later is written directly */
+	bool			_closed;
+
+
+	/**
+	 * The writer thread function; writes diagnostics as they're queued,
+	 * until Close() is called.
+	 */
+	void
+	RunWriter();
+
+
+	/**
+	 * Writes a diagnostic to the console, applying its colours.
+	 *
+	 * @param[in] entry The diagnostic
+	 */
+	void
+	Write(
+		const diag_entry& entry
+	);
+
+
+	/**
+	 * Adds a report of the suppressed and dropped diagnostics, if any, to
+	 * those being written; and resets the counts. The lock must be held.
+	 *
+	 * @param[in,out] writing The diagnostics about to be written
+	 */
+	void
+	QueueSuppressed(
+		std::deque<diag_entry>& writing
+	);
+
+public:
+
+	/**
+	 * Writes anything still queued, and stops the writer thread. Anything
+	 * submitted afterwards is written immediately, by the caller.
+	 */
+	void
+	Close();
+
+
+	/**
+	 * Determines if a diagnostic would be output. Used by DIAG() before
+	 * anything is formatted, so keep it cheap.
+	 *
+	 * @param[in] category The source of the diagnostic
+	 * @param[in] level The criticality of the diagnostic
+	 * @return true if the diagnostic would be output
+	 */
+	bool
+	IsEnabled(
+		EDiagCategory category,
+		ELogLevel level
+	) const
+	{
+		return _enabled.load(std::memory_order_relaxed)
+		    && (level == ELogLevel::Force
+		    || level <= _levels[(size_t)category].load(std::memory_order_relaxed));
+	}
+
+
+	/**
+	 * Enables or disables all output; disabled for daemons, or anything
+	 * else without a terminal to see it.
+	 *
+	 * @param[in] enabled true to output diagnostics
+	 */
+	void
+	SetEnabled(
+		bool enabled
+	)
+	{
+		_enabled = enabled;
+	}
+
+
+	/**
+	 * Sets the verbosity of a category.
+	 *
+	 * @param[in] category The category to change
+	 * @param[in] level The most detailed level output
+	 */
+	void
+	SetLevel(
+		EDiagCategory category,
+		ELogLevel level
+	)
+	{
+		_levels[(size_t)category] = level;
+	}
+
+
+	/**
+	 * Sets the number of lines per second each category may output.
+	 *
+	 * @param[in] per_second The lines per second; 0 for no limit
+	 */
+	void
+	SetRateLimit(
+		uint32_t per_second
+	);
+
+
+	/**
+	 * Queues a diagnostic for writing, subject to the rate limit. Called
+	 * by DiagLine; use the DIAG() macro.
+	 *
+	 * @param[in] category The source of the diagnostic
+	 * @param[in] level The criticality of the diagnostic
+	 * @param[in] text The text, with colour markers
+	 */
+	void
+	Submit(
+		EDiagCategory category,
+		ELogLevel level,
+		std::string&& text
+	);
+};
+
+
+
+/* true if a DIAG() of this category and level would be output */
+#define DIAG_ENABLED(Category, Level)	\
+	runtime.Diagnostics()->IsEnabled(Category, Level)
+
+/* console output, in place of std::cout and std::cerr:
+ @code
+ DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Invalid data: " << data << "\n";
+ @endcode
+ * As with LOG(), the operands aren't evaluated when it wouldn't be output. */
+#define DIAG(Category, Level)	\
+	!DIAG_ENABLED(Category, Level) ? (void)0 :	\
+	DiagVoidify() & DiagLine(Category, Level)
+
+
+END_NAMESPACE
@@ -0,0 +1,511 @@
+
+/**
+ * @file	src/api/HeapProfiler.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include "HeapProfiler.h"		// prototypes, definitions
+
+// This file is only valid if USING_HEAP_PROFILER is enabled
+#if defined(USING_HEAP_PROFILER)
+
+#include <cerrno>			// errno
+#include <cmath>			// exp, log
+#include <cstdio>			// fopen, fprintf
+#include <cstdlib>			// malloc, realloc, free
+#include <cstring>			// strrchr
+#include <ctime>			// time
+#include <new>				// std::nothrow
+#include <vector>
+
+#if !defined(_WIN32)
+#	include <signal.h>		// sigaction
+#	include <unistd.h>		// pipe, read, write
+#endif
+
+#include "Log.h"			// LOG
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+static_assert(sizeof(heap_prefix) <= HEAP_PROFILER_PREFIX_SIZE,
+	      "heap_prefix must fit within the allocation prefix");
+
+
+/* thread-local storage; a plain POD so it's usable with __declspec(thread),
+ * and zero-initialized, so the first allocation of a thread always takes the
+ * slow path and gets a proper sample distance */
+#if defined(_WIN32)
+#	define HEAP_THREAD_LOCAL	__declspec(thread)
+#else
+#	define HEAP_THREAD_LOCAL	__thread
+#endif
+
+struct heap_thread_state
+{
+	int64_t		countdown;	/**< Bytes until the next sample */
+	uint64_t	rng;		/**< xorshift64 state; 0 until seeded */
+};
+
+static HEAP_THREAD_LOCAL heap_thread_state	tls_heap;
+
+
+#if !defined(_WIN32)
+/** Written to by the signal handler, read by the dump thread */
+static int	dump_pipe[2] = { -1, -1 };
+#endif
+
+
+
+/**
+ * Draws the number of bytes until the next sample, from an exponential
+ * distribution with the mean of rate.
+ *
+ * @param[in] rate The mean sample distance
+ * @return The distance, at least 1
+ */
+static int64_t
+sample_distance(
+	uint64_t rate
+)
+{
+	uint64_t	x = tls_heap.rng;
+	double		u;
+	double		distance;
+
+	if ( x == 0 )
+	{
+		// seed per thread; quality is not a concern, independence is
+		x = (uint64_t)(uintptr_t)&tls_heap ^ ((uint64_t)time(nullptr) << 32) ^ 0x9E3779B97F4A7C15ULL;
+	}
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	tls_heap.rng = x;
+
+	// uniform in (0,1]; 53 bits is all a double holds
+	u = ((x >> 11) + 1) * (1.0 / 9007199254740992.0);
+	distance = -log(u) * (double)rate;
+
+	return distance < 1.0 ? 1 : (int64_t)distance;
+}
+
+
+
+#if !defined(_WIN32)
+
+/**
+ * Handler for the dump signal; write() is async-signal-safe, the dump itself
+ * is not, so the dump thread is woken to do it.
+ */
+static void
+dump_signal_handler(
+	int32_t sig
+)
+{
+	char	c = 'd';
+	ssize_t	rc = write(dump_pipe[1], &c, 1);
+
+	(void)sig;
+	(void)rc;
+}
+
+#endif
+
+
+
+HeapProfiler::HeapProfiler()
+{
+	_sample_rate = HEAP_PROFILER_DEFAULT_RATE;
+	_site_count = 0;
+	_dump_path = "heap.collapsed";
+
+	for ( auto& s : _sites )
+		s = nullptr;
+
+	_overflow.file = "(other)";
+	_overflow.function = "(other)";
+	_overflow.line = 0;
+	_overflow.live_bytes = 0;
+	_overflow.total_bytes = 0;
+	_overflow.samples = 0;
+}
+
+
+
+HeapProfiler::~HeapProfiler()
+{
+	Close();
+
+	/* the sites are deliberately leaked; blocks freed during static
+	 * destruction may still point at them */
+}
+
+
+
+void*
+HeapProfiler::Alloc(
+	size_t size,
+	const char* file,
+	const char* function,
+	const uint32_t line
+)
+{
+	heap_prefix*	prefix;
+
+	if (( prefix = (heap_prefix*)malloc(size + HEAP_PROFILER_PREFIX_SIZE)) == nullptr )
+		return nullptr;
+
+	prefix->site = nullptr;
+
+	if (( tls_heap.countdown -= (int64_t)size ) <= 0 )
+		Sample(prefix, size, file, function, line);
+
+	return (uint8_t*)prefix + HEAP_PROFILER_PREFIX_SIZE;
+}
+
+
+
+void
+HeapProfiler::Close()
+{
+#if !defined(_WIN32)
+	if ( _dumper.joinable() )
+	{
+		char	c = 'q';
+
+		if ( write(dump_pipe[1], &c, 1) == 1 )
+			_dumper.join();
+		else
+			_dumper.detach();
+	}
+#endif
+}
+
+
+
+std::string
+HeapProfiler::Dump(
+	const char* path,
+	EHeapProfileValue value,
+	heap_profile_summary* summary
+)
+{
+	std::vector<heap_site*>	sites;
+	std::string	out_path;
+	FILE*		fp;
+	uint32_t	written = 0;
+	int64_t		live_total = 0;
+	uint64_t	total_total = 0;
+
+	/* sites are never removed, so only the list needs the lock; sampling
+	 * threads aren't held up by the file writes */
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		if ( path != nullptr )
+			out_path = path;
+		else
+			out_path = _dump_path + "." + std::to_string((uint64_t)time(nullptr));
+
+		sites.reserve(_site_count + 1);
+		for ( auto s : _sites )
+		{
+			if ( s != nullptr )
+				sites.push_back(s);
+		}
+		sites.push_back(&_overflow);
+	}
+
+	if (( fp = fopen(out_path.c_str(), "w")) == nullptr )
+	{
+		LOG(ELogLevel::Error) << "Unable to open '" << out_path << "' for the heap profile\n";
+		return std::string();
+	}
+
+	for ( auto site : sites )
+	{
+		const char*	file;
+		const char*	p;
+		int64_t		live;
+		uint64_t	total;
+		uint64_t	v;
+
+		live = site->live_bytes.load(std::memory_order_relaxed);
+		total = site->total_bytes.load(std::memory_order_relaxed);
+		live_total += live;
+		total_total += total;
+
+		v = value == EHeapProfileValue::LiveBytes ? (live < 0 ? 0 : (uint64_t)live) : total;
+
+		if ( v == 0 )
+			continue;
+
+		// we don't want the full path information that compilers set
+		file = site->file;
+		if (( p = strrchr(file, PATH_CHAR)) != nullptr )
+			file = p + 1;
+
+		fprintf(fp, HEAP_PROFILER_ROOT_FRAME ";%s;%s;%s:%u %llu\n",
+			file, site->function, file, site->line,
+			(unsigned long long)v);
+		written++;
+	}
+
+	fclose(fp);
+
+	if ( summary != nullptr )
+	{
+		summary->sites = written;
+		summary->live_bytes = live_total;
+		summary->total_bytes = total_total;
+	}
+
+	LOG(ELogLevel::Info) << "Heap profile written to '" << out_path << "'; "
+		<< written << " sites, " << live_total << " bytes live, "
+		<< total_total << " bytes allocated in total\n";
+
+	return out_path;
+}
+
+
+
+void
+HeapProfiler::Free(
+	void* memory
+)
+{
+	heap_prefix*	prefix;
+
+	// as per the C standard, if it's a nullptr, do nothing
+	if ( memory == nullptr )
+		return;
+
+	prefix = (heap_prefix*)((uint8_t*)memory - HEAP_PROFILER_PREFIX_SIZE);
+
+	if ( prefix->site != nullptr )
+		prefix->site->live_bytes.fetch_sub((int64_t)prefix->weight, std::memory_order_relaxed);
+
+	free(prefix);
+}
+
+
+
+bool
+HeapProfiler::InstallSignalHandler()
+{
+#if defined(_WIN32)
+	return false;
+#else
+	struct sigaction	sa;
+
+	if ( _dumper.joinable() )
+		return true;
+
+	if ( dump_pipe[0] == -1 && pipe(dump_pipe) != 0 )
+	{
+		LOG(ELogLevel::Error) << "Unable to create the heap profile signal pipe; errno " << errno << "\n";
+		return false;
+	}
+
+	sa.sa_handler = dump_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+
+	if ( sigaction(SIGUSR2, &sa, nullptr) == -1 )
+	{
+		LOG(ELogLevel::Error) << "Unable to trap the SIGUSR2 signal; errno " << errno << "\n";
+		return false;
+	}
+
+	_dumper = std::thread(&HeapProfiler::RunDumper, this);
+
+	LOG(ELogLevel::Info) << "Heap profiles will be written on SIGUSR2\n";
+	return true;
+#endif
+}
+
+
+
+void*
+HeapProfiler::Realloc(
+	void* memory,
+	size_t size,
+	const char* file,
+	const char* function,
+	const uint32_t line
+)
+{
+	heap_prefix*	prefix;
+	heap_site*	site;
+	uint64_t	weight;
+
+	if ( memory == nullptr )
+	{
+		// if the memory is NULL, call malloc [ISO C]
+		return Alloc(size, file, function, line);
+	}
+
+	if ( size == 0 )
+	{
+		// if the size is 0 and the memory is not null, call free [ISO C]
+		Free(memory);
+		return nullptr;
+	}
+
+	prefix = (heap_prefix*)((uint8_t*)memory - HEAP_PROFILER_PREFIX_SIZE);
+	site = prefix->site;
+	weight = prefix->weight;
+
+	if (( prefix = (heap_prefix*)realloc(prefix, size + HEAP_PROFILER_PREFIX_SIZE)) == nullptr )
+		return nullptr;
+
+	// the original block is gone; treat the result as a new allocation
+	if ( site != nullptr )
+		site->live_bytes.fetch_sub((int64_t)weight, std::memory_order_relaxed);
+
+	prefix->site = nullptr;
+
+	if (( tls_heap.countdown -= (int64_t)size ) <= 0 )
+		Sample(prefix, size, file, function, line);
+
+	return (uint8_t*)prefix + HEAP_PROFILER_PREFIX_SIZE;
+}
+
+
+
+void
+HeapProfiler::RunDumper()
+{
+#if !defined(_WIN32)
+	char	c;
+
+	while ( read(dump_pipe[0], &c, 1) == 1 && c != 'q' )
+	{
+		Dump(nullptr, EHeapProfileValue::LiveBytes);
+	}
+#endif
+}
+
+
+
+void
+HeapProfiler::Sample(
+	heap_prefix* prefix,
+	size_t size,
+	const char* file,
+	const char* function,
+	const uint32_t line
+)
+{
+	uint64_t	rate = _sample_rate.load(std::memory_order_relaxed);
+	heap_site*	site;
+	double		probability;
+	uint64_t	weight;
+
+	if ( rate == 0 )
+	{
+		/* disabled; check back after a while, so enabling it again
+		 * takes effect without touching the fast path */
+		tls_heap.countdown = HEAP_PROFILER_DEFAULT_RATE;
+		return;
+	}
+
+	tls_heap.countdown = sample_distance(rate);
+
+	if ( size == 0 )
+		return;
+
+	/* the chance of an allocation this size being sampled; dividing by it
+	 * gives the unbiased estimate of the bytes this sample represents */
+	probability = 1.0 - exp(-(double)size / (double)rate);
+	weight = (uint64_t)((double)size / probability);
+
+	site = Site(file, function, line);
+
+	prefix->site = site;
+	prefix->weight = weight;
+
+	site->live_bytes.fetch_add((int64_t)weight, std::memory_order_relaxed);
+	site->total_bytes.fetch_add(weight, std::memory_order_relaxed);
+	site->samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+
+void
+HeapProfiler::SetDumpPath(
+	const std::string& path
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	_dump_path = path;
+}
+
+
+
+heap_site*
+HeapProfiler::Site(
+	const char* file,
+	const char* function,
+	const uint32_t line
+)
+{
+	uintptr_t	hash;
+	uint32_t	index;
+
+	/* the macros pass string literals, so the pointers identify the site;
+	 * no need to compare the text */
+	hash = (uintptr_t)file ^ ((uintptr_t)function >> 3) ^ ((uintptr_t)line * 2654435761u);
+	index = (uint32_t)(hash % HEAP_PROFILER_MAX_SITES);
+
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	for ( uint32_t probe = 0; probe < HEAP_PROFILER_MAX_SITES; probe++ )
+	{
+		heap_site*	site = _sites[index];
+
+		if ( site == nullptr )
+		{
+			// the table is kept part-empty, so probing stays short
+			if ( _site_count >= HEAP_PROFILER_MAX_SITES / 2 )
+				break;
+
+			// plain new; this mustn't recurse into the profiler
+			if (( site = new (std::nothrow) heap_site) == nullptr )
+				break;
+
+			site->file = file;
+			site->function = function;
+			site->line = line;
+			site->live_bytes = 0;
+			site->total_bytes = 0;
+			site->samples = 0;
+
+			_sites[index] = site;
+			_site_count++;
+			return site;
+		}
+
+		if ( site->file == file && site->function == function && site->line == line )
+			return site;
+
+		index = (index + 1) % HEAP_PROFILER_MAX_SITES;
+	}
+
+	return &_overflow;
+}
+
+
+END_NAMESPACE
+
+
+#endif	// USING_HEAP_PROFILER
@@ -0,0 +1,299 @@
+#pragma once
+
+/**
+ * @file	src/api/HeapProfiler.h
+ * @author	James Warren
+ * @brief	Low-overhead sampling heap profiler, behind the MALLOC macros
+ */
+
+
+
+#if defined(USING_HEAP_PROFILER)
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Runtime.h"			// technical dependency for macros
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/** Default mean number of bytes allocated between samples */
+#define HEAP_PROFILER_DEFAULT_RATE	(512 * 1024)
+/** Slots for call sites; up to half are used, later sites are counted as one */
+#define HEAP_PROFILER_MAX_SITES		4096
+/** Bytes placed before every allocation; keeps the returned pointer aligned */
+#define HEAP_PROFILER_PREFIX_SIZE	16
+/** Root frame written for every stack in a dump */
+#define HEAP_PROFILER_ROOT_FRAME	"sbi"
+
+
+
+/**
+ * An allocating call site - a single MALLOC or REALLOC in the source - and
+ * the sampled bytes attributed to it.
+ *
+ * Sizes are estimates: each sample stands in for all the bytes allocated
+ * since the previous one, so small but frequent allocations are still seen.
+ *
+ * @struct heap_site
+ */
+struct heap_site
+{
+	const char*		file;
+	const char*		function;
+	uint32_t		line;
+	std::atomic<int64_t>	live_bytes;	/**< Estimated bytes not yet freed */
+	std::atomic<uint64_t>	total_bytes;	/**< Estimated bytes ever allocated */
+	std::atomic<uint64_t>	samples;	/**< Allocations actually sampled */
+};
+
+
+/**
+ * Placed before the memory returned to the caller, so a free knows whether
+ * the block was sampled without any lookup.
+ *
+ * @struct heap_prefix
+ */
+struct heap_prefix
+{
+	heap_site*	site;		/**< The sampled site, or nullptr */
+	uint64_t	weight;		/**< The estimated bytes this sample represents */
+};
+
+
+/**
+ * Which figure of each site a dump writes out.
+ */
+enum class EHeapProfileValue : uint8_t
+{
+	LiveBytes = 0,	/**< what is still allocated; for finding growth */
+	TotalBytes	/**< everything ever allocated; for finding churn */
+};
+
+
+/**
+ * The totals of a profile dump.
+ *
+ * @struct heap_profile_summary
+ */
+struct heap_profile_summary
+{
+	uint32_t	sites;		/**< Sites with a non-zero value */
+	int64_t		live_bytes;
+	uint64_t	total_bytes;
+};
+
+
+
+/**
+ * Samples, on average, one allocation per sample-rate bytes made through the
+ * MALLOC and REALLOC macros, and aggregates the estimated live and total
+ * bytes per call site. The call site is captured by the macros, so there is
+ * no stack walking; each 'stack' is the root frame, source file, and the
+ * function and line.
+ *
+ * Designed to be left on in release builds. Unsampled allocations cost a
+ * 16-byte prefix and a thread-local subtraction; only the sampled ones take
+ * a lock. The distance to the next sample is drawn from an exponential
+ * distribution, so allocation patterns can't hide in the gaps.
+ *
+ * Profiles are written in the collapsed-stack format consumed by
+ * flamegraph.pl and most other flame graph tools - one line per site, the
+ * frames separated by semicolons, followed by the value. They are written
+ * on request through the heap_profile RPC, or on SIGUSR2 where available.
+ *
+ * Not to be used with USING_MEMORY_DEBUGGING; that already tracks every
+ * allocation.
+ *
+ * @class HeapProfiler
+ */
+class SBI_API HeapProfiler
+{
+	// only the runtime is allowed to construct us
+	friend class Runtime;
+private:
+	NO_CLASS_ASSIGNMENT(HeapProfiler);
+	NO_CLASS_COPY(HeapProfiler);
+
+	HeapProfiler();
+	~HeapProfiler();
+
+
+	/** Mean bytes between samples; 0 disables sampling */
+	std::atomic<uint64_t>	_sample_rate;
+
+	/** Protects the site table and the dump path */
+	std::mutex		_mutex;
+
+	/** Open-addressed table of every site seen; never shrinks */
+	heap_site*		_sites[HEAP_PROFILER_MAX_SITES];
+
+	/** Number of entries in _sites */
+	uint32_t		_site_count;
+
+	/** Absorbs every site once the table is full */
+	heap_site		_overflow;
+
+	/** The file name dumps are written to, before the time suffix */
+	std::string		_dump_path;
+
+	/** Writes a profile each time the dump signal is raised */
+	std::thread		_dumper;
+
+
+	/**
+	 * Records a sampled allocation, and works out how far away the next
+	 * sample is. The slow path of Alloc() and Realloc().
+	 *
+	 * @param[in] prefix The prefix of the allocated block
+	 * @param[in] size The size requested
+	 * @param[in] file The source file of the caller
+	 * @param[in] function The function of the caller
+	 * @param[in] line The line number of the caller
+	 */
+	void
+	Sample(
+		heap_prefix* prefix,
+		size_t size,
+		const char* file,
+		const char* function,
+		const uint32_t line
+	);
+
+
+	/**
+	 * Finds the site for the caller, adding it if this is the first sample
+	 * from it.
+	 *
+	 * @return The site; _overflow if the table is full
+	 */
+	heap_site*
+	Site(
+		const char* file,
+		const char* function,
+		const uint32_t line
+	);
+
+
+	/**
+	 * Thread function; writes a live profile each time the dump signal is
+	 * raised, until Close() is called.
+	 */
+	void
+	RunDumper();
+
+public:
+
+	/**
+	 * Allocates size bytes, sampling the allocation if it is due.
+	 *
+	 * @return A pointer to the usable memory, or nullptr on failure
+	 */
+	void*
+	Alloc(
+		size_t size,
+		const char* file,
+		const char* function,
+		const uint32_t line
+	);
+
+
+	/**
+	 * Stops the dump thread, if running. Profiling carries on.
+	 */
+	void
+	Close();
+
+
+	/**
+	 * Writes the profile to path in the collapsed-stack format. Sites
+	 * with a zero value are left out.
+	 *
+	 * @param[in] path The file to write; nullptr for the configured dump
+	 * path, suffixed with the current time
+	 * @param[in] value Which figure of each site is written
+	 * @param[out] summary The totals of the dump; optional
+	 * @return The path written to, or an empty string on failure
+	 */
+	std::string
+	Dump(
+		const char* path,
+		EHeapProfileValue value,
+		heap_profile_summary* summary = nullptr
+	);
+
+
+	/**
+	 * Frees memory returned by Alloc() or Realloc(), removing its bytes
+	 * from the live figure if it was sampled.
+	 */
+	void
+	Free(
+		void* memory
+	);
+
+
+	/**
+	 * Installs the dump signal handler (SIGUSR2) and starts the thread that
+	 * writes the dumps it requests; signal handlers can't safely do file
+	 * I/O themselves.
+	 *
+	 * @return true if installed, false on failure or where there are no
+	 * user signals (Windows; use the RPC)
+	 */
+	bool
+	InstallSignalHandler();
+
+
+	/**
+	 * Reallocates memory returned by Alloc() or Realloc(); the new block
+	 * is sampled as a fresh allocation from the caller.
+	 *
+	 * @return A pointer to the usable memory, or nullptr on failure; the
+	 * original memory is untouched on failure, as with realloc
+	 */
+	void*
+	Realloc(
+		void* memory,
+		size_t size,
+		const char* file,
+		const char* function,
+		const uint32_t line
+	);
+
+
+	/**
+	 * Sets the file name dumps are written to when no path is given.
+	 */
+	void
+	SetDumpPath(
+		const std::string& path
+	);
+
+
+	/**
+	 * Sets the mean number of bytes allocated between samples. Lower is
+	 * more accurate but slower. Threads pick the new rate up from their
+	 * next sample.
+	 *
+	 * @param[in] bytes The mean sample distance; 0 stops sampling
+	 */
+	void
+	SetSampleRate(
+		uint64_t bytes
+	)
+	{
+		_sample_rate = bytes;
+	}
+};
+
+
+
+END_NAMESPACE
+
+#endif	// USING_HEAP_PROFILER
@@ -11,99 +11,978 @@
 #include <iostream>		// std::cout in IS_DEBUG_BUILD
 #include <ctime>		// time + date acquistion
 #include <cassert>		// debug assertions
+#include <chrono>		// writer interval
+#include <cstdio>		// rename, remove
+#include <cstring>		// memcpy
+#include <new>			// std::nothrow
 
-#if defined(__linux__)
+#if defined(_WIN32)
+#	include <io.h>				// _write
+#elif defined(__linux__)
 #	include <sys/stat.h>			// file ops
 #	include <fcntl.h>			// open() options
 #	include <string.h>  			// strrchr
+#	include <unistd.h>			// close, write
+#endif
+#if defined(USING_ZLIB_LOG)
+#	include <zlib.h>			// segment compression
+#endif
+
+#include "Terminal.h"		// colour output
+#include "Log.h"		// prototypes
+#include "log_binary.h"		// binary records
+#include "MemoryAccounting.h"	// buffer accounting
+#include "ThreadSlots.h"	// per-thread buffers
+#include "utils.h"		// string formatting for reporting
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/**
+ * A single threads log buffer; a ring that the owning thread writes lines
+ * into, and the writer thread reads from. Lines are copied in whole before
+ * head is advanced, so the reader never sees part of one.
+ *
+ * @struct log_buffer
+ */
+struct log_buffer
+{
+	char			data[LOG_BUFFER_SIZE];	/**< The ring */
+	std::atomic<size_t>	head;		/**< Total bytes written; owning thread only */
+	std::atomic<size_t>	tail;		/**< Total bytes read; reader only */
+	std::atomic<bool>	in_use;		/**< Owned by a live thread */
+	log_buffer*		next;		/**< The next thread registered */
+	CHARSTREAMTYPE		stream;		/**< The owning threads formatting stream */
+	std::string		record;		/**< The owning threads binary record */
+	bool			formatting;	/**< stream is in use; a LOG() within a LOG() */
+};
+
+
+/**
+ * Gets the timestamp for a binary record.
+ *
+ * @return Microseconds since the epoch
+ */
+static uint64_t
+log_timestamp()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()
+	).count();
+}
+
+
+
+/**
+ * Opens a log file for writing, such that other processes may read it but
+ * not write to it.
+ *
+ * @param[in] filename The name of the file to open
+ * @param[in] append Append to the file, rather than erasing it
+ * @return The opened file, or nullptr on failure; the reason is output
+ */
+static FILE*
+open_log_file(
+	const char* filename,
+	bool append
+)
+{
+	FILE*	file;
+
+	/* allow others to open the log file at runtime, but not for writing.
+	 * This is implementation and operating system dependant as to what
+	 * action is taken, if errors are forwarded (e.g. cpp streams setting
+	 * errno, and win32 being able to use GetLastError()), and what errors
+	 * we can actually retrieve (beyond just knowing an error occurred).
+	 * Until there is a standard for doing this, back to the nice C-style
+	 * methods here */
+#if defined(_WIN32)
+	if ( (file = _fsopen(filename, append ? "ab" : "wb", _SH_DENYWR)) == nullptr )
+	{
+		std::cerr << fg_red << "Failed to open log file:\n\n" << filename << "\n\nerrno = " << errno << "\n";
+		return nullptr;
+	}
+#else
+	int	fd;
+	int	flags = O_WRONLY|O_CREAT|(append ? O_APPEND : O_TRUNC);
+
+	if ( (fd = open(filename, flags, O_NOATIME|S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) == -1 )
+	{
+		std::cerr << fg_red << "Could not open the log file " << filename << "; errno " << errno << "\n";
+		return nullptr;
+	}
+
+	if ( (file = fdopen(fd, append ? "a" : "w")) == nullptr )
+	{
+		std::cerr << fg_red << "fdopen failed on the file descriptor for " << filename << "; errno " << errno << "\n";
+		close(fd);
+		return nullptr;
+	}
+#endif
+
+	return file;
+}
+
+
+
+/**
+ * Writes the whole of a block to a file descriptor, for CrashFlush(); unlike
+ * stdio, write(2) is safe to use within a signal handler.
+ *
+ * @param[in] fd The descriptor to write to
+ * @param[in] data The data to write
+ * @param[in] length The number of bytes of data
+ */
+static void
+crash_write(
+	int fd,
+	const char* data,
+	size_t length
+)
+{
+	while ( length > 0 )
+	{
+#if defined(_WIN32)
+		int	res = _write(fd, data, (unsigned int)length);
+#else
+		ssize_t	res = write(fd, data, length);
+
+		if ( res == -1 && errno == EINTR )
+			continue;
+#endif
+		if ( res <= 0 )
+			return;
+
+		data += res;
+		length -= (size_t)res;
+	}
+}
+
+
+
+/**
+ * Copies narrow text into a buffer as CHARTYPEs, for CrashFlush(); the drop
+ * notice has to match the rest of the file, without a stream to widen it.
+ *
+ * @param[in] dest The buffer to write to, which must have room
+ * @param[in] text The text to copy
+ * @param[in] length The number of characters of text
+ * @return The number of bytes written to dest
+ */
+static size_t
+crash_put_text(
+	char* dest,
+	const char* text,
+	size_t length
+)
+{
+	for ( size_t i = 0; i < length; i++ )
+	{
+		CHARTYPE	c = (CHARTYPE)text[i];
+
+		// dest needn't be aligned; the binary header comes before it
+		memcpy(dest + i * sizeof(CHARTYPE), &c, sizeof(CHARTYPE));
+	}
+
+	return length * sizeof(CHARTYPE);
+}
+
+
+
+/**
+ * Compresses a file with gzip. The source is removed on success; on
+ * failure, the partial destination is.
+ *
+ * Always fails in builds without USING_ZLIB_LOG.
+ *
+ * @param[in] source The file to compress
+ * @param[in] destination The compressed file to create
+ * @return true if the file was compressed
+ */
+static bool
+compress_file(
+	const std::string& source,
+	const std::string& destination
+)
+{
+#if defined(USING_ZLIB_LOG)
+	FILE*	in;
+	gzFile	out;
+	char	buf[16384];
+	size_t	read;
+	bool	success = true;
+
+	if ( (in = fopen(source.c_str(), "rb")) == nullptr )
+		return false;
+	if ( (out = gzopen(destination.c_str(), "wb6")) == nullptr )
+	{
+		fclose(in);
+		return false;
+	}
+
+	while ( (read = fread(buf, 1, sizeof(buf), in)) > 0 )
+	{
+		if ( gzwrite(out, buf, (unsigned)read) != (int)read )
+		{
+			success = false;
+			break;
+		}
+	}
+
+	if ( ferror(in) )
+		success = false;
+
+	fclose(in);
+	if ( gzclose(out) != Z_OK )
+		success = false;
+
+	if ( !success )
+	{
+		remove(destination.c_str());
+		return false;
+	}
+
+	remove(source.c_str());
+	return true;
+#else
+	return false;
 #endif
+}
+
+
+
+/**
+ * Gets the file name of a rotated segment.
+ *
+ * @param[in] path The log path
+ * @param[in] number The segments position; 1 is the newest
+ * @param[in] compressed Get the name of the compressed form
+ * @return The file name
+ */
+static std::string
+segment_name(
+	const std::string& path,
+	uint32_t number,
+	bool compressed
+)
+{
+	std::string	name = path + "." + std::to_string(number);
+
+	if ( compressed )
+		name += ".gz";
+
+	return name;
+}
+
+
+
+/**
+ * Invoked as a thread exits; its buffer is released for reuse, once the
+ * writer has emptied it.
+ *
+ * @param[in] buffer The exiting threads log_buffer
+ */
+static void
+release_buffer(
+	log_buffer* buffer
+)
+{
+	buffer->formatting = false;
+	buffer->in_use = false;
+}
+
+
+/* every threads buffer; only ever added to, until the log is destroyed, as
+ * those of exited threads are handed on */
+static ThreadSlots<log_buffer, &release_buffer>	thread_buffers;
+
+
+
+/**
+ * Determines if the released buffer of an exited thread can be adopted; not
+ * until the writer has emptied it.
+ *
+ * @param[in] buffer The buffer to check
+ * @return true if the buffer is empty
+ */
+static bool
+buffer_reusable(
+	log_buffer* buffer
+)
+{
+	return buffer->head.load() == buffer->tail.load();
+}
+
+
+
+/**
+ * Creates the buffer for a thread with none to adopt.
+ *
+ * @return The new, empty buffer, in use; nullptr on allocation failure
+ */
+static log_buffer*
+create_buffer(
+	uint32_t
+)
+{
+	log_buffer*	buffer;
+
+	if (( buffer = new (std::nothrow) log_buffer) == nullptr )
+		return nullptr;
+
+	buffer->head = 0;
+	buffer->tail = 0;
+	buffer->formatting = false;
+	buffer->in_use = true;
+
+	/* never taken off; buffers are handed on to later threads rather than
+	 * freed, until the log itself goes */
+	MEM_ACCOUNT(LogBuffers, sizeof(log_buffer), 1);
+
+	return buffer;
+}
+
+
+
+LogLine::LogLine(
+	ELogLevel log_level,
+	const char* file,
+	const char* function,
+	const uint32_t line,
+	std::atomic<uint32_t>* site
+)
+{
+	Log*	log = runtime.Logger();
+
+	_discard = !log->IsEnabled(log_level);
+	_urgent = (log_level == ELogLevel::Error || log_level == ELogLevel::Force);
+	_buffer = log->ThreadBuffer();
+	_owns = (_buffer == nullptr || _buffer->formatting);
+
+	if ( _owns )
+	{
+		// nested; the threads stream already has a line in progress
+		_stream = new CHARSTREAMTYPE;
+		_record = nullptr;
+		if ( log->_binary && file != nullptr )
+			_record = new std::string;
+	}
+	else
+	{
+		_stream = &_buffer->stream;
+		_record = nullptr;
+		if ( log->_binary && file != nullptr )
+			_record = &_buffer->record;
+		_buffer->formatting = true;
+	}
+
+	if ( _discard || file == nullptr )
+		return;
+
+	if ( _record != nullptr )
+	{
+		uint32_t	id = 0;
+
+		// assigned on first use; a plain load from then on
+		if ( _buffer != nullptr && site != nullptr
+		    && (id = site->load(std::memory_order_acquire)) == 0 )
+		{
+			id = log->SiteId(_buffer, log_level, file, function, line, site);
+		}
+
+		_record->push_back((char)LogRecord_Entry);
+		logbin_put(*_record, id, 4);
+		logbin_put(*_record, log_timestamp(), 8);
+	}
+	else
+	{
+		log->FormatPrefix(*_stream, log_level, file, function, line);
+	}
+}
+
+
+
+LogLine::~LogLine()
+{
+	Log*	log = runtime.Logger();
+
+	if ( !_discard && _buffer != nullptr )
+	{
+		if ( _record != nullptr )
+		{
+			_record->push_back((char)LogArg_End);
+			log->Commit(_buffer, _record->c_str(), _record->length(), _urgent);
+		}
+		else
+		{
+			log->CommitText(_buffer, _stream->str(), _urgent);
+		}
+	}
+
+	if ( _owns )
+	{
+		delete _stream;
+		delete _record;
+	}
+	else
+	{
+		RESET_STREAM((*_stream));
+		_stream->clear();
+		if ( _record != nullptr )
+			_record->clear();
+		_buffer->formatting = false;
+	}
+}
+
+
+
+void
+LogLine::PutArg(
+	uint8_t type,
+	uint64_t value,
+	uint32_t size
+)
+{
+	_record->push_back((char)type);
+	logbin_put(*_record, value, size);
+}
+
+
+
+void
+LogLine::PutString(
+	const char* text,
+	size_t length
+)
+{
+	_record->push_back((char)LogArg_String);
+	logbin_put_string(*_record, text, length);
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	const char* value
+)
+{
+	if ( _record == nullptr )
+		*_stream << value;
+	else if ( value == nullptr )
+		PutString("(null)", 6);
+	else
+		PutString(value, strlen(value));
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	char* value
+)
+{
+	return *this << (const char*)value;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	const std::string& value
+)
+{
+	if ( _record == nullptr )
+		*_stream << value.c_str();
+	else
+		PutString(value.c_str(), value.length());
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	const void* value
+)
+{
+	if ( _record == nullptr )
+		*_stream << value;
+	else
+		PutArg(LogArg_Pointer, (uint64_t)(uintptr_t)value, 8);
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	bool value
+)
+{
+	if ( _record == nullptr )
+		*_stream << value;
+	else
+		PutArg(LogArg_Bool, value ? 1 : 0, 1);
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	double value
+)
+{
+	if ( _record == nullptr )
+	{
+		*_stream << value;
+	}
+	else
+	{
+		uint64_t	bits;
+
+		memcpy(&bits, &value, sizeof(bits));
+		PutArg(LogArg_Double, bits, 8);
+	}
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	float value
+)
+{
+	if ( _record == nullptr )
+		*_stream << value;
+	else
+		*this << (double)value;
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	std::ios_base& (*manip)(std::ios_base&)
+)
+{
+	if ( _record == nullptr )
+		*_stream << manip;
+
+	return *this;
+}
+
+
+
+LogLine&
+LogLine::operator << (
+	std::basic_ostream<CHARTYPE>& (*manip)(std::basic_ostream<CHARTYPE>&)
+)
+{
+	if ( _record == nullptr )
+		*_stream << manip;
+
+	return *this;
+}
+
+
+
+/* the integer types only differ in their encoding; as the stream writes
+ * them, chars are characters, rather than numbers */
+#define LOGLINE_INSERTER(type, arg, size)	\
+	LogLine&				\
+	LogLine::operator << (			\
+		type value			\
+	)					\
+	{					\
+		if ( _record == nullptr )	\
+			*_stream << value;	\
+		else				\
+			PutArg(arg, (uint64_t)value, size);	\
+		return *this;			\
+	}
+
+LOGLINE_INSERTER(char, LogArg_Char, 1)
+LOGLINE_INSERTER(signed char, LogArg_Char, 1)
+LOGLINE_INSERTER(unsigned char, LogArg_Char, 1)
+LOGLINE_INSERTER(short, LogArg_Signed, 8)
+LOGLINE_INSERTER(unsigned short, LogArg_Unsigned, 8)
+LOGLINE_INSERTER(int, LogArg_Signed, 8)
+LOGLINE_INSERTER(unsigned int, LogArg_Unsigned, 8)
+LOGLINE_INSERTER(long, LogArg_Signed, 8)
+LOGLINE_INSERTER(unsigned long, LogArg_Unsigned, 8)
+LOGLINE_INSERTER(long long, LogArg_Signed, 8)
+LOGLINE_INSERTER(unsigned long long, LogArg_Unsigned, 8)
+
+#undef LOGLINE_INSERTER
+
+
+
+Log::Log()
+{
+	_file = nullptr;
+	 // logging at debug level by default 
+	_log_level = ELogLevel::Warn;
+	_dropped = 0;
+	_stopping = false;
+	_binary = false;
+	_last_site = 0;
+	_written = 0;
+	_opened = 0;
+	_rotate_size = 0;
+	_rotate_interval = 0;
+	_rotate_keep = 0;
+	_rotate_compress = false;
+	_rotations = 0;
+	_archive_stopping = false;
+
+	thread_buffers.Attach();
+}
+
+
+
+Log::~Log()
+{
+	// if it hasn't already been closed, do it
+	if ( _file != nullptr )
+		Close();
+
+	/* threads still running keep their buffer pointer; detach the exit
+	 * notification first, so it doesn't run on freed memory. Anything else
+	 * logging this late is broken anyway. */
+	thread_buffers.Detach();
+	thread_buffers.Clear();
+}
+
+
+
+void
+Log::Append(
+	const CHARSTRINGTYPE& append_string
+)
+{
+	log_buffer*	buffer = ThreadBuffer();
+
+	if ( buffer != nullptr )
+		CommitText(buffer, append_string, false);
+}
+
+
+
+void
+Log::Close()
+{
+	if ( _file != nullptr )
+	{
+		// don't print file/line info, call direct
+		LogLine(ELogLevel::Force) << "*** Log file closed ***\n";
 
-#include "Terminal.h"		// colour output
-#include "Log.h"		// prototypes
-#include "utils.h"		// string formatting for reporting
+		_stopping = true;
+		_writer_cond.notify_one();
 
+		if ( _writer.joinable() )
+			_writer.join();
 
+		Flush();
 
-BEGIN_NAMESPACE(APP_NAMESPACE)
+		fclose(_file);
+		_file = nullptr;
+	}
 
+	// let the archiver finish what's queued
+	if ( _archiver.joinable() )
+	{
+		{
+			std::lock_guard<std::mutex>	lock(_archive_mutex);
+			_archive_stopping = true;
+		}
+		_archive_cond.notify_one();
+		_archiver.join();
+	}
+}
 
 
 
-/** number of bytes the stream can contain before it will be flushed 
- * @bug threshold appears to make no difference - see if fixable */
-#define STREAM_FLUSH_THRESHOLD		1024
+bool
+Log::Commit(
+	log_buffer* buffer,
+	const char* data,
+	size_t length,
+	bool urgent
+)
+{
+	size_t	head = buffer->head.load(std::memory_order_relaxed);
+	size_t	tail = buffer->tail.load(std::memory_order_acquire);
+	size_t	pos;
+	size_t	first;
 
+	if ( length == 0 )
+		return true;
 
+	if ( length > LOG_BUFFER_SIZE - (head - tail) )
+	{
+		_dropped++;
+		_writer_cond.notify_one();
+		return false;
+	}
 
+	pos = head % LOG_BUFFER_SIZE;
+	first = LOG_BUFFER_SIZE - pos;
+	if ( first > length )
+		first = length;
 
-Log::Log()
-{
-	 // operations append to the stream, and don't replace it
-	 //_next_log.setstate(std::ios_base::app);
-	 // logging at debug level by default 
-	_log_level = ELogLevel::Warn;
-}
+	memcpy(&buffer->data[pos], data, first);
+	if ( first < length )
+		memcpy(&buffer->data[0], data + first, length - first);
 
+	// publish; the reader sees the whole line or none of it
+	buffer->head.store(head + length, std::memory_order_release);
 
+	if ( urgent || (head + length - tail) > (LOG_BUFFER_SIZE / 2) )
+		_writer_cond.notify_one();
 
-Log::~Log()
-{
-	// if it hasn't already been closed, do it
-	if ( _file != nullptr )
-		Close();
+	return true;
 }
 
 
 
 void
-Log::Append(
-	const CHARSTRINGTYPE& append_string
+Log::ArchiveSegment(
+	const log_segment& segment
 )
 {
-	_next_log << append_string;
+	std::string	target;
 
-	if ( _next_log.gcount() > STREAM_FLUSH_THRESHOLD )
-		Flush();
+	// the oldest drops off the end, whichever form it's in
+	remove(segment_name(segment.path, segment.keep, false).c_str());
+	remove(segment_name(segment.path, segment.keep, true).c_str());
+
+	for ( uint32_t i = segment.keep; i > 1; i-- )
+	{
+		rename(segment_name(segment.path, i - 1, false).c_str(), segment_name(segment.path, i, false).c_str());
+		rename(segment_name(segment.path, i - 1, true).c_str(), segment_name(segment.path, i, true).c_str());
+	}
+
+	if ( segment.keep == 0 )
+	{
+		remove(segment.pending.c_str());
+		return;
+	}
+
+	if ( segment.compress )
+	{
+		target = segment_name(segment.path, 1, true);
+
+		if ( compress_file(segment.pending, target) )
+			return;
+
+		std::cerr << fg_red << "Failed to compress the log segment " << target << "; keeping it uncompressed\n";
+	}
+
+	target = segment_name(segment.path, 1, false);
+
+	if ( rename(segment.pending.c_str(), target.c_str()) != 0 )
+	{
+		std::cerr << fg_red << "Failed to rename the log segment " << segment.pending << " to " << target << "; errno " << errno << "\n";
+	}
 }
 
 
 
 void
-Log::Close()
+Log::CommitText(
+	log_buffer* buffer,
+	const CHARSTRINGTYPE& text,
+	bool urgent
+)
 {
-	if ( _file != nullptr )
+	const char*	data = (const char*)text.c_str();
+	size_t		length = text.length() * sizeof(CHARTYPE);
+
+	if ( _binary )
 	{
-		// don't print file/line info, call direct
-		LogWithLevel(ELogLevel::Force) << "*** Log file closed ***\n";
-		Flush();
+		std::string	record;
 
-		fclose(_file);
-		_file = nullptr;
+		record.push_back((char)LogRecord_Text);
+		logbin_put(record, log_timestamp(), 8);
+		logbin_put_string(record, data, length);
+
+		Commit(buffer, record.c_str(), record.length(), urgent);
+		return;
 	}
+
+	Commit(buffer, data, length, urgent);
 }
 
 
 
 void
-Log::Flush()
+Log::CrashFlush()
 {
+	static const char	notice_prefix[] = "*** ";
+	static const char	notice_suffix[] = " log entries dropped; buffers full ***\n";
+	/* the drop notice is built here rather than on the stack; large
+	 * enough for the binary header and the widest text */
+	static char		notice[16 + (sizeof(notice_prefix) + 20 + sizeof(notice_suffix)) * sizeof(CHARTYPE)];
+	char		digits[20];
+	size_t		num_digits = 0;
+	size_t		pos = 0;
+	size_t		text_len;
+	uint64_t	dropped;
+	uint64_t	timestamp;
+	int		fd;
+	int		console_fd = -1;
+
 	if ( _file == nullptr )
+		return;
+
+	// the writer may be mid-drain (or crashed within it); go in regardless
+	_drain_mutex.try_lock();
+
+	/* nothing here may allocate or take a lock that could be held - the
+	 * heap may be what's corrupt - so unlike Drain, each ring is written
+	 * out from where it is. The buffers are never freed, and the vector is
+	 * only indexed, never copied. Anything stdio was holding was from a
+	 * drain the crash interrupted, and is lost */
+#if defined(_WIN32)
+	fd = _fileno(_file);
+	if ( !_binary && sizeof(CHARTYPE) == sizeof(char) )
+		console_fd = _fileno(stdout);
+#else
+	fd = fileno(_file);
+	if ( !_binary && sizeof(CHARTYPE) == sizeof(char) )
+		console_fd = STDOUT_FILENO;
+#endif
+
+	for ( log_buffer* b = thread_buffers.First(); b != nullptr; b = b->next )
 	{
-		// don't keep the data
-		RESET_STREAM(_next_log);
+		size_t		tail = b->tail.load(std::memory_order_relaxed);
+		size_t		head = b->head.load(std::memory_order_acquire);
+		size_t		start = tail % LOG_BUFFER_SIZE;
+		size_t		len = head - tail;
+		size_t		first = LOG_BUFFER_SIZE - start;
+
+		if ( len == 0 )
+			continue;
+		if ( first > len )
+			first = len;
+
+		crash_write(fd, &b->data[start], first);
+		if ( first < len )
+			crash_write(fd, &b->data[0], len - first);
+
+		if ( console_fd != -1 )
+		{
+			crash_write(console_fd, &b->data[start], first);
+			if ( first < len )
+				crash_write(console_fd, &b->data[0], len - first);
+		}
+
+		b->tail.store(head, std::memory_order_release);
+	}
+
+	if (( dropped = _dropped.exchange(0)) == 0 )
 		return;
+
+	do
+	{
+		digits[num_digits++] = (char)('0' + (dropped % 10));
+		dropped /= 10;
+	} while ( dropped != 0 );
+
+	text_len = (sizeof(notice_prefix) - 1 + num_digits + sizeof(notice_suffix) - 1) * sizeof(CHARTYPE);
+
+	if ( _binary )
+	{
+		// as logbin_put and logbin_put_string would write it
+		timestamp = log_timestamp();
+		notice[pos++] = (char)LogRecord_Text;
+		for ( uint32_t i = 0; i < 8; i++, timestamp >>= 8 )
+			notice[pos++] = (char)(timestamp & 0xFF);
+		for ( uint32_t i = 0; i < 4; i++ )
+			notice[pos++] = (char)((text_len >> (i * 8)) & 0xFF);
+	}
+
+	pos += crash_put_text(&notice[pos], notice_prefix, sizeof(notice_prefix) - 1);
+	while ( num_digits > 0 )
+		pos += crash_put_text(&notice[pos], &digits[--num_digits], 1);
+	pos += crash_put_text(&notice[pos], notice_suffix, sizeof(notice_suffix) - 1);
+
+	crash_write(fd, notice, pos);
+	if ( console_fd != -1 )
+		crash_write(console_fd, notice, pos);
+}
+
+
+
+void
+Log::Drain()
+{
+	std::string	writing;
+	uint64_t	dropped;
+
+	for ( log_buffer* b = thread_buffers.First(); b != nullptr; b = b->next )
+	{
+		size_t		tail = b->tail.load(std::memory_order_relaxed);
+		size_t		head = b->head.load(std::memory_order_acquire);
+		size_t		pos = tail % LOG_BUFFER_SIZE;
+		size_t		len = head - tail;
+		size_t		first = LOG_BUFFER_SIZE - pos;
+
+		if ( len == 0 )
+			continue;
+		if ( first > len )
+			first = len;
+
+		writing.append(&b->data[pos], first);
+		if ( first < len )
+			writing.append(&b->data[0], len - first);
+
+		b->tail.store(head, std::memory_order_release);
 	}
 
-	CHARSTRINGTYPE	writing = _next_log.str();
-	size_t		written;
-	int32_t		flush_res;
+	if (( dropped = _dropped.exchange(0)) != 0 )
+	{
+		CHARSTREAMTYPE	ss;
+		CHARSTRINGTYPE	str;
+
+		ss << "*** " << dropped << " log entries dropped; buffers full ***\n";
+		str = ss.str();
+
+		if ( _binary )
+		{
+			writing.push_back((char)LogRecord_Text);
+			logbin_put(writing, log_timestamp(), 8);
+			logbin_put_string(writing, (const char*)str.c_str(), str.length() * sizeof(CHARTYPE));
+		}
+		else
+		{
+			writing.append((const char*)str.c_str(), str.length() * sizeof(CHARTYPE));
+		}
+	}
 
-	if ( writing.empty() )
+	if ( writing.empty() || _file == nullptr )
+	{
+		// don't keep the data
 		return;
+	}
 
-	written = fwrite(writing.c_str(), sizeof(CHARTYPE), writing.length(), _file);
+	fwrite(writing.c_str(), 1, writing.length(), _file);
+	_written += writing.length();
 
-	if ( (flush_res = fflush(_file)) != 0 )
+	if ( fflush(_file) != 0 )
 	{
 		char	errmsg[256];
 
@@ -115,110 +994,323 @@ Log::Flush()
 		std::cerr << fg_red << "fflush failed; " << errmsg << "\n";
 	}
 
-	// also output to console
+	// also output to console, unless it's binary
 	/// @todo temp; implement with chain of responsibility instead
-	std::cout << writing.c_str();
+	if ( !_binary )
+	{
+		if ( sizeof(CHARTYPE) == sizeof(char) )
+			std::cout.write(writing.c_str(), writing.length());
+		else
+			std::wcout.write((const wchar_t*)writing.c_str(), writing.length() / sizeof(wchar_t));
+	}
+
+	if ( (_rotate_size != 0 && _written >= _rotate_size)
+	    || (_rotate_interval != 0 && difftime(time(nullptr), _opened) >= _rotate_interval) )
+	{
+		Rotate();
+	}
+}
+
+
+
+void
+Log::Flush()
+{
+	std::lock_guard<std::mutex>	lock(_drain_mutex);
 
-	RESET_STREAM(_next_log);
+	Drain();
 }
 
 
 
-CHARSTREAMTYPE&
-Log::LogWithLevel(
+void
+Log::FormatPrefix(
+	CHARSTREAMTYPE& stream,
 	ELogLevel log_level,
 	const char* file,
 	const char* function,
 	const uint32_t line
 )
 {
-	if ( log_level != ELogLevel::Force && log_level > _log_level )
-	{
-		/* ugly, ugly, nasty hack. Returns another stringstream that is
-		 * used temporarily, and cleared at every opportunity. */
-		_null_log.clear();
-		return _null_log;
-	}
-
-	// force log flushing if too much data is buffered
-	if ( _next_log.gcount() > STREAM_FLUSH_THRESHOLD )
-		Flush();
-
-	if ( file != nullptr )
-	{	
-		const char*	p;
-		char		cur_datetime[32];
+	const char*	p;
+	char		cur_datetime[32];
 		
 #if defined(_WIN32)
-		// ISO 8601 : %F %T (invalid format on Win7,VS2013)
-		get_current_time_format(cur_datetime, sizeof(cur_datetime), "%Y-%m-%d %H:%M:%S");
+	// ISO 8601 : %F %T (invalid format on Win7,VS2013)
+	get_current_time_format(cur_datetime, sizeof(cur_datetime), "%Y-%m-%d %H:%M:%S");
 #else
-		get_current_time_format(cur_datetime, sizeof(cur_datetime), "%F %T");
+	get_current_time_format(cur_datetime, sizeof(cur_datetime), "%F %T");
 #endif
 
-		_next_log << cur_datetime << "\t";
+	stream << cur_datetime << "\t";
+
+	switch ( log_level )
+	{
+	case ELogLevel::Debug:	stream << "[DEBUG]    "; break;
+	case ELogLevel::Error:	stream << "[ERROR]    "; break;
+	case ELogLevel::Warn:	stream << "[WARNING]  "; break;
+	case ELogLevel::Info:	stream << "[INFO]     "; break;
+	case ELogLevel::Force:	stream << "[FORCED]   "; break;
+	default:
+		// no custom text by default
+		break;
+	}
+
+	// we don't want the full path that some compilers set
+	if ( (p = strrchr(file, PATH_CHAR)) != nullptr )
+		file = (p + 1);
+
+	stream << function << " (" << file << ":" << line << "): ";
+}
+
+
+
+bool
+Log::Open(
+	const char* filename
+)
+{
+	if ( (_file = open_log_file(filename, false)) == nullptr )
+		return false;
+
+	_path = filename;
+	_opened = time(nullptr);
+	_written = 0;
+
+	if ( _binary )
+	{
+		fwrite(LOGBIN_MAGIC, 1, LOGBIN_MAGIC_LEN, _file);
+		_written += LOGBIN_MAGIC_LEN;
+	}
+
+	_stopping = false;
+	if ( !_writer.joinable() )
+		_writer = std::thread(&Log::RunWriter, this);
+
+	// Default log message (verifies path used); don't print file/line info, call direct
+	LogLine(ELogLevel::Force) << "*** Log File '" << filename << "' opened ***\n";
+
+	return true;
+}
+
+
 
-		switch ( log_level )
+void
+Log::RunWriter()
+{
+	while ( !_stopping )
+	{
 		{
-		case ELogLevel::Debug:	_next_log << "[DEBUG]    "; break;
-		case ELogLevel::Error:	_next_log << "[ERROR]    "; break;
-		case ELogLevel::Warn:	_next_log << "[WARNING]  "; break;
-		case ELogLevel::Info:	_next_log << "[INFO]     "; break;
-		case ELogLevel::Force:	_next_log << "[FORCED]   "; break;
-		default:
-			// no custom text by default
-			break;
+			std::unique_lock<std::mutex>	lock(_writer_mutex);
+
+			_writer_cond.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_INTERVAL_MS));
 		}
 
-		// we don't want the full path that some compilers set
-		if ( (p = strrchr(file, PATH_CHAR)) != nullptr )
-			file = (p + 1);
+		Flush();
+	}
+}
+
+
+
+void
+Log::Rotate()
+{
+	log_segment	segment;
+
+	segment.pending = _path + ".rotated." + std::to_string(++_rotations);
+	segment.path = _path;
+	segment.keep = _rotate_keep;
+	segment.compress = _rotate_compress;
+
+	fclose(_file);
+
+	if ( rename(_path.c_str(), segment.pending.c_str()) != 0 )
+	{
+		std::cerr << fg_red << "Failed to rotate the log file " << _path << "; errno " << errno << "\n";
+
+		// carry on with the one we have; try again after another period
+		_file = open_log_file(_path.c_str(), true);
+		_opened = time(nullptr);
+		_written = 0;
+		return;
+	}
+
+	if ( (_file = open_log_file(_path.c_str(), false)) == nullptr )
+	{
+		// put the old one back, rather than losing everything from now on
+		if ( rename(segment.pending.c_str(), _path.c_str()) == 0 )
+			_file = open_log_file(_path.c_str(), true);
+		_opened = time(nullptr);
+		_written = 0;
+		return;
+	}
+
+	_opened = time(nullptr);
+	_written = 0;
+
+	if ( _binary )
+	{
+		/* the new file needs every call site described again; any also
+		 * still in a buffer will just be described twice */
+		std::lock_guard<std::mutex>	lock(_sites_mutex);
+
+		fwrite(LOGBIN_MAGIC, 1, LOGBIN_MAGIC_LEN, _file);
+		fwrite(_site_records.c_str(), 1, _site_records.length(), _file);
+		_written += LOGBIN_MAGIC_LEN + _site_records.length();
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(_archive_mutex);
+
+		_archive_queue.push_back(segment);
 
-		_next_log << function << " (" << file << ":" << line << "): ";
+		if ( !_archiver.joinable() )
+		{
+			_archive_stopping = false;
+			_archiver = std::thread(&Log::RunArchiver, this);
+		}
 	}
+	_archive_cond.notify_one();
+
+	// don't print file/line info, call direct
+	LogLine(ELogLevel::Force) << "*** Log file rotated; previous segment archived ***\n";
+}
 
-	return _next_log;
+
+
+void
+Log::RunArchiver()
+{
+	for ( ;; )
+	{
+		log_segment	segment;
+
+		{
+			std::unique_lock<std::mutex>	lock(_archive_mutex);
+
+			while ( _archive_queue.empty() && !_archive_stopping )
+				_archive_cond.wait(lock);
+
+			if ( _archive_queue.empty() )
+				break;
+
+			segment = _archive_queue.front();
+			_archive_queue.pop_front();
+		}
+
+		ArchiveSegment(segment);
+	}
 }
 
 
 
 bool
-Log::Open(
-	const char* filename
+Log::SetBinary(
+	bool binary
 )
 {
-	/* allow others to open the log file at runtime, but not for writing.
-	 * This is implementation and operating system dependant as to what
-	 * action is taken, if errors are forwarded (e.g. cpp streams setting
-	 * errno, and win32 being able to use GetLastError()), and what errors
-	 * we can actually retrieve (beyond just knowing an error occurred).
-	 * Until there is a standard for doing this, back to the nice C-style
-	 * methods here */
-#if defined(_WIN32)
-	if ( (_file = _fsopen(filename, "wb", _SH_DENYWR)) == nullptr )
+	if ( _file != nullptr )
 	{
-		std::cerr << fg_red << "Failed to open log file:\n\n" << filename << "\n\nerrno = " << errno << "\n";
+		LOG(ELogLevel::Warn) << "The log format can't be changed while the file is open\n";
 		return false;
 	}
-#else
-	int	fd;
-	if ( (fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, O_NOATIME|S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) == -1 )
+	if ( binary && sizeof(CHARTYPE) != sizeof(char) )
 	{
-		std::cerr << fg_red << "Could not open the log file " << filename << "; errno " << errno << "\n";
+		std::cerr << fg_yellow << "The binary log format is unavailable with wide characters; using text\n";
 		return false;
 	}
 
-	if ( (_file = fdopen(fd, "w")) == nullptr )
+	_binary = binary;
+	return true;
+}
+
+
+
+bool
+Log::SetRotation(
+	uint64_t max_size,
+	uint32_t interval,
+	uint32_t keep,
+	bool compress
+)
+{
+	std::lock_guard<std::mutex>	lock(_drain_mutex);
+	bool	retval = true;
+
+#if !defined(USING_ZLIB_LOG)
+	if ( compress )
 	{
-		std::cerr << fg_red << "fdopen failed on the file descriptor for " << filename << "; errno " << errno << "\n";
-		return false;
+		std::cerr << fg_yellow << "Log compression is unavailable in this build; segments will be rotated uncompressed\n";
+		compress = false;
+		retval = false;
 	}
 #endif
 
-	// Default log message (verifies path used); don't print file/line info, call direct
-	LogWithLevel(ELogLevel::Force) << "*** Log File '" << filename << "' opened ***\n";
+	_rotate_size = max_size;
+	_rotate_interval = interval;
+	_rotate_keep = keep;
+	_rotate_compress = compress;
 
-	return true;
+	return retval;
+}
+
+
+
+uint32_t
+Log::SiteId(
+	log_buffer* buffer,
+	ELogLevel log_level,
+	const char* file,
+	const char* function,
+	const uint32_t line,
+	std::atomic<uint32_t>* site
+)
+{
+	std::lock_guard<std::mutex>	lock(_sites_mutex);
+	std::string	record;
+	const char*	p;
+	uint32_t	id;
+
+	// another thread may have got here first
+	if (( id = site->load(std::memory_order_acquire)) != 0 )
+		return id;
+
+	id = ++_last_site;
+
+	// we don't want the full path that some compilers set
+	if ( (p = strrchr(file, PATH_CHAR)) != nullptr )
+		file = (p + 1);
+
+	record.push_back((char)LogRecord_Site);
+	logbin_put(record, id, 4);
+	logbin_put(record, (uint64_t)log_level, 1);
+	logbin_put(record, strlen(file), 2);
+	record.append(file);
+	logbin_put(record, strlen(function), 2);
+	record.append(function);
+	logbin_put(record, line, 4);
+
+	/* if it's dropped, the next use tries again with a new id; the entry
+	 * this is for has most likely been dropped with it */
+	if ( Commit(buffer, record.c_str(), record.length(), false) )
+	{
+		_site_records += record;
+		site->store(id, std::memory_order_release);
+	}
+
+	return id;
+}
+
+
+
+log_buffer*
+Log::ThreadBuffer()
+{
+	// detached as the log is destroyed; nothing is kept after that
+	if ( !thread_buffers.Attached() )
+		return nullptr;
+
+	return thread_buffers.Get(&buffer_reusable, &create_buffer);
 }
 
 
@@ -10,6 +10,13 @@
 
 #include <sstream>
 #include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "char_helper.h"
 #include "Runtime.h"		// our class exists through Runtime
 
@@ -29,13 +36,208 @@ enum class ELogLevel
 };
 
 
+/* The most detailed level compiled in, as the ELogLevel value; statements
+ * above it are removed entirely. Set in build_config.h (LOG_COMPILE_LEVEL),
+ * otherwise everything is compiled in, and filtered at runtime only. */
+#if !defined(LOG_COMPILE_LEVEL)
+#	define LOG_COMPILE_LEVEL	4	// ELogLevel::Debug
+#endif
+
+
+/** Bytes each threads buffer holds; lines that don't fit are dropped */
+#define LOG_BUFFER_SIZE			65536
+/** How often the writer thread wakes if nothing prompts it sooner */
+#define LOG_WRITER_INTERVAL_MS		100
+
+
+// forward declarations
+struct log_buffer;
+
+
+/**
+ * A log file segment that has been rotated out, awaiting the archiver
+ * thread; the settings are copied at the time of rotation.
+ *
+ * @struct log_segment
+ */
+struct log_segment
+{
+	std::string	pending;	/**< The segments temporary file name */
+	std::string	path;		/**< The log path; segments are path.1, path.2, ... */
+	uint32_t	keep;		/**< Number of rotated segments retained */
+	bool		compress;	/**< Compress the segment with gzip */
+};
+
+
+
+
+/**
+ * A single LOG() statement; formats into the calling threads stream, and
+ * hands the finished line to the Log when it goes out of scope - at the end
+ * of the statement.
+ *
+ * In binary mode, the arguments are instead appended to a binary record
+ * (see log_binary.h) as they are, with no formatting; types without an
+ * encoding of their own are stored as their text. Stream manipulators are
+ * ignored in binary mode.
+ *
+ * @class LogLine
+ */
+class SBI_API LogLine
+{
+private:
+	NO_CLASS_ASSIGNMENT(LogLine);
+	NO_CLASS_COPY(LogLine);
+
+	log_buffer*		_buffer;	/**< The threads buffer, or nullptr if unavailable */
+	CHARSTREAMTYPE*		_stream;	/**< The stream being written to */
+	std::string*		_record;	/**< The binary record; nullptr if writing text */
+	bool			_owns;		/**< _stream/_record allocated for a nested LOG() */
+	bool			_discard;	/**< Below the logging level; not kept */
+	bool			_urgent;	/**< Wake the writer now */
+
+
+	/**
+	 * Appends an argument to the binary record.
+	 *
+	 * @param[in] type The ELogArg
+	 * @param[in] value The value
+	 * @param[in] size The number of bytes of value to write
+	 */
+	void
+	PutArg(
+		uint8_t type,
+		uint64_t value,
+		uint32_t size
+	);
+
+
+	/**
+	 * Appends a string argument to the binary record.
+	 *
+	 * @param[in] text The string
+	 * @param[in] length The length of text, in bytes
+	 */
+	void
+	PutString(
+		const char* text,
+		size_t length
+	);
+
+public:
+	/**
+	 * Prepares the stream, writing the date, level, and location prefix
+	 * if file is supplied.
+	 *
+	 * @param[in] log_level The criticality level of the entry
+	 * @param[in] file Optional filename the entry is from
+	 * @param[in] function Optional function the entry is from
+	 * @param[in] line Optional line number the entry is from
+	 * @param[in] site Optional binary id of the call site; 0 until the
+	 * first entry from it, when one is assigned (see LOG())
+	 */
+	LogLine(
+		ELogLevel log_level,
+		const char* file = nullptr,
+		const char* function = nullptr,
+		const uint32_t line = 0,
+		std::atomic<uint32_t>* site = nullptr
+	);
+	~LogLine();
+
+
+	LogLine& operator << (const char* value);
+	LogLine& operator << (char* value);
+	LogLine& operator << (const std::string& value);
+	LogLine& operator << (const void* value);
+	LogLine& operator << (char value);
+	LogLine& operator << (signed char value);
+	LogLine& operator << (unsigned char value);
+	LogLine& operator << (bool value);
+	LogLine& operator << (short value);
+	LogLine& operator << (unsigned short value);
+	LogLine& operator << (int value);
+	LogLine& operator << (unsigned int value);
+	LogLine& operator << (long value);
+	LogLine& operator << (unsigned long value);
+	LogLine& operator << (long long value);
+	LogLine& operator << (unsigned long long value);
+	LogLine& operator << (float value);
+	LogLine& operator << (double value);
+	LogLine& operator << (std::ios_base& (*manip)(std::ios_base&));
+	LogLine& operator << (std::basic_ostream<CHARTYPE>& (*manip)(std::basic_ostream<CHARTYPE>&));
+
+
+	/**
+	 * Any other pointer is logged as its address.
+	 */
+	template <typename T>
+	LogLine&
+	operator << (
+		T* value
+	)
+	{
+		return *this << (const void*)value;
+	}
+
+
+	/**
+	 * Anything else is logged through its stream operator.
+	 */
+	template <typename T>
+	LogLine&
+	operator << (
+		const T& value
+	)
+	{
+		if ( _record == nullptr )
+		{
+			*_stream << value;
+		}
+		else
+		{
+			CHARSTREAMTYPE	ss;
+			CHARSTRINGTYPE	str;
+
+			ss << value;
+			str = ss.str();
+			PutString((const char*)str.c_str(), str.length() * sizeof(CHARTYPE));
+		}
+
+		return *this;
+	}
+};
+
 
 
 /**
+ * The application log.
+ *
+ * Every thread logs into a buffer of its own - a ring of LOG_BUFFER_SIZE
+ * bytes, which it alone writes to and the writer thread alone reads
+ * from - so logging takes no locks, and never waits on the disk. The writer
+ * thread collects whatever all the buffers hold every
+ * LOG_WRITER_INTERVAL_MS (sooner for errors, or buffers filling up) and
+ * writes it out as one batch.
+ *
+ * Memory is bounded; a line that doesn't fit in its threads buffer is
+ * dropped and counted, and the count written out with the next batch.
+ * Buffers of threads that have exited are reused by new ones.
+ *
+ * Optionally, the log is written in binary (SetBinary); each call site is
+ * described once, and each entry is just the site, a raw timestamp and the
+ * arguments - no time formatting, prefix text, or argument formatting. The
+ * sbi --decode-log option renders it back to text.
+ *
+ * The file can be rotated once it reaches a size, or has been open for an
+ * interval (SetRotation). The writer only renames the file and opens a new
+ * one; the archiver thread shifts the older segments along - path.1 being
+ * the newest - deleting any beyond the retention count, and compresses the
+ * new segment (builds with USING_ZLIB_LOG only).
+ *
  * @todo consider using a ChainOfResponsibility style for this; will enable us
  * to have a single LOG() line of code, with all errors always being output to
- * cerr, but only certain things going to a physical file. The complications
- * will be multi-line and immediate or delayed flush...
+ * cerr, but only certain things going to a physical file.
  *
  * @class Log
  */
@@ -43,6 +245,8 @@ class SBI_API Log
 {
 	// only the runtime is allowed to construct us
 	friend class Runtime;
+	// submits the lines
+	friend class LogLine;
 private:
 	NO_CLASS_ASSIGNMENT(Log);
 	NO_CLASS_COPY(Log);
@@ -52,15 +256,6 @@ private:
 	~Log();
 
 
-	/** This holds all of the data written into the stream inbetween calls
-	 * to the @a flush function, which actually writes out to file */
-	CHARSTREAMTYPE		_next_log;
-
-	/** A stream to hold logging events that don't reach the required level
-	 * to be put to the normal stream. Nasty hack, as all the data is still
-	 * written to the stream, where it then gets wiped straight away. */
-	CHARSTREAMTYPE		_null_log;
-
 	/** we need error handling beyond that of 'an error occurred' so we need
 	 * to call into the platforms APIs to retain control; hence the usage of
 	 * the C-style FILE and not a std::ofstream */
@@ -68,7 +263,204 @@ private:
 
 	/** The active logging level; log requests with a lower rating will not
 	 * log those with higher levels unless set here. */
-	ELogLevel		_log_level;
+	std::atomic<ELogLevel>	_log_level;
+
+	/** Held while reading the buffers and writing to file; one reader only */
+	std::mutex		_drain_mutex;
+
+	/** Lines dropped as their threads buffer was full */
+	std::atomic<uint64_t>	_dropped;
+
+	/** The writer thread */
+	std::thread		_writer;
+	/** Lock for the writer wait; protects nothing else */
+	std::mutex		_writer_mutex;
+	/** Signalled to wake the writer early */
+	std::condition_variable	_writer_cond;
+	/** Set to make the writer thread exit */
+	std::atomic<bool>	_stopping;
+
+	/** Writing the binary format; only changed while the file is closed */
+	bool			_binary;
+
+	/** Lock for the site ids and records; taken only on a sites first
+	 * use, as the id is kept by the LOG() statement itself */
+	std::mutex		_sites_mutex;
+	/** The last call site id assigned */
+	uint32_t		_last_site;
+	/** Every Site record described so far; replayed into each new binary
+	 * file on rotation, protected by _sites_mutex */
+	std::string		_site_records;
+
+	/** The path of the open file */
+	std::string		_path;
+	/** Bytes written to the open file */
+	uint64_t		_written;
+	/** When the open file was opened */
+	time_t			_opened;
+	/** Rotate once the file reaches this size, in bytes; 0 for never */
+	uint64_t		_rotate_size;
+	/** Rotate once the file has been open this long, in seconds; 0 for
+	 * never */
+	uint32_t		_rotate_interval;
+	/** Number of rotated segments retained */
+	uint32_t		_rotate_keep;
+	/** Compress rotated segments */
+	bool			_rotate_compress;
+	/** Rotations this run; keeps the temporary names unique */
+	uint32_t		_rotations;
+
+	/** The archiver thread; started on the first rotation */
+	std::thread		_archiver;
+	/** Lock for the archiver queue and flag */
+	std::mutex		_archive_mutex;
+	/** Signalled when a segment is queued, or the archiver should stop */
+	std::condition_variable	_archive_cond;
+	/** Segments awaiting the archiver */
+	std::deque<log_segment>	_archive_queue;
+	/** Set to make the archiver exit, once the queue is empty */
+	bool			_archive_stopping;
+
+
+	/**
+	 * Moves a rotated segment into place as path.1, shifting the older
+	 * segments along and deleting those beyond the retention count, and
+	 * compresses it if desired.
+	 *
+	 * Runs on the archiver thread, so may take as long as it needs.
+	 *
+	 * @param[in] segment The segment to archive
+	 */
+	void
+	ArchiveSegment(
+		const log_segment& segment
+	);
+
+
+	/**
+	 * Copies a finished line into the buffer; dropped if there is no room.
+	 *
+	 * Only ever called by the thread owning the buffer.
+	 *
+	 * @param[in] buffer The calling threads buffer
+	 * @param[in] data The line; text, or a binary record
+	 * @param[in] length The length of data, in bytes
+	 * @param[in] urgent Wake the writer rather than waiting for its interval
+	 * @return true if the line was added; false if it was dropped
+	 */
+	bool
+	Commit(
+		log_buffer* buffer,
+		const char* data,
+		size_t length,
+		bool urgent
+	);
+
+
+	/**
+	 * Commits text; as-is, or wrapped in a Text record in binary mode.
+	 *
+	 * @param[in] buffer The calling threads buffer
+	 * @param[in] text The text
+	 * @param[in] urgent Wake the writer rather than waiting for its interval
+	 */
+	void
+	CommitText(
+		log_buffer* buffer,
+		const CHARSTRINGTYPE& text,
+		bool urgent
+	);
+
+
+	/**
+	 * Collects the contents of every buffer, and writes them to file (and
+	 * the console) in one go. Discarded if the file is not open.
+	 *
+	 * The drain lock must be held. Not for use in a crash handler, as it
+	 * allocates; see CrashFlush().
+	 */
+	void
+	Drain();
+
+
+	/**
+	 * Writes the header of a log entry - date, level, and the location.
+	 *
+	 * @param[in] stream The stream to write to
+	 * @param[in] log_level The criticality level of the entry
+	 * @param[in] file The filename the entry is from
+	 * @param[in] function The function the entry is from
+	 * @param[in] line The line number the entry is from
+	 */
+	void
+	FormatPrefix(
+		CHARSTREAMTYPE& stream,
+		ELogLevel log_level,
+		const char* file,
+		const char* function,
+		const uint32_t line
+	);
+
+
+	/**
+	 * Renames the open file out of the way, and opens a new one in its
+	 * place; the old one is passed to the archiver thread. If the rename
+	 * fails, the existing file is reopened and appended to instead.
+	 *
+	 * Called by Drain() only; the drain lock must be held.
+	 */
+	void
+	Rotate();
+
+
+	/**
+	 * The archiver thread function; archives queued segments until Close()
+	 * is called, and the queue is empty.
+	 */
+	void
+	RunArchiver();
+
+
+	/**
+	 * Assigns the binary id of a call site on its first use, committing
+	 * its Site record. The id is only stored in site once the record has
+	 * made it into a buffer, so if it's dropped, the next use tries again.
+	 *
+	 * @param[in] buffer The calling threads buffer
+	 * @param[in] log_level The criticality level of the site
+	 * @param[in] file The filename of the site
+	 * @param[in] function The function of the site
+	 * @param[in] line The line number of the site
+	 * @param[in,out] site The id held by the LOG() statement
+	 * @return The id
+	 */
+	uint32_t
+	SiteId(
+		log_buffer* buffer,
+		ELogLevel log_level,
+		const char* file,
+		const char* function,
+		const uint32_t line,
+		std::atomic<uint32_t>* site
+	);
+
+
+	/**
+	 * Gets the calling threads buffer, claiming or creating one on its
+	 * first use.
+	 *
+	 * @return The threads buffer; nullptr only on allocation failure
+	 */
+	log_buffer*
+	ThreadBuffer();
+
+
+	/**
+	 * The writer thread function; drains the buffers until Close() is
+	 * called.
+	 */
+	void
+	RunWriter();
 
 public:
 
@@ -103,56 +495,42 @@ public:
 
 
 	/**
-	 * Forces the current contents of the logging stream to be written to
-	 * file, if it's open.
+	 * Writes out whatever the buffers of every thread are holding from
+	 * within a crash handler. Takes no locks, doesn't allocate, and
+	 * doesn't wait on the writer thread - which may be the one that
+	 * crashed. Each ring is written straight to the file descriptor, as
+	 * it is; nothing goes through stdio.
+	 */
+	void
+	CrashFlush();
+
+
+	/**
+	 * Forces the current contents of every threads buffer to be written
+	 * to file, if it's open, before returning.
 	 *
-	 * If the file is not open, the stream is reset, just like if there was
-	 * data to write.
+	 * If the file is not open, the contents are discarded, just like if
+	 * they were written.
 	 */
 	void
 	Flush();
 
 
 	/**
-	 * Writes to the logging stream, preparing for the input from a runtime
-	 * file. Returns the actual stream, so game code can perform logging in
-	 * a single, non-descriptive line:
-	 @code
-	 LOG(ELogLevel::Warn) << "This operation should have succeeded: ") << info_detail;
-	 @endcode
-	 *
-	 * Newlines are not automatically added (since the caller has the stream
-	 * on return), so must be provided.
-	 *
-	 * If the logging level would not write the supplied data, it is
-	 * redirected to a unused stream.
-	 *
-	 * While all other parameters are optional, if you supply a filename,
-	 * then the function + line are mandatory to be supplied. This is why,
-	 * amongst clarity, the LOG() macro should be used for all output,
-	 * unless you need fine grained control.
-	 *
-	 * The file and function parameters are always passed in as ANSI-style
-	 * strings due to the way they're provided by the compiler. They are
-	 * converted, if need be, at runtime.
+	 * Determines if an entry at the supplied level would be logged. Used
+	 * by LOG() before anything is formatted, so keep it cheap.
 	 *
-	 * @param[in] log_level The criticality level at which the incoming
-	 * entry is deemed
-	 * @param[in] file Optional pointer to the filename this log entry will
-	 * contain
-	 * @param[in] function Optional pointer to the function this log entry
-	 * will contain
-	 * @param[in] line Optional line number of the filename this log entry
-	 * will contain
-	 * @return A reference to the logging stream
+	 * @param[in] log_level The criticality level of the entry
+	 * @return true if the entry would be logged
 	 */
-	CHARSTREAMTYPE&
-	LogWithLevel(
-		ELogLevel log_level,
-		const char* file = nullptr,
-		const char* function = nullptr,
-		const uint32_t line = 0
-	);
+	bool
+	IsEnabled(
+		ELogLevel log_level
+	) const
+	{
+		return log_level == ELogLevel::Force 
+		    || log_level <= _log_level.load(std::memory_order_relaxed);
+	}
 
 
 	/**
@@ -169,7 +547,7 @@ public:
 
 	/**
 	 * Opens the file name specified for writing, erasing any prior data in
-	 * the log file. This is opened in such a way that other processes may
+	 * the log file, and starts the writer thread. This is opened in such a way that other processes may
 	 * not write anything to the file, but are free to read it.
 	 *
 	 * This is useful for checking for an event at runtime, when we don't
@@ -186,6 +564,47 @@ public:
 	);
 
 
+	/**
+	 * Selects the binary log format, rather than text. Only possible
+	 * while the file is not open; takes effect on the next Open().
+	 *
+	 * Not available where CHARTYPE is wide; the text format is kept.
+	 *
+	 * @param[in] binary true to write the binary format
+	 * @return true if the format is set; false if the file is open, or
+	 * binary is unavailable
+	 */
+	bool
+	SetBinary(
+		bool binary
+	);
+
+
+	/**
+	 * Configures rotation of the log file. Takes effect from the next
+	 * write; rotation is checked as each batch is written out.
+	 *
+	 * Compression is only available in builds with USING_ZLIB_LOG; without
+	 * it, segments are rotated uncompressed.
+	 *
+	 * @param[in] max_size Rotate once the file reaches this many bytes; 0
+	 * to not rotate by size
+	 * @param[in] interval Rotate once the file has been open this many
+	 * seconds; 0 to not rotate by time
+	 * @param[in] keep The number of rotated segments to retain
+	 * @param[in] compress Compress rotated segments with gzip
+	 * @return true if the settings are applied; false if compression was
+	 * requested but is unavailable - the remaining settings still apply
+	 */
+	bool
+	SetRotation(
+		uint64_t max_size,
+		uint32_t interval,
+		uint32_t keep,
+		bool compress
+	);
+
+
 	/**
 	 * Changes what level of events will be logged, and those that will be
 	 * sent to /dev/null.
@@ -203,8 +622,32 @@ public:
 
 
 
-// quick access definition
-#define LOG(LogLevel)	runtime.Logger()->LogWithLevel(LogLevel, __FILE__, __func__, __LINE__)
+/* true if a LOG() at this level would be written; the compile-time check
+ * comes first, so is folded away for levels not compiled in */
+#define LOG_ENABLED(LogLevel)	\
+	((LogLevel) == ELogLevel::Force	\
+	|| ((int)(LogLevel) <= LOG_COMPILE_LEVEL && runtime.Logger()->IsEnabled(LogLevel)))
+
+/* quick access definition. The LogLine is a temporary, living until the end
+ * of the statement; so the line is complete when it's submitted:
+ @code
+ LOG(ELogLevel::Warn) << "This operation should have succeeded: " << info_detail << "\n";
+ @endcode
+ * Newlines are not automatically added, so must be provided.
+ *
+ * When the level is not enabled, none of the operands are evaluated - so
+ * they must not have side effects that are relied upon.
+ *
+ * Each statement holds its own call site id for the binary format, so no
+ * lookup is needed once it has been assigned. The loops are only there to
+ * declare it, and run the statement at most once; being a for, rather than
+ * an if, an else that follows still binds to the callers if. The id is
+ * zero-initialized without a constructor call, so needs no thread-safe
+ * static initialization. */
+#define LOG(LogLevel)	\
+	for ( bool log_once_ = LOG_ENABLED(LogLevel); log_once_; log_once_ = false )	\
+	for ( static std::atomic<uint32_t> log_site_id_; log_once_; log_once_ = false )	\
+	LogLine(LogLevel, __FILE__, __func__, __LINE__, &log_site_id_)
 
 
 END_NAMESPACE
@@ -0,0 +1,243 @@
+
+/**
+ * @file	src/api/MemoryAccounting.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <new>				// std::nothrow
+
+#include "MemoryAccounting.h"		// prototypes
+#include "Log.h"			// LOG
+#include "ThreadSlots.h"		// per-thread counters
+#include "utils.h"			// BUILD_STRING
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+static const char*	subsystem_names[] = {
+	"irc_users",
+	"irc_channels",
+	"irc_connections",
+	"irc_networks",
+	"recv_queues",
+	"send_queues",
+	"log_buffers",
+	"rpc_sessions",
+	"gui"
+};
+
+static_assert(sizeof(subsystem_names) / sizeof(subsystem_names[0]) == (size_t)EMemSubsystem::Count,
+	      "subsystem_names must have an entry for every EMemSubsystem");
+
+
+
+/**
+ * Invoked as a thread exits; its counters are released for the next new
+ * thread to carry on with.
+ *
+ * @param[in] counters The exiting threads mem_account_counters
+ */
+static void
+release_counters(
+	mem_account_counters* counters
+)
+{
+	counters->in_use = false;
+}
+
+
+/* every threads counters; a plain static, so it outlives the runtime, and
+ * static destructors that run after us can still account what they release */
+static ThreadSlots<mem_account_counters, &release_counters>	thread_counters;
+
+
+
+/**
+ * Creates the counters for a thread with none to adopt.
+ *
+ * @return The new counters, zeroed and in use; nullptr on allocation failure
+ */
+static mem_account_counters*
+create_counters(
+	uint32_t
+)
+{
+	mem_account_counters*	counters;
+
+	// not through MALLOC; these are never freed, so would show as leaks
+	if (( counters = new (std::nothrow) mem_account_counters) == nullptr )
+		return nullptr;
+
+	for ( size_t i = 0; i < (size_t)EMemSubsystem::Count; i++ )
+	{
+		counters->bytes[i] = 0;
+		counters->objects[i] = 0;
+	}
+	counters->in_use = true;
+
+	return counters;
+}
+
+
+
+MemoryAccounting::MemoryAccounting()
+{
+	_snapshot_interval = MEM_ACCOUNT_DEFAULT_INTERVAL;
+	_snapshot_timer = 0;
+
+	/* never detached, like the counters; threads exiting after we're
+	 * destroyed still hand theirs back */
+	thread_counters.Attach();
+}
+
+
+
+MemoryAccounting::~MemoryAccounting()
+{
+	/* the counters are left alone, so static destructors that run after
+	 * us can still account what they release */
+}
+
+
+
+void
+MemoryAccounting::Add(
+	EMemSubsystem subsystem,
+	int64_t bytes,
+	int64_t objects
+)
+{
+	mem_account_counters*	counters = thread_counters.Get(nullptr, &create_counters);
+	size_t			idx = (size_t)subsystem;
+
+	// couldn't be allocated; the update is lost
+	if ( counters == nullptr )
+		return;
+
+	// we're the only writer, so there's no need for a locked add
+	counters->bytes[idx].store(
+		counters->bytes[idx].load(std::memory_order_relaxed) + bytes,
+		std::memory_order_relaxed
+	);
+	counters->objects[idx].store(
+		counters->objects[idx].load(std::memory_order_relaxed) + objects,
+		std::memory_order_relaxed
+	);
+}
+
+
+
+void
+MemoryAccounting::LogSnapshot()
+{
+	mem_account_totals	totals;
+	std::string		str = "Memory accounting snapshot:";
+	int64_t			total_bytes = 0;
+
+	Totals(&totals);
+
+	for ( size_t i = 0; i < (size_t)EMemSubsystem::Count; i++ )
+	{
+		str += BUILD_STRING(
+			" ", subsystem_names[i], "=",
+			std::to_string(totals.bytes[i]).c_str(), "b/",
+			std::to_string(totals.objects[i]).c_str()
+		);
+		total_bytes += totals.bytes[i];
+	}
+
+	LOG(ELogLevel::Info) << str << " (total " << total_bytes << " bytes)\n";
+}
+
+
+
+const char*
+MemoryAccounting::Name(
+	EMemSubsystem subsystem
+)
+{
+	if ( (size_t)subsystem >= (size_t)EMemSubsystem::Count )
+		return "unknown";
+
+	return subsystem_names[(size_t)subsystem];
+}
+
+
+
+void
+MemoryAccounting::OnSnapshotTimer(
+	timer_id id,
+	void* context
+)
+{
+	MemoryAccounting*	accounting = static_cast<MemoryAccounting*>(context);
+	uint32_t		interval = accounting->_snapshot_interval;
+	timer_id		expected = id;
+
+	accounting->LogSnapshot();
+
+	if ( interval == 0 )
+		return;
+
+	/* only re-arm if we're still the current timer; SetSnapshotInterval
+	 * may have replaced us while the snapshot was being written */
+	if ( !accounting->_snapshot_timer.compare_exchange_strong(expected, 0) )
+		return;
+
+	accounting->_snapshot_timer = runtime.Timers()->Arm(
+		(uint64_t)interval * 1000, &MemoryAccounting::OnSnapshotTimer, accounting
+	);
+}
+
+
+
+void
+MemoryAccounting::SetSnapshotInterval(
+	uint32_t seconds
+)
+{
+	_snapshot_interval = seconds;
+
+	runtime.Timers()->Cancel(_snapshot_timer.exchange(0));
+
+	if ( seconds == 0 )
+		return;
+
+	_snapshot_timer = runtime.Timers()->Arm(
+		(uint64_t)seconds * 1000, &MemoryAccounting::OnSnapshotTimer, this
+	);
+}
+
+
+
+void
+MemoryAccounting::Totals(
+	mem_account_totals* totals
+)
+{
+	for ( size_t i = 0; i < (size_t)EMemSubsystem::Count; i++ )
+	{
+		totals->bytes[i] = 0;
+		totals->objects[i] = 0;
+	}
+
+	for ( mem_account_counters* c = thread_counters.First(); c != nullptr; c = c->next )
+	{
+		for ( size_t i = 0; i < (size_t)EMemSubsystem::Count; i++ )
+		{
+			totals->bytes[i] += c->bytes[i].load(std::memory_order_relaxed);
+			totals->objects[i] += c->objects[i].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+
+
+END_NAMESPACE
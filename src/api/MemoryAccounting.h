@@ -0,0 +1,204 @@
+#pragma once
+
+/**
+ * @file	src/api/MemoryAccounting.h
+ * @author	James Warren
+ * @brief	Live memory accounting, by subsystem
+ */
+
+
+
+#include <atomic>
+
+#include "Runtime.h"			// technical dependency for macros
+#include "TimerWheel.h"		// timer_id
+#include "types.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/** Default seconds between snapshots written to the log; 0 for none */
+#define MEM_ACCOUNT_DEFAULT_INTERVAL	0
+
+
+
+/**
+ * The subsystems memory is accounted against. Count must remain last.
+ */
+enum class EMemSubsystem : uint8_t
+{
+	IrcUsers = 0,		/**< IrcUser objects taken from the pool */
+	IrcChannels,		/**< IrcChannel objects taken from the pool */
+	IrcConnections,		/**< IrcConnection objects taken from the pool */
+	IrcNetworks,		/**< IrcNetwork objects taken from the pool */
+	RecvQueues,		/**< Lines received, waiting to be parsed */
+	SendQueues,		/**< Lines queued, waiting to be sent */
+	LogBuffers,		/**< Per-thread log ring buffers */
+	RpcSessions,		/**< Accepted RPC connections */
+	Gui,			/**< Widgets created through the GUI RPC calls */
+	Count
+};
+
+
+
+/**
+ * One threads counters. Only the owning thread writes to them, so updates are
+ * a relaxed load and store rather than a locked operation; readers may see a
+ * value a few updates behind, which is fine for accounting.
+ *
+ * Memory freed on a different thread to the one that allocated it is taken
+ * off the freeing threads counters, so a single thread can go negative - the
+ * sum across all threads is what's meaningful.
+ *
+ * @struct mem_account_counters
+ */
+struct mem_account_counters
+{
+	std::atomic<int64_t>	bytes[(size_t)EMemSubsystem::Count];
+	std::atomic<int64_t>	objects[(size_t)EMemSubsystem::Count];
+	std::atomic<bool>	in_use;	/**< Owned by a live thread */
+	mem_account_counters*	next;	/**< The next thread registered */
+};
+
+
+/**
+ * The accounted memory, summed across every thread.
+ *
+ * @struct mem_account_totals
+ */
+struct mem_account_totals
+{
+	int64_t		bytes[(size_t)EMemSubsystem::Count];
+	int64_t		objects[(size_t)EMemSubsystem::Count];
+};
+
+
+
+/**
+ * Keeps a running count of the bytes and objects held by each subsystem, so
+ * growth in the resident size can be put down to something specific. The
+ * figures cover what each subsystem holds directly - the pooled objects, the
+ * queued lines, the buffers - rather than every allocation it made; see the
+ * heap profiler and the memory debugger for those.
+ *
+ * Each thread has its own counters, created on its first update and never
+ * freed; threads come and go, but the counts they made must remain. When a
+ * thread exits, its counters are taken over by the next new thread, which
+ * carries on from the values left - only the sum matters - so short-lived
+ * threads don't each leave a set behind. Nothing here is destroyed with the
+ * runtime either, so updates made from other static destructors are
+ * harmless.
+ *
+ * The totals are available through the memory_usage RPC, and optionally
+ * written to the log at an interval. The interval is driven by the runtime
+ * timers, which are advanced by the IRC parser.
+ *
+ * @class MemoryAccounting
+ */
+class SBI_API MemoryAccounting
+{
+	// only the runtime is allowed to construct us
+	friend class Runtime;
+private:
+	NO_CLASS_ASSIGNMENT(MemoryAccounting);
+	NO_CLASS_COPY(MemoryAccounting);
+
+	MemoryAccounting();
+	~MemoryAccounting();
+
+
+	/** Seconds between log snapshots; 0 if disabled */
+	std::atomic<uint32_t>	_snapshot_interval;
+
+	/** The armed snapshot timer; 0 if none */
+	std::atomic<timer_id>	_snapshot_timer;
+
+
+	/**
+	 * Timer callback; writes a snapshot to the log, and arms the next one.
+	 *
+	 * @param[in] id The id of the timer that fired
+	 * @param[in] context The MemoryAccounting instance
+	 */
+	static void
+	OnSnapshotTimer(
+		timer_id id,
+		void* context
+	);
+
+public:
+
+	/**
+	 * Adjusts the figures of a subsystem; use the MEM_ACCOUNT macro rather
+	 * than calling this directly.
+	 *
+	 * @param[in] subsystem The subsystem to adjust
+	 * @param[in] bytes The bytes gained; negative when released
+	 * @param[in] objects The objects gained; negative when released
+	 */
+	void
+	Add(
+		EMemSubsystem subsystem,
+		int64_t bytes,
+		int64_t objects
+	);
+
+
+	/**
+	 * Writes the current totals of every subsystem to the log, as a single
+	 * Info entry.
+	 */
+	void
+	LogSnapshot();
+
+
+	/**
+	 * Gets the name of a subsystem, as used in the log and RPC output.
+	 *
+	 * @return The name, or "unknown" if the subsystem is out of range
+	 */
+	static const char*
+	Name(
+		EMemSubsystem subsystem
+	);
+
+
+	/**
+	 * Sets how often a snapshot is written to the log. The first is written
+	 * one interval from now.
+	 *
+	 * @param[in] seconds The interval; 0 stops the snapshots
+	 */
+	void
+	SetSnapshotInterval(
+		uint32_t seconds
+	);
+
+
+	/**
+	 * Sums the counters of every thread.
+	 *
+	 * @param[out] totals The structure to populate
+	 */
+	void
+	Totals(
+		mem_account_totals* totals
+	);
+};
+
+
+
+/*
+ * Adjusts the accounted memory of a subsystem, named without the enum prefix:
+ * MEM_ACCOUNT(RecvQueues, length, 1) when a line is queued, and
+ * MEM_ACCOUNT(RecvQueues, -(int64_t)length, -1) when it's taken off; note the
+ * cast, as negating an unsigned length doesn't make it negative.
+ */
+#define MEM_ACCOUNT(subsystem, bytes, objects)	\
+	runtime.Accounting()->Add(EMemSubsystem::subsystem, (int64_t)(bytes), (int64_t)(objects))
+
+
+
+END_NAMESPACE
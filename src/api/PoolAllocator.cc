@@ -0,0 +1,417 @@
+
+/**
+ * @file	src/api/PoolAllocator.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include "PoolAllocator.h"		// prototypes, definitions
+
+// This file is only valid if USING_POOL_ALLOCATOR is enabled
+#if defined(USING_POOL_ALLOCATOR)
+
+#include <cstdlib>			// malloc, realloc, free
+#include <cstring>			// memcpy
+#include <new>				// std::nothrow
+
+#include "ThreadSlots.h"		// per-thread caches
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+static_assert(sizeof(pool_prefix) <= POOL_PREFIX_SIZE,
+	      "pool_prefix must fit within the allocation prefix");
+static_assert(POOL_PREFIX_SIZE >= 2 * sizeof(void*),
+	      "free blocks hold two links within the prefix");
+
+
+/** The usable bytes of each size class; all multiples of 16, so every block
+ * stays aligned */
+static const uint32_t	class_sizes[POOL_CLASS_COUNT] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512
+};
+
+/** The size class for a request, indexed by the size in 16-byte units,
+ * rounded up */
+static const uint8_t	size_to_class[(POOL_MAX_SMALL / 16) + 1] = {
+	0, 0, 1, 2, 3, 4, 5, 6, 7,
+	8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13,
+	14, 14, 14, 14, 15, 15, 15, 15
+};
+
+
+/**
+ * Invoked as a thread exits; its cache is flushed and released for reuse.
+ *
+ * @param[in] cache The exiting threads pool_thread_cache
+ */
+static void
+release_cache(
+	pool_thread_cache* cache
+)
+{
+	runtime.PoolAlloc()->ThreadExit(cache);
+}
+
+
+/* every cache created; never freed, nor is the exit notification detached,
+ * as memory can still be freed by static destructors that run after us */
+static ThreadSlots<pool_thread_cache, &release_cache>	thread_caches;
+
+
+
+/**
+ * Creates the cache for a thread with none to adopt.
+ *
+ * @return The new, empty cache, in use; nullptr on allocation failure
+ */
+static pool_thread_cache*
+create_cache(
+	uint32_t
+)
+{
+	pool_thread_cache*	cache;
+
+	// not through MALLOC, for obvious reasons; never freed
+	if (( cache = new (std::nothrow) pool_thread_cache) == nullptr )
+		return nullptr;
+
+	for ( uint32_t i = 0; i < POOL_CLASS_COUNT; i++ )
+	{
+		cache->lists[i].head = nullptr;
+		cache->lists[i].count = 0;
+	}
+	cache->chunk_pos = nullptr;
+	cache->chunk_left = 0;
+	cache->in_use = true;
+
+	return cache;
+}
+
+
+
+/**
+ * Gets the first word of a free block; the next block in its list.
+ */
+static inline void*&
+next_block(
+	void* block
+)
+{
+	return static_cast<void**>(block)[0];
+}
+
+
+/**
+ * Gets the second word of a free block; the next batch in a depot, if the
+ * block is the first of its batch.
+ */
+static inline void*&
+next_batch(
+	void* block
+)
+{
+	return static_cast<void**>(block)[1];
+}
+
+
+
+PoolAllocator::PoolAllocator()
+{
+	for ( uint32_t i = 0; i < POOL_CLASS_COUNT; i++ )
+		_depots[i].batches = nullptr;
+
+	thread_caches.Attach();
+}
+
+
+
+PoolAllocator::~PoolAllocator()
+{
+	/* the chunks, caches and exit notification are deliberately left
+	 * alone; memory can still be freed by static destructors that run
+	 * after us */
+}
+
+
+
+void*
+PoolAllocator::Alloc(
+	size_t size
+)
+{
+	pool_thread_cache*	cache;
+	pool_free_list*		list;
+	pool_prefix*		prefix;
+	uint32_t		size_class;
+	void*			block;
+
+	if ( size > POOL_MAX_SMALL || (( cache = thread_caches.Current()) == nullptr && ( cache = ThreadCache() ) == nullptr ))
+	{
+		if ( size > SIZE_MAX - POOL_PREFIX_SIZE )
+			return nullptr;
+		if (( prefix = static_cast<pool_prefix*>(malloc(size + POOL_PREFIX_SIZE))) == nullptr )
+			return nullptr;
+
+		prefix->size_class = POOL_LARGE_CLASS;
+		prefix->large_size = size;
+		return (uint8_t*)prefix + POOL_PREFIX_SIZE;
+	}
+
+	size_class = size_to_class[(size + 15) / 16];
+	list = &cache->lists[size_class];
+
+	if ( list->head != nullptr || Refill(list, size_class) )
+	{
+		block = list->head;
+		list->head = next_block(block);
+		list->count--;
+	}
+	else if (( block = Carve(cache, size_class)) == nullptr )
+	{
+		return nullptr;
+	}
+
+	prefix = static_cast<pool_prefix*>(block);
+	prefix->size_class = size_class;
+
+	return (uint8_t*)prefix + POOL_PREFIX_SIZE;
+}
+
+
+
+void*
+PoolAllocator::Carve(
+	pool_thread_cache* cache,
+	uint32_t size_class
+)
+{
+	size_t	need = POOL_PREFIX_SIZE + class_sizes[size_class];
+	void*	block;
+
+	if ( cache->chunk_left < need )
+	{
+		/* the remainder of the old chunk is too small to be of use;
+		 * at most the size of the largest class, so not worth keeping */
+		if (( cache->chunk_pos = static_cast<uint8_t*>(malloc(POOL_CHUNK_SIZE))) == nullptr )
+		{
+			cache->chunk_left = 0;
+			return nullptr;
+		}
+
+		cache->chunk_left = POOL_CHUNK_SIZE;
+	}
+
+	block = cache->chunk_pos;
+	cache->chunk_pos += need;
+	cache->chunk_left -= need;
+
+	return block;
+}
+
+
+
+void
+PoolAllocator::Free(
+	void* memory
+)
+{
+	pool_thread_cache*	cache;
+	pool_free_list*		list;
+	pool_prefix*		prefix;
+	uint32_t		size_class;
+
+	if ( memory == nullptr )
+		return;
+
+	prefix = reinterpret_cast<pool_prefix*>((uint8_t*)memory - POOL_PREFIX_SIZE);
+	size_class = prefix->size_class;
+
+	if ( size_class == POOL_LARGE_CLASS )
+	{
+		free(prefix);
+		return;
+	}
+
+	if (( cache = thread_caches.Current()) == nullptr && ( cache = ThreadCache() ) == nullptr )
+	{
+		// no cache to put it in; straight to the depot as a batch of one
+		std::lock_guard<std::mutex>	lock(_depots[size_class].mutex);
+
+		next_block(prefix) = nullptr;
+		next_batch(prefix) = _depots[size_class].batches;
+		_depots[size_class].batches = prefix;
+		return;
+	}
+
+	list = &cache->lists[size_class];
+
+	next_block(prefix) = list->head;
+	list->head = prefix;
+
+	/* keep a batch in hand for the next allocations, and hand on the
+	 * rest; a thread that only frees would otherwise hoard the lot */
+	if ( ++list->count > POOL_BATCH_COUNT * 2 )
+		Release(list, size_class);
+}
+
+
+
+void*
+PoolAllocator::Realloc(
+	void* memory,
+	size_t size
+)
+{
+	pool_prefix*	prefix;
+	uint32_t	size_class;
+	void*		retval;
+
+	if ( memory == nullptr )
+		return Alloc(size);
+
+	prefix = reinterpret_cast<pool_prefix*>((uint8_t*)memory - POOL_PREFIX_SIZE);
+	size_class = prefix->size_class;
+
+	if ( size_class == POOL_LARGE_CLASS )
+	{
+		if ( size > POOL_MAX_SMALL )
+		{
+			if ( size > SIZE_MAX - POOL_PREFIX_SIZE )
+				return nullptr;
+			if (( prefix = static_cast<pool_prefix*>(realloc(prefix, size + POOL_PREFIX_SIZE))) == nullptr )
+				return nullptr;
+
+			prefix->large_size = size;
+			return (uint8_t*)prefix + POOL_PREFIX_SIZE;
+		}
+
+		// small enough for a size class now
+		if (( retval = Alloc(size)) == nullptr )
+			return nullptr;
+
+		memcpy(retval, memory, size < prefix->large_size ? size : (size_t)prefix->large_size);
+		free(prefix);
+		return retval;
+	}
+
+	// still fits, and wouldn't fit the class below; nothing to do
+	if ( size <= class_sizes[size_class] &&
+	     (size_class == 0 || size > class_sizes[size_class - 1]) )
+	{
+		return memory;
+	}
+
+	if (( retval = Alloc(size)) == nullptr )
+		return nullptr;
+
+	memcpy(retval, memory, size < class_sizes[size_class] ? size : class_sizes[size_class]);
+	Free(memory);
+
+	return retval;
+}
+
+
+
+bool
+PoolAllocator::Refill(
+	pool_free_list* list,
+	uint32_t size_class
+)
+{
+	void*		batch;
+	uint32_t	count = 0;
+
+	{
+		std::lock_guard<std::mutex>	lock(_depots[size_class].mutex);
+
+		if (( batch = _depots[size_class].batches ) == nullptr )
+			return false;
+
+		_depots[size_class].batches = next_batch(batch);
+	}
+
+	// batches vary in length (those flushed on thread exit), so count it
+	for ( void* b = batch; b != nullptr; b = next_block(b) )
+		count++;
+
+	list->head = batch;
+	list->count = count;
+
+	return true;
+}
+
+
+
+void
+PoolAllocator::Release(
+	pool_free_list* list,
+	uint32_t size_class
+)
+{
+	void*	batch = list->head;
+	void*	last = batch;
+
+	for ( uint32_t i = 1; i < POOL_BATCH_COUNT; i++ )
+		last = next_block(last);
+
+	list->head = next_block(last);
+	list->count -= POOL_BATCH_COUNT;
+	next_block(last) = nullptr;
+
+	std::lock_guard<std::mutex>	lock(_depots[size_class].mutex);
+
+	next_batch(batch) = _depots[size_class].batches;
+	_depots[size_class].batches = batch;
+}
+
+
+
+pool_thread_cache*
+PoolAllocator::ThreadCache()
+{
+	return thread_caches.Get(nullptr, &create_cache);
+}
+
+
+
+void
+PoolAllocator::ThreadExit(
+	pool_thread_cache* cache
+)
+{
+	for ( uint32_t i = 0; i < POOL_CLASS_COUNT; i++ )
+	{
+		pool_free_list*	list = &cache->lists[i];
+
+		if ( list->head == nullptr )
+			continue;
+
+		{
+			std::lock_guard<std::mutex>	lock(_depots[i].mutex);
+
+			next_batch(list->head) = _depots[i].batches;
+			_depots[i].batches = list->head;
+		}
+
+		list->head = nullptr;
+		list->count = 0;
+	}
+
+	/* the thread has already let go of the cache; anything it frees from
+	 * here on (other exit handlers) goes through a new one, or the depot */
+	cache->in_use = false;
+}
+
+
+
+END_NAMESPACE
+
+#endif	// USING_POOL_ALLOCATOR
@@ -0,0 +1,237 @@
+#pragma once
+
+/**
+ * @file	src/api/PoolAllocator.h
+ * @author	James Warren
+ * @brief	Size-class allocator with per-thread free lists, behind the MALLOC macros
+ */
+
+
+
+#if defined(USING_POOL_ALLOCATOR)
+
+#include <atomic>
+#include <mutex>
+
+#include "Runtime.h"			// technical dependency for macros
+#include "types.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/** Bytes placed before every allocation; holds the size class, and keeps the
+ * returned pointer aligned as malloc's would be */
+#define POOL_PREFIX_SIZE	16
+/** Number of size classes; requests up to POOL_MAX_SMALL bytes use one */
+#define POOL_CLASS_COUNT	16
+/** The largest request served from a size class; larger go to malloc */
+#define POOL_MAX_SMALL		512
+/** The size class recorded for allocations passed through to malloc */
+#define POOL_LARGE_CLASS	UINT32_MAX
+/** Blocks moved between a thread and the shared depot at a time */
+#define POOL_BATCH_COUNT	32
+/** Bytes obtained from malloc at a time, to be carved into blocks */
+#define POOL_CHUNK_SIZE		(64 * 1024)
+
+
+
+/**
+ * Placed before the memory returned to the caller, so a free knows where
+ * the block goes back to without any lookup.
+ *
+ * @struct pool_prefix
+ */
+struct pool_prefix
+{
+	uint32_t	size_class;	/**< Index into the class sizes, or POOL_LARGE_CLASS */
+	uint32_t	padding;
+	uint64_t	large_size;	/**< The size requested, for POOL_LARGE_CLASS only */
+};
+
+
+/**
+ * A singly-linked list of free blocks of one size class. The link is kept
+ * in the first bytes of each free block, so costs nothing.
+ *
+ * @struct pool_free_list
+ */
+struct pool_free_list
+{
+	void*		head;
+	uint32_t	count;
+};
+
+
+/**
+ * A threads private store of free blocks, and the chunk it is carving new
+ * blocks from. Handed on to a new thread when its owner exits, so chunks are
+ * never abandoned part-used.
+ *
+ * @struct pool_thread_cache
+ */
+struct pool_thread_cache
+{
+	pool_free_list		lists[POOL_CLASS_COUNT];
+	uint8_t*		chunk_pos;	/**< The next unused byte of the chunk */
+	size_t			chunk_left;	/**< Bytes remaining in the chunk */
+	std::atomic<bool>	in_use;		/**< Owned by a live thread */
+	pool_thread_cache*	next;		/**< The next cache registered */
+};
+
+
+/**
+ * Batches of free blocks of one size class, given up by threads freeing more
+ * than they allocate, and taken by those allocating more than they free.
+ *
+ * Each batch is a list of blocks; the first block of a batch holds the next
+ * batch in the word after its own link.
+ *
+ * @struct pool_depot
+ */
+struct pool_depot
+{
+	std::mutex	mutex;
+	void*		batches;	/**< The first block of the first batch */
+};
+
+
+
+/**
+ * A size-class allocator for the small, short-lived allocations that make
+ * up most of what we do - copies of nicknames, hosts, channels and message
+ * parameters, from every connection thread.
+ *
+ * Requests up to POOL_MAX_SMALL bytes are rounded up to one of the size
+ * classes and served from a free list private to the calling thread, with no
+ * lock taken. When a thread frees more than it allocates - the usual case,
+ * with lines received on one thread and parsed on another - the excess goes
+ * in batches to a shared depot, where threads that have run out take from.
+ * A lock is only taken once per batch, not per block. Larger requests pass
+ * straight through to malloc.
+ *
+ * Blocks are carved from chunks that are never returned to the system; the
+ * memory is reused through the free lists instead. Nothing here is released
+ * when the runtime is destroyed either, so memory freed by other static
+ * destructors is handled safely.
+ *
+ * Not to be used with USING_MEMORY_DEBUGGING or USING_HEAP_PROFILER; both
+ * need to see the real allocations.
+ *
+ * @class PoolAllocator
+ */
+class SBI_API PoolAllocator
+{
+	// only the runtime is allowed to construct us
+	friend class Runtime;
+private:
+	NO_CLASS_ASSIGNMENT(PoolAllocator);
+	NO_CLASS_COPY(PoolAllocator);
+
+	PoolAllocator();
+	~PoolAllocator();
+
+
+	/** Free block batches, per size class */
+	pool_depot		_depots[POOL_CLASS_COUNT];
+
+
+	/**
+	 * Carves a new block from the threads chunk, getting a new chunk if
+	 * the current one is exhausted.
+	 *
+	 * @return The block, or nullptr if a new chunk couldn't be allocated
+	 */
+	void*
+	Carve(
+		pool_thread_cache* cache,
+		uint32_t size_class
+	);
+
+
+	/**
+	 * Moves POOL_BATCH_COUNT blocks from the threads list to the depot,
+	 * as a single batch.
+	 */
+	void
+	Release(
+		pool_free_list* list,
+		uint32_t size_class
+	);
+
+
+	/**
+	 * Takes a batch from the depot into the threads (empty) list.
+	 *
+	 * @return true if a batch was taken, false if the depot is empty
+	 */
+	bool
+	Refill(
+		pool_free_list* list,
+		uint32_t size_class
+	);
+
+
+	/**
+	 * Gets the cache of the calling thread, adopting the cache of an exited
+	 * thread, or creating a new one, if this is its first allocation.
+	 *
+	 * @return The cache; nullptr if one couldn't be allocated
+	 */
+	pool_thread_cache*
+	ThreadCache();
+
+public:
+
+	/**
+	 * Allocates size bytes.
+	 *
+	 * @return A pointer to the usable memory, or nullptr on failure
+	 */
+	void*
+	Alloc(
+		size_t size
+	);
+
+
+	/**
+	 * Frees memory returned by Alloc() or Realloc(), onto the free list of
+	 * the calling thread - regardless of which thread allocated it.
+	 */
+	void
+	Free(
+		void* memory
+	);
+
+
+	/**
+	 * Reallocates memory returned by Alloc() or Realloc(). Stays in place
+	 * if the new size is within the same size class.
+	 *
+	 * @return A pointer to the usable memory, or nullptr on failure; the
+	 * original memory is untouched on failure, as with realloc
+	 */
+	void*
+	Realloc(
+		void* memory,
+		size_t size
+	);
+
+
+	/**
+	 * Flushes the free lists of an exiting threads cache to the depots, and
+	 * makes it available to the next new thread. Called by the thread exit
+	 * notification; not for general use.
+	 */
+	void
+	ThreadExit(
+		pool_thread_cache* cache
+	);
+};
+
+
+
+END_NAMESPACE
+
+#endif	// USING_POOL_ALLOCATOR
@@ -45,7 +45,8 @@
 #include "RpcServer.h"
 #include "Runtime.h"
 #include "Log.h"
-#include "Terminal.h"
+#include "Diagnostics.h"
+#include "MemoryAccounting.h"
 #include "utils.h"
 #include "version.h"
 
@@ -145,6 +146,12 @@ public:
 	  _dev(ssl_stream, use_ssl),
 	  _stream(_dev)
 	{
+		MEM_ACCOUNT(RpcSessions, sizeof(AcceptedConnection), 1);
+	}
+
+	~AcceptedConnection()
+	{
+		MEM_ACCOUNT(RpcSessions, -(int64_t)sizeof(AcceptedConnection), -1);
 	}
 
 	std::iostream&
@@ -815,7 +822,7 @@ RpcServer::RpcHandlerThread(
 		}
 		if ( !IsAuthorizedHTTP(headers) )
 		{
-			std::cerr << "Invalid credentials received from " << conn->peer_address_to_string().c_str() << "\n";
+			DIAG(EDiagCategory::Rpc, ELogLevel::Error) << "Invalid credentials received from " << conn->peer_address_to_string().c_str() << "\n";
 			LOG(ELogLevel::Error) << "Invalid credentials received from " << conn->peer_address_to_string().c_str() << "\n";
 			SLEEP_MILLISECONDS(250);
 
@@ -955,7 +962,7 @@ RpcServer::RpcServerThread(
 			" for listening on IPv6; falling back to IPv4: ",
 			e.what()
 		);
-		std::cerr << errstr.c_str() << "\n";
+		DIAG(EDiagCategory::Rpc, ELogLevel::Error) << errstr.c_str() << "\n";
 		LOG(ELogLevel::Error) << errstr.c_str() << "\n";
 	}
 
@@ -985,7 +992,7 @@ RpcServer::RpcServerThread(
 				" for listening on IPv4: ",
 				e.what()
 			);
-			std::cerr << errstr.c_str() << "\n";
+			DIAG(EDiagCategory::Rpc, ELogLevel::Error) << errstr.c_str() << "\n";
 			LOG(ELogLevel::Error) << errstr.c_str() << "\n";
 		}
 	}
@@ -1070,7 +1077,7 @@ RpcServer::Startup()
 	);
 	if ( _server_params.thread_handle == -1 )
 	{
-		std::cerr << fg_red << "_beginthreadex failed\n";
+		DIAG(EDiagCategory::Rpc, ELogLevel::Error) << fg_red << "_beginthreadex failed\n";
 		LOG(ELogLevel::Error) << "_beginthreadex failed\n";
 		return ERpcStatus::ThreadCreateFailed;
 	}
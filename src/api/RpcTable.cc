@@ -28,6 +28,10 @@ static const RpcCommand ApiRpcCommands[] =
 	{ "help", &api_Help, RPCF_ALLOW_IN_TEST_MODE | RPCF_UNLOCKED },
 	{ "stop", &api_Stop, RPCF_ALLOW_IN_TEST_MODE | RPCF_UNLOCKED },
 	{ "cpu_core_count", &api_GetEnvironmentCoreCount, RPCF_ALLOW_IN_TEST_MODE | RPCF_UNLOCKED },
+	{ "memory_usage", &api_MemoryUsage, RPCF_UNLOCKED },
+#if defined(USING_HEAP_PROFILER)
+	{ "heap_profile", &api_HeapProfile, RPCF_UNLOCKED },
+#endif
 };
 
 
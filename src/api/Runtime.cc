@@ -30,8 +30,12 @@
 #include "Allocator.h"
 #include "Log.h"
 #include "Configuration.h"
+#include "Diagnostics.h"
+#include "HeapProfiler.h"
+#include "MemoryAccounting.h"
+#include "PoolAllocator.h"
 #include "RpcServer.h"
-#include "Terminal.h"
+#include "TimerWheel.h"
 #include "utils.h"		// string handling
 
 
@@ -63,7 +67,7 @@ Runtime::AddManualThread(
 {
 	_manual_threads.push_back(ti);
 
-	std::cout << fg_white << "Thread id "
+	DIAG(EDiagCategory::Runtime, ELogLevel::Info) << fg_white << "Thread id "
 		<< ti->thread << " (" << ti->called_by_function << ") "
 		<< "is starting execution\n";
 	LOG(ELogLevel::Info) << "Thread id " 
@@ -183,6 +187,50 @@ Runtime::GetObjectFromModule(
 
 
 
+MemoryAccounting*
+Runtime::Accounting() const
+{
+	static MemoryAccounting	accounting;
+	return &accounting;
+}
+
+
+
+#if defined(USING_HEAP_PROFILER)
+
+HeapProfiler*
+Runtime::HeapProfile() const
+{
+	static HeapProfiler	profiler;
+	return &profiler;
+}
+
+#endif	// USING_HEAP_PROFILER
+
+
+
+#if defined(USING_POOL_ALLOCATOR)
+
+PoolAllocator*
+Runtime::PoolAlloc() const
+{
+	static PoolAllocator	allocator;
+	return &allocator;
+}
+
+#endif	// USING_POOL_ALLOCATOR
+
+
+
+DiagnosticsSink*
+Runtime::Diagnostics() const
+{
+	static DiagnosticsSink	diagnostics;
+	return &diagnostics;
+}
+
+
+
 class Log*
 Runtime::Logger() const
 {
@@ -232,6 +280,15 @@ Runtime::RPC() const
 
 
 
+TimerWheel*
+Runtime::Timers() const
+{
+	static class TimerWheel	timers;
+	return &timers;
+}
+
+
+
 void
 Runtime::ThreadStopping(
 	thread_t thread,
@@ -245,7 +302,7 @@ Runtime::ThreadStopping(
 	{
 		if ( t->thread == thread )
 		{
-			std::cout << fg_white << "Thread id " << thread
+			DIAG(EDiagCategory::Runtime, ELogLevel::Info) << fg_white << "Thread id " << thread
 				<< " (" << t->called_by_function << ") "
 				<< "is ending execution (called by "
 				<< function << ")\n";
@@ -262,7 +319,7 @@ Runtime::ThreadStopping(
 
 	if ( !found )
 	{
-		std::cerr << fg_red << "The supplied thread id (" << thread
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The supplied thread id (" << thread
 			<< ") was not found in the list - did you call AddManualThread()?\n";
 		LOG(ELogLevel::Info) << "The supplied thread id (" << thread
 			<< ") was not found in the list - did you call AddManualThread()?\n";
@@ -302,7 +359,7 @@ Runtime::WaitThenKillThread(
 				{
 					if ( GetLastError() == ERROR_INVALID_HANDLE )
 					{
-						std::cerr << fg_red << "The thread handle " << thread_handle << " was reported as invalid by the system\n";
+						DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The thread handle " << thread_handle << " was reported as invalid by the system\n";
 						LOG(ELogLevel::Error) << "The thread handle " << thread_handle << " was reported as invalid by the system\n";
 						// exit loop, just remove the thread_info
 						success = false;
@@ -316,14 +373,14 @@ Runtime::WaitThenKillThread(
 					if ( TerminateThread(thread_handle, EXIT_FAILURE) )
 					{
 						killed = true;
-						std::cerr << fg_yellow << "Thread id " << thread << " has been forcibly killed after timing out\n";
+						DIAG(EDiagCategory::Runtime, ELogLevel::Warn) << fg_yellow << "Thread id " << thread << " has been forcibly killed after timing out\n";
 						LOG(ELogLevel::Warn) << "Thread id " << thread << " has been forcibly killed after timing out\n";
 					}
 					else
 					{
 						success = false;
 						err = GetLastError();
-						std::cerr << fg_red << "Failed to terminate thread id " << thread << "; Win32 error " << err << "\n";
+						DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Failed to terminate thread id " << thread << "; Win32 error " << err << "\n";
 						LOG(ELogLevel::Error) << "Failed to terminate thread id " << thread << "; Win32 error " << err << "\n";
 					}
 				}
@@ -353,7 +410,7 @@ Runtime::WaitThenKillThread(
 
 				if ( rc == ETIMEDOUT )
 				{
-					std::cerr << fg_yellow << "Thread " << t->thread << " has been forcibly killed after failing to finish on request\n";
+					DIAG(EDiagCategory::Runtime, ELogLevel::Warn) << fg_yellow << "Thread " << t->thread << " has been forcibly killed after failing to finish on request\n";
 
 					// Just kill it and live with any resource leaks
 					pthread_kill(t->thread, SIGKILL);
@@ -361,7 +418,7 @@ Runtime::WaitThenKillThread(
 				}
 				else if ( rc != 0 )
 				{
-					std::cerr << fg_red << "Received errno " << rc << " after waiting for thread " << t->thread << " to finish\n";
+					DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Received errno " << rc << " after waiting for thread " << t->thread << " to finish\n";
 				}
 			}
 #endif	// _WIN32
@@ -378,7 +435,7 @@ Runtime::WaitThenKillThread(
 	 * called, so we need to remove it manually + notify */
 	if ( ti != nullptr && killed )
 	{
-		std::cerr << fg_yellow << "Thread id " << thread << " has been killed\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Warn) << fg_yellow << "Thread id " << thread << " has been killed\n";
 		LOG(ELogLevel::Warn) << "Thread id " << thread << " has been killed\n";
 		_manual_threads.erase(std::find(_manual_threads.begin(), _manual_threads.end(), ti));
 	}
@@ -396,9 +453,9 @@ Runtime::WaitThenKillThread(
 		{
 			if ( t->thread == thread )
 			{
-				std::cerr << fg_red << "Thread id " << thread <<
+				DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Thread id " << thread <<
 					" still exists after a successful wait for the thread to finish;"
-					" was Runtime::ThreadStopping() not executed or did the system lie?";
+					" was Runtime::ThreadStopping() not executed or did the system lie?\n";
 				LOG(ELogLevel::Warn) << "Thread id " << thread <<
 					" still exists after a successful wait for the thread to finish;"
 					" was Runtime::ThreadStopping() not executed or did the system lie?";
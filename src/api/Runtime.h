@@ -36,8 +36,13 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 // forward declarations
 class Allocator;
 class Configuration;
+class DiagnosticsSink;
+class HeapProfiler;
+class MemoryAccounting;
+class PoolAllocator;
 class Log;
 class RpcServer;
+class TimerWheel;
 
 
 // required definitions
@@ -218,6 +223,16 @@ public:
 	Config() const;
 
 
+	/**
+	 * Gets the console diagnostics sink; use DIAG() rather than calling
+	 * it directly.
+	 *
+	 * @return A pointer to the static instance within the runtime.
+	 */
+	DiagnosticsSink*
+	Diagnostics() const;
+
+
 	/**
 	 * Sets _quitting to true, and enters a waiting phase for all existing
 	 * threads to close, and to kill on timeout.
@@ -241,6 +256,40 @@ public:
 	);
 
 
+	/**
+	 * Gets the per-subsystem memory accounting; use MEM_ACCOUNT() rather
+	 * than calling it directly.
+	 *
+	 * @return A pointer to the static instance within the runtime.
+	 */
+	MemoryAccounting*
+	Accounting() const;
+
+
+#if defined(USING_HEAP_PROFILER)
+	/**
+	 * Gets the sampling heap profiler, which the MALLOC, REALLOC and FREE
+	 * macros go through when not debugging memory.
+	 *
+	 * @return A pointer to the static instance within the runtime.
+	 */
+	HeapProfiler*
+	HeapProfile() const;
+#endif
+
+
+#if defined(USING_POOL_ALLOCATOR)
+	/**
+	 * Gets the size-class allocator, which the MALLOC, REALLOC and FREE
+	 * macros go through when neither debugging nor profiling memory.
+	 *
+	 * @return A pointer to the static instance within the runtime.
+	 */
+	PoolAllocator*
+	PoolAlloc() const;
+#endif
+
+
 	/**
 	 * Gets whether DoShutdown() has been called; mostly used for threads
 	 * and other sync objects to know when they should close down, or stop.
@@ -339,6 +388,15 @@ public:
 	);
 
 
+	/**
+	 * Gets the timer wheel, used for all timeouts and delayed actions.
+	 *
+	 * @return A pointer to the static instance within the runtime.
+	 */
+	TimerWheel*
+	Timers() const;
+
+
 	/**
 	 * Locates the supplied thread_id in the stored thread list, and if
 	 * found, waits timeout_ms for it to finish before terminating it by
@@ -0,0 +1,151 @@
+
+/**
+ * @file	src/api/ScratchArena.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <cstdlib>			// malloc, free
+#include <cstring>			// memcpy
+
+#include "ScratchArena.h"		// prototypes
+#include "Allocator.h"			// memory allocation macros
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+ScratchArena::ScratchArena(
+	size_t block_size
+)
+{
+	_head = nullptr;
+	_current = nullptr;
+	_block_size = block_size;
+	_block_allocs = 0;
+}
+
+
+
+ScratchArena::~ScratchArena()
+{
+	arena_block*	block = _head;
+
+	while ( block != nullptr )
+	{
+		arena_block*	next = block->next;
+
+		FREE(block);
+		block = next;
+	}
+}
+
+
+
+void*
+ScratchArena::Allocate(
+	size_t size,
+	size_t align
+)
+{
+	arena_block*	block = _current;
+	size_t		offset;
+
+	while ( block != nullptr )
+	{
+		// round up to the alignment, relative to the real address
+		uintptr_t	base = (uintptr_t)(block + 1);
+
+		offset = ((base + block->used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+
+		if ( offset + size <= block->size )
+		{
+			block->used = offset + size;
+			_current = block;
+			return (uint8_t*)(block + 1) + offset;
+		}
+
+		// kept from before a reset; may be free
+		block = block->next;
+	}
+
+	if (( block = NewBlock(size + align)) == nullptr )
+		return nullptr;
+
+	_current = block;
+	offset = (((uintptr_t)(block + 1) + align - 1) & ~(uintptr_t)(align - 1)) - (uintptr_t)(block + 1);
+	block->used = offset + size;
+
+	return (uint8_t*)(block + 1) + offset;
+}
+
+
+
+char*
+ScratchArena::Duplicate(
+	const char* str,
+	size_t len
+)
+{
+	char*	copy;
+
+	if (( copy = (char*)Allocate(len + 1, 1)) == nullptr )
+		return nullptr;
+
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+
+	return copy;
+}
+
+
+
+arena_block*
+ScratchArena::NewBlock(
+	size_t min_size
+)
+{
+	arena_block*	block;
+	size_t		size = min_size > _block_size ? min_size : _block_size;
+
+	if (( block = (arena_block*)MALLOC(sizeof(arena_block) + size)) == nullptr )
+		return nullptr;
+
+	block->size = size;
+	block->used = 0;
+	_block_allocs++;
+
+	// link in after the current block, so later ones are still reused
+	if ( _current == nullptr )
+	{
+		block->next = _head;
+		_head = block;
+	}
+	else
+	{
+		block->next = _current->next;
+		_current->next = block;
+	}
+
+	return block;
+}
+
+
+
+void
+ScratchArena::Reset()
+{
+	for ( arena_block* block = _head; block != nullptr; block = block->next )
+		block->used = 0;
+
+	_current = _head;
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,210 @@
+#pragma once
+
+/**
+ * @file	src/api/ScratchArena.h
+ * @author	James Warren
+ * @brief	Bump allocator for short-lived scratch memory
+ */
+
+
+
+#include <cstddef>			// size_t
+#include <new>				// std::bad_alloc
+#include <type_traits>			// std::alignment_of
+
+#include "definitions.h"
+#include "types.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/** Default size of each block; comfortably holds a full IRC line and its parameters */
+#define ARENA_BLOCK_SIZE		4096
+/** Alignment of memory returned when none is requested */
+#define ARENA_DEFAULT_ALIGN		(sizeof(void*) * 2)
+
+
+
+/**
+ * A block of arena memory; the usable space directly follows the header.
+ *
+ * @struct arena_block
+ */
+struct arena_block
+{
+	arena_block*	next;		/**< The next block in the chain, if any */
+	size_t		size;		/**< Usable bytes following this header */
+	size_t		used;		/**< Bytes handed out since the last reset */
+};
+
+
+
+/**
+ * Hands out memory by advancing a pointer through a chain of blocks, and
+ * releases all of it at once with Reset(). There is no per-allocation free.
+ *
+ * Blocks are kept across resets, so once the arena has grown to suit its
+ * workload, allocating from it never reaches the heap. Intended for memory
+ * that lives only as long as one unit of work - one parsed message, say.
+ *
+ * Not thread-safe; each arena belongs to a single thread.
+ *
+ * @class ScratchArena
+ */
+class SBI_API ScratchArena
+{
+private:
+	NO_CLASS_ASSIGNMENT(ScratchArena);
+	NO_CLASS_COPY(ScratchArena);
+
+	/** The first block; nullptr until the first allocation */
+	arena_block*	_head;
+
+	/** The block currently being allocated from */
+	arena_block*	_current;
+
+	/** The size of each new block, unless a larger one is needed */
+	size_t		_block_size;
+
+	/** Blocks obtained from the heap over the arena's lifetime */
+	uint64_t	_block_allocs;
+
+
+	/**
+	 * Obtains a new block from the heap, large enough to hold min_size
+	 * bytes, and links it after _current.
+	 *
+	 * @return The new block, or nullptr if allocation failed
+	 */
+	arena_block*
+	NewBlock(
+		size_t min_size
+	);
+
+public:
+	ScratchArena(
+		size_t block_size = ARENA_BLOCK_SIZE
+	);
+	~ScratchArena();
+
+
+	/**
+	 * Allocates size bytes from the arena. The memory remains valid until
+	 * the next Reset(), or the arena is destroyed.
+	 *
+	 * @param[in] size The number of bytes required
+	 * @param[in] align The alignment required; must be a power of 2
+	 * @return A pointer to the memory, or nullptr if a new block was
+	 * needed and could not be allocated
+	 */
+	void*
+	Allocate(
+		size_t size,
+		size_t align = ARENA_DEFAULT_ALIGN
+	);
+
+
+	/**
+	 * Gets the number of blocks obtained from the heap since the arena was
+	 * created; stops increasing once the arena has reached its working
+	 * size.
+	 */
+	uint64_t
+	BlockAllocations() const
+	{
+		return _block_allocs;
+	}
+
+
+	/**
+	 * Copies len characters of str into the arena, nul-terminated.
+	 *
+	 * @return The copy, or nullptr on allocation failure
+	 */
+	char*
+	Duplicate(
+		const char* str,
+		size_t len
+	);
+
+
+	/**
+	 * Makes every allocation available again. Nothing is returned to the
+	 * heap, and no destructors are run; anything with one must have been
+	 * destroyed by its owner already.
+	 */
+	void
+	Reset();
+};
+
+
+
+/**
+ * Standard library allocator drawing from a ScratchArena, so containers of
+ * scratch objects don't touch the heap either. Deallocation does nothing;
+ * the memory comes back when the arena is reset.
+ *
+ * @code
+ std::vector<mode_data, arena_allocator<mode_data>>  modes((arena_allocator<mode_data>(&arena)));
+ * @endcode
+ */
+template <typename T>
+class arena_allocator
+{
+public:
+	typedef T	value_type;
+
+	ScratchArena*	arena;
+
+	arena_allocator(
+		ScratchArena* source
+	) : arena(source)
+	{
+	}
+
+	template <typename U>
+	arena_allocator(
+		const arena_allocator<U>& other
+	) : arena(other.arena)
+	{
+	}
+
+	T*
+	allocate(
+		size_t num
+	)
+	{
+		void*	p = arena->Allocate(num * sizeof(T), std::alignment_of<T>::value);
+
+		if ( p == nullptr )
+			throw std::bad_alloc();
+
+		return static_cast<T*>(p);
+	}
+
+	void
+	deallocate(
+		T*,
+		size_t
+	)
+	{
+	}
+
+	template <typename U>
+	bool operator == (const arena_allocator<U>& other) const
+	{
+		return arena == other.arena;
+	}
+
+	template <typename U>
+	bool operator != (const arena_allocator<U>& other) const
+	{
+		return arena != other.arena;
+	}
+};
+
+
+
+END_NAMESPACE
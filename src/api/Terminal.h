@@ -423,4 +423,37 @@ inline std::ostream& fg_yellow( std::ostream& os )
 
 
 
+/** A colour manipulator; any of the above */
+typedef std::ostream& (*terminal_manip)(std::ostream&);
+
+
+/**
+ * Gets every colour manipulator, so colours can be recorded by position
+ * and applied later (see DiagnosticsSink).
+ *
+ * The addresses of inline functions can differ between modules, so only
+ * compare against this from code in the same module as the manipulator
+ * was taken.
+ *
+ * @param[out] count The number of manipulators
+ * @return The manipulators
+ */
+inline const terminal_manip*
+terminal_colours(
+	size_t* count
+)
+{
+	static const terminal_manip	colours[] = {
+		bg_black, bg_blue, bg_cyan, bgfg_default, bg_green, bg_grey,
+		bg_magenta, bg_red, bg_white, bg_yellow, clear,
+		fg_black, fg_blue, fg_cyan, fg_green, fg_grey,
+		fg_magenta, fg_red, fg_white, fg_yellow
+	};
+
+	*count = sizeof(colours) / sizeof(colours[0]);
+	return colours;
+}
+
+
+
 END_NAMESPACE
@@ -0,0 +1,271 @@
+#pragma once
+
+/**
+ * @file	src/api/ThreadSlots.h
+ * @author	James Warren
+ * @brief	Per-thread objects, handed on from exited threads to new ones
+ */
+
+
+
+#include <atomic>
+
+#if defined(_WIN32)
+#	include <Windows.h>		// Fls*
+#else
+#	include <pthread.h>		// thread-specific data
+#endif
+
+#include "definitions.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/* A plain pointer, so __declspec(thread) is usable; nothing tells us when a
+ * __declspec(thread) variable goes away, so the exit notification is a
+ * separate FLS index or pthread key */
+#if defined(_WIN32)
+#	define SLOT_THREAD_LOCAL	__declspec(thread)
+#else
+#	define SLOT_THREAD_LOCAL	__thread
+#endif
+
+
+
+/**
+ * Gives each thread an object of its own - a log buffer, a set of counters -
+ * found through a thread-local pointer, with no lock. When the thread exits,
+ * OnExit is called with its object, which must then clear in_use; the next
+ * new thread adopts the object rather than creating another, so there are
+ * only ever as many as the most threads alive at once.
+ *
+ * T must have a std::atomic<bool> 'in_use', set while a live thread owns it,
+ * and a T* 'next'. Every object is kept in a list, newest first, that is only
+ * ever pushed on to; so it can be walked (First) without a lock, at any time.
+ *
+ * Has no constructor or destructor, so a static instance is zero-initialized
+ * before any code runs, and outlives everything; usable from other static
+ * constructors and destructors. Attach() is needed before exit notification
+ * happens; without it, objects are simply never reused.
+ *
+ * Only one instance may exist for each T and OnExit, as the thread-local
+ * pointer is shared.
+ *
+ * @class ThreadSlots
+ */
+template <typename T, void (*OnExit)(T*)>
+class ThreadSlots
+{
+private:
+	/** The calling threads object; nullptr until its first Get */
+	static SLOT_THREAD_LOCAL T*	_current;
+
+	/** Every object created, newest first */
+	std::atomic<T*>		_head;
+	/** The number of objects created */
+	std::atomic<uint32_t>	_count;
+	/** Set while the exit notification is registered */
+	std::atomic<bool>	_attached;
+#if defined(_WIN32)
+	DWORD			_index;	/**< The FLS index for the exit notification */
+#else
+	pthread_key_t		_key;	/**< The key for the exit notification */
+#endif
+
+
+	/**
+	 * Invoked as a thread exits; the thread-local pointer is cleared first,
+	 * so anything the thread does from here on (other exit handlers) goes
+	 * through another object.
+	 *
+	 * @param[in] value The exiting threads object
+	 */
+#if defined(_WIN32)
+	static void WINAPI
+#else
+	static void
+#endif
+	ThreadExiting(
+		void* value
+	)
+	{
+		if ( value == nullptr )
+			return;
+
+		_current = nullptr;
+		OnExit(static_cast<T*>(value));
+	}
+
+public:
+	/**
+	 * Registers the exit notification; until this is called, or if it
+	 * fails, objects are never handed on.
+	 *
+	 * @return true if the notification is registered
+	 */
+	bool
+	Attach()
+	{
+		if ( _attached )
+			return true;
+
+#if defined(_WIN32)
+		if (( _index = FlsAlloc(&ThreadExiting)) == FLS_OUT_OF_INDEXES )
+			return false;
+#else
+		if ( pthread_key_create(&_key, &ThreadExiting) != 0 )
+			return false;
+#endif
+
+		_attached = true;
+		return true;
+	}
+
+
+	/**
+	 * Determines if the exit notification is registered.
+	 *
+	 * @return true if Attach succeeded, and Detach has not been called
+	 */
+	bool
+	Attached() const
+	{
+		return _attached;
+	}
+
+
+	/**
+	 * Removes the exit notification, so it won't run on objects about to be
+	 * freed. The calling thread lets go of its object; other threads still
+	 * running keep their pointer, so anything they do this late is broken.
+	 */
+	void
+	Detach()
+	{
+		if ( !_attached.exchange(false) )
+			return;
+
+#if defined(_WIN32)
+		FlsSetValue(_index, nullptr);
+		FlsFree(_index);
+#else
+		pthread_setspecific(_key, nullptr);
+		pthread_key_delete(_key);
+#endif
+
+		_current = nullptr;
+	}
+
+
+	/**
+	 * Deletes every object. Only once Detach has been called, and nothing
+	 * else can be using them.
+	 */
+	void
+	Clear()
+	{
+		T*	obj = _head.exchange(nullptr);
+
+		while ( obj != nullptr )
+		{
+			T*	next = obj->next;
+
+			delete obj;
+			obj = next;
+		}
+
+		_count = 0;
+	}
+
+
+	/**
+	 * Gets the first object for walking the list through each 'next'.
+	 * Objects are fully initialized before they're added, and never
+	 * removed until Clear, so this is safe from any thread.
+	 *
+	 * @return The newest object, or nullptr if none have been created
+	 */
+	T*
+	First() const
+	{
+		return _head.load(std::memory_order_acquire);
+	}
+
+
+	/**
+	 * Gets the calling threads object, if it has one yet.
+	 *
+	 * @return The object, or nullptr if Get has not been called
+	 */
+	static T*
+	Current()
+	{
+		return _current;
+	}
+
+
+	/**
+	 * Gets the calling threads object; on its first use, adopting that of
+	 * an exited thread, or creating one if there are none to adopt.
+	 *
+	 * @param[in] reusable Optional; returns false for a released object that
+	 * isn't yet fit to be adopted
+	 * @param[in] create Allocates and initializes a new object, with in_use
+	 * set; passed the number created before it. Returns nullptr on failure
+	 * @return The object; nullptr only if create failed
+	 */
+	T*
+	Get(
+		bool (*reusable)(T*),
+		T* (*create)(uint32_t)
+	)
+	{
+		T*	obj = _current;
+
+		if ( obj != nullptr )
+			return obj;
+
+		for ( obj = First(); obj != nullptr; obj = obj->next )
+		{
+			bool	expected = false;
+
+			if ( reusable != nullptr && !reusable(obj) )
+				continue;
+			if ( obj->in_use.compare_exchange_strong(expected, true) )
+				break;
+		}
+
+		if ( obj == nullptr )
+		{
+			if (( obj = create(_count.fetch_add(1))) == nullptr )
+				return nullptr;
+
+			obj->next = _head.load();
+			while ( !_head.compare_exchange_weak(obj->next, obj, std::memory_order_release) )
+				;
+		}
+
+		// without an exit notification, the object is simply never reused
+		if ( _attached )
+		{
+#if defined(_WIN32)
+			FlsSetValue(_index, obj);
+#else
+			pthread_setspecific(_key, obj);
+#endif
+		}
+
+		_current = obj;
+		return obj;
+	}
+};
+
+
+template <typename T, void (*OnExit)(T*)>
+SLOT_THREAD_LOCAL T*	ThreadSlots<T, OnExit>::_current = nullptr;
+
+
+
+END_NAMESPACE
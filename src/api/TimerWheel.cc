@@ -0,0 +1,304 @@
+
+/**
+ * @file	src/api/TimerWheel.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <vector>
+#include <cstring>		// memset
+
+#include "TimerWheel.h"		// prototypes
+#include "utils.h"		// get_ms_time
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+TimerWheel::TimerWheel()
+{
+	memset(_root, 0, sizeof(_root));
+	memset(_levels, 0, sizeof(_levels));
+
+	_start_ms = get_ms_time();
+	_current_tick = 0;
+	_next_id = 1;
+	_wake_hook = nullptr;
+	_wake_context = nullptr;
+}
+
+
+
+TimerWheel::~TimerWheel()
+{
+	for ( auto t : _timers )
+		delete t.second;
+}
+
+
+
+uint32_t
+TimerWheel::Advance()
+{
+	std::vector<timer_node*>	expired;
+	uint64_t	now = get_ms_time();
+	uint64_t	target_tick;
+	uint32_t	index;
+
+	// clock went backwards; wait for it to catch up rather than misfire
+	if ( now < _start_ms )
+		return 0;
+
+	target_tick = (now - _start_ms) / TIMER_WHEEL_TICK_MS;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		// nothing to cascade or expire; skip straight past the idle time
+		if ( _timers.empty() && _current_tick <= target_tick )
+			_current_tick = target_tick + 1;
+
+		while ( _current_tick <= target_tick )
+		{
+			index = (uint32_t)(_current_tick & TIMER_WHEEL_ROOT_MASK);
+
+			/* on each full turn of a wheel, bring the next slot of the
+			 * wheel above down into the finer ones */
+			if ( index == 0
+			    && Cascade(0, (uint32_t)((_current_tick >> TIMER_WHEEL_ROOT_BITS) & TIMER_WHEEL_LEVEL_MASK)) == 0
+			    && Cascade(1, (uint32_t)((_current_tick >> (TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_LEVEL_MASK)) == 0 )
+			{
+				Cascade(2, (uint32_t)((_current_tick >> (TIMER_WHEEL_ROOT_BITS + 2 * TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_LEVEL_MASK));
+			}
+
+			while ( _root[index] != nullptr )
+			{
+				timer_node*	node = _root[index];
+
+				Unlink(node);
+				_timers.erase(node->id);
+				expired.push_back(node);
+			}
+
+			_current_tick++;
+		}
+	}
+
+	for ( auto n : expired )
+	{
+		n->callback(n->id, n->context);
+		delete n;
+	}
+
+	return (uint32_t)expired.size();
+}
+
+
+
+timer_id
+TimerWheel::Arm(
+	uint64_t delay_ms,
+	timer_callback callback,
+	void* context
+)
+{
+	timer_node*	node = new timer_node;
+	uint64_t	now = get_ms_time();
+	uint64_t	elapsed = now > _start_ms ? now - _start_ms : 0;
+	timer_wake_hook	wake = nullptr;
+	void*		wake_context = nullptr;
+	timer_id	id;
+
+	node->callback	= callback;
+	node->context	= context;
+	// round up, so a timer never fires early
+	node->expires	= (elapsed + delay_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		if ( _timers.empty() )
+		{
+			/* Advance may not have run for some time; catch up
+			 * first, so the timer is placed relative to now */
+			if ( _current_tick < elapsed / TIMER_WHEEL_TICK_MS )
+				_current_tick = elapsed / TIMER_WHEEL_TICK_MS;
+
+			/* and it may be asleep with no timeout; while anything
+			 * is armed, it wakes every tick by itself */
+			wake = _wake_hook;
+			wake_context = _wake_context;
+		}
+
+		id = node->id = _next_id++;
+		_timers[node->id] = node;
+		Place(node);
+	}
+
+	// outside the lock, so the hook is free to do as it pleases
+	if ( wake != nullptr )
+		wake(wake_context);
+
+	return id;
+}
+
+
+
+bool
+TimerWheel::Cancel(
+	timer_id id
+)
+{
+	std::unordered_map<timer_id, timer_node*>::iterator	iter;
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if ( id == 0 || (iter = _timers.find(id)) == _timers.end() )
+		return false;
+
+	Unlink(iter->second);
+	delete iter->second;
+	_timers.erase(iter);
+
+	return true;
+}
+
+
+
+uint32_t
+TimerWheel::Cascade(
+	uint32_t level,
+	uint32_t index
+)
+{
+	timer_node*	node = _levels[level][index];
+
+	_levels[level][index] = nullptr;
+
+	while ( node != nullptr )
+	{
+		timer_node*	next = node->next;
+
+		Place(node);
+		node = next;
+	}
+
+	return index;
+}
+
+
+
+size_t
+TimerWheel::Count()
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	return _timers.size();
+}
+
+
+
+uint32_t
+TimerWheel::MsUntilNextTick()
+{
+	uint64_t	now = get_ms_time();
+	uint64_t	next_ms;
+
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if ( _timers.empty() )
+		return UINT32_MAX;
+
+	next_ms = _start_ms + _current_tick * TIMER_WHEEL_TICK_MS;
+
+	return next_ms > now ? (uint32_t)(next_ms - now) : 0;
+}
+
+
+
+void
+TimerWheel::Place(
+	timer_node* node
+)
+{
+	uint64_t	expires = node->expires;
+	uint64_t	delta;
+	timer_node**	slot;
+
+	// anything already due goes in the very next slot to be processed
+	if ( expires < _current_tick )
+		expires = _current_tick;
+
+	delta = expires - _current_tick;
+
+	if ( delta < TIMER_WHEEL_ROOT_SIZE )
+	{
+		slot = &_root[expires & TIMER_WHEEL_ROOT_MASK];
+	}
+	else if ( delta < (1ULL << (TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS)) )
+	{
+		slot = &_levels[0][(expires >> TIMER_WHEEL_ROOT_BITS) & TIMER_WHEEL_LEVEL_MASK];
+	}
+	else if ( delta < (1ULL << (TIMER_WHEEL_ROOT_BITS + 2 * TIMER_WHEEL_LEVEL_BITS)) )
+	{
+		slot = &_levels[1][(expires >> (TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_LEVEL_MASK];
+	}
+	else
+	{
+		// beyond the range of the wheels; clamp to the furthest slot
+		if ( delta >= (1ULL << (TIMER_WHEEL_ROOT_BITS + 3 * TIMER_WHEEL_LEVEL_BITS)) )
+		{
+			expires = _current_tick + (1ULL << (TIMER_WHEEL_ROOT_BITS + 3 * TIMER_WHEEL_LEVEL_BITS)) - 1;
+			node->expires = expires;
+		}
+		slot = &_levels[2][(expires >> (TIMER_WHEEL_ROOT_BITS + 2 * TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_LEVEL_MASK];
+	}
+
+	// push onto the front of the slot
+	node->slot = slot;
+	node->prev = nullptr;
+	node->next = *slot;
+	if ( *slot != nullptr )
+		(*slot)->prev = node;
+	*slot = node;
+}
+
+
+
+void
+TimerWheel::SetWakeHook(
+	timer_wake_hook hook,
+	void* context
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	_wake_hook = hook;
+	_wake_context = context;
+}
+
+
+
+void
+TimerWheel::Unlink(
+	timer_node* node
+)
+{
+	if ( node->prev != nullptr )
+		node->prev->next = node->next;
+	else
+		*node->slot = node->next;
+
+	if ( node->next != nullptr )
+		node->next->prev = node->prev;
+
+	node->prev = nullptr;
+	node->next = nullptr;
+	node->slot = nullptr;
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,232 @@
+#pragma once
+
+/**
+ * @file	src/api/TimerWheel.h
+ * @author	James Warren
+ * @brief	Hierarchical timer wheel, for timeouts without a thread each
+ */
+
+
+
+#include <mutex>
+#include <unordered_map>
+#include "char_helper.h"
+#include "Runtime.h"		// our class exists through Runtime
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/** Resolution of the timer wheel; timers fire on the first tick after expiry */
+#define TIMER_WHEEL_TICK_MS		100
+/** Bits (and so slots) in the first, finest-grained, wheel */
+#define TIMER_WHEEL_ROOT_BITS		8
+/** Bits (and so slots) in each outer wheel */
+#define TIMER_WHEEL_LEVEL_BITS		6
+/** Number of outer wheels; with the above, timers can reach ~77 days out */
+#define TIMER_WHEEL_LEVELS		3
+
+#define TIMER_WHEEL_ROOT_SIZE		(1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_SIZE		(1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_ROOT_MASK		(TIMER_WHEEL_ROOT_SIZE - 1)
+#define TIMER_WHEEL_LEVEL_MASK		(TIMER_WHEEL_LEVEL_SIZE - 1)
+
+
+/** Identifies an armed timer; 0 is never a valid id */
+typedef uint64_t	timer_id;
+
+/**
+ * Executed when a timer expires, in the thread calling TimerWheel::Advance.
+ * The timer is no longer armed when this is called, so it may be re-armed.
+ */
+typedef void (*timer_callback)(timer_id id, void* context);
+
+/**
+ * Executed when a timer is armed into an empty wheel, in the thread calling
+ * TimerWheel::Arm; see TimerWheel::SetWakeHook.
+ */
+typedef void (*timer_wake_hook)(void* context);
+
+
+
+/**
+ * An armed timer; linked into exactly one wheel slot.
+ *
+ * @struct timer_node
+ */
+struct timer_node
+{
+	timer_node*	prev;
+	timer_node*	next;
+	timer_node**	slot;		/**< The slot this node is linked into */
+	uint64_t	expires;	/**< The tick this timer expires on */
+	timer_id	id;
+	timer_callback	callback;
+	void*		context;
+};
+
+
+
+/**
+ * A hashed hierarchical timer wheel (Varghese & Lauck), as used in the Linux
+ * kernel. Arming and cancelling are O(1) regardless of how many timers exist;
+ * the cost of advancing is one slot per tick, plus the occasional cascade of
+ * an outer slot down to the finer wheels.
+ *
+ * Nothing runs by itself; the thread that owns the I/O loop calls Advance()
+ * whenever it wakes, and uses MsUntilNextTick() to bound how long it sleeps.
+ * The IRC parser thread does exactly this. With nothing armed, it sleeps
+ * without a timeout; so it registers a wake hook, which Arm() calls when the
+ * wheel goes from empty to not, whichever thread is arming.
+ *
+ * @class TimerWheel
+ */
+class SBI_API TimerWheel
+{
+	// only the runtime is allowed to construct us
+	friend class Runtime;
+private:
+	NO_CLASS_ASSIGNMENT(TimerWheel);
+	NO_CLASS_COPY(TimerWheel);
+
+	// private constructor; we want one instance that is controlled.
+	TimerWheel();
+	~TimerWheel();
+
+	/** Synchronization lock; timers are armed from any thread */
+	std::mutex		_mutex;
+
+	/** The finest wheel; one slot per tick */
+	timer_node*		_root[TIMER_WHEEL_ROOT_SIZE];
+	/** The outer wheels; each slot spans a full turn of the wheel below */
+	timer_node*		_levels[TIMER_WHEEL_LEVELS][TIMER_WHEEL_LEVEL_SIZE];
+
+	/** Every armed timer, for O(1) cancellation by id */
+	std::unordered_map<timer_id, timer_node*>	_timers;
+
+	uint64_t		_start_ms;	/**< get_ms_time() of tick 0 */
+	uint64_t		_current_tick;	/**< The next tick to be processed */
+	timer_id		_next_id;	/**< The id to assign the next timer */
+	timer_wake_hook		_wake_hook;	/**< Wakes the thread calling Advance; nullptr if none */
+	void*			_wake_context;	/**< Passed to _wake_hook unmodified */
+
+
+	/**
+	 * Moves every timer in the slot of an outer wheel back into the wheels,
+	 * which places them a level (or more) finer.
+	 *
+	 * @param[in] level The outer wheel, 0-based
+	 * @param[in] index The slot within the wheel
+	 * @return The index, so a zero can trigger cascading the next level
+	 */
+	uint32_t
+	Cascade(
+		uint32_t level,
+		uint32_t index
+	);
+
+
+	/**
+	 * Links node into the slot appropriate for its expiry tick. The lock
+	 * must be held.
+	 */
+	void
+	Place(
+		timer_node* node
+	);
+
+
+	/**
+	 * Removes node from whichever slot it is in. The lock must be held.
+	 */
+	void
+	Unlink(
+		timer_node* node
+	);
+
+public:
+
+	/**
+	 * Processes every tick up to the time now, executing the callback of
+	 * each timer that expired. Callbacks run without the lock held, so they
+	 * are free to arm and cancel timers.
+	 *
+	 * @return The number of timers that fired
+	 */
+	uint32_t
+	Advance();
+
+
+	/**
+	 * Arms a timer to execute callback after delay_ms. If the wheel was
+	 * empty, the wake hook is called, as the thread calling Advance may be
+	 * sleeping with no timeout.
+	 *
+	 * @param[in] delay_ms The time from now that the timer expires
+	 * @param[in] callback The function to execute on expiry
+	 * @param[in] context Passed to callback unmodified
+	 * @return The id of the new timer, used to cancel it
+	 */
+	timer_id
+	Arm(
+		uint64_t delay_ms,
+		timer_callback callback,
+		void* context
+	);
+
+
+	/**
+	 * Cancels a timer. Cancelling one that already fired, or an id of 0,
+	 * is harmless.
+	 *
+	 * A timer that expired in the same Advance() call, but whose callback
+	 * has not yet been executed, will still fire; cancel from the thread
+	 * calling Advance() where this matters.
+	 *
+	 * @param[in] id The timer to cancel
+	 * @return true if the timer was armed and has been cancelled
+	 */
+	bool
+	Cancel(
+		timer_id id
+	);
+
+
+	/**
+	 * Gets the number of timers currently armed.
+	 */
+	size_t
+	Count();
+
+
+	/**
+	 * Gets how long until the next tick is due, for use as a wait timeout.
+	 * If no timers are armed, there's no need to wake at all.
+	 *
+	 * @return The milliseconds until the next tick, or UINT32_MAX if no
+	 * timers are armed
+	 */
+	uint32_t
+	MsUntilNextTick();
+
+
+	/**
+	 * Sets the function that wakes the thread calling Advance(), which
+	 * sleeps without a timeout while no timers are armed. Supply a nullptr
+	 * to remove it, before the thread goes away.
+	 *
+	 * @param[in] hook The function to call when the wheel stops being empty
+	 * @param[in] context Passed to hook unmodified
+	 */
+	void
+	SetWakeHook(
+		timer_wake_hook hook,
+		void* context
+	);
+};
+
+
+
+END_NAMESPACE
@@ -16,6 +16,8 @@
 
 #include "crash_handler.h"
 #include "utils.h"
+#include "Runtime.h"
+#include "Log.h"		// flushed on crash
 
 using namespace APP_NAMESPACE;
 
@@ -39,6 +41,9 @@ write_dump(
 
 	UNREFERENCED_PARAMETER(code);
 
+	// the lead-up to the crash is what we want; get it out first
+	runtime.Logger()->CrashFlush();
+
 	// output to executables current directory
 	GetCurrentDirectory(_countof(dump_path), dump_path);
 
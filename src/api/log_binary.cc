@@ -0,0 +1,412 @@
+
+/**
+ * @file	src/api/log_binary.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <ctime>		// localtime
+#include <cstring>		// memcmp, memcpy
+#include <map>
+#include <sstream>
+
+#include "log_binary.h"		// prototypes
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/**
+ * A call site, as read from a Site record.
+ *
+ * @struct logbin_site
+ */
+struct logbin_site
+{
+	uint32_t	level;		/**< The ELogLevel */
+	std::string	file;		/**< The source file */
+	std::string	function;	/**< The function */
+	uint32_t	line;		/**< The line number */
+};
+
+
+/**
+ * Reads the fields of records from the loaded file.
+ *
+ * @struct logbin_reader
+ */
+struct logbin_reader
+{
+	const std::string*	data;	/**< The file contents */
+	size_t			pos;	/**< The next byte to read */
+};
+
+
+/** The level prefixes, by ELogLevel; as the text log writes them */
+static const char*	level_text[] = {
+	"",
+	"[ERROR]    ",
+	"[WARNING]  ",
+	"[INFO]     ",
+	"[DEBUG]    ",
+	"[FORCED]   "
+};
+
+
+
+/**
+ * Reads a little-endian integer of size bytes.
+ *
+ * @param[in] reader The reader
+ * @param[out] value Receives the value
+ * @param[in] size The number of bytes to read
+ * @return false if there aren't enough bytes left
+ */
+static bool
+get_uint(
+	logbin_reader& reader,
+	uint64_t& value,
+	uint32_t size
+)
+{
+	if ( reader.data->length() - reader.pos < size )
+		return false;
+
+	value = 0;
+	for ( uint32_t i = 0; i < size; i++ )
+		value |= (uint64_t)(uint8_t)(*reader.data)[reader.pos + i] << (i * 8);
+
+	reader.pos += size;
+	return true;
+}
+
+
+
+/**
+ * Reads a string with a length prefix of length_size bytes.
+ *
+ * @param[in] reader The reader
+ * @param[out] text Receives the string
+ * @param[in] length_size The number of bytes in the length prefix
+ * @return false if there aren't enough bytes left
+ */
+static bool
+get_string(
+	logbin_reader& reader,
+	std::string& text,
+	uint32_t length_size
+)
+{
+	uint64_t	length;
+
+	if ( !get_uint(reader, length, length_size) )
+		return false;
+	if ( reader.data->length() - reader.pos < length )
+		return false;
+
+	text.assign(*reader.data, reader.pos, (size_t)length);
+	reader.pos += (size_t)length;
+	return true;
+}
+
+
+
+/**
+ * Reads the arguments of an Entry record up to its LogArg_End, rendering
+ * them into text if it's not a nullptr.
+ *
+ * @param[in] reader The reader
+ * @param[out] text Receives the rendered arguments; nullptr to skip
+ * @return false if the record is truncated, or an argument unknown
+ */
+static bool
+get_args(
+	logbin_reader& reader,
+	std::ostringstream* text
+)
+{
+	uint64_t	type;
+	uint64_t	value;
+	std::string	str;
+
+	for ( ;; )
+	{
+		if ( !get_uint(reader, type, 1) )
+			return false;
+
+		switch ( type )
+		{
+		case LogArg_End:
+			return true;
+		case LogArg_String:
+			if ( !get_string(reader, str, 4) )
+				return false;
+			if ( text != nullptr )
+				*text << str;
+			break;
+		case LogArg_Signed:
+			if ( !get_uint(reader, value, 8) )
+				return false;
+			if ( text != nullptr )
+				*text << (int64_t)value;
+			break;
+		case LogArg_Unsigned:
+			if ( !get_uint(reader, value, 8) )
+				return false;
+			if ( text != nullptr )
+				*text << value;
+			break;
+		case LogArg_Double:
+			if ( !get_uint(reader, value, 8) )
+				return false;
+			if ( text != nullptr )
+			{
+				double	d;
+
+				memcpy(&d, &value, sizeof(d));
+				*text << d;
+			}
+			break;
+		case LogArg_Pointer:
+			if ( !get_uint(reader, value, 8) )
+				return false;
+			if ( text != nullptr )
+				*text << (const void*)(uintptr_t)value;
+			break;
+		case LogArg_Char:
+			if ( !get_uint(reader, value, 1) )
+				return false;
+			if ( text != nullptr )
+				*text << (char)value;
+			break;
+		case LogArg_Bool:
+			if ( !get_uint(reader, value, 1) )
+				return false;
+			if ( text != nullptr )
+				*text << (value != 0);
+			break;
+		default:
+			return false;
+		}
+	}
+}
+
+
+
+/**
+ * Writes the timestamp as the text log would; local time, to the second.
+ *
+ * @param[in] out The output file
+ * @param[in] timestamp Microseconds since the epoch
+ */
+static void
+put_time(
+	FILE* out,
+	uint64_t timestamp
+)
+{
+	time_t		secs = (time_t)(timestamp / 1000000);
+	struct tm	tm_local;
+	char		buf[32];
+
+#if defined(_WIN32)
+	localtime_s(&tm_local, &secs);
+#else
+	localtime_r(&secs, &tm_local);
+#endif
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_local);
+
+	fputs(buf, out);
+}
+
+
+
+void
+logbin_put(
+	std::string& record,
+	uint64_t value,
+	uint32_t size
+)
+{
+	for ( uint32_t i = 0; i < size; i++ )
+	{
+		record.push_back((char)(value & 0xFF));
+		value >>= 8;
+	}
+}
+
+
+
+void
+logbin_put_string(
+	std::string& record,
+	const char* text,
+	size_t length
+)
+{
+	logbin_put(record, length, 4);
+	record.append(text, length);
+}
+
+
+
+bool
+logbin_decode(
+	const char* path,
+	FILE* out
+)
+{
+	std::map<uint32_t, logbin_site>	sites;
+	std::string	data;
+	logbin_reader	reader;
+	FILE*		fp;
+	char		buf[65536];
+	size_t		read;
+	uint64_t	type;
+	uint64_t	value;
+
+	if (( fp = fopen(path, "rb")) == nullptr )
+	{
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		return false;
+	}
+
+	while (( read = fread(buf, 1, sizeof(buf), fp)) > 0 )
+		data.append(buf, read);
+
+	fclose(fp);
+
+	if ( data.length() < LOGBIN_MAGIC_LEN
+	    || memcmp(data.c_str(), LOGBIN_MAGIC, LOGBIN_MAGIC_LEN) != 0 )
+	{
+		fprintf(stderr, "'%s' is not a binary log\n", path);
+		return false;
+	}
+
+	reader.data = &data;
+
+	/* first pass collects the call sites; an entry can come before the
+	 * site it uses, if they were written by different threads */
+	reader.pos = LOGBIN_MAGIC_LEN;
+	while ( reader.pos < data.length() )
+	{
+		if ( !get_uint(reader, type, 1) )
+			break;
+
+		if ( type == LogRecord_Site )
+		{
+			logbin_site	site;
+			uint64_t	id;
+			uint64_t	line;
+
+			if ( !get_uint(reader, id, 4)
+			    || !get_uint(reader, value, 1)
+			    || !get_string(reader, site.file, 2)
+			    || !get_string(reader, site.function, 2)
+			    || !get_uint(reader, line, 4) )
+				break;
+
+			site.level = (uint32_t)value;
+			site.line = (uint32_t)line;
+			sites[(uint32_t)id] = site;
+		}
+		else if ( type == LogRecord_Entry )
+		{
+			if ( !get_uint(reader, value, 4) || !get_uint(reader, value, 8) || !get_args(reader, nullptr) )
+				break;
+		}
+		else if ( type == LogRecord_Text )
+		{
+			std::string	text;
+
+			if ( !get_uint(reader, value, 8) || !get_string(reader, text, 4) )
+				break;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	// second pass renders
+	reader.pos = LOGBIN_MAGIC_LEN;
+	while ( reader.pos < data.length() )
+	{
+		if ( !get_uint(reader, type, 1) )
+			goto corrupt;
+
+		if ( type == LogRecord_Site )
+		{
+			std::string	str;
+
+			if ( !get_uint(reader, value, 4)
+			    || !get_uint(reader, value, 1)
+			    || !get_string(reader, str, 2)
+			    || !get_string(reader, str, 2)
+			    || !get_uint(reader, value, 4) )
+				goto corrupt;
+		}
+		else if ( type == LogRecord_Entry )
+		{
+			std::ostringstream	text;
+			uint64_t	id;
+			uint64_t	timestamp;
+
+			if ( !get_uint(reader, id, 4) || !get_uint(reader, timestamp, 8) )
+				goto corrupt;
+			if ( !get_args(reader, &text) )
+				goto corrupt;
+
+			auto	site = sites.find((uint32_t)id);
+
+			put_time(out, timestamp);
+			fputc('\t', out);
+
+			if ( site == sites.end() )
+			{
+				fprintf(out, "[site %u]: ", (uint32_t)id);
+			}
+			else
+			{
+				if ( site->second.level < sizeof(level_text) / sizeof(level_text[0]) )
+					fputs(level_text[site->second.level], out);
+
+				fprintf(out, "%s (%s:%u): ",
+					site->second.function.c_str(),
+					site->second.file.c_str(),
+					site->second.line
+				);
+			}
+
+			fputs(text.str().c_str(), out);
+		}
+		else if ( type == LogRecord_Text )
+		{
+			std::string	text;
+
+			if ( !get_uint(reader, value, 8) || !get_string(reader, text, 4) )
+				goto corrupt;
+
+			fwrite(text.c_str(), 1, text.length(), out);
+		}
+		else
+		{
+			goto corrupt;
+		}
+	}
+
+	return true;
+
+corrupt:
+	fprintf(stderr, "'%s' is truncated or corrupt at offset %lu\n", path, (unsigned long)reader.pos);
+	return false;
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,124 @@
+#pragma once
+
+/**
+ * @file	src/api/log_binary.h
+ * @author	James Warren
+ * @brief	The binary log format; encoding helpers and the decoder
+ */
+
+
+
+#include <cstdio>
+#include <string>
+
+#include "char_helper.h"
+#include "types.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/*-----------------------------------------------------------------------------
+ * Binary log layout. All integers are little-endian.
+ *
+ * The file starts with LOGBIN_MAGIC, and is then a sequence of records, each
+ * starting with its ELogRecord type:
+ *
+ * Site	  u32 id, u8 level, u16 length + file, u16 length + function, u32 line
+ * Entry  u32 site id, u64 timestamp, arguments..., LogArg_End
+ * Text	  u64 timestamp, u32 length + text
+ *
+ * Each LOG() call site is described once by a Site record, the first time it
+ * is used; Entry records refer to it by id, so the file, function, line and
+ * level aren't repeated. As threads write their own buffers, a Site can land
+ * later in the file than the first Entry using it.
+ *
+ * Timestamps are microseconds since the epoch, UTC. Arguments are each their
+ * ELogArg type and value; anything without an encoding of its own is written
+ * as a String of its text form.
+ *----------------------------------------------------------------------------*/
+
+/** Identifies a binary log file */
+#define LOGBIN_MAGIC		"SBIBLOG1"
+#define LOGBIN_MAGIC_LEN	8
+
+
+/**
+ * @enum ELogRecord
+ */
+enum ELogRecord
+{
+	LogRecord_Site = 1,	/**< A call site description */
+	LogRecord_Entry,	/**< A LOG() statement */
+	LogRecord_Text		/**< Plain text; Append, or entries with no call site */
+};
+
+
+/**
+ * @enum ELogArg
+ */
+enum ELogArg
+{
+	LogArg_End = 0,		/**< No more arguments */
+	LogArg_String,		/**< u32 length + text */
+	LogArg_Signed,		/**< i64 */
+	LogArg_Unsigned,	/**< u64 */
+	LogArg_Double,		/**< IEEE 754 double, as a u64 */
+	LogArg_Pointer,		/**< u64 */
+	LogArg_Char,		/**< u8 */
+	LogArg_Bool		/**< u8 */
+};
+
+
+/**
+ * Appends a little-endian integer of size bytes to a record.
+ *
+ * @param[in] record The record being built
+ * @param[in] value The value to append
+ * @param[in] size The number of bytes to write
+ */
+SBI_API
+void
+logbin_put(
+	std::string& record,
+	uint64_t value,
+	uint32_t size
+);
+
+
+/**
+ * Appends a u32 length, followed by the text, to a record.
+ *
+ * @param[in] record The record being built
+ * @param[in] text The text
+ * @param[in] length The length of text
+ */
+SBI_API
+void
+logbin_put_string(
+	std::string& record,
+	const char* text,
+	size_t length
+);
+
+
+/**
+ * Renders a binary log file back into the text format.
+ *
+ * @param[in] path The binary log file
+ * @param[in] out Where to write the text
+ * @return true if the whole file was decoded
+ * @return false if the file could not be read, is not a binary log, or is
+ * truncated or corrupt; everything up to that point is still written
+ */
+SBI_API
+bool
+logbin_decode(
+	const char* path,
+	FILE* out
+);
+
+
+
+END_NAMESPACE
@@ -11,6 +11,8 @@
 #include "rpc_commands.h"
 #include "RpcServer.h"
 #include "Runtime.h"			// RpcServer accessor
+#include "HeapProfiler.h"
+#include "MemoryAccounting.h"
 
 
 
@@ -29,6 +31,57 @@ api_GetEnvironmentCoreCount(
 
 
 
+#if defined(USING_HEAP_PROFILER)
+
+json_spirit::Value
+api_HeapProfile(
+	const json_spirit::Array& params,
+	bool fHelp
+)
+{
+	EHeapProfileValue	value = EHeapProfileValue::LiveBytes;
+	heap_profile_summary	summary;
+	json_spirit::Object	obj;
+	std::string	path;
+	std::string	written;
+
+	if ( fHelp || params.size() > 2 )
+	{
+		throw std::runtime_error(
+			"heap_profile [live|total] [path]\n"
+			"Writes the sampled heap profile in collapsed-stack format, for flame graphs.\n"
+			"live (the default) is what is still allocated; total is everything allocated."
+		);
+	}
+
+	if ( params.size() > 0 )
+	{
+		if ( params[0].get_str() == "total" )
+			value = EHeapProfileValue::TotalBytes;
+		else if ( params[0].get_str() != "live" )
+			throw std::runtime_error("Invalid value; must be live or total");
+	}
+
+	if ( params.size() > 1 )
+		path = params[1].get_str();
+
+	written = runtime.HeapProfile()->Dump(path.empty() ? nullptr : path.c_str(), value, &summary);
+
+	if ( written.empty() )
+		throw std::runtime_error("Unable to write the heap profile");
+
+	obj.push_back(json_spirit::Pair("path", written));
+	obj.push_back(json_spirit::Pair("sites", (uint64_t)summary.sites));
+	obj.push_back(json_spirit::Pair("live_bytes", (int64_t)summary.live_bytes));
+	obj.push_back(json_spirit::Pair("total_bytes", (uint64_t)summary.total_bytes));
+
+	return obj;
+}
+
+#endif	// USING_HEAP_PROFILER
+
+
+
 json_spirit::Value
 api_Help(
 	const json_spirit::Array& params,
@@ -53,6 +106,50 @@ api_Help(
 
 
 
+json_spirit::Value
+api_MemoryUsage(
+	const json_spirit::Array& params,
+	bool fHelp
+)
+{
+	mem_account_totals	totals;
+	json_spirit::Object	obj;
+	json_spirit::Object	subsystems;
+	int64_t		total_bytes = 0;
+	int64_t		total_objects = 0;
+
+	if ( fHelp || params.size() > 0 )
+	{
+		throw std::runtime_error(
+			"memory_usage\n"
+			"Returns the bytes and objects currently held by each subsystem.\n"
+			"See irc_memory for the breakdown by connection and channel."
+		);
+	}
+
+	runtime.Accounting()->Totals(&totals);
+
+	for ( size_t i = 0; i < (size_t)EMemSubsystem::Count; i++ )
+	{
+		json_spirit::Object	sub;
+
+		sub.push_back(json_spirit::Pair("bytes", totals.bytes[i]));
+		sub.push_back(json_spirit::Pair("objects", totals.objects[i]));
+		subsystems.push_back(json_spirit::Pair(MemoryAccounting::Name((EMemSubsystem)i), sub));
+
+		total_bytes += totals.bytes[i];
+		total_objects += totals.objects[i];
+	}
+
+	obj.push_back(json_spirit::Pair("subsystems", subsystems));
+	obj.push_back(json_spirit::Pair("total_bytes", total_bytes));
+	obj.push_back(json_spirit::Pair("total_objects", total_objects));
+
+	return obj;
+}
+
+
+
 json_spirit::Value
 api_Stop(
 	const json_spirit::Array& params, 
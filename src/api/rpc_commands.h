@@ -43,6 +43,19 @@ api_GetEnvironmentCoreCount(
 );
 
 
+#if defined(USING_HEAP_PROFILER)
+/**
+ * Writes a heap profile; see HeapProfiler::Dump
+ */
+SBI_API
+json_spirit::Value
+api_HeapProfile(
+	const json_spirit::Array& params,
+	bool fHelp
+);
+#endif
+
+
 /**
  * 
  */
@@ -54,6 +67,17 @@ api_Help(
 );
 
 
+/**
+ * Returns the accounted memory of each subsystem; see MemoryAccounting
+ */
+SBI_API
+json_spirit::Value
+api_MemoryUsage(
+	const json_spirit::Array& params,
+	bool fHelp
+);
+
+
 /**
  *
  */
@@ -8,8 +8,11 @@
 
 
 
+#include <errno.h>		// ETIMEDOUT
+#include <time.h>		// clock_gettime
+
 #include "sync_event.h"		// prototypes
-#include "Terminal.h"
+#include "Diagnostics.h"
 
 
 BEGIN_NAMESPACE(APP_NAMESPACE)
@@ -22,18 +25,18 @@ sync_event_construct(
 {
 	if ( evt == nullptr )
 	{
-		std::cerr << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
 		return false;
 	}
 
 	if ( pthread_mutex_init(&evt->mutex, nullptr) != 0 )
 	{
-		std::cerr << fg_red << "pthread_mutex_init() failed; errno " << errno << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "pthread_mutex_init() failed; errno " << errno << "\n";
 		return false;
 	}
 	if ( pthread_cond_init(&evt->condition, nullptr) != 0 )
 	{
-		std::cerr << fg_red << "pthread_cond_init() failed; errno " << errno << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "pthread_cond_init() failed; errno " << errno << "\n";
 
 		pthread_mutex_destroy(&evt->mutex);
 		return false;
@@ -55,21 +58,21 @@ sync_event_destroy(
 
 	if ( evt == nullptr )
 	{
-		std::cerr << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
 		return false;
 	}
 
 	/* if another thread is blocking, errno is set to EBUSY */
 	if ( pthread_mutex_destroy(&evt->mutex) != 0 )
 	{
-		std::cerr << fg_red << "pthread_mutex_destroy() failed; errno " << errno << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "pthread_mutex_destroy() failed; errno " << errno << "\n";
 		return false;
 	}
 
 	/* should never fail since pthread_mutex_destroy succeeded */
 	if (( rc = pthread_cond_destroy(&evt->condition)) != 0 )
 	{
-		std::cerr << fg_red << "pthread_cond_destroy() failed; errno " << rc << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "pthread_cond_destroy() failed; errno " << rc << "\n";
 		return false;
 	}
 
@@ -87,7 +90,7 @@ sync_event_set(
 {
 	if ( evt == nullptr )
 	{
-		std::cerr << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
 		return;
 	}
 
@@ -112,7 +115,7 @@ sync_event_wait(
 {
 	if ( evt == nullptr )
 	{
-		std::cerr << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
 		return;
 	}
 
@@ -130,4 +133,47 @@ sync_event_wait(
 }
 
 
+
+bool
+sync_event_timed_wait(
+	sync_event* evt,
+	uint32_t timeout_ms
+)
+{
+	struct timespec	abstime;
+	bool		signalled;
+
+	if ( evt == nullptr )
+	{
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "The event passed in to " << __FUNCTION__ << " was a nullptr\n";
+		return false;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &abstime);
+	abstime.tv_sec	+= timeout_ms / 1000;
+	abstime.tv_nsec	+= (long)(timeout_ms % 1000) * 1000000;
+	if ( abstime.tv_nsec >= 1000000000 )
+	{
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&evt->mutex);
+
+	while ( !evt->flag )
+	{
+		// ETIMEDOUT; anything else is a spurious wakeup, so wait again
+		if ( pthread_cond_timedwait(&evt->condition, &evt->mutex, &abstime) == ETIMEDOUT )
+			break;
+	}
+
+	signalled = evt->flag != 0;
+	evt->flag = 0;
+
+	pthread_mutex_unlock(&evt->mutex);
+
+	return signalled;
+}
+
+
 END_NAMESPACE
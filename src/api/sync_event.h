@@ -14,6 +14,7 @@
 
 
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include "definitions.h"
 
@@ -101,6 +102,24 @@ sync_event_wait(
 );
 
 
+/**
+ * As sync_event_wait, but gives up after timeout_ms; the event is reset if it
+ * was signalled.
+ *
+ * Just like calling WaitForSingleObject(evt, timeout_ms) in Windows.
+ *
+ * @param[in] evt The sync_event to wait on
+ * @param[in] timeout_ms The maximum time to wait, in milliseconds
+ * @retval true if the event was signalled
+ * @retval false if the wait timed out, or the event is a nullptr
+ */
+bool
+sync_event_timed_wait(
+	sync_event* evt,
+	uint32_t timeout_ms
+);
+
+
 /**
  * Signals the supplied sync_event; a thread waiting for this signal will block
  * until this is received,
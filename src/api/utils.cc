@@ -30,7 +30,7 @@
 #endif
 
 #include "Allocator.h"		// memory allocation macros
-#include "Terminal.h"
+#include "Diagnostics.h"
 #include "utils.h"		// prototypes
 
 
@@ -482,7 +482,7 @@ base64(
 
 	if ( !res )
 	{
-		std::cerr << fg_red << "Memory allocation failed (" << alloc << ") bytes\n";
+		DIAG(EDiagCategory::General, ELogLevel::Error) << fg_red << "Memory allocation failed (" << alloc << ") bytes\n";
 		return nullptr;
 	}
 
@@ -537,7 +537,7 @@ unbase64(
 	{
 		// 2 accesses below would be OOB.
 		// catch empty string, return NULL as result.
-		std::cerr << fg_red << "Invalid base64 string (too short).\n";
+		DIAG(EDiagCategory::General, ELogLevel::Error) << fg_red << "Invalid base64 string (too short).\n";
 		*flen = 0;
 		return nullptr;
 	}
@@ -552,7 +552,7 @@ unbase64(
 
 	if (( bin = (unsigned char*)MALLOC(alloc)) == nullptr )
 	{
-		std::cerr << fg_red << "Memory allocation failed (" << alloc << ") bytes\n";
+		DIAG(EDiagCategory::General, ELogLevel::Error) << fg_red << "Memory allocation failed (" << alloc << ") bytes\n";
 		return nullptr;
 	}
 
@@ -13,6 +13,9 @@
 #include <string.h>
 #include <fcntl.h>			// open flags
 #include "Terminal.h"
+#include "Diagnostics.h"
+#include "Runtime.h"
+#include "Log.h"			// flushed on crash
 #include "utils_linux.h"
 
 
@@ -42,7 +45,7 @@ get_current_binary_path(
 	// find the last trailing path separator
 	if (( r = strrchr(buffer, PATH_CHAR)) == nullptr )
 	{
-		std::cerr << fg_red << "The buffer for the current path contained no path separators\n";
+		DIAG(EDiagCategory::General, ELogLevel::Error) << fg_red << "The buffer for the current path contained no path separators\n";
 		return 0;
 	}
 
@@ -71,6 +74,9 @@ segfault_handler(
 	int32_t	i;
 	int32_t	fd;
 
+	// the lead-up to the crash is what we want; get it out first
+	runtime.Logger()->CrashFlush();
+
 	num_ptrs = backtrace(array, array_size);
 	std::cerr << fg_red 
 		<< "\n********************\n Segmentation Fault\n********************\n\n"
@@ -14,7 +14,7 @@
 #include <Psapi.h>
 #include "Allocator.h"			// memory allocation macros
 #include "utils_win.h"			// prototypes
-#include "Terminal.h"
+#include "Diagnostics.h"
 
 #if IS_VISUAL_STUDIO
 	// special, non-standard libraries
@@ -391,7 +391,7 @@ wide_to_mb(
 		src, -1, dest, dest_size, "?", NULL) == 0 )
 	{
 		// error_code_as_string (returns wchar_t!)
-		std::cerr << fg_red << "WideCharToMultiByte() failed: " 
+		DIAG(EDiagCategory::General, ELogLevel::Error) << fg_red << "WideCharToMultiByte() failed: " 
 			<< "error code " << GetLastError() << "\n";
 		return false;
 	}
@@ -0,0 +1,393 @@
+
+/**
+ * @file	src/irc/DnsResolver.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <algorithm>			// std::transform
+#include <cctype>			// tolower
+#include <cstring>			// memset
+
+#if !defined(_WIN32)
+#	include <netdb.h>			// EAI_FAMILY
+#endif
+
+#include <api/Log.h>
+#include <api/Runtime.h>
+#include <api/utils.h>			// get_ms_time
+#include "DnsResolver.h"		// prototypes
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+DnsResolver::DnsResolver()
+{
+	_lookup = &host_to_addresses;
+	_reverse = &address_to_host;
+	_ttl_ms = DNS_DEFAULT_TTL_MS;
+	_negative_ttl_ms = DNS_DEFAULT_NEGATIVE_TTL_MS;
+	_idle_workers = 0;
+	_hits = 0;
+	_misses = 0;
+	_coalesced = 0;
+	_stopping = false;
+}
+
+
+
+DnsResolver::~DnsResolver()
+{
+	Stop();
+
+	LOG(ELogLevel::Debug) << "DnsResolver stats: " << _hits << " hits, " <<
+		_misses << " lookups, " << _coalesced << " coalesced\n";
+}
+
+
+
+void
+DnsResolver::Complete(
+	const std::string& key,
+	const dns_cache_entry& result
+)
+{
+	std::vector<std::pair<dns_callback, void*>>	waiters;
+	uint64_t	now = get_ms_time();
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		std::map<std::string, dns_cache_entry>::iterator	iter;
+		dns_cache_entry&	entry = _cache[key];
+
+		entry.addresses	= result.addresses;
+		entry.hostname	= result.hostname;
+		entry.error	= result.error;
+		entry.expires	= now + (result.error == 0 ? _ttl_ms : _negative_ttl_ms);
+		entry.in_flight	= false;
+		waiters.swap(entry.waiters);
+
+		// opportune moment to drop anything stale
+		for ( iter = _cache.begin(); iter != _cache.end(); )
+		{
+			if ( !iter->second.in_flight && iter->second.expires <= now )
+				iter = _cache.erase(iter);
+			else
+				++iter;
+		}
+	}
+
+	_done_cond.notify_all();
+
+	// outside the lock, so callbacks are free to issue further lookups
+	for ( auto w : waiters )
+		w.first(key, result.error, result.addresses, w.second);
+}
+
+
+
+void
+DnsResolver::Flush(
+	const char* hostname
+)
+{
+	std::map<std::string, dns_cache_entry>::iterator	iter;
+	std::string	key = hostname == nullptr ? "" : hostname;
+
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	for ( iter = _cache.begin(); iter != _cache.end(); )
+	{
+		if ( !iter->second.in_flight && ( hostname == nullptr || iter->first == key ))
+			iter = _cache.erase(iter);
+		else
+			++iter;
+	}
+}
+
+
+
+void
+DnsResolver::Lookup(
+	const std::string& key,
+	dns_cache_entry& result
+)
+{
+	dns_lookup_func		lookup;
+	dns_reverse_func	reverse;
+	ip_address		ip;
+	std::string		literal;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		lookup = _lookup;
+		reverse = _reverse;
+	}
+
+	if ( key.empty() || key[0] != '[' )
+	{
+		result.error = lookup(key.c_str(), result.addresses);
+		return;
+	}
+
+	// only ever created by ReverseResolve, so always a valid address
+	literal = key.substr(1, key.length() - 2);
+	memset(&ip, 0, sizeof(ip));
+	ip.family = literal.find(':') == std::string::npos ? AF_INET : AF_INET6;
+	inet_pton(ip.family, literal.c_str(), &ip.data);
+
+	result.error = reverse(ip, result.hostname);
+}
+
+
+
+void
+DnsResolver::Query(
+	const std::string& key,
+	dns_cache_entry& result
+)
+{
+	bool		waited = false;
+
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		std::map<std::string, dns_cache_entry>::iterator	iter;
+
+		/* wait out a lookup of the same name by another thread. The
+		 * entry can be purged by a later Complete while we sleep, so it
+		 * is found afresh on every wake rather than held on to */
+		while (( iter = _cache.find(key)) != _cache.end() && iter->second.in_flight )
+		{
+			if ( !waited )
+			{
+				_coalesced++;
+				waited = true;
+			}
+
+			_done_cond.wait(lock);
+		}
+
+		if ( iter != _cache.end() && iter->second.expires > get_ms_time() )
+		{
+			if ( !waited )
+				_hits++;
+
+			result.addresses = iter->second.addresses;
+			result.hostname	= iter->second.hostname;
+			result.error	= iter->second.error;
+			return;
+		}
+
+		// not cached, stale, or purged before we woke; look it up ourselves
+		_cache[key].in_flight = true;
+		_misses++;
+	}
+
+	Lookup(key, result);
+	Complete(key, result);
+}
+
+
+
+int32_t
+DnsResolver::Resolve(
+	const char* hostname,
+	std::vector<ip_address>& addresses
+)
+{
+	dns_cache_entry	result;
+	std::string	key = hostname;
+
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	Query(key, result);
+
+	addresses.insert(addresses.end(), result.addresses.begin(), result.addresses.end());
+	return result.error;
+}
+
+
+
+void
+DnsResolver::ResolveAsync(
+	const char* hostname,
+	dns_callback callback,
+	void* context
+)
+{
+	std::vector<ip_address>	result;
+	std::string	key = hostname;
+	int32_t		error;
+
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		dns_cache_entry&	entry = _cache[key];
+
+		if ( entry.in_flight )
+		{
+			_coalesced++;
+			if ( callback != nullptr )
+				entry.waiters.push_back(std::make_pair(callback, context));
+			return;
+		}
+
+		if ( entry.expires <= get_ms_time() )
+		{
+			// no worker to hand off to
+			if ( _stopping )
+				return;
+
+			// new (or stale) entry; hand off to the workers
+			_misses++;
+			entry.in_flight = true;
+			if ( callback != nullptr )
+				entry.waiters.push_back(std::make_pair(callback, context));
+			_pending.push(key);
+
+			// every worker busy; another lookup mustn't wait behind them
+			if ( _idle_workers < _pending.size() && _workers.size() < DNS_MAX_WORKERS )
+				_workers.push_back(std::thread(&DnsResolver::RunWorker, this));
+
+			_work_cond.notify_one();
+			return;
+		}
+
+		_hits++;
+		result	= entry.addresses;
+		error	= entry.error;
+	}
+
+	if ( callback != nullptr )
+		callback(key, error, result, context);
+}
+
+
+
+int32_t
+DnsResolver::ReverseResolve(
+	const ip_address& ip,
+	std::string& hostname
+)
+{
+	dns_cache_entry	result;
+	char		buffer[INET6_ADDRSTRLEN];
+
+	if ( !ip_address_to_string(ip, buffer, sizeof(buffer)) )
+		return EAI_FAMILY;
+
+	Query(std::string("[") + buffer + "]", result);
+
+	if ( result.error == 0 )
+		hostname = result.hostname;
+	return result.error;
+}
+
+
+
+void
+DnsResolver::RunWorker()
+{
+	for ( ;; )
+	{
+		dns_cache_entry	result;
+		std::string	key;
+
+		{
+			std::unique_lock<std::mutex>	lock(_mutex);
+
+			while ( _pending.empty() && !_stopping )
+			{
+				_idle_workers++;
+				_work_cond.wait(lock);
+				_idle_workers--;
+			}
+
+			if ( _stopping )
+				break;
+
+			key = _pending.front();
+			_pending.pop();
+		}
+
+		Lookup(key, result);
+		Complete(key, result);
+	}
+}
+
+
+
+void
+DnsResolver::SetLookupFunctions(
+	dns_lookup_func lookup,
+	dns_reverse_func reverse
+)
+{
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		_lookup = lookup == nullptr ? &host_to_addresses : lookup;
+		_reverse = reverse == nullptr ? &address_to_host : reverse;
+	}
+
+	Flush();
+}
+
+
+
+void
+DnsResolver::SetTtl(
+	uint32_t ttl_ms,
+	uint32_t negative_ttl_ms
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	_ttl_ms = ttl_ms;
+	_negative_ttl_ms = negative_ttl_ms;
+}
+
+
+
+void
+DnsResolver::Stop()
+{
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		_stopping = true;
+	}
+
+	_work_cond.notify_all();
+
+	for ( auto& w : _workers )
+	{
+		if ( w.joinable() )
+			w.join();
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		/* nothing will complete what was still queued; drop the entries
+		 * so blocking callers look them up themselves, not wait forever */
+		while ( !_pending.empty() )
+		{
+			_cache.erase(_pending.front());
+			_pending.pop();
+		}
+	}
+
+	_done_cond.notify_all();
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,303 @@
+#pragma once
+
+/**
+ * @file	src/irc/DnsResolver.h
+ * @author	James Warren
+ * @brief	Caching, coalescing name resolution for IRC connections
+ */
+
+
+
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <api/char_helper.h>
+#include "nethelper.h"			// ip_address
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/** Default lifetime of a successful lookup, in milliseconds */
+#define DNS_DEFAULT_TTL_MS		300000
+/** Default lifetime of a failed lookup, in milliseconds */
+#define DNS_DEFAULT_NEGATIVE_TTL_MS	30000
+/** Maximum number of asynchronous lookup threads */
+#define DNS_MAX_WORKERS			4
+
+
+/**
+ * Function that performs a forward lookup; host_to_addresses by default, but
+ * can be replaced by a stub so resolution can be tested without a network.
+ *
+ * Returns 0 on success, or an error code (e.g. getaddrinfo's) on failure.
+ */
+typedef int32_t (*dns_lookup_func)(const char* hostname, std::vector<ip_address>& addresses);
+
+/**
+ * Function that performs a reverse lookup; address_to_host by default, but
+ * can be replaced by a stub as with dns_lookup_func.
+ *
+ * Returns 0 on success, or an error code (e.g. getnameinfo's) on failure.
+ */
+typedef int32_t (*dns_reverse_func)(const ip_address& ip, std::string& hostname);
+
+/**
+ * Executed when an asynchronous lookup completes. error is 0 on success; the
+ * addresses are only valid for the duration of the call.
+ */
+typedef void (*dns_callback)(const std::string& hostname, int32_t error, const std::vector<ip_address>& addresses, void* context);
+
+
+
+/**
+ * A cached lookup result, or one that is in progress.
+ *
+ * Forward and reverse lookups share the cache; reverse entries are keyed by
+ * the bracketed address (e.g. "[192.0.2.1]"), which no hostname can clash
+ * with, and hold their result in hostname rather than addresses.
+ *
+ * @struct dns_cache_entry
+ */
+struct dns_cache_entry
+{
+	std::vector<ip_address>	addresses;	/**< The resolved addresses, in preference order */
+	std::string		hostname;	/**< The name of the address, for reverse lookups */
+	uint64_t		expires;	/**< get_ms_time() at which this entry is stale */
+	int32_t			error;		/**< 0 on success, the lookup error otherwise (negative cached) */
+	bool			in_flight;	/**< A lookup for this name is in progress */
+
+	/** Async callers waiting on the in-flight lookup */
+	std::vector<std::pair<dns_callback, void*>>	waiters;
+
+	dns_cache_entry()
+	{
+		expires		= 0;
+		error		= 0;
+		in_flight	= false;
+	}
+};
+
+
+
+/**
+ * Resolves hostnames to their IPv4 and IPv6 addresses, and addresses back to
+ * their names, caching the results.
+ *
+ * getaddrinfo does not expose the record TTLs, so successful and failed
+ * lookups are kept for a fixed time each (SetTtl). Concurrent requests for a
+ * name already being looked up wait for that lookup rather than issuing their
+ * own - important when every connection to a network reconnects at once.
+ *
+ * Asynchronous lookups are performed by up to DNS_MAX_WORKERS threads,
+ * started as the queue needs them; so the servers of a network can be looked
+ * up together, rather than one after the other.
+ *
+ * @class DnsResolver
+ */
+class DnsResolver
+{
+	// we are created on the stack in IrcEngine::Resolver()
+	friend class IrcEngine;
+private:
+	NO_CLASS_ASSIGNMENT(DnsResolver);
+	NO_CLASS_COPY(DnsResolver);
+
+	/** Synchronization lock for all members */
+	std::mutex			_mutex;
+	/** Signalled when a lookup completes; wakes coalesced Resolve callers */
+	std::condition_variable		_done_cond;
+	/** Signalled when work is queued, or when stopping */
+	std::condition_variable		_work_cond;
+
+	/** The cache, keyed by the lowercased hostname */
+	std::map<std::string, dns_cache_entry>	_cache;
+	/** Names awaiting lookup by the worker threads */
+	std::queue<std::string>		_pending;
+	/** The asynchronous lookup threads */
+	std::vector<std::thread>	_workers;
+
+	dns_lookup_func		_lookup;	/**< The forward lookup function in use */
+	dns_reverse_func	_reverse;	/**< The reverse lookup function in use */
+	uint32_t		_ttl_ms;	/**< Lifetime of successful lookups */
+	uint32_t		_negative_ttl_ms;	/**< Lifetime of failed lookups */
+	uint32_t		_idle_workers;	/**< Worker threads waiting for work */
+	uint64_t		_hits;		/**< stats tracking - answered from the cache */
+	uint64_t		_misses;	/**< stats tracking - lookups performed */
+	uint64_t		_coalesced;	/**< stats tracking - joined an in-flight lookup */
+	bool			_stopping;	/**< Set to make the worker threads exit */
+
+
+	/**
+	 * Stores the result of a lookup, wakes any blocked callers and executes
+	 * the callbacks of asynchronous ones. Expired entries are purged at the
+	 * same time.
+	 *
+	 * @param[in] key The cache key the lookup was for
+	 * @param[in] result The entry holding the outcome of the lookup
+	 */
+	void
+	Complete(
+		const std::string& key,
+		const dns_cache_entry& result
+	);
+
+
+	/**
+	 * Performs the lookup for key with the functions in use; a reverse
+	 * lookup if key is a bracketed address, otherwise a forward one.
+	 *
+	 * @param[in] key The cache key to look up
+	 * @param[out] result The entry to store the outcome in
+	 */
+	void
+	Lookup(
+		const std::string& key,
+		dns_cache_entry& result
+	);
+
+
+	/**
+	 * Returns the entry for key, from the cache if still valid; if it is
+	 * being looked up by another thread, waits for that result instead,
+	 * otherwise looks it up in the calling thread.
+	 *
+	 * @param[in] key The cache key to resolve
+	 * @param[out] result The entry to copy the outcome to
+	 */
+	void
+	Query(
+		const std::string& key,
+		dns_cache_entry& result
+	);
+
+
+	/**
+	 * The worker thread function; performs queued lookups until Stop() is
+	 * called.
+	 */
+	void
+	RunWorker();
+
+
+	// private constructor; we want one instance that is controlled
+	DnsResolver();
+
+public:
+	~DnsResolver();
+
+
+	/**
+	 * Removes the cached entry for hostname, or every entry if a nullptr.
+	 * Lookups in progress are unaffected.
+	 *
+	 * @param[in] hostname The hostname to forget
+	 */
+	void
+	Flush(
+		const char* hostname = nullptr
+	);
+
+
+	/**
+	 * Resolves hostname, blocking the calling thread until complete. The
+	 * result is taken from the cache if still valid; if the name is being
+	 * looked up by another thread, waits for that result instead.
+	 *
+	 * @param[in] hostname The hostname to resolve
+	 * @param[out] addresses The vector to append the addresses to
+	 * @return 0 on success, otherwise the lookup error (which may have been
+	 * cached)
+	 */
+	int32_t
+	Resolve(
+		const char* hostname,
+		std::vector<ip_address>& addresses
+	);
+
+
+	/**
+	 * Resolves hostname on a worker thread, executing callback with the
+	 * result. If the result is already cached, callback is executed
+	 * immediately, in the calling thread.
+	 *
+	 * callback may be a nullptr, to warm the cache for a later Resolve;
+	 * which will wait for this lookup if it is still in progress.
+	 *
+	 * @param[in] hostname The hostname to resolve
+	 * @param[in] callback The function to receive the result
+	 * @param[in] context Passed to callback unmodified
+	 */
+	void
+	ResolveAsync(
+		const char* hostname,
+		dns_callback callback,
+		void* context
+	);
+
+
+	/**
+	 * Looks up the name of ip, blocking the calling thread until complete;
+	 * cached and coalesced as for Resolve.
+	 *
+	 * @param[in] ip The IPv4 or IPv6 address to reverse-lookup
+	 * @param[out] hostname The string to assign the name to
+	 * @return 0 on success, otherwise the lookup error (which may have been
+	 * cached)
+	 */
+	int32_t
+	ReverseResolve(
+		const ip_address& ip,
+		std::string& hostname
+	);
+
+
+	/**
+	 * Replaces the functions that perform lookups; supply a nullptr for
+	 * either to restore its default, host_to_addresses or address_to_host.
+	 * The cache is flushed.
+	 *
+	 * Intended for testing against a stub resolver.
+	 *
+	 * @param[in] lookup The forward lookup function to use
+	 * @param[in] reverse The reverse lookup function to use
+	 */
+	void
+	SetLookupFunctions(
+		dns_lookup_func lookup,
+		dns_reverse_func reverse
+	);
+
+
+	/**
+	 * Sets how long results are cached for; applies to future lookups.
+	 *
+	 * @param[in] ttl_ms Lifetime of successful lookups
+	 * @param[in] negative_ttl_ms Lifetime of failed lookups
+	 */
+	void
+	SetTtl(
+		uint32_t ttl_ms,
+		uint32_t negative_ttl_ms
+	);
+
+
+	/**
+	 * Stops the worker threads, waiting for them to finish any lookups they
+	 * are performing. Outstanding asynchronous requests are never called
+	 * back.
+	 */
+	void
+	Stop();
+};
+
+
+
+END_NAMESPACE
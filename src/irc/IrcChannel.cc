@@ -20,7 +20,9 @@
 #include "IrcPool.h"
 #include "irc_channel_modes.h"		// channel flags
 #include <api/Runtime.h>		// IRC instance
-#include <api/Terminal.h>		// console output
+#include <api/Log.h>
+#include <api/Diagnostics.h>		// console output
+#include <api/TimerWheel.h>		// NAMES timeout
 #include <api/utils.h>			// string functions
 
 
@@ -33,7 +35,7 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 IrcChannel::IrcChannel(
 	std::shared_ptr<IrcConnection> connection,
 	const char* channel_name
-) : _flags(0), _limit(0), _owner(connection)
+) : _flags(0), _limit(0), _owner(connection), _names_timer(0), _names_context(nullptr)
 {
 	// userlist, nameslist, etc., start empty
 
@@ -88,13 +90,13 @@ IrcChannel::AddNamesUser(
 	return EIrcStatus::OK;
 
 no_name:
-	std::cerr << fg_red << "The supplied nickname was a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The supplied nickname was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 no_ident:
-	std::cerr << fg_red << "The supplied ident was a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The supplied ident was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 no_hostmask:
-	std::cerr << fg_red << "The supplied hostmask was a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The supplied hostmask was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 }
 
@@ -107,6 +109,8 @@ IrcChannel::Cleanup()
 
 	std::lock_guard<std::recursive_mutex>	lock(_mutex);
 
+	StopNamesTimer();
+
 	if (( retval = EraseNameslist()) != EIrcStatus::OK )
 		return retval;
 	if (( retval = EraseUserlist()) != EIrcStatus::OK )
@@ -129,7 +133,7 @@ IrcChannel::DeleteUser(
 		EIrcStatus::OK : EIrcStatus::ObjectFreeError;
 	
 no_user:
-	std::cerr << fg_red << "The supplied user was a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The supplied user was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 }
 
@@ -184,6 +188,32 @@ IrcChannel::IsActive() const
 
 
 
+std::string
+IrcChannel::Key() const
+{
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+	return _key;
+}
+
+
+
+size_t
+IrcChannel::MemoryUsage() const
+{
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+	size_t	retval = sizeof(IrcChannel);
+
+	retval += _key.capacity() + _name.capacity() + _topic.capacity();
+
+	// a set node is three pointers and a colour on top of the string
+	for ( auto& u : _userlist )
+		retval += sizeof(std::string) + (sizeof(void*) * 4) + u.capacity();
+
+	return retval;
+}
+
+
+
 std::string
 IrcChannel::Name() const
 {
@@ -221,6 +251,76 @@ IrcChannel::PopulateUserlist()
 
 
 
+void
+IrcChannel::OnNamesTimeout(
+	timer_id id,
+	void* context
+)
+{
+	names_timer_context*		ctx = (names_timer_context*)context;
+	std::shared_ptr<IrcChannel>	channel;
+
+	// freed since the timer was armed if not found
+	channel = IRC_ENGINE->Pools()->GetChannel(ctx->connection_id, ctx->channel_name.c_str());
+	delete ctx;
+
+	if ( channel == nullptr )
+		return;
+
+	std::lock_guard<std::recursive_mutex>	lock(channel->_mutex);
+
+	// cancelled, or re-armed, after this one was collected to fire
+	if ( channel->_names_timer != id )
+		return;
+
+	channel->_names_timer = 0;
+	channel->_names_context = nullptr;
+
+	LOG(ELogLevel::Warn) << "The NAMES list for " << channel->_name <<
+		" did not complete; using the " << channel->_nameslist.size() <<
+		" names received\n";
+
+	channel->PopulateUserlist();
+}
+
+
+
+void
+IrcChannel::StartNamesTimer()
+{
+	std::shared_ptr<IrcConnection>	connection = _owner.lock();
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+
+	StopNamesTimer();
+
+	if ( connection == nullptr )
+		return;
+
+	// the id and name, not this; a timer left behind finds nothing, rather than freed memory
+	_names_context = new names_timer_context;
+	_names_context->connection_id = connection->Id();
+	_names_context->channel_name = _name;
+	_names_timer = runtime.Timers()->Arm(IRC_NAMES_TIMEOUT_MS, &IrcChannel::OnNamesTimeout, _names_context);
+}
+
+
+
+void
+IrcChannel::StopNamesTimer()
+{
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+
+	/* if the timer has already been collected to fire, the callback has
+	 * the context, and frees it */
+	if ( runtime.Timers()->Cancel(_names_timer) )
+		delete _names_context;
+
+	_names_timer = 0;
+	_names_context = nullptr;
+}
+
+
+
 std::string
 IrcChannel::Topic() const
 {
@@ -13,6 +13,7 @@
 #include <mutex>	// std::mutex
 
 #include <api/char_helper.h>
+#include <api/TimerWheel.h>	// timer_id
 #include "IrcObject.h"
 #include "irc_status.h"
 
@@ -27,12 +28,31 @@ class IrcUser;
 struct mode_update;
 
 
+/** Time allowed between joining a channel and the end of its NAMES list */
+#define IRC_NAMES_TIMEOUT_MS		30000
+
+
 
 /**
  *
  *
  * @class IrcChannel
  */
+/**
+ * What a NAMES timer looks its channel up by; the channel can be freed off
+ * the parser thread, after the timer has been collected to fire, so the
+ * timer can't hold the channel itself.
+ *
+ * @struct names_timer_context
+ */
+struct names_timer_context
+{
+	uint32_t	connection_id;	/**< Id of the owning connection */
+	std::string	channel_name;	/**< Name of the channel */
+};
+
+
+
 class SBI_IRC_API IrcChannel : public IrcObject
 {
 	// Updates internals directly when parsing relevant data
@@ -47,6 +67,10 @@ private:
 	std::string		_name;		/**< Channel name, including any prefixes */
 	std::string		_topic;		/**< Channel topic (will contain colour codes) */
 	std::weak_ptr<IrcConnection>	_owner;	/**< Pointer to the owning connection */
+	timer_id		_names_timer;	/**< Armed from joining until 366 is received */
+	/** The context _names_timer was armed with; freed by a successful cancel,
+	 * otherwise by the callback */
+	names_timer_context*	_names_context;
 
 	/** Active channel userlist */
 	std::set<std::string>	_userlist;
@@ -76,6 +100,34 @@ private:
 	EIrcStatus
 	EraseUserlist();
 
+
+	/**
+	 * Timer callback; the server never finished sending the NAMES list, so
+	 * make do with whatever was received rather than have no userlist.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The names_timer_context, which is freed here
+	 */
+	static void
+	OnNamesTimeout(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Arms the NAMES completion timer; called on joining the channel.
+	 */
+	void
+	StartNamesTimer();
+
+
+	/**
+	 * Cancels the NAMES completion timer; called on receipt of 366.
+	 */
+	void
+	StopNamesTimer();
+
 public:
 
 	/**
@@ -207,6 +259,24 @@ public:
 	) const;
 
 
+	/**
+	 * Retrieves a copy of the channel key, if one is known.
+	 */
+	std::string
+	Key() const;
+
+
+	/**
+	 * Estimates the memory held by the channel: the object itself, its
+	 * strings, and the userlist. Computed on each call, so meant for the
+	 * occasional diagnostic rather than anything frequent.
+	 *
+	 * @return The estimated bytes
+	 */
+	size_t
+	MemoryUsage() const;
+
+
 	/**
 	 * Retrieves a copy.
 	 */
@@ -8,6 +8,7 @@
 
 
 
+#include <algorithm>			// std::sort, std::count
 #include <cassert>			// assertions
 
 #if defined(_WIN32)
@@ -40,9 +41,12 @@
 #endif
 
 #include <api/utils.h>			// utility functions
-#include <api/Terminal.h>		// console output
+#include <api/Diagnostics.h>		// console output
+#include <api/interface.h>		// instance()
 #include <api/Log.h>
+#include <api/MemoryAccounting.h>	// queue accounting
 #include <api/Runtime.h>
+#include <api/TimerWheel.h>		// timeouts
 #include "IrcConnection.h"		// prototypes
 #include "IrcEngine.h"
 #include "IrcNetwork.h"
@@ -51,7 +55,13 @@
 #include "IrcParser.h"
 #include "IrcPool.h"
 #include "IrcFactory.h"
+#include "DnsResolver.h"		// cached name lookups
+#include "ReconnectManager.h"		// reconnect on unexpected drops
+#include "NetsplitTracker.h"		// dropped with the connection
+#include "PresenceTracker.h"		// dropped with the connection
+#include "SslCache.h"			// shared SSL_CTX, session resumption
 #include "config_structs.h"
+#include "irc_fast_path.h"		// lines handled on receipt
 
 
 
@@ -60,6 +70,35 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 
 
 
+/**
+ * Copies an outgoing line for the log, replacing the parameters of those that
+ * carry credentials - the SASL payload, server password and operator login.
+ *
+ * @param[in] line The line, without the CR-LF
+ * @param[in] len The length of line
+ * @return The line as it may be logged
+ */
+static std::string
+loggable_line(
+	const char* line,
+	size_t len
+)
+{
+	static const char*	sensitive[] = { "AUTHENTICATE ", "PASS ", "OPER " };
+
+	for ( auto cmd : sensitive )
+	{
+		size_t	cmd_len = strlen(cmd);
+
+		if ( len >= cmd_len && strncmp(line, cmd, cmd_len) == 0 )
+			return std::string(line, cmd_len) + "<redacted>";
+	}
+
+	return std::string(line, len);
+}
+
+
+
 IrcConnection::IrcConnection(
 	std::shared_ptr<IrcNetwork> network
 ) : _owner(network)
@@ -71,10 +110,42 @@ IrcConnection::IrcConnection(
 #endif
 	_bytes_recv = 0;
 	_bytes_sent = 0;
+	_writes_sent = 0;
+	_send_queue_bytes = 0;
+	_recv_queue_bytes = 0;
+	_registration_timer = 0;
+	_ping_timer = 0;
+	_flush_timer = 0;
+	_timers_stopped = true;
+	_presence_started = false;
+	_disconnecting = false;
+	_last_flush = 0;
+	_send_written = 0;
+	_send_stalled = 0;
+	_whox_timer = 0;
+	_last_whox = 0;
+	_whox_token = 0;
+	_whox_last_token = 0;
 	_state = CS_Disconnected;
 
+	_tls_stats.last_handshake_ms = 0;
+	_tls_stats.total_handshake_ms = 0;
+	_tls_stats.handshakes = 0;
+	_tls_stats.resumed = 0;
+
+	memset(&_lag_stats, 0, sizeof(_lag_stats));
+	memset(&_lag_window, 0, sizeof(_lag_window));
+	_lag_stats.send_limit = MAX_LEN_SEND_BATCH;
+
 	_last_data = 0;
 	_lag_sent = 0;
+	_last_probe = 0;
+	_caps_available = CAP_None;
+	_caps_enabled = CAP_None;
+	_caps_requested = CAP_None;
+	_cap_reqs_pending = 0;
+	_cap_negotiating = false;
+	_sasl_state = ESaslState::None;
 
 	_thread = 0;
 
@@ -84,12 +155,17 @@ IrcConnection::IrcConnection(
 	memset(&_params.ip, 0, sizeof(_params.ip));
 	memset(&_params.sa, 0, sizeof(_params.sa));
 #endif
+	_params.preconnected = false;
+	_params.raw_socket = -1;
 }
 
 
 
 IrcConnection::~IrcConnection()
 {
+	_irc_engine->Reconnector()->Cancel(_id);
+	_irc_engine->Presence()->Forget(_id);
+	_irc_engine->Netsplits()->Forget(_id);
 	Cleanup();
 }
 
@@ -117,7 +193,7 @@ IrcConnection::AddChannel(
 	return EIrcStatus::OK;
 
 no_name:
-	std::cerr << fg_red << "The supplied channel name was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied channel name was a nullptr\n";
 	return EIrcStatus::InvalidParameter;
 }
 
@@ -148,21 +224,24 @@ IrcConnection::AddToRecvQueue(
 
 		// append the new data to the receiving queue as a copy
 		_recv_queue.push(data);
+		_recv_queue_bytes += length;
 	}
 
+	MEM_ACCOUNT(RecvQueues, length, 1);
+
 	// Debug log
 	LOG(ELogLevel::Debug) << "Recv on " << this << ": " << data << "\n";
 
 	return EIrcStatus::OK;
 
 no_data:
-	std::cerr << fg_red << "The supplied data was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied data was a nullptr\n";
 	return EIrcStatus::InvalidParameter;
 data_too_long:
-	std::cerr << fg_red << "The supplied data exceeded the maximum buffer size for an IRC message\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied data exceeded the maximum buffer size for an IRC message\n";
 	return EIrcStatus::InvalidData;
 data_too_short:
-	std::cerr << fg_red << "The supplied data was too short for a valid IRC message\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied data was too short for a valid IRC message\n";
 	return EIrcStatus::InvalidData;
 }
 
@@ -173,11 +252,66 @@ IrcConnection::AddToSendQueue(
 	const char* data
 )
 {
-	/** @todo existing functionality is temporary - flood protection! */
+	uint32_t	length = 0;
+	bool		flush_now;
+
+	if ( data == nullptr )
+		goto no_data;
+
+	length = strlen(data);
+
+	// the CR-LF is appended here, so must not be counted
+	if ( length > MAX_LEN_IRC_MSG )
+		goto data_too_long;
 
-	SendBypass("%s\r\n", data);
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		flush_now = queue_send_line(_send_queue, _send_queue_bytes, data, length);
+	}
+
+	MEM_ACCOUNT(SendQueues, length + 2, 1);
+
+	if ( flush_now )
+	{
+		// errors are output within the function
+		FlushSendQueue();
+	}
+	else
+	{
+		/* the parser flushes the queue on its next pass; if we're
+		 * being called from within the parser, this is just another
+		 * pass once it's finished the current one */
+		_irc_engine->Parser()->TriggerSync();
+	}
 
 	return EIrcStatus::OK;
+
+no_data:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied data was a nullptr\n";
+	return EIrcStatus::InvalidParameter;
+data_too_long:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied data exceeded the maximum length for an IRC message\n";
+	return EIrcStatus::InvalidData;
+}
+
+
+
+void
+IrcConnection::ArmTimer(
+	timer_id* slot,
+	uint64_t delay_ms,
+	timer_callback callback
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if ( _timers_stopped )
+		return;
+
+	runtime.Timers()->Cancel(*slot);
+	// the id, not this; a timer left behind finds nothing, rather than freed memory
+	*slot = runtime.Timers()->Arm(delay_ms, callback, (void*)(uintptr_t)_id);
 }
 
 
@@ -224,20 +358,43 @@ IrcConnection::AutoChangeNick()
 	return EIrcStatus::OK;
 
 no_parent:
-	std::cerr << fg_red << "The supplied connections parent network was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
 	return EIrcStatus::NoOwner;
 no_more_nicks:
-	std::cerr << fg_red << "There are no more nicknames left to try\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "There are no more nicknames left to try\n";
 	return EIrcStatus::NoMoreNicks;
 }
 
 
 
+void
+IrcConnection::CancelTimer(
+	timer_id* slot
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	runtime.Timers()->Cancel(*slot);
+	*slot = 0;
+}
+
+
+
 EIrcStatus
 IrcConnection::Cleanup()
 {
+	/* the disconnect and reconnect threads can both get here; the second
+	 * waits, then finds nothing left to free */
+	std::lock_guard<std::mutex>	cleanup_lock(_cleanup_mutex);
+
 	// the order of cleanup here should be the most stable/suitable
 
+	// nothing should fire against a connection being torn down
+	StopTimers();
+
+	// the next registration starts presence tracking afresh
+	_presence_started = false;
+
 	if ( _state & CS_Active )
 	{
 		/* we can't use _owner->_client.quit_reason.c_str() here,
@@ -246,6 +403,8 @@ IrcConnection::Cleanup()
 		 * this class; until we're fully aware of all the intricate bits,
 		 * yes send a quit without a message. Not that important... */
 		SendQuit();
+		// don't leave the QUIT waiting on the parser, or the send rate
+		FlushSendQueue(true);
 		_state = CS_Disconnecting;
 	}
 
@@ -271,7 +430,7 @@ IrcConnection::Cleanup()
 				/* termination failed - we're very likely to crash if the
 				 * thread tries to resume at the blocking BIO_read, since
 				 * we're about to free the ssl & class data.. */
-				std::cerr << fg_red << "Failed to terminate the connection thread; Win32 error " << GetLastError();
+				DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to terminate the connection thread; Win32 error " << GetLastError() << "\n";
 			}
 		}
 
@@ -308,7 +467,7 @@ IrcConnection::Cleanup()
 
 			if ( ret == ETIMEDOUT )
 			{
-				std::cout << fg_red << "Thread " << _thread << " has been forcibly killed after failing to finish on request\n";
+				DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Thread " << _thread << " has been forcibly killed after failing to finish on request\n";
 
 				/* second timeout, even after cancelling. Just
 				 * kill it and live with any resource leaks */
@@ -316,7 +475,7 @@ IrcConnection::Cleanup()
 			}
 			else if ( ret != 0 )
 			{
-				std::cout << fg_red << "Received errno " << ret << " after waiting for thread " << _thread << " to finish\n";
+				DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Received errno " << ret << " after waiting for thread " << _thread << " to finish\n";
 			}
 		}
 
@@ -336,8 +495,7 @@ IrcConnection::Cleanup()
 		if ( _ssl != nullptr )
 		{
 			SSL_shutdown(_ssl.release());
-			SSL_CTX_free(_ssl_context.release());
-			// frees the connection->socket too, no need to reset
+			// frees the connection->socket too, no need to reset; the context is shared
 			SSL_free(_ssl.release());
 			_ssl = nullptr;
 			_ssl_context = nullptr;
@@ -356,10 +514,24 @@ IrcConnection::Cleanup()
 
 	// theoretically possible for a queue to add entries inbetween above
 
+	MEM_ACCOUNT(SendQueues, -(int64_t)_send_queue_bytes, -(int64_t)_send_queue.size());
+	MEM_ACCOUNT(RecvQueues, -(int64_t)_recv_queue_bytes, -(int64_t)_recv_queue.size());
+
 	while ( !_send_queue.empty() )
 		_send_queue.pop();
 	while ( !_recv_queue.empty() )
 		_recv_queue.pop();
+	_send_queue_bytes = 0;
+
+	{
+		std::lock_guard<std::mutex>	send_lock(_send_mutex);
+
+		_send_batch.clear();
+		_send_bypassed.clear();
+		_send_written = 0;
+		_send_stalled = 0;
+	}
+	_recv_queue_bytes = 0;
 
 	_last_data = 0;
 	_lag_sent = 0;
@@ -385,6 +557,7 @@ IrcConnection::ConnectToServer()
 	char	fp[EVP_MAX_MD_SIZE * 3];
 	BIO*	bio = nullptr;
 	time_t	curtime = time(nullptr);
+	uint64_t	handshake_start;
 	bool	expired = false;
 	bool	not_yet_valid = false;
 	bool	no_fingerprint = false;
@@ -407,7 +580,17 @@ IrcConnection::ConnectToServer()
 
 	/* If the connection fails or is cancelled, the socket must be freed! */
 
-	if ( BIO_do_connect(_socket.get()) <= 0 )
+	handshake_start = get_ms_time();
+
+	if ( _params.preconnected )
+	{
+		// TCP connected already by race_connect; only SSL remains
+		_params.preconnected = false;
+
+		if ( _ssl != nullptr && BIO_do_handshake(_socket.get()) <= 0 )
+			goto openssl_ssl_connect_failed;
+	}
+	else if ( BIO_do_connect(_socket.get()) <= 0 )
 	{
 		if ( _ssl != nullptr )
 			goto openssl_ssl_connect_failed;
@@ -415,6 +598,23 @@ IrcConnection::ConnectToServer()
 			goto openssl_connect_failed;
 	}
 
+	if ( _ssl != nullptr )
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		bool	resumed = SSL_session_reused(_ssl.get()) == 1;
+
+		_tls_stats.last_handshake_ms = get_ms_time() - handshake_start;
+		_tls_stats.total_handshake_ms += _tls_stats.last_handshake_ms;
+		_tls_stats.handshakes++;
+		if ( resumed )
+			_tls_stats.resumed++;
+
+		LOG(ELogLevel::Info) << "SSL handshake with " << _params.conn_str <<
+			" completed in " << _tls_stats.last_handshake_ms << "ms (" <<
+			(resumed ? "resumed" : "full") << "); " << _tls_stats.resumed <<
+			"/" << _tls_stats.handshakes << " resumed\n";
+	}
+
 	/* connection success, means the port requested is listening;
 	 * unset disconnected, set connecting */
 	_state &= ~CS_Disconnected;
@@ -512,7 +712,7 @@ IrcConnection::ConnectToServer()
 		if (( res = SSL_get_verify_result(_ssl.get())) != X509_V_OK )
 		{
 			// always generate an error on an invalid certificate
-			std::cerr << fg_red << "The certificate received from " <<
+			DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The certificate received from " <<
 				_owner->_server.host << " [" <<
 				_owner->_server.ip_address << "] was invalid\n"
 				"\tSubject: " << subject << "\n"
@@ -527,7 +727,7 @@ IrcConnection::ConnectToServer()
 			if ( !_params.allow_invalid_cert )
 				goto openssl_invalid_cert;
 
-			std::cout << fg_grey << "Ignoring invalid certificate\n";
+			DIAG(EDiagCategory::Network, ELogLevel::Info) << fg_grey << "Ignoring invalid certificate\n";
 		}
 	}
 
@@ -538,30 +738,32 @@ IrcConnection::ConnectToServer()
 	 * the gui and not restricted to the cli (which can optionally be hidden
 	 * , thereby leaving no cause of error) */
 no_parent:
-	std::cerr << fg_red << "The supplied connections parent network was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
 	return -1;
 already_connected:
-	std::cerr << fg_red << "Already connected!\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Already connected!\n";
 	return 1;
 openssl_connect_failed:
-	std::cerr << fg_red << "OpenSSL connect failed\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "OpenSSL connect failed\n";
 	ERR_print_errors_cb(&openssl_err_callback, NULL);
 	BIO_free(_socket.release());
 	return -1;
 openssl_ssl_connect_failed:
-	std::cerr << fg_red << "OpenSSL connect failed\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "OpenSSL connect failed\n";
 	ERR_print_errors_cb(&openssl_err_callback, NULL);
+	// don't offer the same (possibly rejected) session next time
+	_irc_engine->SslContexts()->RemoveSession(_params.conn_str);
 	goto openssl_cleanup;
 openssl_no_cert:
-	std::cerr << fg_red << "No certificate was received from the remote host\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "No certificate was received from the remote host\n";
 	goto openssl_cleanup;
 openssl_invalid_cert:
-	std::cerr << fg_red << "The application is configured to disallow invalid certificates\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The application is configured to disallow invalid certificates\n";
 	goto openssl_cleanup;
 openssl_cleanup:
 	SSL_shutdown(_ssl.release());
-	SSL_CTX_free(_ssl_context.release());
 	SSL_free(_ssl.release());
+	_ssl_context = nullptr;
 	return -1;
 }
 
@@ -606,10 +808,10 @@ IrcConnection::CreateThread()
 	return true;
 
 exists:
-	std::cerr << fg_red << "The thread appears to already exist!\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The thread appears to already exist!\n";
 	return false;
 creation_failure:
-	std::cerr << fg_red << "Thread creation failure; errno " << errno << "\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Thread creation failure; errno " << errno << "\n";
 	return false;
 #else
 	int32_t		err;
@@ -672,15 +874,71 @@ IrcConnection::DeleteChannel(
 	return EIrcStatus::OK;
 
 no_channel:
-	std::cerr << fg_red << "The supplied channel was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied channel was a nullptr\n";
 	return EIrcStatus::InvalidParameter;
 not_found:
-	std::cerr << fg_red << "The supplied channel (" << channel_name << ") was not found in the channel list\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied channel (" << channel_name << ") was not found in the channel list\n";
 	return EIrcStatus::ObjectNotFound;
 }
 
 
 
+void
+IrcConnection::DisconnectAsync()
+{
+	irc_disconnect_params	params;
+
+	// already on its way down
+	if ( _disconnecting.exchange(true) )
+		return;
+
+	params.connection = _irc_engine->Pools()->GetConnection(_id);
+	params.taken = false;
+
+	if ( params.connection == nullptr )
+	{
+		_disconnecting = false;
+		return;
+	}
+
+#if defined(_WIN32)
+	params.thread_handle = _beginthreadex(nullptr, 0,
+		ExecDisconnectThread,
+		&params,
+		CREATE_SUSPENDED,
+		&params.thread_id);
+
+	if ( params.thread_handle == 0 )
+		goto creation_failure;
+
+	ResumeThread((HANDLE)params.thread_handle);
+#else
+	int32_t		err;
+	pthread_attr_t	attr;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	if (( err = pthread_create(&params.thread, &attr, ExecDisconnectThread, &params)) != 0 )
+		goto creation_failure;
+#endif
+
+	/* wait for the thread to take its copy; we don't want to exit scope
+	 * before it has a chance to */
+	while ( !params.taken )
+		SLEEP_MILLISECONDS(9);
+
+	return;
+
+creation_failure:
+	// better to stall the parser than leave a dead connection up
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to create the disconnect thread; disconnecting in place\n";
+	Cleanup();
+	_disconnecting = false;
+}
+
+
+
 EIrcStatus
 IrcConnection::EraseChannelList()
 {
@@ -710,6 +968,7 @@ IrcConnection::EstablishConnection()
 	int32_t		buffer_read = 0;
 	uint32_t	len;
 	uint32_t	max_len = sizeof(buffer) - 1;
+	uint32_t	queued;
 
 	if ( &_owner == nullptr )
 		goto invalid_parent;
@@ -752,6 +1011,7 @@ IrcConnection::EstablishConnection()
 	 * function never gets called. As such, we have to maintain this for all
 	 * the other servers too!
 	 */
+	StartTimers();
 	SendInit();
 
 	while ( IsActive() || IsConnecting() )
@@ -794,18 +1054,10 @@ IrcConnection::EstablishConnection()
 			 * this buffer, copies are made for later usage. */
 			buffer[buffer_read] = '\0';
 
-			/* if it's a PING, reply straight away, bypassing the
-			 * queue; otherwise, add it. More efficient checking
-			 * it here than allocating memory for the queue */
-			if ( strncmp(buffer, "PING :", 6) == 0 )
-			{
-				// Turn PING into PONG
-				buffer[1] = 'O';
-				SendBypass("%s", buffer);
-				continue;
-			}
-			/* we don't handle PONG's here (replies from our PING LAG12345) as it
-			 * contains the server prefix like a normal message */
+			/* PING, PONG and ERROR are picked out of each complete
+			 * line below and handled here, rather than waiting
+			 * behind whatever the parser has yet to get through */
+			queued = 0;
 
 			/* reuse the same buffer that will be used for storing the 'prev'
 			 * data, and make a copy of each instance. This eases debugging,
@@ -832,7 +1084,11 @@ IrcConnection::EstablishConnection()
 					// append the rest of the string to the previous buffer
 					strlcat(store_buffer, p, sizeof(store_buffer));
 					// and add it to the queue as normal
-					AddToRecvQueue(store_buffer);
+					if ( !HandleFastPath(store_buffer) )
+					{
+						AddToRecvQueue(store_buffer);
+						queued++;
+					}
 					store_buffer[0] = '\0';
 				}
 				else
@@ -847,7 +1103,11 @@ IrcConnection::EstablishConnection()
 						// remove the linefeed
 						store_buffer[len-1] = '\0';
 						// add the whole string to the queue
-						AddToRecvQueue(store_buffer);
+						if ( !HandleFastPath(store_buffer) )
+						{
+							AddToRecvQueue(store_buffer);
+							queued++;
+						}
 						// whole message, start fresh with next iteration
 						store_buffer[0] = '\0';
 					}
@@ -856,6 +1116,10 @@ IrcConnection::EstablishConnection()
 				p = str_token(nullptr, delim, &last);
 			}
 
+			// nothing for the parser if it was all handled above
+			if ( queued == 0 )
+				continue;
+
 			/* do the notifications here, on end of data instance,
 			 * rather than AddToRecvQueue - potential race condition
 			 * with the queues otherwise? */
@@ -870,39 +1134,44 @@ IrcConnection::EstablishConnection()
 	}
 	catch ( std::exception& e )
 	{
-		std::cerr << fg_red << "Caught an exception; " << e.what() << "\n";
+		DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Caught an exception; " << e.what() << "\n";
 	}
 	catch ( ... )
 	{
-		std::cerr << fg_red << "Caught an unhandled exception\n";
+		DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Caught an unhandled exception\n";
 	}
 
 	goto finish;
 
 invalid_parent:
-	std::cerr << fg_red << "The supplied connections parent_network was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent_network was a nullptr\n";
 	goto finish;
 invalid_data:
-	std::cerr << fg_red << "The received data was invalid\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The received data was invalid\n";
 	goto finish;
 invalid_state:
-	std::cerr << fg_red << "The connection state is invalid\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The connection state is invalid\n";
 	goto finish;
 #if defined(USING_OPENSSL_NET)
 bio_abort:
 	// as this thread blocks on the socket, it can be deleted legitimately
 	if ( _socket != nullptr )
-		std::cerr << fg_red << "BIO_should_retry returned false\n";
+		DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "BIO_should_retry returned false\n";
 	goto finish;
 bio_abort_0:
 	if ( _socket != nullptr )
-		std::cerr << fg_red << "BIO_should_retry returned false\n";
+		DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "BIO_should_retry returned false\n";
 	goto finish;
 #elif defined(USING_BOOST_NET)
 #else
 	// non-OpenSSL equivalent
 #endif
 finish:
+	/* the socket is only still here if we weren't asked to disconnect
+	 * (Cleanup releases it first); the server or network dropped us */
+	if ( _socket != nullptr && !(_state & CS_Disconnecting) )
+		_irc_engine->Reconnector()->ConnectionLost(_irc_engine->Pools()->GetConnection(_id));
+
 	_state = CS_Disconnected;
 
 #if defined(_WIN32)
@@ -915,6 +1184,58 @@ finish:
 
 
 
+#if defined(_WIN32)
+uint32_t
+#	if IS_VISUAL_STUDIO
+	__stdcall
+#	elif IS_GCC
+	__attribute__((stdcall))
+#	else
+#		error "Unsupported compiler; this requires stdcall"
+#	endif
+#elif defined(__linux__) || defined(BSD)
+void*
+#endif
+IrcConnection::ExecDisconnectThread(
+	void* params
+)
+{
+	irc_disconnect_params*		tparam = (irc_disconnect_params*)params;
+	std::shared_ptr<IrcConnection>	connection;
+	std::shared_ptr<thread_info>	ti;
+
+	{
+		connection = tparam->connection;
+
+		ti.reset(new thread_info);
+#if defined(_WIN32)
+		ti->thread		= tparam->thread_id;
+		ti->thread_handle	= tparam->thread_handle;
+#else
+		ti->thread		= tparam->thread;
+#endif
+		strlcpy(ti->called_by_function, __func__, sizeof(ti->called_by_function));
+		rename_thread("ircdisconnect");
+		runtime.AddManualThread(ti);
+
+		// let the caller know we're done
+		tparam->taken = true;
+	}
+
+	connection->Cleanup();
+	// a reconnect attempt waiting on us can go ahead
+	connection->_disconnecting = false;
+
+	runtime.ThreadStopping(ti->thread, __func__);
+#if defined(_WIN32)
+	return 0;
+#else
+	return nullptr;
+#endif
+}
+
+
+
 #if defined(_WIN32)
 uint32_t
 #	if IS_VISUAL_STUDIO
@@ -941,6 +1262,164 @@ IrcConnection::ExecEstablishConnection(
 
 
 
+EIrcStatus
+IrcConnection::FlushSendQueue(
+	bool force
+)
+{
+	uint32_t	num_lines = 0;
+	uint32_t	num_bytes = 0;
+	uint32_t	limit = MAX_LEN_SEND_BATCH;
+	uint64_t	now;
+	EIrcStatus	retval;
+
+	// held until written, so a concurrent flush can't overtake this batch
+	std::unique_lock<std::mutex>	send_lock(_send_mutex);
+
+	/* a part-written batch is finished before anything else goes out; a
+	 * new one would otherwise follow a truncated line */
+	if ( _send_batch.empty() )
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		// anything SendBypass held back is not subject to the send rate
+		_send_batch.swap(_send_bypassed);
+
+		if ( _send_queue.empty() && _send_batch.empty() )
+			return EIrcStatus::QueueEmpty;
+
+		now = get_ms_time();
+
+		if ( !force && !_send_queue.empty() )
+		{
+			/* the server is lagging; give it time to catch up, and
+			 * come back when the next write is due */
+			if ( now < _last_flush + _lag_stats.send_spacing_ms )
+			{
+				if ( _flush_timer == 0 && !_timers_stopped )
+				{
+					_flush_timer = runtime.Timers()->Arm(
+						_last_flush + _lag_stats.send_spacing_ms - now,
+						&IrcConnection::OnFlushTimer, (void*)(uintptr_t)_id);
+				}
+				if ( _send_batch.empty() )
+					return EIrcStatus::Throttled;
+				// the held back lines still go now, on their own
+				limit = 0;
+			}
+			else
+			{
+				limit = _lag_stats.send_limit;
+			}
+		}
+
+		if ( !_send_queue.empty() && limit != 0 )
+		{
+			_last_flush = now;
+			num_bytes = _send_queue_bytes;
+			num_lines = take_send_batch(_send_queue, _send_queue_bytes, _send_batch, limit);
+			num_bytes -= _send_queue_bytes;
+		}
+
+		_send_written = 0;
+		_send_stalled = 0;
+	}
+
+	if ( num_lines != 0 )
+		MEM_ACCOUNT(SendQueues, -(int64_t)num_bytes, -(int64_t)num_lines);
+
+#if defined(USING_OPENSSL_NET)
+	if ( _socket == nullptr )
+		goto no_socket;
+
+	{
+		size_t		before = _send_written;
+		E_SEND_RESULT	result;
+
+		result = write_send_batch(_socket.get(), _send_batch, _send_written, IRC_SEND_POLL_MS, _writes_sent);
+		_bytes_sent += _send_written - before;
+
+		if ( result == SR_Failed )
+			goto openssl;
+
+		if ( result == SR_Stalled )
+		{
+			now = get_ms_time();
+
+			// any progress starts the stall afresh
+			if ( _send_stalled == 0 || _send_written != before )
+				_send_stalled = now;
+			else if ( now - _send_stalled >= IRC_SEND_WAIT_MS )
+				goto send_timeout;
+
+			/* every connection shares the parser thread; don't hold
+			 * it, the flush timer carries on with the rest */
+			send_lock.unlock();
+			ArmTimer(&_flush_timer, TIMER_WHEEL_TICK_MS, &IrcConnection::OnFlushTimer);
+			return EIrcStatus::Throttled;
+		}
+	}
+
+	_send_stalled = 0;
+#else
+#endif
+
+	// Debug log, one entry per line, without the cr+lf
+	if ( LOG_ENABLED(ELogLevel::Debug) )
+	{
+		std::string::size_type	start = 0;
+		std::string::size_type	end;
+
+		while (( end = _send_batch.find("\r\n", start)) != std::string::npos )
+		{
+			LOG(ELogLevel::Debug) << "Sent on " << this << ": "
+				<< loggable_line(_send_batch.c_str() + start, end - start) << "\n";
+			start = end + 2;
+		}
+	}
+
+	_send_batch.clear();
+	_send_written = 0;
+
+	return EIrcStatus::OK;
+
+#if defined(USING_OPENSSL_NET)
+no_socket:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "No socket to send on; discarded " <<
+		std::count(_send_batch.begin(), _send_batch.end(), '\n') << " queued lines\n";
+	_send_batch.clear();
+	_send_written = 0;
+	return EIrcStatus::InvalidState;
+openssl:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "OpenSSL send error: " << ERR_error_string(ERR_get_error(), nullptr)
+		<< "; " << _send_written << " of " << _send_batch.length() << " bytes of the batch sent\n";
+	retval = EIrcStatus::OpenSSLError;
+	goto write_failed;
+send_timeout:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Socket not writable within " << IRC_SEND_WAIT_MS
+		<< "ms; " << _send_written << " of " << _send_batch.length() << " bytes of the batch sent\n";
+	retval = EIrcStatus::TimedOut;
+	goto write_failed;
+write_failed:
+	/* part of the batch may be on the wire; whatever we send next would
+	 * follow a truncated line, so the connection can't be kept */
+	_send_batch.clear();
+	_send_written = 0;
+	_send_stalled = 0;
+	send_lock.unlock();
+
+	// the QUIT of a disconnect already under way; nothing more to do
+	if ( !force )
+	{
+		_irc_engine->Reconnector()->ConnectionLost(_irc_engine->Pools()->GetConnection(_id));
+		DisconnectAsync();
+	}
+	return retval;
+#endif
+}
+
+
+
 std::shared_ptr<IrcChannel>
 IrcConnection::GetChannel(
 	const char* channel_name
@@ -967,7 +1446,7 @@ IrcConnection::GetChannel(
 	return nullptr;
 
 invalid_name:
-	std::cerr << fg_red << "The supplied channel name was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied channel name was a nullptr\n";
 	return nullptr;
 }
 
@@ -983,59 +1462,222 @@ IrcConnection::GetCurrentNickname() const
 
 
 
-std::string
-IrcConnection::GroupName() const
+std::vector<std::string>
+IrcConnection::GetJoinList() const
 {
-	std::lock_guard<std::mutex>	lock(_mutex);
-	std::shared_ptr<IrcNetwork>	net = _owner.lock();
-	return net == nullptr ? "" : net->_group_name;
-}
+	std::vector<std::string>	retval;
+	std::set<std::string>		channels;
+	std::shared_ptr<IrcChannel>	channel;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		channels = _channel_list;
+	}
 
+	// GetChannel takes the lock itself
+	for ( auto c : channels )
+	{
+		std::string	key;
 
+		if (( channel = const_cast<IrcConnection*>(this)->GetChannel(c.c_str())) != nullptr )
+			key = channel->Key();
 
-bool
-IrcConnection::IsActive()
-{
-	return (_state & CS_Active) != 0;
+		retval.push_back(key.empty() ? c : BUILD_STRING(c.c_str(), " ", key.c_str()));
+	}
+
+	return retval;
 }
 
 
 
-bool
-IrcConnection::IsConnecting()
+irc_queue_stats
+IrcConnection::GetQueueStats() const
 {
-	return (_state & CS_Connecting) != 0;
+	irc_queue_stats			retval;
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	retval.recv_lines = (uint32_t)_recv_queue.size();
+	retval.recv_bytes = _recv_queue_bytes;
+	retval.send_lines = (uint32_t)_send_queue.size();
+	retval.send_bytes = _send_queue_bytes;
+	retval.channels = (uint32_t)_channel_list.size();
+
+	return retval;
 }
 
 
 
-bool
-IrcConnection::IsDisconnected()
+std::vector<std::string>
+IrcConnection::GetSendQueue() const
 {
-	return (_state & CS_Disconnected) != 0;
+	std::vector<std::string>	retval;
+	std::lock_guard<std::mutex>	lock(_mutex);
+	std::queue<std::string>		copy = _send_queue;
+
+	while ( !copy.empty() )
+	{
+		// strip the CR-LF added by AddToSendQueue
+		retval.push_back(copy.front().substr(0, copy.front().length() - 2));
+		copy.pop();
+	}
+
+	return retval;
 }
 
 
 
-bool
-IrcConnection::IsDisconnecting()
+irc_lag_stats
+IrcConnection::GetLagStats() const
 {
-	return (_state & CS_Disconnecting) != 0;
+	irc_lag_stats	retval;
+	uint32_t	window[IRC_LAG_SAMPLES];
+	uint32_t	count;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		retval = _lag_stats;
+		memcpy(window, _lag_window, sizeof(window));
+	}
+
+	count = std::min<uint32_t>(retval.samples, IRC_LAG_SAMPLES);
+
+	if ( count > 0 )
+	{
+		std::sort(window, window + count);
+		retval.p50_ms = window[(count - 1) / 2];
+		retval.p95_ms = window[((count - 1) * 95) / 100];
+	}
+
+	return retval;
 }
 
 
 
-std::string
-IrcConnection::NetworkName() const
+irc_tls_stats
+IrcConnection::GetTlsStats() const
 {
 	std::lock_guard<std::mutex>	lock(_mutex);
-	std::shared_ptr<IrcNetwork>	net = _owner.lock();
-	return net == nullptr ? "" : net->_server.network;
+	return _tls_stats;
 }
 
 
 
-std::shared_ptr<IrcNetwork>
+std::string
+IrcConnection::GroupName() const
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	std::shared_ptr<IrcNetwork>	net = _owner.lock();
+	return net == nullptr ? "" : net->_group_name;
+}
+
+
+
+bool
+IrcConnection::HandleFastPath(
+	const char* line
+)
+{
+	const char*	params;
+	const char*	lag;
+	uint64_t	sent;
+	uint64_t	now;
+
+	switch ( fast_path_command(line, &params) )
+	{
+	case FP_Ping:
+		// straight back out, ahead of anything queued
+		SendBypass("PONG %s\r\n", params);
+		return true;
+	case FP_Pong:
+		/* reply to our lag probe; 'PONG server :LAG<ms>'. Anything
+		 * else goes to the parser as normal */
+		if (( lag = strstr(params, ":LAG")) == nullptr )
+			return false;
+
+		sent = strtoull(lag + 4, nullptr, 10);
+		now = get_ms_time();
+
+		/* timed on arrival, so what the parser has yet to get through
+		 * doesn't count as server lag */
+		// OnPingTimer sees this cleared and schedules the next probe
+		if ( _lag_sent.exchange(0) != 0 && sent != 0 && sent <= now )
+			RecordLag((uint32_t)(now - sent));
+		return true;
+	case FP_Error:
+		DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The server closed the connection: " << params << "\n";
+		LOG(ELogLevel::Warn) << "ERROR from " << _params.conn_str << ": " << params << "\n";
+
+		/* the server is about to close the socket; stop reading once
+		 * it does. If we were quitting, Cleanup is handling it */
+		if ( !(_state & CS_Disconnecting) )
+			_state = CS_Disconnected;
+		return true;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+
+
+bool
+IrcConnection::IsActive()
+{
+	return (_state & CS_Active) != 0;
+}
+
+
+
+bool
+IrcConnection::IsConnecting()
+{
+	return (_state & CS_Connecting) != 0;
+}
+
+
+
+bool
+IrcConnection::IsDisconnected()
+{
+	return (_state & CS_Disconnected) != 0;
+}
+
+
+
+bool
+IrcConnection::IsDisconnecting()
+{
+	return (_state & CS_Disconnecting) != 0;
+}
+
+
+
+uint32_t
+IrcConnection::LagInterval()
+{
+	std::shared_ptr<IrcNetwork>	network = Owner();
+
+	if ( network == nullptr || network->_network_config.lag_interval == 0 )
+		return IRC_PING_INTERVAL_MS;
+
+	return network->_network_config.lag_interval * 1000;
+}
+
+
+
+std::string
+IrcConnection::NetworkName() const
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	std::shared_ptr<IrcNetwork>	net = _owner.lock();
+	return net == nullptr ? "" : net->_server.network;
+}
+
+
+
+std::shared_ptr<IrcNetwork>
 IrcConnection::Owner()
 {
 	return _owner.lock();
@@ -1066,6 +1708,28 @@ IrcConnection::SendAway(
 
 
 
+EIrcStatus
+IrcConnection::SendAuthenticate(
+	const char* data
+)
+{
+	char	buffer[MAX_BUF_IRC_MSG];
+
+	if ( data == nullptr )
+		goto no_data;
+
+	str_format(buffer, sizeof(buffer),
+		"AUTHENTICATE %s",
+		data);
+
+	return AddToSendQueue(buffer);
+
+no_data:
+	return EIrcStatus::MissingParameter;
+}
+
+
+
 EIrcStatus
 IrcConnection::SendBack()
 {
@@ -1115,7 +1779,7 @@ IrcConnection::SendBypass(
 		buf[sizeof(buf)-1] = '\0';
 		buf[sizeof(buf)-2] = '\n';
 		buf[sizeof(buf)-3] = '\r';
-		std::cout << fg_magenta << "Sending buffer truncated to read: " << buf << "\n";
+		DIAG(EDiagCategory::Network, ELogLevel::Warn) << fg_magenta << "Sending buffer truncated to read: " << loggable_line(buf, strlen(buf)) << "\n";
 	}
 	else
 	{
@@ -1124,7 +1788,19 @@ IrcConnection::SendBypass(
 	}
 
 #if defined(USING_OPENSSL_NET)
-	ret = BIO_puts(_socket.get(), buf);
+	{
+		std::lock_guard<std::mutex>	send_lock(_send_mutex);
+
+		/* landing in the middle of a part-written batch would split one
+		 * of its lines; go out straight after it instead */
+		if ( !_send_batch.empty() )
+		{
+			_send_bypassed += buf;
+			return EIrcStatus::OK;
+		}
+
+		ret = BIO_puts(_socket.get(), buf);
+	}
 
 	if ( ret <= 0 )
 		goto openssl;
@@ -1133,19 +1809,20 @@ IrcConnection::SendBypass(
 
 	// Debug log, remove the cr+lf! (-2, not -3, array pos by strlen)
 	buf[strlen(buf)-2] = '\0';
-	LOG(ELogLevel::Debug) << "Sent on " << this << ": " << buf << "\n";
+	LOG(ELogLevel::Debug) << "Sent on " << this << ": " << loggable_line(buf, strlen(buf)) << "\n";
 
+	_writes_sent++;
 	_bytes_sent += ret;
 
 	return EIrcStatus::OK;
 
 no_format:
-	std::cerr << fg_red << "The supplied data format was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied data format was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 
 #if defined(USING_OPENSSL_NET)
 openssl:
-	std::cerr << fg_red << "OpenSSL send error: " << ERR_error_string(ERR_get_error(), nullptr) << "\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "OpenSSL send error: " << ERR_error_string(ERR_get_error(), nullptr) << "\n";
 	return EIrcStatus::OpenSSLError;
 #endif
 
@@ -1210,41 +1887,27 @@ no_message:
 EIrcStatus
 IrcConnection::SendInit()
 {
-	char		response[MAX_BUF_IRC_MSG];
-	const char*	capabilities[] = { "multi-prefix", "uhnames" };
-	const uint32_t	num_cap = sizeof(capabilities)/sizeof(char*);
 	IrcNetwork*	network = std::shared_ptr<IrcNetwork>(_owner).get();
-	uint32_t	len;
-	uint32_t	i;
-	char*		p = nullptr;
 	EIrcStatus	retval;
 
-	/* send our nick, user, and capability requests. If the server doesn't
-	 * support them, there's not much we can do about it, so just dump all
-	 * our initial requirements and handle the responses as best as possible. */
-
 	_state |= CS_InitSent;
 
-	if (( retval = SendBypass("CAP LIST\r\n")) != EIrcStatus::OK )
-		return retval;
-
-	/// @todo we should wait here, receive the replys, and REQ in response...
-
-	/* use our copy/append trick to save using str_format for each
-	 * capability */
-	p = &response[(len = strlcpy(response, "CAP REQ ", sizeof(response)))];
-
-	for ( i = 0; i < num_cap; i++ )
-	{
-		response[len] = '\0';
-		strlcat(p, capabilities[i], sizeof(response)-len);
-
-		// function will log all errors itself
-		if (( retval = SendBypass("%s\r\n", response)) != EIrcStatus::OK )
-			return retval;
-	}
-
-	if (( retval = SendBypass("CAP END\r\n")) != EIrcStatus::OK )
+	// a new registration; nothing carries over from a previous connection
+	_caps_available = CAP_None;
+	_caps_enabled = CAP_None;
+	_caps_requested = CAP_None;
+	_cap_reqs_pending = 0;
+	_cap_negotiating = true;
+	_sasl_state = ESaslState::None;
+
+	/* everything here is queued and written as one batch at the end, so
+	 * registration costs a single write rather than one per line */
+
+	/* listing the capabilities holds registration open until we send CAP
+	 * END, which HandleCap does once it has requested what we want - and
+	 * authenticated, if using SASL - so we're identified before 001.
+	 * Servers without CAP support ignore it and register us as normal */
+	if (( retval = AddToSendQueue("CAP LS 302")) != EIrcStatus::OK )
 		return retval;
 
 	/* use the first nickname in the profile configuration, unless
@@ -1261,10 +1924,78 @@ IrcConnection::SendInit()
 
 	/* user fields are non-modifiable once connected, so they are
 	 * loaded from the profile configuration */
-	return SendUser(
+	if (( retval = SendUser(
 		network->_profile_config.ident.c_str(),
 		network->_profile_config.mode,
-		network->_profile_config.real_name.c_str());
+		network->_profile_config.real_name.c_str())) != EIrcStatus::OK )
+		return retval;
+
+	/* the parser may have already picked some of this up, in which case
+	 * there is nothing left and QueueEmpty is fine */
+	if (( retval = FlushSendQueue()) == EIrcStatus::QueueEmpty )
+		retval = EIrcStatus::OK;
+
+	return retval;
+}
+
+
+
+EIrcStatus
+IrcConnection::SendCapEnd()
+{
+	// still waiting on the server, or already sent
+	if ( !_cap_negotiating || _cap_reqs_pending > 0
+	    || _sasl_state == ESaslState::Requested
+	    || _sasl_state == ESaslState::Authenticating )
+		return EIrcStatus::OK;
+
+	_cap_negotiating = false;
+
+	return AddToSendQueue("CAP END");
+}
+
+
+
+EIrcStatus
+IrcConnection::SendCapReq(
+	uint32_t caps
+)
+{
+	static const char	req[] = "CAP REQ :";
+	std::string	line = req;
+	EIrcStatus	retval;
+
+	if ( caps == CAP_None )
+		return EIrcStatus::MissingParameter;
+
+	for ( auto& c : irc_cap_names )
+	{
+		if ( !(caps & c.flag) )
+			continue;
+
+		/* everything we know fits on one line with room to spare, but
+		 * don't rely on it; the server answers each line separately */
+		if ( line.length() + strlen(c.name) + 1 > MAX_LEN_IRC_MSG )
+		{
+			line.erase(line.length() - 1);
+			if (( retval = AddToSendQueue(line.c_str())) != EIrcStatus::OK )
+				return retval;
+			_cap_reqs_pending++;
+			line = req;
+		}
+
+		line += c.name;
+		line += " ";
+		_caps_requested |= c.flag;
+	}
+
+	// drop the trailing space
+	line.erase(line.length() - 1);
+
+	if (( retval = AddToSendQueue(line.c_str())) == EIrcStatus::OK )
+		_cap_reqs_pending++;
+
+	return retval;
 }
 
 
@@ -1317,7 +2048,7 @@ IrcConnection::SendJoin(
 	{
 		str_format(buffer, sizeof(buffer),
 			"JOIN %s %s",
-			channel_name);
+			channel_name, channel_key);
 	}
 
 	return AddToSendQueue(buffer);
@@ -1328,6 +2059,81 @@ no_channel:
 
 
 
+EIrcStatus
+IrcConnection::SendJoinList(
+	const std::vector<std::string>& channels
+)
+{
+	std::shared_ptr<IrcNetwork>	network = _owner.lock();
+	// channel name + key pairs; key is empty if the channel has none
+	std::vector<std::pair<std::string, std::string>>	keyed;
+	std::vector<std::pair<std::string, std::string>>	unkeyed;
+	std::vector<std::string>	lines;
+	uint32_t	max_targets;
+	uint32_t	max_joins;
+	EIrcStatus	retval;
+
+	if ( network == nullptr )
+		goto no_parent;
+	if ( channels.empty() )
+		goto no_channels;
+
+	for ( auto c : channels )
+	{
+		std::string::size_type	sep = c.find(' ');
+
+		if ( sep == std::string::npos )
+			unkeyed.push_back(std::make_pair(c, std::string()));
+		else
+			keyed.push_back(std::make_pair(c.substr(0, sep), c.substr(sep + 1)));
+	}
+
+	// keys are positional, so every keyed channel must precede the rest
+	keyed.insert(keyed.end(), unkeyed.begin(), unkeyed.end());
+
+	max_targets = network->_server.max_targets_join;
+
+	/* don't bother sending joins the server will only reject; the limit
+	 * is for the total, so account for the channels we're already in */
+	max_joins = (uint32_t)keyed.size();
+	if ( network->_server.max_num_channels != 0 )
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		uint32_t	current = (uint32_t)_channel_list.size();
+
+		if ( current + max_joins > network->_server.max_num_channels )
+		{
+			max_joins = current >= network->_server.max_num_channels ?
+				0 : network->_server.max_num_channels - current;
+		}
+	}
+
+	pack_join_lines(keyed, max_joins, max_targets, lines);
+
+	for ( auto& l : lines )
+	{
+		if (( retval = AddToSendQueue(l.c_str())) != EIrcStatus::OK )
+			return retval;
+	}
+
+	if ( max_joins < keyed.size() )
+		goto limit_exceeded;
+
+	return EIrcStatus::OK;
+
+no_parent:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
+	return EIrcStatus::NoOwner;
+no_channels:
+	return EIrcStatus::MissingParameter;
+limit_exceeded:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Channel limit of " << network->_server.max_num_channels
+		<< " reached; " << (keyed.size() - max_joins) << " channels were not joined\n";
+	return EIrcStatus::LimitExceeded;
+}
+
+
+
 EIrcStatus
 IrcConnection::SendKick(
 	const char* channel_name,
@@ -1392,6 +2198,134 @@ no_mode:
 
 
 
+EIrcStatus
+IrcConnection::SendMultiTarget(
+	const char* command,
+	uint16_t max_targets,
+	const std::vector<std::string>& targets,
+	const char* message
+)
+{
+	std::string	names;
+	std::string	line;
+	uint32_t	fixed_len;
+	uint32_t	in_line = 0;
+	size_t		i;
+	EIrcStatus	retval;
+
+	if ( command == nullptr )
+		goto no_command;
+	if ( message == nullptr )
+		goto no_message;
+	if ( targets.empty() )
+		goto no_targets;
+
+	// unknown limit; the only thing guaranteed to work is one at a time
+	if ( max_targets == 0 )
+		max_targets = 1;
+
+	// "COMMAND " + " :" + message
+	fixed_len = strlen(command) + 1 + 2 + strlen(message);
+
+	/* one iteration past the end, so the final line is sent by the same
+	 * code that sends a full one */
+	for ( i = 0; i <= targets.size(); i++ )
+	{
+		if ( in_line > 0 &&
+		     ( i == targets.size() || in_line == max_targets ||
+		       (fixed_len + names.length() + 1 + targets[i].length()) > MAX_LEN_IRC_MSG ))
+		{
+			line = command;
+			line += " ";
+			line += names;
+			line += " :";
+			line += message;
+
+			if (( retval = AddToSendQueue(line.c_str())) != EIrcStatus::OK )
+				return retval;
+
+			names.clear();
+			in_line = 0;
+		}
+
+		if ( i == targets.size() )
+			break;
+
+		if ( !names.empty() )
+			names += ",";
+		names += targets[i];
+		in_line++;
+	}
+
+	return EIrcStatus::OK;
+
+no_command:
+	return EIrcStatus::MissingParameter;
+no_message:
+	return EIrcStatus::MissingParameter;
+no_targets:
+	return EIrcStatus::MissingParameter;
+}
+
+
+
+void
+IrcConnection::SendNextWhox()
+{
+	std::string	channel_name;
+	std::string	line;
+	uint64_t	now = get_ms_time();
+
+	// one at a time; the 315 (or the timeout) sends the next
+	if ( _whox_token != 0 || _whox_queue.empty() )
+		return;
+
+	if ( now < _last_whox + IRC_WHOX_SPACING_MS )
+	{
+		bool	armed;
+
+		{
+			std::lock_guard<std::mutex>	lock(_mutex);
+			armed = _whox_timer != 0;
+		}
+
+		if ( !armed )
+			ArmTimer(&_whox_timer, _last_whox + IRC_WHOX_SPACING_MS - now, &IrcConnection::OnWhoxTimer);
+		return;
+	}
+
+	// skip any channels we've since left
+	do
+	{
+		channel_name = _whox_queue.front();
+		_whox_queue.pop_front();
+	}
+	while ( GetChannel(channel_name.c_str()) == nullptr && !_whox_queue.empty() );
+
+	if ( GetChannel(channel_name.c_str()) == nullptr )
+		return;
+
+	if ( ++_whox_last_token > IRC_WHOX_MAX_TOKEN )
+		_whox_last_token = 1;
+
+	/* the token identifies our replies, so a WHO the user sent at the same
+	 * time doesn't get mixed in with them */
+	line = BUILD_STRING("WHO ", channel_name.c_str(), " %" IRC_WHOX_FIELDS ",",
+		std::to_string(_whox_last_token).c_str());
+
+	if ( AddToSendQueue(line.c_str()) != EIrcStatus::OK )
+		return;
+
+	_whox_token = _whox_last_token;
+	_whox_channel = channel_name;
+	_whox_results.clear();
+	_last_whox = now;
+
+	ArmTimer(&_whox_timer, IRC_WHOX_TIMEOUT_MS, &IrcConnection::OnWhoxTimer);
+}
+
+
+
 EIrcStatus
 IrcConnection::SendNick(
 	const char* nickname
@@ -1490,6 +2424,27 @@ no_message:
 
 
 
+EIrcStatus
+IrcConnection::SendNoticeList(
+	const std::vector<std::string>& targets,
+	const char* message
+)
+{
+	std::shared_ptr<IrcNetwork>	network = _owner.lock();
+
+	if ( network == nullptr )
+		goto no_parent;
+
+	return SendMultiTarget("NOTICE", network->_server.max_targets_notice,
+		targets, message);
+
+no_parent:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
+	return EIrcStatus::NoOwner;
+}
+
+
+
 EIrcStatus
 IrcConnection::SendPart(
 	const char* channel_name,
@@ -1553,6 +2508,269 @@ no_message:
 
 
 
+EIrcStatus
+IrcConnection::SendPrivmsgList(
+	const std::vector<std::string>& targets,
+	const char* privmsg
+)
+{
+	std::shared_ptr<IrcNetwork>	network = _owner.lock();
+
+	if ( network == nullptr )
+		goto no_parent;
+
+	return SendMultiTarget("PRIVMSG", network->_server.max_targets_privmsg,
+		targets, privmsg);
+
+no_parent:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
+	return EIrcStatus::NoOwner;
+}
+
+
+
+std::shared_ptr<IrcConnection>
+IrcConnection::TimerConnection(
+	void* context
+)
+{
+	// deleted since the timer was armed if not found
+	return IRC_ENGINE->Pools()->GetConnection((uint32_t)(uintptr_t)context);
+}
+
+
+
+void
+IrcConnection::OnFlushTimer(
+	timer_id id,
+	void* context
+)
+{
+	std::shared_ptr<IrcConnection>	connection = TimerConnection(context);
+
+	if ( connection == nullptr || !connection->TimerFired(&connection->_flush_timer, id) )
+		return;
+
+	// if still throttled after this batch, the next is deferred again
+	while ( connection->FlushSendQueue() == EIrcStatus::OK )
+		;
+}
+
+
+
+void
+IrcConnection::OnWhoxTimer(
+	timer_id id,
+	void* context
+)
+{
+	std::shared_ptr<IrcConnection>	connection = TimerConnection(context);
+
+	if ( connection == nullptr || !connection->TimerFired(&connection->_whox_timer, id) )
+		return;
+
+	if ( connection->_whox_token != 0
+	    && get_ms_time() >= connection->_last_whox + IRC_WHOX_TIMEOUT_MS )
+	{
+		LOG(ELogLevel::Warn) << "The WHOX for " << connection->_whox_channel <<
+			" did not complete; abandoning it\n";
+
+		connection->_whox_token = 0;
+		connection->_whox_channel.clear();
+		connection->_whox_results.clear();
+	}
+
+	connection->SendNextWhox();
+}
+
+
+
+void
+IrcConnection::OnPingTimer(
+	timer_id id,
+	void* context
+)
+{
+	std::shared_ptr<IrcConnection>	connection = TimerConnection(context);
+	time_t		now = time(nullptr);
+	uint64_t	now_ms = get_ms_time();
+	uint64_t	due;
+	uint32_t	interval;
+	time_t		lag_sent;
+
+	if ( connection == nullptr || !connection->TimerFired(&connection->_ping_timer, id) )
+		return;
+
+	interval = connection->LagInterval();
+	// the receive thread clears it on the PONG; read it the once
+	lag_sent = connection->_lag_sent;
+
+	if ( !connection->IsActive() && !connection->IsConnecting() )
+		return;
+
+	// probing before registration only earns us ERR_NOTREGISTERED
+	if ( !connection->IsActive() )
+	{
+		connection->ArmTimer(&connection->_ping_timer, interval, &IrcConnection::OnPingTimer);
+		return;
+	}
+
+	/* the PONG is taken on the receive thread, which only clears
+	 * _lag_sent; all the timer handling stays here, on the parser thread.
+	 * So either the probe was answered and we wait for the next to be due,
+	 * or it's still outstanding and we wait for the timeout */
+	if ( lag_sent == 0 )
+		due = connection->_last_probe + interval;
+	else
+		due = connection->_last_probe + IRC_PING_TIMEOUT_MS;
+
+	if ( now_ms < due )
+	{
+		connection->ArmTimer(&connection->_ping_timer, due - now_ms, &IrcConnection::OnPingTimer);
+		return;
+	}
+
+	/* we only get here with a PING outstanding IRC_PING_TIMEOUT_MS after
+	 * sending it; if nothing whatsoever has come back, it's dead */
+	if ( lag_sent != 0 && connection->_last_data < lag_sent )
+	{
+		DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Ping timeout; nothing received from " <<
+			connection->_params.conn_str << " for " <<
+			(now - connection->_last_data) << " seconds\n";
+		LOG(ELogLevel::Warn) << "Ping timeout on " << connection->_params.conn_str << "\n";
+
+		// before Cleanup, which loses the channels to rejoin
+		connection->_irc_engine->Reconnector()->ConnectionLost(connection);
+		/* Cleanup waits on the receive thread, which could take a
+		 * while; every other connection depends on this thread */
+		connection->DisconnectAsync();
+		return;
+	}
+
+	if ( lag_sent != 0 )
+	{
+		/* data is still arriving, but our PONG is stuck behind it; the
+		 * server is at least this far behind */
+		connection->RecordLag(IRC_PING_TIMEOUT_MS);
+	}
+
+	/* bypass the send queue; a probe waiting behind our own backlog (or
+	 * our own throttling) would measure us, not the server */
+	connection->_last_probe = now_ms;
+	connection->_lag_sent = now;
+	connection->SendBypass("PING :LAG%s\r\n", std::to_string(now_ms).c_str());
+	connection->ArmTimer(&connection->_ping_timer, std::min<uint32_t>(interval, IRC_PING_TIMEOUT_MS),
+		&IrcConnection::OnPingTimer);
+
+	{
+		std::lock_guard<std::mutex>	lock(connection->_mutex);
+		connection->_lag_stats.probes++;
+	}
+}
+
+
+
+void
+IrcConnection::OnRegistrationTimeout(
+	timer_id id,
+	void* context
+)
+{
+	std::shared_ptr<IrcConnection>	connection = TimerConnection(context);
+
+	if ( connection == nullptr || !connection->TimerFired(&connection->_registration_timer, id) )
+		return;
+
+	if ( connection->IsActive() || !connection->IsConnecting() )
+		return;
+
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Registration with " << connection->_params.conn_str <<
+		" did not complete within " << (IRC_REGISTRATION_TIMEOUT_MS / 1000) << " seconds\n";
+	LOG(ELogLevel::Warn) << "Registration timeout on " << connection->_params.conn_str << "\n";
+
+	// before Cleanup, which loses the channels to rejoin
+	connection->_irc_engine->Reconnector()->ConnectionLost(connection);
+	/* Cleanup frees the socket the send path may be writing to, and waits
+	 * on the receive thread; neither belongs on the parser thread */
+	connection->DisconnectAsync();
+}
+
+
+
+void
+IrcConnection::QueueWhox(
+	const char* channel_name
+)
+{
+	// a second NAMES before the first WHOX went out needs no second WHOX
+	if ( _whox_channel.compare(channel_name) == 0
+	    || std::find(_whox_queue.begin(), _whox_queue.end(), channel_name) != _whox_queue.end() )
+		return;
+
+	_whox_queue.push_back(channel_name);
+
+	SendNextWhox();
+}
+
+
+
+void
+IrcConnection::RecordLag(
+	uint32_t lag_ms
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	uint32_t	count;
+	uint32_t	excess;
+	bool		was_backed_off = (_lag_stats.send_spacing_ms != 0);
+
+	_lag_window[_lag_stats.samples % IRC_LAG_SAMPLES] = lag_ms;
+	_lag_stats.samples++;
+	_lag_stats.last_ms = lag_ms;
+
+	if ( _lag_stats.samples == 1 )
+		_lag_stats.average_ms = lag_ms;
+	else
+		_lag_stats.average_ms = (_lag_stats.average_ms * 7 + lag_ms + 4) / 8;	// rounded, not truncated
+
+	// the baseline is what the network alone costs us
+	count = std::min<uint32_t>(_lag_stats.samples, IRC_LAG_SAMPLES);
+	_lag_stats.min_ms = *std::min_element(_lag_window, _lag_window + count);
+
+	/* the average trails the window, so a new low sample can put the
+	 * baseline above it for a while */
+	excess = _lag_stats.average_ms > _lag_stats.min_ms ? _lag_stats.average_ms - _lag_stats.min_ms : 0;
+
+	if ( excess <= IRC_LAG_BACKOFF_MS )
+	{
+		_lag_stats.send_limit = MAX_LEN_SEND_BATCH;
+		_lag_stats.send_spacing_ms = 0;
+
+		if ( was_backed_off )
+		{
+			LOG(ELogLevel::Info) << "Lag on " << _params.conn_str <<
+				" recovered (" << _lag_stats.average_ms << "ms); send rate restored\n";
+		}
+		return;
+	}
+
+	/* the further behind the server is, the less we give it per write and
+	 * the longer we wait between them; never less than a single line */
+	_lag_stats.send_limit = std::max<uint32_t>(MAX_LEN_IRC_MSG_CRLF,
+		(MAX_LEN_SEND_BATCH * IRC_LAG_BACKOFF_MS) / excess);
+	_lag_stats.send_spacing_ms = std::min<uint32_t>(IRC_MAX_SEND_SPACING_MS,
+		excess - IRC_LAG_BACKOFF_MS);
+
+	if ( !was_backed_off )
+	{
+		LOG(ELogLevel::Warn) << "Lag on " << _params.conn_str << " is " <<
+			_lag_stats.average_ms << "ms (baseline " << _lag_stats.min_ms <<
+			"ms); backing off the send rate\n";
+	}
+}
+
+
+
 EIrcStatus
 IrcConnection::SendRaw(
 	const char* data
@@ -1563,6 +2781,61 @@ IrcConnection::SendRaw(
 
 
 
+EIrcStatus
+IrcConnection::SendSaslCredentials()
+{
+	std::shared_ptr<IrcNetwork>	network = Owner();
+	std::string	account;
+	std::string	payload;
+	char*		encoded = nullptr;
+	int		encoded_len = 0;
+	int		offset;
+	EIrcStatus	retval = EIrcStatus::OK;
+
+	if ( network == nullptr )
+		goto no_parent;
+
+	// the certificate already identified us; nothing further to send
+	if ( network->_profile_config.sasl_mechanism.compare("EXTERNAL") == 0 )
+		return SendAuthenticate("+");
+
+	account = network->_profile_config.sasl_account.empty() ?
+		network->_client.nickname : network->_profile_config.sasl_account;
+
+	// PLAIN; authzid NUL authcid NUL password
+	payload = account;
+	payload += '\0';
+	payload += account;
+	payload += '\0';
+	payload += network->_profile_config.sasl_password;
+
+	if (( encoded = base64(payload.data(), (int)payload.length(), &encoded_len)) == nullptr )
+		goto encode_failed;
+
+	for ( offset = 0; offset < encoded_len && retval == EIrcStatus::OK; offset += SASL_CHUNK_LEN )
+	{
+		std::string	chunk(encoded + offset, std::min(SASL_CHUNK_LEN, encoded_len - offset));
+
+		retval = SendAuthenticate(chunk.c_str());
+	}
+
+	// a final chunk of exactly SASL_CHUNK_LEN is only known to be final by this
+	if ( retval == EIrcStatus::OK && (encoded_len % SASL_CHUNK_LEN) == 0 )
+		retval = SendAuthenticate("+");
+
+	FREE(encoded);
+	return retval;
+
+no_parent:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
+	return EIrcStatus::NoOwner;
+encode_failed:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to encode the SASL credentials\n";
+	return EIrcStatus::InvalidData;
+}
+
+
+
 EIrcStatus
 IrcConnection::SendQuit(
 	const char* msg
@@ -1668,7 +2941,6 @@ IrcConnection::Setup(
 	std::shared_ptr<config_server> server_config
 )
 {
-	int32_t	i;
 	char	buffer[NI_MAXHOST];
 
 	/* if a prior conn_str exists, we're reconnecting, so the network and
@@ -1710,11 +2982,16 @@ params_set:
 		ep = *resolver.resolve(query);
 		_params.data = ep.address().to_string();
 #else
-		i = host_to_ipv4(_params.host.c_str(), -1, buffer, sizeof(buffer));
+		/* cached, and shared with any other connection looking up the
+		 * same host at the same time (reconnecting en masse) */
+		std::vector<ip_address>	addresses;
 
-		if ( i == -1 )
+		if ( _irc_engine->Resolver()->Resolve(_params.host.c_str(), addresses) != 0
+		    || addresses.empty() )
 			goto lookup_failed;
 
+		_params.ip = addresses[0];
+		ip_address_to_string(addresses[0], buffer, sizeof(buffer));
 		_params.data = buffer;
 #endif
 	}
@@ -1724,6 +3001,9 @@ params_set:
 			"%s:%u", _params.ip_addr.c_str(), _params.port);
 		_params.conn_str = buffer;
 
+		_params.ip.family = _params.ip_addr.find(':') == std::string::npos ? AF_INET : AF_INET6;
+		inet_pton(_params.ip.family, _params.ip_addr.c_str(), &_params.ip.data);
+
 		// reverse lookup for additional information
 #if defined(USING_BOOST_NET)
 		ip::tcp::endpoint	ep;
@@ -1738,8 +3018,13 @@ params_set:
 		dest = res.resolve(ep);
 		_params.data = dest->host_name();
 #else
-		ipv4_to_host(_params.ip_addr.c_str(), buffer, sizeof(buffer));
-		_params.data = buffer;
+		// cached alongside the forward lookups; either family
+		std::string	hostname;
+
+		if ( _irc_engine->Resolver()->ReverseResolve(_params.ip, hostname) == 0 )
+			_params.data = hostname;
+		else
+			_params.data = _params.ip_addr;
 #endif
 	}
 	else
@@ -1748,7 +3033,6 @@ params_set:
 	}
 
 	// reaching here, we must know an IP to connect to
-	inet_pton(AF_INET, _params.ip_addr.c_str(), &_params.ip);
 
 	// copy the data into the networks connection information
 	network->UpdateServerInfo();
@@ -1756,20 +3040,34 @@ params_set:
 	if ( _params.use_ssl )
 	{
 #if defined(USING_OPENSSL_NET)
-		// SSL connection requested
-		SSL_CTX*	ssl_ctx = SSL_CTX_new(SSLv23_client_method());
+		// SSL connection requested; contexts are shared per network + policy
+		SSL_CTX*	ssl_ctx = _irc_engine->SslContexts()->GetContext(
+			network->_group_name,
+			network->_network_config.allow_invalid_cert,
+			network->_network_config.client_certificate
+		);
 		SSL*		ssl = nullptr;
 		BIO*		socket = nullptr;
 
 		if ( ssl_ctx == nullptr )
 			goto openssl_context_failed;
 
-		_ssl_context = std::unique_ptr<SSL_CTX>(ssl_ctx);
+		_ssl_context = ssl_ctx;
 
-		socket = BIO_new_ssl_connect(ssl_ctx);
+		if ( _params.raw_socket != -1 )
+		{
+			// layer SSL over the socket race_connect already connected
+			if (( socket = BIO_new_ssl(ssl_ctx, 1)) == nullptr )
+				goto openssl_ssl_bio_failed;
 
-		if ( socket == nullptr )
+			BIO_push(socket, BIO_new_socket((int)_params.raw_socket, BIO_CLOSE));
+			_params.raw_socket = -1;
+			_params.preconnected = true;
+		}
+		else if (( socket = BIO_new_ssl_connect(ssl_ctx)) == nullptr )
+		{
 			goto openssl_ssl_bio_failed;
+		}
 
 		_socket = std::unique_ptr<BIO>(socket);
 
@@ -1777,16 +3075,37 @@ params_set:
 		_ssl = std::unique_ptr<SSL>(ssl);
 
 		SSL_set_mode(_ssl.get(), SSL_MODE_AUTO_RETRY);
-		BIO_set_conn_hostname(_socket.get(), _params.conn_str.c_str());
+		if ( !_params.preconnected )
+			BIO_set_conn_hostname(_socket.get(), _params.conn_str.c_str());
+
+		/* offer the last session from this host:port, if any, so a
+		 * reconnect can skip the full handshake */
+		if ( _irc_engine->SslContexts()->ApplySession(&_params.conn_str, _ssl.get()) )
+		{
+			LOG(ELogLevel::Debug) << "Offering cached SSL session for " << _params.conn_str << "\n";
+		}
 	}
 	else
 	{
 		// non-SSL connection requested
-		BIO*	socket = BIO_new_connect(const_cast<char*>(_params.conn_str.c_str()));
+		BIO*	socket;
+
+		if ( _params.raw_socket != -1 )
+			socket = BIO_new_socket((int)_params.raw_socket, BIO_CLOSE);
+		else
+			socket = BIO_new_connect(const_cast<char*>(_params.conn_str.c_str()));
+
 		if ( socket == nullptr )
 			goto openssl_bio_failed;
+
 		_socket.reset(socket);
 
+		if ( _params.raw_socket != -1 )
+		{
+			_params.raw_socket = -1;
+			_params.preconnected = true;
+		}
+
 #elif defined(USING_BOOST_NET)
 		// SSL connection requested
 	}
@@ -1803,10 +3122,10 @@ params_set:
 	return EIrcStatus::OK;
 
 invalid_network:
-	std::cerr << fg_red << "The supplied irc_network was a nullptr\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied irc_network was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 no_server:
-	std::cerr << fg_red << "There is no server specified by the input\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "There is no server specified by the input\n";
 	return EIrcStatus::InvalidData;
 lookup_failed:
 	// already logged in function call
@@ -1814,14 +3133,14 @@ lookup_failed:
 
 #if defined(USING_OPENSSL_NET)
 openssl_context_failed:
-	std::cerr << fg_red << "Failed to create the OpenSSL SSL context\n";
+	// already logged in function call
 	return EIrcStatus::OpenSSLError;
 openssl_ssl_bio_failed:
-	std::cerr << fg_red << "Failed to create the OpenSSL SSL BIO\n";
-	SSL_CTX_free(_ssl_context.release());
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to create the OpenSSL SSL BIO\n";
+	_ssl_context = nullptr;
 	return EIrcStatus::OpenSSLError;
 openssl_bio_failed:
-	std::cerr << fg_red << "Failed to create the OpenSSL BIO\n";
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to create the OpenSSL BIO\n";
 	return EIrcStatus::OpenSSLError;
 #endif
 
@@ -1829,4 +3148,208 @@ openssl_bio_failed:
 
 
 
+void
+IrcConnection::StartTimers()
+{
+	StopTimers();
+
+	_last_data = time(nullptr);
+	_lag_sent = 0;
+	_last_probe = 0;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+
+		// a new server; the old lag means nothing here
+		memset(&_lag_stats, 0, sizeof(_lag_stats));
+		memset(&_lag_window, 0, sizeof(_lag_window));
+		_lag_stats.send_limit = MAX_LEN_SEND_BATCH;
+		_last_flush = 0;
+
+		_timers_stopped = false;
+	}
+
+	ArmTimer(&_registration_timer, IRC_REGISTRATION_TIMEOUT_MS, &IrcConnection::OnRegistrationTimeout);
+	ArmTimer(&_ping_timer, LagInterval(), &IrcConnection::OnPingTimer);
+}
+
+
+
+void
+IrcConnection::StopTimers()
+{
+	/* a callback already running on the parser thread sees the flag when
+	 * it tries to re-arm, so nothing outlives this call */
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	_timers_stopped = true;
+
+	runtime.Timers()->Cancel(_registration_timer);
+	runtime.Timers()->Cancel(_ping_timer);
+	runtime.Timers()->Cancel(_whox_timer);
+	runtime.Timers()->Cancel(_flush_timer);
+
+	_registration_timer = 0;
+	_ping_timer = 0;
+	_whox_timer = 0;
+	_flush_timer = 0;
+}
+
+
+
+bool
+IrcConnection::TimerFired(
+	timer_id* slot,
+	timer_id id
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	// cancelled or replaced while waiting to run, or stopped altogether
+	if ( _timers_stopped || *slot != id )
+		return false;
+
+	*slot = 0;
+	return true;
+}
+
+
+
+void
+IrcConnection::WaitForDisconnect() const
+{
+	while ( _disconnecting )
+		SLEEP_MILLISECONDS(9);
+}
+
+
+
+EIrcStatus
+IrcConnection::SetupFastest(
+	std::shared_ptr<IrcNetwork> network,
+	const std::vector<std::shared_ptr<config_server>>* server_list
+)
+{
+	std::vector<std::shared_ptr<config_server>>	servers;
+	std::vector<connect_candidate>	by_family[2];
+	std::vector<connect_candidate>	candidates;
+	std::shared_ptr<config_server>	server;
+	char		buffer[INET6_ADDRSTRLEN];
+	size_t		winner = 0;
+	size_t		i;
+	uint64_t	latency = 0;
+	intptr_t	sock;
+	EIrcStatus	status;
+	int		first_family = -1;
+
+	if ( network == nullptr )
+		goto invalid_network;
+
+	servers = server_list != nullptr ? *server_list : network->ServersByLatency();
+
+	/* start every lookup at once; the Resolve calls below then wait on
+	 * whichever are still in progress, rather than each in turn */
+	for ( i = 0; i < servers.size(); i++ )
+	{
+		if ( !servers[i]->hostname.empty() )
+			_irc_engine->Resolver()->ResolveAsync(servers[i]->hostname.c_str(), nullptr, nullptr);
+	}
+
+	for ( i = 0; i < servers.size(); i++ )
+	{
+		std::vector<ip_address>	addresses;
+		ip_address		literal;
+
+		if ( !servers[i]->hostname.empty() )
+		{
+			// failures are cached by the resolver; just skip the server
+			_irc_engine->Resolver()->Resolve(servers[i]->hostname.c_str(), addresses);
+		}
+		else if ( !servers[i]->ip_address.empty() )
+		{
+			memset(&literal, 0, sizeof(literal));
+			literal.family = servers[i]->ip_address.find(':') == std::string::npos ? AF_INET : AF_INET6;
+			if ( inet_pton(literal.family, servers[i]->ip_address.c_str(), &literal.data) == 1 )
+				addresses.push_back(literal);
+		}
+
+		for ( auto a : addresses )
+		{
+			connect_candidate	c;
+
+			c.ip		= a;
+			c.port		= servers[i]->port;
+			c.server_index	= (uint32_t)i;
+
+			if ( first_family == -1 )
+				first_family = a.family;
+
+			by_family[a.family == first_family ? 0 : 1].push_back(c);
+		}
+	}
+
+	/* interleave the address families (RFC 8305 section 4), starting with
+	 * whichever the fastest server resolved to first; each family list is
+	 * already in server preference order */
+	for ( i = 0; i < by_family[0].size() || i < by_family[1].size(); i++ )
+	{
+		if ( i < by_family[0].size() )
+			candidates.push_back(by_family[0][i]);
+		if ( i < by_family[1].size() )
+			candidates.push_back(by_family[1][i]);
+	}
+
+	if ( candidates.empty() )
+		goto no_candidates;
+
+	sock = race_connect(candidates, CONNECT_ATTEMPT_DELAY_MS, CONNECT_RACE_TIMEOUT_MS, &winner, &latency);
+
+	if ( sock == -1 )
+		goto connect_failed;
+
+	server = servers[candidates[winner].server_index];
+
+	network->RecordServerLatency(server_key(server.get()), latency);
+
+	ip_address_to_string(candidates[winner].ip, buffer, sizeof(buffer));
+
+	LOG(ELogLevel::Info) << "Connected to " << buffer << " port " <<
+		server->port << " in " << latency << "ms (" << (winner + 1) <<
+		" of " << candidates.size() << " candidates)\n";
+
+	// fresh setup for the winning server, using the connected socket
+	_params.conn_str.clear();
+	_params.raw_socket = sock;
+
+	if (( status = Setup(network, server)) != EIrcStatus::OK )
+	{
+		// not consumed if Setup failed before creating the BIO
+		if ( _params.raw_socket != -1 )
+		{
+			close_socket(_params.raw_socket);
+			_params.raw_socket = -1;
+		}
+		_params.preconnected = false;
+		return status;
+	}
+
+	// the address actually connected to, not just the first resolved
+	_params.ip = candidates[winner].ip;
+	_params.data = buffer;
+
+	return EIrcStatus::OK;
+
+invalid_network:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "The supplied irc_network was a nullptr\n";
+	return EIrcStatus::MissingParameter;
+no_candidates:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "No addresses could be found for any server in " << network->GroupName() << "\n";
+	return EIrcStatus::LookupFailed;
+connect_failed:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Unable to connect to any of the " << candidates.size() << " addresses for " << network->GroupName() << "\n";
+	return EIrcStatus::ConnectFailed;
+}
+
+
+
 END_NAMESPACE
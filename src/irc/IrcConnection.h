@@ -8,6 +8,8 @@
 
 
 
+#include <atomic>
+#include <deque>
 #include <queue>
 #include <mutex>
 #include <set>
@@ -27,10 +29,13 @@
 
 #include <api/char_helper.h>
 #include <api/Runtime.h>
+#include <api/TimerWheel.h>		// timer_id
 #include "IrcObject.h"
 #include "nethelper.h"
 #include "irc_structs.h"
 #include "irc_status.h"
+#include "irc_capabilities.h"
+#include "irc_send_batch.h"		// MAX_LEN_SEND_BATCH
 
 
 
@@ -39,10 +44,43 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 
 // forward declarations
 class IrcChannel;
+class IrcConnection;
 class IrcNetwork;
 struct config_server;
 
 
+/** Longest a flush waits for the socket before leaving the rest of the batch
+ * to a timer; flushes run on the parser thread, which every connection shares */
+#define IRC_SEND_POLL_MS		50
+/** Time the socket may stay unwritable, across retries, before the
+ * connection is dropped */
+#define IRC_SEND_WAIT_MS		30000
+
+/** Time allowed between connecting and receiving RPL_WELCOME */
+#define IRC_REGISTRATION_TIMEOUT_MS	60000
+/** Default time between lag probes (PING :LAG<ms>); a networks
+ * config_network::lag_interval overrides it */
+#define IRC_PING_INTERVAL_MS		30000
+/** Time allowed for anything to arrive after our PING before giving up */
+#define IRC_PING_TIMEOUT_MS		60000
+/** Longest AUTHENTICATE payload per line; longer ones are split */
+#define SASL_CHUNK_LEN			400
+/** Number of lag samples kept for the percentiles and baseline */
+#define IRC_LAG_SAMPLES			32
+/** Lag above the baseline the server is allowed before we slow down */
+#define IRC_LAG_BACKOFF_MS		500
+/** The longest we will hold back between two writes when backing off */
+#define IRC_MAX_SEND_SPACING_MS		2000
+/** Minimum time between two WHOX requests for channel user details */
+#define IRC_WHOX_SPACING_MS		2000
+/** Time allowed for a WHOX reply to complete (315) before moving on */
+#define IRC_WHOX_TIMEOUT_MS		30000
+/** The WHOX fields we request; replies list them in a fixed order, t c u h n f a r */
+#define IRC_WHOX_FIELDS			"tcuhnfar"
+/** Tokens are limited to three digits; we cycle through 1-999 */
+#define IRC_WHOX_MAX_TOKEN		999
+
+
 
 /**
  * This structure holds variables extracted from the xml configuration, ready
@@ -63,6 +101,120 @@ struct irc_connection_params
 	uint16_t	port;		/**< The port to connect to */
 	bool		use_ssl;	/**< Whether or not to use SSL to connect */
 	bool		allow_invalid_cert;	/**< If use_ssl, whether it allows an invalid certificate */
+	bool		preconnected;	/**< The socket was connected by race_connect; only SSL remains */
+	intptr_t	raw_socket;	/**< A connected socket for Setup to use instead of conn_str, or -1 */
+};
+
+
+
+/**
+ * TLS handshake statistics for a connection, covering every connection
+ * attempt it has made (and so reconnections too).
+ *
+ * @struct irc_tls_stats
+ */
+struct irc_tls_stats
+{
+	uint64_t	last_handshake_ms;	/**< Duration of the most recent connect + handshake */
+	uint64_t	total_handshake_ms;	/**< Sum of all handshake durations */
+	uint32_t	handshakes;	/**< Number of successful handshakes */
+	uint32_t	resumed;	/**< Number of handshakes that resumed a cached session */
+};
+
+
+
+/**
+ * The current depth of a connections queues, for seeing where memory is
+ * going; lines that are queued but not yet parsed or sent.
+ *
+ * @struct irc_queue_stats
+ */
+struct irc_queue_stats
+{
+	uint32_t	recv_lines;	/**< Lines waiting to be parsed */
+	uint32_t	recv_bytes;	/**< Total length of the lines waiting to be parsed */
+	uint32_t	send_lines;	/**< Lines waiting to be sent */
+	uint32_t	send_bytes;	/**< Total length of the lines waiting to be sent, CR-LF included */
+	uint32_t	channels;	/**< Channels currently joined */
+};
+
+
+
+/**
+ * Lag statistics for a connection, from the round trip of our PING :LAG
+ * probes; reset on each new connection, since it'll be a new server.
+ *
+ * Lag above the baseline (the lowest in the sample window) means the server
+ * is queueing what we send; the send limit and spacing reflect how far the
+ * send rate has been backed off as a result.
+ *
+ * @struct irc_lag_stats
+ */
+struct irc_lag_stats
+{
+	uint32_t	last_ms;	/**< The most recent sample */
+	uint32_t	average_ms;	/**< Moving average (1/8 weight per sample) */
+	uint32_t	min_ms;		/**< Baseline; lowest in the sample window */
+	uint32_t	p50_ms;		/**< Median of the sample window */
+	uint32_t	p95_ms;		/**< 95th percentile of the sample window */
+	uint32_t	samples;	/**< Total samples taken */
+	uint32_t	probes;		/**< Total probes sent */
+	uint32_t	send_limit;	/**< Current bytes per write */
+	uint32_t	send_spacing_ms;	/**< Current minimum time between writes */
+};
+
+
+
+/**
+ * Parameters handed to a disconnect thread; taken is set by the thread once
+ * it has its own copy of the connection.
+ *
+ * @struct irc_disconnect_params
+ */
+struct irc_disconnect_params
+{
+	std::shared_ptr<IrcConnection>	connection;
+	std::atomic<bool>		taken;
+
+#if defined(_WIN32)
+	uintptr_t	thread_handle;
+	uint32_t	thread_id;
+#else
+	pthread_t	thread;
+#endif
+};
+
+
+
+/**
+ * A users details from a WHOX reply, held until the reply is complete and
+ * they can be applied to the channel in one pass.
+ *
+ * @struct whox_entry
+ */
+struct whox_entry
+{
+	std::string	nickname;	/**< The users current nickname */
+	std::string	ident;		/**< The users ident */
+	std::string	hostmask;	/**< The users hostmask */
+	std::string	account;	/**< Services account; empty if not logged in */
+	std::string	realname;	/**< The users real name */
+};
+
+
+
+/**
+ * Progress of SASL authentication during capability negotiation.
+ *
+ * @enum ESaslState
+ */
+enum class ESaslState
+{
+	None,		// Not configured, or not offered by the server
+	Requested,	// 'sasl' is in our CAP REQ
+	Authenticating,	// AUTHENTICATE sent, awaiting the outcome
+	Succeeded,	// 903 received; we are logged in
+	Failed		// Rejected, or our mechanism is not supported
 };
 
 
@@ -79,6 +231,8 @@ class SBI_IRC_API IrcConnection : public IrcObject
 	friend class IrcParser;
 	// reads + updates internals
 	friend class IrcNetwork;
+	// reconnects; needs _params and EstablishConnection
+	friend class ReconnectManager;
 	// calls ExecEstablishConnection
 	//friend bool Runtime::CreateThread(E_THREAD_TYPE, void*, const char*);
 private:
@@ -86,17 +240,53 @@ private:
 	NO_CLASS_COPY(IrcConnection);
 
 	uint32_t	_state;		/**< flag-based connection state */
-	time_t		_last_data;	/**< The time data was last received */
-	time_t		_lag_sent;	/**< The time 'LAG' was sent */
+	std::atomic<time_t>	_last_data;	/**< The time data was last received; read by the ping timer */
+	std::atomic<time_t>	_lag_sent;	/**< The time 'LAG' was sent; cleared by the PONG */
+	std::atomic<bool>	_presence_started;	/**< Presence tracking began at the end of the MOTD; cleared by 001 and Cleanup */
+	std::atomic<bool>	_disconnecting;	/**< Set by DisconnectAsync until its thread has finished Cleanup */
+	uint64_t	_last_probe;	/**< get_ms_time() the last lag probe was sent */
 	uint64_t	_bytes_recv;	/**< stats tracking - bytes received */
 	uint64_t	_bytes_sent;	/**< stats tracking - bytes sent */
+	uint64_t	_writes_sent;	/**< stats tracking - socket writes issued */
+	uint32_t	_send_queue_bytes;	/**< Total length of the lines in the send queue */
+	uint32_t	_recv_queue_bytes;	/**< Total length of the lines in the receive queue */
+	timer_id	_registration_timer;	/**< Armed until 001 is received */
+	timer_id	_ping_timer;	/**< Lag probe; sends the PING and detects the timeout */
+	timer_id	_flush_timer;	/**< Armed while a throttled write is waiting */
+	bool		_timers_stopped;	/**< Set by StopTimers; nothing may be armed until StartTimers */
+	uint64_t	_last_flush;	/**< get_ms_time() of the last write */
+	uint32_t	_lag_window[IRC_LAG_SAMPLES];	/**< The most recent lag samples, circular */
+	irc_lag_stats	_lag_stats;	/**< Lag and send rate; percentiles filled on retrieval */
+	timer_id	_whox_timer;	/**< Spaces WHOX requests apart, and times out the one in flight */
+	uint64_t	_last_whox;	/**< get_ms_time() the last WHOX was sent */
+	uint16_t	_whox_token;	/**< Token of the WHOX in flight; 0 if none */
+	uint16_t	_whox_last_token;	/**< The last token used */
+	std::string	_whox_channel;	/**< The channel the WHOX in flight is for */
+	/** Channels waiting on a WHOX; only touched by the parser thread */
+	std::deque<std::string>		_whox_queue;
+	/** Replies to the WHOX in flight, applied on its 315 */
+	std::vector<whox_entry>		_whox_results;
 
 	/** Synchronization lock; mutable to enable constness for retrieval functions */
 	mutable std::mutex		_mutex;
+	/** Serializes writes to the socket, so batches go out in queued order */
+	std::mutex			_send_mutex;
+	/** Held for the whole of Cleanup; the disconnect, reconnect and owning
+	 * threads can all call it, and none must free what another is using */
+	std::mutex			_cleanup_mutex;
+
+	/** The batch being written; kept whole until it has all been sent, as an
+	 * SSL write must be retried with the same data. Guarded by _send_mutex */
+	std::string			_send_batch;
+	/** Lines SendBypass held back while a batch was part written; they go
+	 * out ahead of the queue once it completes. Guarded by _send_mutex */
+	std::string			_send_bypassed;
+	size_t				_send_written;	/**< Bytes of _send_batch written so far */
+	uint64_t			_send_stalled;	/**< get_ms_time() the socket stopped taking _send_batch; 0 if it hasn't */
 
 	/** The connections unprocessed receive queue */
 	std::queue<std::string>		_recv_queue;
-	/** The connections unprocessed send queue */
+	/** The connections unsent lines, each already terminated with CR-LF */
 	std::queue<std::string>		_send_queue;
 
 	/** The connections channel list */
@@ -104,7 +294,7 @@ private:
 
 #if defined(USING_OPENSSL_NET)
 	std::unique_ptr<BIO>		_socket;	/**< The raw socket, in an OpenSSL struct */
-	std::unique_ptr<SSL_CTX>	_ssl_context;	/**< OpenSSL's context */
+	SSL_CTX*			_ssl_context;	/**< OpenSSL's context; shared, owned by the SslCache */
 	std::unique_ptr<SSL>		_ssl;		/**< OpenSSL's state and data */
 #elif defined(USING_BOOST_NET)
 	boost::asio::ip::tcp::socket*			_socket;	/**<  */
@@ -114,12 +304,19 @@ private:
 
 	std::weak_ptr<IrcNetwork>	_owner;		/**< the network we reside in */
 
-	std::vector<std::string>	_cap_ack;	/**< Servers confirmed CAP support */
-	std::vector<std::string>	_cap_nak;	/**< Servers confirmed CAP no support */
-	std::vector<std::string>	_cap_ls;	/**< Servers listed CAP support */
+	/* the registration state below is reset by SendInit on the connection
+	 * thread, while the parser reads and updates it; HasCap is called for
+	 * every line received, so these are atomic rather than locked */
+	std::atomic<uint32_t>		_caps_available;	/**< E_IRC_CAP flags the server listed */
+	std::atomic<uint32_t>		_caps_enabled;		/**< E_IRC_CAP flags the server acknowledged */
+	std::atomic<uint32_t>		_caps_requested;	/**< E_IRC_CAP flags awaiting an ACK/NAK */
+	std::atomic<uint32_t>		_cap_reqs_pending;	/**< CAP REQ lines awaiting an ACK/NAK */
+	std::atomic<bool>		_cap_negotiating;	/**< Registration is held until we send CAP END */
+	std::atomic<ESaslState>		_sasl_state;	/**< SASL progress for this registration */
 
 	irc_activity			_activity;	/**< The last parsed activity */
 	irc_connection_params		_params;	/**< The parameters used for the last server connection */
+	irc_tls_stats			_tls_stats;	/**< TLS handshake timings and session reuse */
 	uint32_t			_id;		/**< Unique id */
 
 #if defined(_WIN32)
@@ -145,15 +342,18 @@ private:
 
 	/**
 	 * Adds the supplied data to the connections send queue, ready for sending
-	 * to the server. The queue is processed by the dedicated thread automatically,
-	 * keeping within the bounds of flood protection.
+	 * to the server. The queue is flushed by the parser thread on its next
+	 * pass, so every line queued within the same pass goes out in a single
+	 * write; if the queue reaches MAX_LEN_SEND_BATCH, it is flushed straight
+	 * away by the calling thread.
 	 *
 	 * The trailing carriage return and linefeed are added BY this function,
 	 * so there is no need to supply it as part of the data.
 	 *
 	 * @param data The raw text to send
-	 * @retval retval true if the data is added to the pending queue
-	 * @retval false on any failure; no data added to the pending queue
+	 * @retval EIrcStatus::OK if the data is added to the pending queue
+	 * @return On any failure, the relevant EIrcStatus; no data is added to
+	 * the pending queue
 	 */
 	EIrcStatus
 	AddToSendQueue(
@@ -213,12 +413,280 @@ private:
 	);
 
 
+	/**
+	 * Removes as many lines from the send queue as fit in MAX_LEN_SEND_BATCH
+	 * (always at least one), and writes them to the socket as one block,
+	 * rather than a write - and TLS record - per line.
+	 *
+	 * Called by the parser once per pass, and by AddToSendQueue when the
+	 * batch threshold is reached.
+	 *
+	 * While the server is lagging, batches are limited to the current send
+	 * limit, and spaced apart; a write that comes too soon is deferred to
+	 * a timer instead.
+	 *
+	 * The socket is waited on for no more than IRC_SEND_POLL_MS; if it is
+	 * still full, the rest of the batch is left to the flush timer, and
+	 * goes out before anything else.
+	 *
+	 * A failed write, or a socket that stays full for IRC_SEND_WAIT_MS,
+	 * loses the connection; part of the batch may already be on the wire,
+	 * and nothing can follow a truncated line. The reconnect manager is
+	 * notified, and the connection closed with DisconnectAsync.
+	 *
+	 * @param[in] force If true, the send rate is ignored (for the QUIT);
+	 * failures are left to the disconnect already in progress
+	 * @retval EIrcStatus::OK if a batch was written
+	 * @retval EIrcStatus::QueueEmpty if there was nothing to send
+	 * @retval EIrcStatus::Throttled if the write was deferred, or is part
+	 * written
+	 * @retval EIrcStatus::TimedOut if the socket stayed full for
+	 * IRC_SEND_WAIT_MS
+	 * @return On a write failure, the relevant EIrcStatus
+	 */
+	EIrcStatus
+	FlushSendQueue(
+		bool force = false
+	);
+
+
+	/**
+	 * Handles the lines that must not wait behind the receive queue, on
+	 * the receive thread as they arrive; a PING is answered immediately
+	 * (bypassing the send queue), the PONG to our lag probe is timed, and
+	 * an ERROR stops the connection. Everything else is left for the
+	 * parser, in the order received.
+	 *
+	 * @param[in] line A complete line, without the CR-LF
+	 * @return true if the line was handled, and must not be queued
+	 */
+	bool
+	HandleFastPath(
+		const char* line
+	);
+
+
+	/**
+	 * Retrieves the lag probe interval for this connection; the networks
+	 * configured value, or IRC_PING_INTERVAL_MS.
+	 *
+	 * @return The interval, in milliseconds
+	 */
+	uint32_t
+	LagInterval();
+
+
+	/**
+	 * Arms a timer for this connection, replacing any already in the slot;
+	 * unless StopTimers has been called, in which case nothing is armed.
+	 * Every timer id is read and written under _mutex.
+	 *
+	 * @param[in] slot The member holding the timer id
+	 * @param[in] delay_ms The time until the callback runs
+	 * @param[in] callback The function to run, passed this connections id
+	 */
+	void
+	ArmTimer(
+		timer_id* slot,
+		uint64_t delay_ms,
+		timer_callback callback
+	);
+
+
+	/**
+	 * Cancels the timer in the slot, if any, and clears it.
+	 *
+	 * @param[in] slot The member holding the timer id
+	 */
+	void
+	CancelTimer(
+		timer_id* slot
+	);
+
+
+	/**
+	 * Clears the slot of a timer that has just fired, so its callback can
+	 * go ahead.
+	 *
+	 * @param[in] slot The member holding the timer id
+	 * @param[in] id The id of the timer that fired
+	 * @return false if the timer was cancelled or replaced in the meantime,
+	 * or the timers have been stopped; the callback must do nothing
+	 */
+	bool
+	TimerFired(
+		timer_id* slot,
+		timer_id id
+	);
+
+
+	/**
+	 * Closes the connection on a new thread; for the timer callbacks, which
+	 * run on the parser thread, and must not block it waiting for the
+	 * receive thread to finish.
+	 *
+	 * Does nothing if a disconnect is already on its way; _disconnecting
+	 * is set until the thread has finished, so a reconnect attempt can
+	 * wait for it (see WaitForDisconnect).
+	 */
+	void
+	DisconnectAsync();
+
+
+	/**
+	 * The disconnect thread function; runs Cleanup on the connection.
+	 *
+	 * @param[in] params A pointer to populated irc_disconnect_params cast void
+	 */
+#if defined(_WIN32)
+	static uint32_t __stdcall
+#elif defined(__linux__) || defined(BSD)
+	static void*
+#endif
+	ExecDisconnectThread(
+		void* params
+	);
+
+
+	/**
+	 * Finds the connection a timer was armed for; timers carry its id, as
+	 * one can still fire after the connection has been deleted.
+	 *
+	 * @param[in] context The timer context, as passed by ArmTimer
+	 * @return The connection, or a nullptr if it no longer exists
+	 */
+	static std::shared_ptr<IrcConnection>
+	TimerConnection(
+		void* context
+	);
+
+
+	/**
+	 * Blocks until a disconnect started by DisconnectAsync has finished its
+	 * Cleanup; returns at once if there is none.
+	 */
+	void
+	WaitForDisconnect() const;
+
+
+	/**
+	 * Timer callback; writes the send queue once a throttled write is due.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, as passed by ArmTimer
+	 */
+	static void
+	OnFlushTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Timer callback; sends the next queued WHOX once the spacing since the
+	 * last has passed, or abandons the one in flight if its reply has not
+	 * completed within IRC_WHOX_TIMEOUT_MS.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, as passed by ArmTimer
+	 */
+	static void
+	OnWhoxTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Timer callback; if 001 has not been received yet, the server is not
+	 * going to let us in, so the connection is closed - on a new thread, as
+	 * for the ping timeout.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, as passed by ArmTimer
+	 */
+	static void
+	OnRegistrationTimeout(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Timer callback; sends a lag probe every LagInterval(), and closes the
+	 * connection if nothing at all arrives within IRC_PING_TIMEOUT_MS of
+	 * sending one. Re-arms itself; the PONG only clears _lag_sent, as it
+	 * arrives on the receive thread.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, as passed by ArmTimer
+	 */
+	static void
+	OnPingTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Queues a WHOX for the channel, to fill in the ident, hostmask,
+	 * account and real name of everyone in it - one request per channel
+	 * rather than one per user. Requests are sent one at a time, at most
+	 * every IRC_WHOX_SPACING_MS, so joining many channels doesn't flood.
+	 *
+	 * @param[in] channel_name The channel to request
+	 */
+	void
+	QueueWhox(
+		const char* channel_name
+	);
+
+
+	/**
+	 * Sends the next queued WHOX, if none is in flight and the spacing
+	 * allows; otherwise arms the timer to try again when it does.
+	 */
+	void
+	SendNextWhox();
+
+
+	/**
+	 * Arms the registration and ping timers, and wakes the parser so the
+	 * timer wheel starts ticking; called once connected.
+	 */
+	void
+	StartTimers();
+
+
+	/**
+	 * Cancels every timer this connection has armed.
+	 */
+	void
+	StopTimers();
+
+
+	/**
+	 * Adds a lag sample, and adjusts the send rate for it; once the
+	 * average lag exceeds the baseline by more than IRC_LAG_BACKOFF_MS, the
+	 * bytes per write shrink and writes are spaced out, in proportion to
+	 * the excess. Recovers by itself as the lag drops.
+	 *
+	 * @param[in] lag_ms The round trip time of a probe
+	 */
+	void
+	RecordLag(
+		uint32_t lag_ms
+	);
+
+
 	/**
 	 * Sends data across the wire through the socket, without doing any form
 	 * of flood protection - the data is sent immediately.
 	 *
-	 * Called by AddToSendQueue after flood protection has been taken into
-	 * account.
+	 * Only for data that must not wait behind the send queue (such as
+	 * PONG replies); everything else should go through AddToSendQueue.
+	 * If a batch is part written, the data follows it as soon as it
+	 * completes, rather than landing in the middle of one of its lines.
 	 *
 	 * @param[in] data_format The format-string of the data to send
 	 * @param[in] ... Variable number of parameters as determined within  data_format
@@ -231,6 +699,28 @@ private:
 		...
 	);
 
+
+	/**
+	 * Sends message to every target with the supplied command, packing the
+	 * targets into 'COMMAND a,b,c :message' lines of up to max_targets
+	 * each, within the length of an IRC message.
+	 *
+	 * @param[in] command The command to send; PRIVMSG or NOTICE
+	 * @param[in] max_targets The servers limit of targets per line; if 0
+	 * (the server has not told us), each target is sent a line of its own
+	 * @param[in] targets The nicknames and/or channels to send to
+	 * @param[in] message The message to send
+	 * @return The status of the first failing AddToSendQueue, or
+	 * EIrcStatus::OK if every line was queued
+	 */
+	EIrcStatus
+	SendMultiTarget(
+		const char* command,
+		uint16_t max_targets,
+		const std::vector<std::string>& targets,
+		const char* message
+	);
+
 public:
 
 #if 0	// Code Removed: consider this style method for variable access instead of friends
@@ -281,6 +771,9 @@ public:
 	 *
 	 * This will not destroy the connection object itself, allowing it to be reused
 	 * for another connection (i.e. reconnecting to the same server)
+	 *
+	 * Calls from different threads are serialized; a later one finds
+	 * nothing left to do.
 	 */
 	EIrcStatus
 	Cleanup();
@@ -387,6 +880,55 @@ public:
 	GetCurrentNickname() const;
 
 
+	/**
+	 * Builds the list of channels we are in, each with its key appended
+	 * (separated by a space) if it has one; the format SendJoinList takes.
+	 *
+	 * @return The channel list, ready to be re-joined
+	 */
+	std::vector<std::string>
+	GetJoinList() const;
+
+
+	/**
+	 * Retrieves a copy of every line still waiting in the send queue,
+	 * without the trailing CR-LF.
+	 *
+	 * @return The unsent lines, oldest first
+	 */
+	std::vector<std::string>
+	GetSendQueue() const;
+
+
+	/**
+	 * Retrieves the current depth of the receive and send queues.
+	 *
+	 * @return A copy of the statistics, taken under the connection lock
+	 */
+	irc_queue_stats
+	GetQueueStats() const;
+
+
+	/**
+	 * Retrieves a copy of the TLS handshake statistics for this connection.
+	 * All values remain 0 if the connection has never used SSL.
+	 *
+	 * @return A copy of the statistics, taken under the connection lock
+	 */
+	irc_tls_stats
+	GetTlsStats() const;
+
+
+	/**
+	 * Retrieves a copy of the lag statistics for this connection, with the
+	 * percentiles calculated from the current sample window.
+	 *
+	 * @return A copy of the statistics, taken under the connection lock
+	 */
+	irc_lag_stats
+	GetLagStats() const;
+
+
 	/**
 	 * Retrieves the group name of the network, as set by the user.
 	 *
@@ -397,6 +939,22 @@ public:
 	GroupName() const;
 
 
+	/**
+	 * Checks if any of the supplied capabilities are enabled; cheap enough
+	 * to call for every line received.
+	 *
+	 * @param[in] caps The E_IRC_CAP flag(s) to check
+	 * @return true if at least one of caps has been acknowledged
+	 */
+	bool
+	HasCap(
+		uint32_t caps
+	) const
+	{
+		return (_caps_enabled & caps) != 0;
+	}
+
+
 	/**
 	 * 
 	 */
@@ -485,12 +1043,43 @@ public:
 		const char* message = nullptr
 	);
 
+	/**
+	 * Sends an AUTHENTICATE line; a mechanism name to begin, a chunk of
+	 * encoded credentials, or '+' for an empty response.
+	 *
+	 * @param[in] data The parameter to send
+	 */
+	EIrcStatus
+	SendAuthenticate(
+		const char* data
+	);
+
 	/**
 	 * Sends a message to the server to clear a previously set 'AWAY' state.
 	 */
 	EIrcStatus
 	SendBack();
 
+	/**
+	 * Ends capability negotiation, allowing registration to complete.
+	 * Does nothing while a CAP REQ or SASL authentication is outstanding,
+	 * or if it has already been sent for this registration.
+	 */
+	EIrcStatus
+	SendCapEnd();
+
+	/**
+	 * Requests the supplied capabilities, in as few CAP REQ lines as the
+	 * message length allows - normally one. The server acknowledges or
+	 * rejects each line as a whole.
+	 *
+	 * @param[in] caps The E_IRC_CAP flags to request
+	 */
+	EIrcStatus
+	SendCapReq(
+		uint32_t caps
+	);
+
 	/**
 	 * The contents of message are surrounded [prefix+suffix] by the CTCP
 	 * codes (\\001), and sent off via a PRIVMSG to the supplied target.
@@ -510,6 +1099,15 @@ public:
 		const char* message
 	);
 
+	/**
+	 * Sends the SASL credentials for the profiles mechanism, in response
+	 * to the servers 'AUTHENTICATE +'. PLAIN sends the account and password
+	 * base64 encoded, split into SASL_CHUNK_LEN lines; EXTERNAL sends an
+	 * empty response, the client certificate being the credential.
+	 */
+	EIrcStatus
+	SendSaslCredentials();
+
 	/**
 	 * Sends the client standard initialization (nick and user, plus any
 	 * capabilities with newer servers).
@@ -538,6 +1136,27 @@ public:
 
 	);
 
+	/**
+	 * Joins every channel in the supplied list, packing them into as few
+	 * 'JOIN #a,#b,#c keyA,keyB' lines as the message length and the
+	 * servers TARGMAX allow. Channels with keys are placed first, as keys
+	 * are matched to channels by position.
+	 *
+	 * The lines are queued together, so they are written in one batch and
+	 * the NAMES replies for every channel stream back without waiting on
+	 * each other.
+	 *
+	 * @param[in] channels The channels to join; a key can follow the name,
+	 * separated by a space (the config_network::channels format)
+	 * @retval EIrcStatus::OK if every channel was queued to be joined
+	 * @retval EIrcStatus::LimitExceeded if the servers CHANLIMIT would be
+	 * exceeded; the channels within the limit are still joined
+	 */
+	EIrcStatus
+	SendJoinList(
+		const std::vector<std::string>& channels
+	);
+
 	/**
 	 *
 	 */
@@ -583,6 +1202,19 @@ public:
 		const char* message
 	);
 
+	/**
+	 * Sends the same notice to every target, with as many targets per
+	 * line as the servers TARGMAX/MAXTARGETS allows; falls back to a line
+	 * per target if the server has not advertised a limit.
+	 *
+	 * @sa SendMultiTarget
+	 */
+	EIrcStatus
+	SendNoticeList(
+		const std::vector<std::string>& targets,
+		const char* message
+	);
+
 	/**
 	 *
 	 */
@@ -601,6 +1233,19 @@ public:
 		const char* privmsg
 	);
 
+	/**
+	 * Sends the same privmsg to every target, with as many targets per
+	 * line as the servers TARGMAX/MAXTARGETS allows; falls back to a line
+	 * per target if the server has not advertised a limit.
+	 *
+	 * @sa SendMultiTarget
+	 */
+	EIrcStatus
+	SendPrivmsgList(
+		const std::vector<std::string>& targets,
+		const char* privmsg
+	);
+
 	/**
 	 *
 	 */
@@ -680,6 +1325,32 @@ public:
 		std::shared_ptr<config_server> server_config
 	);
 
+
+	/**
+	 * As Setup, but rather than a single server, races connections to
+	 * every resolved address (IPv4 and IPv6) of every server configured
+	 * for the network; attempts are staggered by CONNECT_ATTEMPT_DELAY_MS,
+	 * so a dead server only costs that long rather than a full timeout.
+	 *
+	 * The first to connect is kept and Setup performed for its server; the
+	 * time it took is recorded in the network, so the fastest servers are
+	 * tried first next time. ConnectToServer then only needs to perform
+	 * the SSL handshake, if any.
+	 *
+	 * @param[in] network A pointer to this connections network
+	 * @param[in] servers The servers to race, in preference order; if a
+	 * nullptr, all of the networks servers, fastest first
+	 * @retval EIrcStatus::OK if a server was connected to and Setup
+	 * succeeded for it
+	 * @retval EIrcStatus::ConnectFailed if no address could be connected to
+	 * @return Otherwise, the status returned from Setup
+	 */
+	EIrcStatus
+	SetupFastest(
+		std::shared_ptr<IrcNetwork> network,
+		const std::vector<std::shared_ptr<config_server>>* servers = nullptr
+	);
+
 };
 
 
@@ -11,7 +11,12 @@
 #include <algorithm>			// std::find
 #include <cassert>
 
-#include <api/Terminal.h>
+#include <api/Diagnostics.h>
+#if defined(USING_JSON_SPIRIT_RPC)
+#	include <api/Runtime.h>		// RpcServer accessor
+#	include <api/RpcServer.h>		// RpcTable
+#	include "rpc_commands.h"		// irc_Xxx rpc functions
+#endif
 #include "IrcEngine.h"			// prototypes
 #include "IrcGui.h"
 #include "IrcListener.h"
@@ -19,6 +24,11 @@
 #include "IrcNetwork.h"
 #include "IrcParser.h"
 #include "IrcPool.h"			// object pool
+#include "DnsResolver.h"		// cached name lookups
+#include "NetsplitTracker.h"		// collapsed netsplit quits/joins
+#include "PresenceTracker.h"		// online/offline notifications
+#include "ReconnectManager.h"		// automatic reconnects
+#include "SslCache.h"			// shared SSL contexts
 #include "irc_structs.h"		// irc_activity (reference in IrcListener.h)
 
 
@@ -27,18 +37,46 @@
 BEGIN_NAMESPACE(APP_NAMESPACE)
 
 
+#if defined(USING_JSON_SPIRIT_RPC)
+/* must be static, as the RpcCommand pointers must remain valid in order to be
+ * called and accessed from the RpcTable */
+static const RpcCommand IrcRpcCommands[] =
+{
+	{ "irc_broadcast", &irc_Broadcast, RPCF_UNLOCKED },
+	{ "irc_lag", &irc_Lag, RPCF_UNLOCKED },
+	{ "irc_memory", &irc_Memory, RPCF_UNLOCKED },
+	{ "irc_monitor", &irc_Monitor, RPCF_UNLOCKED },
+	{ "irc_tls_stats", &irc_TlsStats, RPCF_UNLOCKED },
+};
+#endif
+
+
+
 IrcEngine::IrcEngine()
 {
 	// create the object factory
 	_ircobject_factory.reset(new IrcFactory(this));
 	// and the UI
 	UI()->CreateMain();
+
+	PopulateRpcTable();
 }
 
 
 
 IrcEngine::~IrcEngine()
 {
+	// nothing is to be brought back while we're going away
+	Reconnector()->Stop();
+
+#if defined(USING_JSON_SPIRIT_RPC)
+	// must be removed before we unload, or the RpcTable holds dead pointers
+	for ( uint32_t i = 0; i < (sizeof(IrcRpcCommands) / sizeof(IrcRpcCommands[0])); i++ )
+	{
+		runtime.RPC()->GetRpcTable()->RemoveRpcCommand(&IrcRpcCommands[i]);
+	}
+#endif
+
 	_ircobject_factory.release();
 }
 
@@ -164,6 +202,10 @@ IrcEngine::NotifyListeners(
 		case LN_Privmsg:	l->OnPrivmsg(connection, connection->GetActivity()); break;
 		case LN_Quit:		l->OnQuit(connection, connection->GetActivity()); break;
 		case LN_Topic:		l->OnTopic(connection, connection->GetActivity()); break;
+		case LN_Online:		l->OnOnline(connection, connection->GetActivity()); break;
+		case LN_Offline:	l->OnOffline(connection, connection->GetActivity()); break;
+		case LN_Netsplit:	l->OnNetsplit(connection, connection->GetActivity()); break;
+		case LN_Netjoin:	l->OnNetjoin(connection, connection->GetActivity()); break;
 		case LN_SentInvite:	l->OnOurInvite(connection, connection->GetActivity()); break;
 		case LN_WeJoined:	l->OnOurJoin(connection, connection->GetActivity()); break;
 		case LN_WeKicked:	l->OnOurKick(connection, connection->GetActivity()); break;
@@ -176,7 +218,7 @@ IrcEngine::NotifyListeners(
 		case LN_WeParted:	l->OnOurPart(connection, connection->GetActivity()); break;
 		case LN_WeQuit:		l->OnOurQuit(connection, connection->GetActivity()); break;
 		default:
-			std::cerr << fg_red << "Unhandled event type received (" << event_type << ")";
+			DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "Unhandled event type received (" << event_type << ")\n";
 			break;
 		}
 	}
@@ -184,6 +226,24 @@ IrcEngine::NotifyListeners(
 
 
 
+void
+IrcEngine::PopulateRpcTable()
+{
+#if defined(USING_JSON_SPIRIT_RPC)
+	for ( uint32_t i = 0; i < (sizeof(IrcRpcCommands) / sizeof(IrcRpcCommands[0])); i++ )
+	{
+		const RpcCommand*	pcmd = &IrcRpcCommands[i];
+
+		if ( runtime.RPC()->GetRpcTable()->AddRpcCommand(pcmd) != ERpcStatus::Ok )
+		{
+			DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "Failed to add the RPC command '" << pcmd->name << "'\n";
+		}
+	}
+#endif
+}
+
+
+
 IrcParser*
 IrcEngine::Parser() const
 {
@@ -203,6 +263,55 @@ IrcEngine::Pools() const
 
 
 
+NetsplitTracker*
+IrcEngine::Netsplits() const
+{
+	static NetsplitTracker	netsplits;
+	return &netsplits;
+}
+
+
+
+PresenceTracker*
+IrcEngine::Presence() const
+{
+	static PresenceTracker	presence;
+	return &presence;
+}
+
+
+
+DnsResolver*
+IrcEngine::Resolver() const
+{
+	static DnsResolver	resolver;
+	return &resolver;
+}
+
+
+
+ReconnectManager*
+IrcEngine::Reconnector() const
+{
+	static ReconnectManager	reconnector;
+	return &reconnector;
+}
+
+
+
+#if defined(USING_OPENSSL_NET)
+
+SslCache*
+IrcEngine::SslContexts() const
+{
+	static SslCache		ssl_cache;
+	return &ssl_cache;
+}
+
+#endif
+
+
+
 IrcGui*
 IrcEngine::UI() const
 {
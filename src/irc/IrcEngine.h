@@ -34,6 +34,13 @@ class IrcChannel;
 class IrcParser;
 class IrcPool;
 class IrcGui;
+class DnsResolver;
+class NetsplitTracker;
+class PresenceTracker;
+class ReconnectManager;
+#if defined(USING_OPENSSL_NET)
+class SslCache;
+#endif
 
 
 
@@ -99,10 +106,13 @@ class SBI_IRC_API IrcEngine
 	// only spawn_interface() is allowed to create this class
 	friend int ::spawn_interface();
 	/* only IrcConnection and IrcParser can execute NotifyListeners(), as
-	 * they are the classes that determine fresh data. Just promise not to
-	 * touch the other private variables..! */
+	 * they are the classes that determine fresh data - and the
+	 * PresenceTracker and NetsplitTracker, working from what the parser
+	 * hands them. Just promise not to touch the other private variables..! */
 	friend class IrcConnection;
 	friend class IrcParser;
+	friend class NetsplitTracker;
+	friend class PresenceTracker;
 private:
 	NO_CLASS_ASSIGNMENT(IrcEngine);
 	NO_CLASS_COPY(IrcEngine);
@@ -177,6 +187,17 @@ private:
 	) const;
 
 
+	/**
+	 * Adds the IRC RPC commands (irc_Xxx) to the runtimes RpcTable, so
+	 * they can be called by RPC clients. They are removed again in the
+	 * destructor.
+	 *
+	 * Does nothing if the build has no RPC support.
+	 */
+	void
+	PopulateRpcTable();
+
+
 public:
 	~IrcEngine();
 
@@ -344,6 +365,59 @@ public:
 	Pools() const;
 
 
+	/**
+	 * Gets the netsplit tracker, which collapses the QUITs and rejoins of
+	 * a netsplit. Never fails - created on the stack as a static variable.
+	 *
+	 * @retval A pointer to the NetsplitTracker
+	 */
+	NetsplitTracker*
+	Netsplits() const;
+
+
+	/**
+	 * Gets the presence tracker, which reports nicknames coming online and
+	 * going offline. Never fails - created on the stack as a static
+	 * variable.
+	 *
+	 * @retval A pointer to the PresenceTracker
+	 */
+	PresenceTracker*
+	Presence() const;
+
+
+	/**
+	 * Gets the caching name resolver, used for all server lookups. Never
+	 * fails - created on the stack as a static variable.
+	 *
+	 * @retval A pointer to the DnsResolver
+	 */
+	DnsResolver*
+	Resolver() const;
+
+
+	/**
+	 * Gets the reconnect manager, which brings back connections that drop
+	 * unexpectedly. Never fails - created on the stack as a static variable.
+	 *
+	 * @retval A pointer to the ReconnectManager
+	 */
+	ReconnectManager*
+	Reconnector() const;
+
+
+#if defined(USING_OPENSSL_NET)
+	/**
+	 * Gets the shared SSL contexts and session cache, used by every SSL
+	 * connection. Never fails - created on the stack as a static variable.
+	 *
+	 * @retval A pointer to the SslCache
+	 */
+	SslCache*
+	SslContexts() const;
+#endif
+
+
 	/**
 	 * Accesses the UI functionality exposed by this interface.
 	 *
@@ -66,6 +66,10 @@ enum EIrcListenerNotification
 	LN_Privmsg,
 	LN_Quit,
 	LN_Topic,
+	LN_Online,			/**< A tracked nickname came online */
+	LN_Offline,			/**< A tracked nickname went offline */
+	LN_Netsplit,			/**< Users quit in a netsplit */
+	LN_Netjoin,			/**< Users returned from a netsplit */
 	// client send/target
 	LN_SentInvite,			/**< We sent an invite */
 	LN_WeJoined,			/**< We joined a channel */
@@ -387,6 +391,64 @@ protected:
 	)
 	{ connection; activity; }
 
+	/**
+	 * A nickname tracked by the PresenceTracker came online; the nickname
+	 * (and ident and hostmask, if the server supplied them) are in the
+	 * instigator.
+	 *
+	 * @param[in] connection The IrcConnection this event occurred on
+	 * @param[in] activity The connections irc_activity, for easier access
+	 */
+	virtual void
+	OnOnline(
+		std::shared_ptr<IrcConnection> connection,
+		irc_activity& activity
+	)
+	{ connection; activity; }
+
+	/**
+	 * A nickname tracked by the PresenceTracker went offline.
+	 *
+	 * @param[in] connection The IrcConnection this event occurred on
+	 * @param[in] activity The connections irc_activity, for easier access
+	 */
+	virtual void
+	OnOffline(
+		std::shared_ptr<IrcConnection> connection,
+		irc_activity& activity
+	)
+	{ connection; activity; }
+
+	/**
+	 * Users quit in a netsplit; sent once for the whole split, in place of
+	 * a LN_Quit for each. The servers are in the message, the users in
+	 * the nicknames.
+	 *
+	 * @param[in] connection The IrcConnection this event occurred on
+	 * @param[in] activity The connections irc_activity, for easier access
+	 */
+	virtual void
+	OnNetsplit(
+		std::shared_ptr<IrcConnection> connection,
+		irc_activity& activity
+	)
+	{ connection; activity; }
+
+	/**
+	 * Users returned from a netsplit; sent in place of a LN_Join for each
+	 * channel they rejoin. The servers are in the message, the users in
+	 * the nicknames.
+	 *
+	 * @param[in] connection The IrcConnection this event occurred on
+	 * @param[in] activity The connections irc_activity, for easier access
+	 */
+	virtual void
+	OnNetjoin(
+		std::shared_ptr<IrcConnection> connection,
+		irc_activity& activity
+	)
+	{ connection; activity; }
+
 
 /*-----------------------------------------------------------------------------
  * Client notifications (we initiated, or targets only us)
@@ -8,6 +8,8 @@
 
 
 
+#include <algorithm>			// std::stable_sort
+
 #if defined(USING_BOOST_NET)
 #	include <boost/asio.hpp>
 #else
@@ -15,7 +17,7 @@
 #endif
 
 #include <api/Runtime.h>		// IRC instance
-#include <api/Terminal.h>		// console output
+#include <api/Diagnostics.h>		// console output
 #include <api/utils.h>
 #include "IrcNetwork.h"			// prototypes
 #include "IrcEngine.h"
@@ -30,11 +32,42 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 
 
 
+/**
+ * Sort predicate for IrcNetwork::ServersByLatency; lowest latency first.
+ */
+static bool
+compare_server_latency(
+	const std::pair<uint64_t, std::shared_ptr<config_server>>& a,
+	const std::pair<uint64_t, std::shared_ptr<config_server>>& b
+)
+{
+	return a.first < b.first;
+}
+
+
+
 IrcNetwork::IrcNetwork(
 	const char* group_name
 )
 : _group_name(group_name)
 {
+	/* ISUPPORT only tells us about what the server wants to; anything it
+	 * doesn't mention is 0 (unknown/unlimited) until the defaults apply */
+	_server.port = 0;
+	_server.max_len_away = 0;
+	_server.max_len_channel = 0;
+	_server.max_len_kickmsg = 0;
+	_server.max_len_nick = 0;
+	_server.max_len_topic = 0;
+	_server.max_num_modes = 0;
+	_server.max_targets_join = 0;
+	_server.max_targets_notice = 0;
+	_server.max_targets_privmsg = 0;
+	_server.max_num_channels = 0;
+	_server.whox = false;
+	_server.monitor = false;
+	_server.watch = false;
+	_server.max_watch_list = 0;
 }
 
 
@@ -143,6 +176,65 @@ IrcNetwork::Server() const
 
 
 
+void
+IrcNetwork::RecordServerLatency(
+	const std::string& server_key,
+	uint64_t latency_ms
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	std::map<std::string, uint64_t>::iterator	iter = _server_latency.find(server_key);
+
+	if ( iter == _server_latency.end() )
+		_server_latency[server_key] = latency_ms;
+	else
+		iter->second = (iter->second * 3 + latency_ms) / 4;
+}
+
+
+
+std::vector<std::shared_ptr<config_server>>
+IrcNetwork::ServersByLatency() const
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	std::vector<std::pair<uint64_t, std::shared_ptr<config_server>>>	measured;
+	std::vector<std::shared_ptr<config_server>>	retval;
+	std::vector<std::shared_ptr<config_server>>	unmeasured;
+	std::map<std::string, uint64_t>::const_iterator	iter;
+
+	for ( auto s : _network_config.servers )
+	{
+		if (( iter = _server_latency.find(server_key(s.get()))) != _server_latency.end() )
+			measured.push_back(std::make_pair(iter->second, s));
+		else
+			unmeasured.push_back(s);
+	}
+
+	// stable, so equal latencies retain the configured order
+	std::stable_sort(measured.begin(), measured.end(), compare_server_latency);
+
+	for ( auto m : measured )
+		retval.push_back(m.second);
+	retval.insert(retval.end(), unmeasured.begin(), unmeasured.end());
+
+	return retval;
+}
+
+
+
+std::string
+server_key(
+	const config_server* server
+)
+{
+	return BUILD_STRING(
+		server->hostname.empty() ? server->ip_address.c_str() : server->hostname.c_str(),
+		":", std::to_string(server->port).c_str()
+	);
+}
+
+
+
 std::shared_ptr<IrcConnection>
 IrcNetwork::Setup(
 	std::shared_ptr<config_network> network_config,
@@ -162,10 +254,13 @@ IrcNetwork::Setup(
 	_network_config.auto_connect		= network_config->auto_connect;
 	_network_config.auto_exec_commands	= network_config->auto_exec_commands;
 	_network_config.auto_join_channels	= network_config->auto_join_channels;
+	_network_config.lag_interval		= network_config->lag_interval;
+	_network_config.client_certificate	= network_config->client_certificate;
 	_network_config.network_name		= network_config->network_name;
 	_network_config.profile_name		= network_config->profile_name;
 	_network_config.channels		= network_config->channels;
 	_network_config.commands		= network_config->commands;
+	_network_config.monitor			= network_config->monitor;
 	_network_config.servers			= network_config->servers;
 
 	_profile_config.auto_identify		= profile_config->auto_identify;
@@ -173,6 +268,9 @@ IrcNetwork::Setup(
 	_profile_config.profile_name		= profile_config->profile_name;
 	_profile_config.autoident_password	= profile_config->autoident_password;
 	_profile_config.autoident_service	= profile_config->autoident_service;
+	_profile_config.sasl_mechanism		= profile_config->sasl_mechanism;
+	_profile_config.sasl_account		= profile_config->sasl_account;
+	_profile_config.sasl_password		= profile_config->sasl_password;
 	_profile_config.kick_reason		= profile_config->kick_reason;
 	_profile_config.part_reason		= profile_config->part_reason;
 	_profile_config.quit_reason		= profile_config->quit_reason;
@@ -190,10 +288,10 @@ IrcNetwork::Setup(
 #endif
 
 no_network:
-	std::cerr << fg_red << "The supplied network configuration was a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The supplied network configuration was a nullptr\n";
 	return nullptr;
 no_profile:
-	std::cerr << fg_red << "The supplied profile configuration was a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The supplied profile configuration was a nullptr\n";
 	return nullptr;
 }
 
@@ -230,7 +328,7 @@ IrcNetwork::UpdateServerInfo()
 	return EIrcStatus::OK;
 
 connection_null:
-	std::cerr << fg_red << "The connection is a nullptr\n";
+	DIAG(EDiagCategory::Irc, ELogLevel::Error) << fg_red << "The connection is a nullptr\n";
 	return EIrcStatus::MissingParameter;
 }
 
@@ -8,6 +8,7 @@
 
 
 
+#include <map>
 #include <mutex>
 #include <api/char_helper.h>
 #include "IrcObject.h"
@@ -25,6 +26,21 @@ class IrcConnection;
 
 
 
+/**
+ * Builds the 'host:port' key identifying a configured server; uses the
+ * hostname if set, otherwise the IP address.
+ *
+ * @param[in] server The server configuration
+ * @return The key, as used for the latency and circuit breaker tables
+ */
+SBI_IRC_API
+std::string
+server_key(
+	const config_server* server
+);
+
+
+
 /**
  * 
  *
@@ -43,6 +59,8 @@ class SBI_IRC_API IrcNetwork : public IrcObject
 	friend class IrcParser;
 	// reads + updates internals
 	friend class IrcConnection;
+	// reads the MONITOR/WATCH support and the nicknames to track
+	friend class PresenceTracker;
 private:
 	NO_CLASS_ASSIGNMENT(IrcNetwork);
 	NO_CLASS_COPY(IrcNetwork);
@@ -58,6 +76,9 @@ private:
 
 	std::string		_group_name;	/**< A name for this network for identification */
 
+	/** Smoothed TCP connect time of each server, keyed by 'host:port' */
+	std::map<std::string, uint64_t>	_server_latency;
+
 	mutable std::mutex	_mutex;		/**< Synchronization lock; mutable to enable constness for retrieval functions */
 
 	
@@ -154,6 +175,21 @@ public:
 	Name() const;
 
 
+	/**
+	 * Records the time taken to connect to a server, smoothed with any
+	 * previous measurements so one slow connect doesn't demote a server
+	 * for good.
+	 *
+	 * @param[in] server_key The 'host:port' of the server
+	 * @param[in] latency_ms The time taken for the connection to complete
+	 */
+	void
+	RecordServerLatency(
+		const std::string& server_key,
+		uint64_t latency_ms
+	);
+
+
 	/**
 	 * Retrieves a copy of the networks hostname, *set by itself*
 	 *
@@ -171,6 +207,16 @@ public:
 	Server() const;
 
 
+	/**
+	 * Retrieves the configured servers, fastest first; servers that have
+	 * never been connected to follow, in their configured order.
+	 *
+	 * @return A copy of the server list, sorted by recorded latency
+	 */
+	std::vector<std::shared_ptr<config_server>>
+	ServersByLatency() const;
+
+
 #if 0	// Code Removed: IrcParser has private access, this is no longer needed
 	/**
 	 * Sets the network name. Can only be called once; once the variable is
@@ -19,9 +19,12 @@
 #	include <signal.h>		// signals (SIGKILL)
 #endif
 
+
 #include <api/Runtime.h>
 #include <api/Allocator.h>		// manual memory management
-#include <api/Terminal.h>		// console output
+#include <api/Diagnostics.h>		// console output
+#include <api/MemoryAccounting.h>	// receive queue accounting
+#include <api/TimerWheel.h>		// timeouts, driven from the parser loop
 #include <api/utils.h>			// utility functions
 #include "IrcParser.h"			// prototypes
 #include "IrcNetwork.h"
@@ -30,6 +33,10 @@
 #include "IrcUser.h"
 #include "IrcEngine.h"
 #include "IrcPool.h"
+#include "ReconnectManager.h"		// re-sync after reconnecting
+#include "NetsplitTracker.h"		// collapsed netsplit QUIT/JOIN
+#include "PresenceTracker.h"		// MONITOR/WATCH/ISON replies
+#include "ircd_bahamut.h"		// WATCH numerics
 #include "rfc1459.h"
 #include "rfc2812.h"
 #include "irc_channel_modes.h"		// channel modes/flags
@@ -41,6 +48,58 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 
 
 
+/**
+ * Determines if item is one of the entries in a separated list, such as the
+ * mechanisms in 'sasl=PLAIN,EXTERNAL'.
+ *
+ * @param[in] list The list to search
+ * @param[in] item The entry to find; compared case-sensitively
+ * @param[in] sep The list separator
+ * @return true if found, otherwise false
+ */
+static bool
+token_in_list(
+	const char* list,
+	const char* item,
+	char sep
+)
+{
+	size_t		item_len = strlen(item);
+	const char*	p = list;
+	const char*	end;
+
+	while ( p != nullptr && *p != '\0' )
+	{
+		end = strchr(p, sep);
+
+		if ( (size_t)((end == nullptr ? p + strlen(p) : end) - p) == item_len
+		    && strncmp(p, item, item_len) == 0 )
+			return true;
+
+		p = end == nullptr ? nullptr : end + 1;
+	}
+
+	return false;
+}
+
+
+
+/**
+ * Timer wheel wake hook; with no timers armed the parser sleeps without a
+ * timeout, so arming one from another thread has to wake it.
+ *
+ * @param[in] parser The IrcParser
+ */
+static void
+wake_parser(
+	void* parser
+)
+{
+	static_cast<IrcParser*>(parser)->TriggerSync();
+}
+
+
+
 IrcParser::IrcParser()
 {
 #if defined(_WIN32)
@@ -49,7 +108,7 @@ IrcParser::IrcParser()
 
 	if ( _sync_event == nullptr )
 	{
-		std::cerr << fg_red << "Failed to create the parser synchronization event; Win32 error " << GetLastError() << "\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Failed to create the parser synchronization event; Win32 error " << GetLastError() << "\n";
 	}
 
 #elif defined(__linux__) || defined(BSD)
@@ -88,7 +147,7 @@ IrcParser::Cleanup()
 		{
 			/* tried to let the thread go peacefully - kill it */
 			if ( !TerminateThread(_thread, EXIT_FAILURE) )
-				std::cerr << fg_red << "Failed to terminate the parser thread; Win32 error " << GetLastError();
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Failed to terminate the parser thread; Win32 error " << GetLastError() << "\n";
 		}
 
 		CloseHandle(_thread);
@@ -169,7 +228,7 @@ IrcParser::CreateThread()
 
 	if ( _thread == nullptr )
 	{
-		std::cerr << fg_red << "Failed to create the parser thread; Win32 error " << GetLastError() << "\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Failed to create the parser thread; Win32 error " << GetLastError() << "\n";
 		return false;
 	}
 
@@ -177,7 +236,7 @@ IrcParser::CreateThread()
 
 	if ( _sync_event == nullptr )
 	{
-		std::cerr << fg_red << "Failed to create the parser synchronization event; Win32 error " << GetLastError() << "\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Failed to create the parser synchronization event; Win32 error " << GetLastError() << "\n";
 		/* has nothing to cleanup, has not started running yet */
 		TerminateThread(_thread, EXIT_SUCCESS);
 		_thread_id = 0;
@@ -228,59 +287,32 @@ IrcParser::ExtractIrcBufData(
 	ircbuf_data* data
 ) const
 {
-	char*	sender = (char*)&buffer[0];
-	char*	code = nullptr;
-	char*	code_data = nullptr;
-
 	if ( buffer == nullptr )
 		goto no_buffer;
 	if ( data == nullptr )
 		goto no_bufdata;
 
-	// ignore the IRC standard prefix, if supplied
-	if ( *sender == ':' )
-		sender++;
-
-	code = strchr(sender, ' ');
-
-	if ( code == nullptr || *code == '\0' )
-		goto missing_data;
-
-	// nul-out the space, and proceed to the 'first' character
-	*code = '\0';
-	code++;
-
-	// copy the data, up to the first space (which is now a nul)
-	data->sender	= sender;
-
-	code_data = strchr(code, ' ');
-
-	if ( code_data == nullptr )
-		goto missing_data;
-
-	*code_data = '\0';
-
-	if ( strlen(code) == 0 )
+	switch ( split_ircbuf_data((char*)buffer, data) )
+	{
+	case LS_OK:
+		return EIrcStatus::OK;
+	case LS_MissingCode:
 		goto missing_code;
-
-	code_data++;
-
-	data->code	= code;
-	data->data	= code_data;
-
-	return EIrcStatus::OK;
+	default:
+		goto missing_data;
+	}
 
 no_buffer:
-	std::cerr << fg_red << "The supplied input buffer was a nullptr\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied input buffer was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 no_bufdata:
-	std::cerr << fg_red << "The supplied output data store was a nullptr\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied output data store was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 missing_data:
-	std::cerr << fg_red << "Invalid buffer received; missing data: " << buffer << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Invalid buffer received; missing data: " << buffer << "\n";
 	return EIrcStatus::InvalidParameter;
 missing_code:
-	std::cerr << fg_red << "Invalid buffer received; missing code: " << buffer << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Invalid buffer received; missing code: " << buffer << "\n";
 	return EIrcStatus::InvalidParameter;
 }
 
@@ -357,6 +389,23 @@ IrcParser::Handle001(
 	 * functions here too. */
 	connection->_state &= ~CS_Connecting;
 	connection->_state |= CS_Active;
+	// the first end of MOTD from here on starts presence tracking
+	connection->_presence_started = false;
+
+	// registered; the ping timer carries on by itself
+	connection->CancelTimer(&connection->_registration_timer);
+
+	/* nothing from the previous server is coming back; done here, as the
+	 * WHOX state is only ever touched by the parser thread, and before the
+	 * rejoin below queues the channels afresh */
+	connection->_whox_queue.clear();
+	connection->_whox_results.clear();
+	connection->_whox_channel.clear();
+	connection->_whox_token = 0;
+	connection->_last_whox = 0;
+
+	// if this was a reconnect, rejoin our channels and resend anything lost
+	_irc_engine->Reconnector()->Registered(connection);
 
 	// we can retrieve our active nickname and the server name at the same time
 
@@ -394,11 +443,11 @@ no_network:
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 invalid_data:
-	std::cerr << fg_red << "The supplied data contains no nickname end: " << data->data << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied data contains no nickname end: " << data->data << "\n";
 	ret = EIrcStatus::InvalidData;
 	goto cleanup;
 nickname_mismatch:
-	std::cerr << fg_red << "Nickname mismatch: Expected '" <<
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Nickname mismatch: Expected '" <<
 		client->nickname << "', got '" << data->data << "'\n";
 	ret = EIrcStatus::NickIsNotClient;
 	goto cleanup;
@@ -479,7 +528,7 @@ IrcParser::Handle002(
 	goto cleanup;
 
 no_info:
-	std::cerr << fg_red << "The server did not supply an expected hostname string\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The server did not supply an expected hostname string\n";
 	ret = EIrcStatus::InvalidData;
 	goto cleanup;
 cleanup:
@@ -586,7 +635,6 @@ IrcParser::Handle005(
 	char*		last = nullptr;
 	char*		nick_end = nullptr;
 	char*		dup = nullptr;
-	uint32_t	alloc;
 	irc_activity&	activity = connection->GetActivity();
 
 	if ( !connection->IsActive() )
@@ -597,13 +645,11 @@ IrcParser::Handle005(
 	/* duplicate the buffer so str_token can modify it without affecting the
 	 * original recv contents. */
 
-	alloc = data->data.length() + 1;
-	dup = (char*)MALLOC(alloc);
+	dup = _arena.Duplicate(data->data.c_str(), data->data.length());
 	
 	if ( dup == nullptr )
 		throw std::bad_alloc();
 
-	strlcpy(dup, data->data.c_str(), alloc);
 	str = dup;
 
 	p = str_token(str, delim, &last);
@@ -639,7 +685,7 @@ IrcParser::Handle005(
 
 			if ( psz == nullptr || *psz != '(' )
 			{
-				std::cerr << fg_red << "PREFIX is invalid; expected opening bracket in '" << p << "'\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "PREFIX is invalid; expected opening bracket in '" << p << "'\n";
 				goto invalid_data;
 			}
 			while ( *psz != ')' && len )
@@ -649,12 +695,12 @@ IrcParser::Handle005(
 			}
 			if ( len == 0 )
 			{
-				std::cerr << fg_red << "PREFIX is invalid; no closing bracket in '" << p << "'\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "PREFIX is invalid; no closing bracket in '" << p << "'\n";
 				goto invalid_data;
 			}
 			if ( psz == (p+8) )
 			{
-				std::cerr << fg_red << "PREFIX is invalid; no prefixes specified in '" << p << "'\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "PREFIX is invalid; no prefixes specified in '" << p << "'\n";
 				goto invalid_data;
 			}
 
@@ -665,7 +711,7 @@ IrcParser::Handle005(
 			// move up to the user modes
 			if ( *++psz == '\0' )
 			{
-				std::cerr << fg_red << "PREFIX is invalid; no modes after prefix list in '" << p << "'\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "PREFIX is invalid; no modes after prefix list in '" << p << "'\n";
 				goto invalid_data;
 			}
 			// and copy these contents
@@ -673,7 +719,61 @@ IrcParser::Handle005(
 		}
 		else if ( strncmp(p, "CHANLIMIT=", 10) == 0 )	// CHANLIMIT=#:75
 		{
-			//network->_server.max_num_channels = (u16)atoi((p+10));
+			/* each prefix group can have its own limit; we only
+			 * track the first listed (always '#' in practice) */
+			char*	limit = strchr((p+10), ':');
+
+			if ( limit != nullptr )
+				network->_server.max_num_channels = (uint16_t)atoi((limit+1));
+		}
+		else if ( strncmp(p, "MAXCHANNELS=", 12) == 0 )	// MAXCHANNELS=20
+		{
+			// deprecated form of CHANLIMIT; it takes precedence
+			if ( network->_server.max_num_channels == 0 )
+				network->_server.max_num_channels = (uint16_t)atoi((p+12));
+		}
+		else if ( strncmp(p, "MAXTARGETS=", 11) == 0 )	// MAXTARGETS=20
+		{
+			/* applies to PRIVMSG and NOTICE alike; TARGMAX is more
+			 * specific, so it takes precedence if also present */
+			uint16_t	max_targets = (uint16_t)atoi((p+11));
+
+			if ( network->_server.max_targets_privmsg == 0 )
+				network->_server.max_targets_privmsg = max_targets;
+			if ( network->_server.max_targets_notice == 0 )
+				network->_server.max_targets_notice = max_targets;
+		}
+		else if ( strncmp(p, "TARGMAX=", 8) == 0 )	// TARGMAX=NAMES:1,LIST:1,KICK:1,WHOIS:1,PRIVMSG:4,NOTICE:4,ACCEPT:,MONITOR:
+		{
+			char	tm_delim[] = ",";
+			char*	psz = (p+8);
+			char*	tm_last = nullptr;
+			char*	limit;
+
+			// p is within our duplicate, so can be tokenized in-place
+			psz = str_token(psz, tm_delim, &tm_last);
+
+			while ( psz != nullptr )
+			{
+				if (( limit = strchr(psz, ':')) != nullptr )
+				{
+					*limit++ = '\0';
+
+					// an empty limit means unlimited; atoi gives 0
+					if ( strcmp(psz, "JOIN") == 0 )
+						network->_server.max_targets_join = (uint16_t)atoi(limit);
+					/* for messages, 0 means we don't know, so
+					 * unlimited is stored as the largest value */
+					else if ( strcmp(psz, "PRIVMSG") == 0 )
+						network->_server.max_targets_privmsg = *limit == '\0' ?
+							UINT16_MAX : (uint16_t)atoi(limit);
+					else if ( strcmp(psz, "NOTICE") == 0 )
+						network->_server.max_targets_notice = *limit == '\0' ?
+							UINT16_MAX : (uint16_t)atoi(limit);
+				}
+
+				psz = str_token(nullptr, tm_delim, &tm_last);
+			}
 		}
 		else if ( strncmp(p, "CHANMODES=", 10) == 0 )	// CHANMODES=eIb,k,l,BMNORScimnpstz
 		{
@@ -685,7 +785,7 @@ IrcParser::Handle005(
 
 			if ( strlen(psz) > 55 )  // a-z, A-Z, and 3 commas
 			{
-				std::cerr << fg_red << "CHANMODES data exceeds possible limit: '" << p << "'\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "CHANMODES data exceeds possible limit: '" << p << "'\n";
 				goto invalid_data;
 			}
 
@@ -711,7 +811,7 @@ IrcParser::Handle005(
 					/* further advancements in the protocol,
 					 * if any, can be added here */
 				default:
-					std::cerr << fg_red << "More chanmode types reported (" << ui << ") than the known amount (4)\n";
+					DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "More chanmode types reported (" << ui << ") than the known amount (4)\n";
 					break;
 				}
 
@@ -719,6 +819,21 @@ IrcParser::Handle005(
 				psz = str_token(nullptr, cm_delim, &cm_last);
 			}
 		}
+		else if ( strcmp(p, "WHOX") == 0 )		// WHOX
+			network->_server.whox = true;
+		else if ( strncmp(p, "MONITOR", 7) == 0 && (p[7] == '=' || p[7] == '\0') )	// MONITOR=100
+		{
+			// no value means no limit
+			network->_server.monitor = true;
+			network->_server.max_watch_list = p[7] == '=' ? (uint16_t)atoi((p+8)) : 0;
+		}
+		else if ( strncmp(p, "WATCH=", 6) == 0 )	// WATCH=128
+		{
+			// MONITOR is preferred, where a server has both
+			network->_server.watch = true;
+			if ( !network->_server.monitor )
+				network->_server.max_watch_list = (uint16_t)atoi((p+6));
+		}
 
 		p = str_token(nullptr, delim, &last);
 	}
@@ -762,14 +877,120 @@ IrcParser::Handle005(
 	goto cleanup;
 
 incorrect_state:
-	std::cerr << fg_red << "The connection state is invalid; not active\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The connection state is invalid; not active\n";
 	ret = EIrcStatus::InvalidState;
 	goto cleanup;
 invalid_data:
 	ret = EIrcStatus::InvalidData;
 	goto cleanup;
 cleanup:
-	FREE(dup);
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle303(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_ISON
+	 *
+	 * :ircd.trezanik.org 303 trez :nick1 nick2
+	 *
+	 * Only those asked about that are online are listed
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_nicks = nullptr;
+
+	if ( !ParseParameters(data->data.c_str(), 2, nullptr, &extracted_nicks) )
+		goto parse_failure;
+
+	_irc_engine->Presence()->IsonReply(connection, extracted_nicks);
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle315(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_ENDOFWHO
+	 *
+	 * :ircd.trezanik.org 315 trez #sbi :End of /WHO list.
+	 */
+
+	std::shared_ptr<IrcChannel>	channel = nullptr;
+	std::shared_ptr<IrcUser>	user = nullptr;
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_mask = nullptr;
+	uint32_t	updated = 0;
+
+	if ( !ParseParameters(data->data.c_str(), 3, nullptr, &extracted_mask, nullptr) )
+		goto parse_failure;
+
+	// the end of a WHO the user sent, not ours
+	if ( connection->_whox_token == 0 || connection->_whox_channel.compare(extracted_mask) != 0 )
+	{
+		ret = EIrcStatus::OK;
+		goto cleanup;
+	}
+
+	/* apply the lot in one pass, under a single channel lock, rather than
+	 * a lookup and lock for each 354 as it arrives. The channel may have
+	 * been left since, in which case there's nothing to apply to */
+	if (( channel = connection->GetChannel(extracted_mask)) != nullptr )
+	{
+		std::lock_guard<std::recursive_mutex>	lock(channel->_mutex);
+
+		for ( auto& e : connection->_whox_results )
+		{
+			if (( user = channel->GetUser(e.nickname.c_str())) == nullptr )
+				continue;
+
+			std::lock_guard<std::recursive_mutex>	user_lock(user->_mutex);
+
+			user->_ident	= e.ident;
+			user->_hostmask	= e.hostmask;
+			user->_account	= e.account;
+			user->_realname	= e.realname;
+			updated++;
+		}
+	}
+
+	LOG(ELogLevel::Debug) << "WHOX updated " << updated << " of " <<
+		connection->_whox_results.size() << " users in " << extracted_mask << "\n";
+
+	connection->_whox_results.clear();
+	connection->_whox_channel.clear();
+	connection->_whox_token = 0;
+	connection->CancelTimer(&connection->_whox_timer);
+
+	// the next channel, once the spacing allows
+	connection->SendNextWhox();
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
 	return ret;
 }
 
@@ -814,9 +1035,6 @@ channel_not_found:
 	/** should we be generating an error? 332 could have no channel? */
 	goto cleanup;
 cleanup:
-	FREE(extracted_nick);
-	FREE(extracted_channel);
-	FREE(extracted_topic);
 	return ret;
 }
 
@@ -860,13 +1078,10 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 cleanup:
-	FREE(extracted_setter);
-	FREE(extracted_channel);
-	FREE(extracted_datetime);
 	return ret;
 }
 
@@ -967,21 +1182,79 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 invalid_data:
 	ret = EIrcStatus::InvalidData;
 	goto cleanup;
 unknown_prefixes:
-	std::cerr << fg_red << "No user/mode prefixes exist; required to parse IRC users\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "No user/mode prefixes exist; required to parse IRC users\n";
 	ret = EIrcStatus::UnknownResponse;
 	goto cleanup;
 cleanup:
-	FREE(extracted_nick);
-	FREE(extracted_channel);
-	FREE(extracted_type);
-	FREE(extracted_names);
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle354(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_WHOSPCRPL [WHOX]
+	 *
+	 * :ircd.trezanik.org 354 trez 42 #sbi ~ident host.example.com nick H@ account :Real Name
+	 *
+	 * The fields are always in the order t c u i h s n f d l a o r, no
+	 * matter the order requested; we ask for IRC_WHOX_FIELDS. An account
+	 * of '0' means the user is not logged in.
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_token = nullptr;
+	char*		extracted_channel = nullptr;
+	char*		extracted_ident = nullptr;
+	char*		extracted_host = nullptr;
+	char*		extracted_nick = nullptr;
+	char*		extracted_account = nullptr;
+	char*		extracted_realname = nullptr;
+	whox_entry	entry;
+
+	if ( !ParseParameters(data->data.c_str(), 9, nullptr,
+		&extracted_token, &extracted_channel, &extracted_ident, &extracted_host,
+		&extracted_nick, nullptr, &extracted_account, &extracted_realname) )
+	{
+		goto parse_failure;
+	}
+
+	// a WHOX the user sent, or one we've given up on
+	if ( connection->_whox_token == 0 || atoi(extracted_token) != connection->_whox_token )
+	{
+		ret = EIrcStatus::OK;
+		goto cleanup;
+	}
+
+	// held until the 315, see Handle315
+	entry.nickname	= extracted_nick;
+	entry.ident	= extracted_ident;
+	entry.hostmask	= extracted_host;
+	entry.realname	= extracted_realname;
+	if ( strcmp(extracted_account, "0") != 0 )
+		entry.account = extracted_account;
+
+	connection->_whox_results.push_back(entry);
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
 	return ret;
 }
 
@@ -1013,9 +1286,16 @@ IrcParser::Handle366(
 		goto channel_not_found;
 
 
+	channel->StopNamesTimer();
+
 	// convert the temporary names list into the active userlist
 	channel->PopulateUserlist();
 
+	/* NAMES only gives us nicknames; fill in the rest with a single WHOX
+	 * for the channel, unless userhost-in-names already has */
+	if ( connection->Owner()->_server.whox && !connection->HasCap(CAP_UserhostInNames) )
+		connection->QueueWhox(extracted_channel);
+
 	// prepare the activity data, then inform our listeners
 	{
 
@@ -1030,13 +1310,10 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 cleanup:
-	FREE(extracted_nick);
-	FREE(extracted_channel);
-	FREE(extracted_message);
 	return ret;
 }
 
@@ -1104,6 +1381,12 @@ IrcParser::Handle376(
 	EIrcStatus	ret = EIrcStatus::Unknown;
 	irc_activity&	activity = connection->GetActivity();
 
+	/* registration is complete, and ISUPPORT has been received; presence
+	 * tracking can pick its method and populate the servers list. A MOTD
+	 * requested later ends the same way, and mustn't send the list again */
+	if ( !connection->_presence_started.exchange(true) )
+		_irc_engine->Presence()->Registered(connection);
+
 	// prepare the activity data, then inform our listeners
 	{
 
@@ -1158,9 +1441,6 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 cleanup:
-	FREE(extracted_nick);
-	FREE(extracted_bad_nick);
-	FREE(extracted_message);
 	return ret;
 }
 
@@ -1199,14 +1479,261 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 cleanup:
-	FREE(extracted_nick);
-	FREE(extracted_used_nick);
-	FREE(extracted_message);
 	return ret;
 }
 
 
 
+EIrcStatus
+IrcParser::Handle600(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_LOGON [bahamut WATCH]
+	 *
+	 * :ircd.trezanik.org 600 trez nick ident host 1400000000 :logged online
+	 *
+	 * Also used for RPL_NOWON (604), the reply to adding a nickname that
+	 * is already online.
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_nick = nullptr;
+	char*		extracted_ident = nullptr;
+	char*		extracted_host = nullptr;
+
+	if ( !ParseParameters(data->data.c_str(), 6, nullptr,
+		&extracted_nick, &extracted_ident, &extracted_host, nullptr, nullptr) )
+	{
+		goto parse_failure;
+	}
+
+	_irc_engine->Presence()->Online(connection, extracted_nick, extracted_ident, extracted_host);
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle601(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_LOGOFF [bahamut WATCH]
+	 *
+	 * :ircd.trezanik.org 601 trez nick ident host 1400000000 :logged offline
+	 *
+	 * Also used for RPL_NOWOFF (605), the reply to adding a nickname that
+	 * is not online; the ident and host are '*'.
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_nick = nullptr;
+
+	if ( !ParseParameters(data->data.c_str(), 6, nullptr, &extracted_nick, nullptr, nullptr, nullptr, nullptr) )
+		goto parse_failure;
+
+	_irc_engine->Presence()->Offline(connection, extracted_nick);
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle730(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_MONONLINE [IRCv3 MONITOR]
+	 *
+	 * :ircd.trezanik.org 730 trez :nick1!ident@host,nick2!ident@host
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_targets = nullptr;
+	char*		target;
+	char*		last = nullptr;
+	char		delim[] = ",";
+
+	if ( !ParseParameters(data->data.c_str(), 2, nullptr, &extracted_targets) )
+		goto parse_failure;
+
+	for ( target = str_token(extracted_targets, delim, &last); target != nullptr; target = str_token(nullptr, delim, &last) )
+	{
+		ircbuf_sender	user;
+
+		if ( SplitSender(target, &user) != EIrcStatus::OK )
+			continue;
+
+		_irc_engine->Presence()->Online(connection, user.nickname.c_str(),
+			user.ident.empty() ? nullptr : user.ident.c_str(),
+			user.hostmask.empty() ? nullptr : user.hostmask.c_str());
+	}
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle731(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_MONOFFLINE [IRCv3 MONITOR]
+	 *
+	 * :ircd.trezanik.org 731 trez :nick1,nick2
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_targets = nullptr;
+	char*		target;
+	char*		last = nullptr;
+	char		delim[] = ",";
+
+	if ( !ParseParameters(data->data.c_str(), 2, nullptr, &extracted_targets) )
+		goto parse_failure;
+
+	for ( target = str_token(extracted_targets, delim, &last); target != nullptr; target = str_token(nullptr, delim, &last) )
+	{
+		_irc_engine->Presence()->Offline(connection, target);
+	}
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle734(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* ERR_MONLISTFULL [IRCv3 MONITOR]
+	 *
+	 * :ircd.trezanik.org 734 trez 100 nick1,nick2 :Monitor list is full.
+	 */
+
+	EIrcStatus	ret = EIrcStatus::Unknown;
+	char*		extracted_targets = nullptr;
+
+	if ( !ParseParameters(data->data.c_str(), 4, nullptr, nullptr, &extracted_targets, nullptr) )
+		goto parse_failure;
+
+	_irc_engine->Presence()->ListFull(connection, extracted_targets);
+
+	ret = EIrcStatus::OK;
+	goto cleanup;
+
+parse_failure:
+	ret = EIrcStatus::ParsingError;
+	goto cleanup;
+cleanup:
+	return ret;
+}
+
+
+
+EIrcStatus
+IrcParser::Handle903(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* RPL_SASLSUCCESS [IRCv3]
+	 *
+	 * :ircd.trezanik.org 903 trez :SASL authentication successful
+	 *
+	 * Also used for ERR_SASLALREADY (907), which leaves us in the same
+	 * position; already logged in.
+	 */
+
+	if ( connection->_sasl_state != ESaslState::Authenticating )
+		return EIrcStatus::OK;
+
+	connection->_sasl_state = ESaslState::Succeeded;
+
+	DIAG(EDiagCategory::Parser, ELogLevel::Info) << fg_grey << "SASL authentication succeeded\n";
+	LOG(ELogLevel::Info) << "SASL authentication succeeded on " << connection->_params.conn_str << "\n";
+
+	// identified; registration can complete
+	return connection->SendCapEnd();
+}
+
+
+
+EIrcStatus
+IrcParser::Handle904(
+	std::shared_ptr<IrcConnection> connection,
+	ircbuf_data* data,
+	ircbuf_sender* sender
+)
+{
+	/* ERR_SASLFAIL [IRCv3]
+	 *
+	 * :ircd.trezanik.org 904 trez :SASL authentication failed
+	 *
+	 * Also used for ERR_NICKLOCKED (902), ERR_SASLTOOLONG (905) and
+	 * ERR_SASLABORTED (906); whichever, we're not logged in.
+	 */
+
+	if ( connection->_sasl_state != ESaslState::Authenticating )
+		return EIrcStatus::OK;
+
+	connection->_sasl_state = ESaslState::Failed;
+
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "SASL authentication failed: " << data->data << "\n";
+	LOG(ELogLevel::Warn) << "SASL authentication failed on " << connection->_params.conn_str <<
+		" (" << data->code << ")\n";
+
+	/* register regardless; services identification (if configured) still
+	 * happens as it did without SASL */
+	return connection->SendCapEnd();
+}
+
+
+
 EIrcStatus
 IrcParser::HandleCap(
 	std::shared_ptr<IrcConnection> connection,
@@ -1227,34 +1754,182 @@ IrcParser::HandleCap(
 	 *
 	 * Servers MUST respond to a REQ command with either the ACK or NAK subcommands to indicate acceptance or rejection of the capability set requested by the client
 	*/
+	std::shared_ptr<IrcNetwork>	network = connection->Owner();
+	std::string	listed;
 	EIrcStatus	ret = EIrcStatus::Unknown;
 	char*		extracted_acknak = nullptr;
 	char*		extracted_cap = nullptr;
+	char*		caps;
+	char*		cap;
+	char*		value;
+	char*		last = nullptr;
+	uint32_t	flags = CAP_None;
+	uint32_t	disabled = CAP_None;
+	uint32_t	wanted;
+	uint32_t	count = 0;
+	E_IRC_CAP	flag;
+	bool		more = false;
+	bool		sasl_offered = false;
 	irc_activity&	activity = connection->GetActivity();
 
+	if ( network == nullptr )
+		goto no_network;
+
 	// CAP param 1 will always be '*' as we won't have sent or confirmed NICK
 	if ( !ParseParameters(data->data.c_str(), 3, nullptr, &extracted_acknak, &extracted_cap) )
 		goto parse_failure;
 
-	if ( strcmp(extracted_acknak, "ACK") == 0 )
+	/* with 302, a long list is split over several lines; all but the last
+	 * have a '*' before the list */
+	caps = extracted_cap;
+	if ( caps[0] == '*' && caps[1] == ' ' )
 	{
-		connection->_cap_ack.push_back(extracted_cap);
+		more = true;
+		caps += 2;
+	}
+	if ( *caps == ':' )
+		caps++;
+
+	// tokenizing modifies the buffer; listeners get the list intact
+	listed = caps;
+
+	/* collect the flags named on this line; names we don't know are of no
+	 * interest, as we would never request them */
+	for ( cap = str_token(caps, " ", &last); cap != nullptr; cap = str_token(nullptr, " ", &last) )
+	{
+		bool	negated = false;
+
+		// an ACK of '-name' means the capability was disabled
+		if ( *cap == '-' )
+		{
+			negated = true;
+			cap++;
+		}
+
+		// 302 may append values (sasl=PLAIN,EXTERNAL); keep the name
+		if (( value = strchr(cap, '=')) != nullptr )
+			*value++ = '\0';
+
+		if (( flag = cap_from_name(cap)) == CAP_None )
+			continue;
+
+		count++;
+
+		if ( negated )
+		{
+			disabled |= flag;
+			continue;
+		}
+
+		flags |= flag;
+
+		/* a 302 server lists the mechanisms it supports; an older one
+		 * doesn't, so we find out when AUTHENTICATE is rejected */
+		if ( flag == CAP_Sasl && !network->_profile_config.sasl_mechanism.empty() )
+		{
+			if ( value == nullptr
+			    || token_in_list(value, network->_profile_config.sasl_mechanism.c_str(), ',') )
+			{
+				sasl_offered = true;
+			}
+			else
+			{
+				DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The server does not support SASL " <<
+					network->_profile_config.sasl_mechanism << " (offers " << value << ")\n";
+			}
+		}
+	}
+
+	if ( strcmp(extracted_acknak, "LS") == 0 )
+	{
+		connection->_caps_available |= flags;
+
+		/* wait for the full list, then request everything we want in
+		 * one go; a REQ per capability would cost a round trip each.
+		 * Once registered, a user-issued LS changes nothing */
+		if ( more || !connection->_cap_negotiating )
+			goto notify;
+
+		wanted = connection->_caps_available & CAP_WANTED;
+
+		if ( sasl_offered && connection->_sasl_state == ESaslState::None )
+			connection->_sasl_state = ESaslState::Requested;
+		else
+			wanted &= ~CAP_Sasl;
+
+		if ( wanted != CAP_None )
+			connection->SendCapReq(wanted);
+		else
+			connection->SendCapEnd();
+	}
+	else if ( strcmp(extracted_acknak, "ACK") == 0 )
+	{
+		if ( connection->_cap_reqs_pending > 0 )
+			connection->_cap_reqs_pending--;
+
+		connection->_caps_requested &= ~(flags | disabled);
+		connection->_caps_enabled |= flags;
+		connection->_caps_enabled &= ~disabled;
+
+		if ( (flags & CAP_Sasl) && connection->_sasl_state == ESaslState::Requested )
+		{
+			// CAP END waits for the outcome; see Handle903 and Handle904
+			connection->_sasl_state = ESaslState::Authenticating;
+			connection->SendAuthenticate(network->_profile_config.sasl_mechanism.c_str());
+		}
+		else
+		{
+			connection->SendCapEnd();
+		}
 	}
 	else if ( strcmp(extracted_acknak, "NAK") == 0 )
 	{
-		connection->_cap_nak.push_back(extracted_cap);
+		if ( connection->_cap_reqs_pending > 0 )
+			connection->_cap_reqs_pending--;
+
+		connection->_caps_requested &= ~flags;
+
+		/* a NAK rejects the whole line, so one capability the server
+		 * won't give us costs us the rest; ask for each on its own,
+		 * and only accept a NAK of a single one as final */
+		if ( count > 1 )
+		{
+			for ( auto& c : irc_cap_names )
+			{
+				if ( flags & c.flag )
+					connection->SendCapReq(c.flag);
+			}
+		}
+		else
+		{
+			if ( (flags & CAP_Sasl) && connection->_sasl_state == ESaslState::Requested )
+				connection->_sasl_state = ESaslState::Failed;
+
+			connection->SendCapEnd();
+		}
+	}
+	else if ( strcmp(extracted_acknak, "NEW") == 0 )
+	{
+		// cap-notify; take up anything we want, bar sasl
+		connection->_caps_available |= flags;
+
+		wanted = flags & CAP_WANTED & ~CAP_Sasl
+			& ~(connection->_caps_enabled | connection->_caps_requested);
+
+		if ( wanted != CAP_None )
+			connection->SendCapReq(wanted);
 	}
-	else if ( strcmp(extracted_acknak, "LS") == 0 )
+	else if ( strcmp(extracted_acknak, "DEL") == 0 )
 	{
-		/* must have requested a list (atm, we don't at all) */
-		/* believe we need a str_token here */
-		connection->_cap_ls.push_back(extracted_cap);
+		connection->_caps_available &= ~flags;
+		connection->_caps_enabled &= ~flags;
 	}
-	else
+	else if ( strcmp(extracted_acknak, "LIST") != 0 )
 	{
 		goto what_acknak;
 	}
 
+notify:
 
 
 	// prepare the activity data, then inform our listeners
@@ -1263,7 +1938,7 @@ IrcParser::HandleCap(
 		activity.instigator.hostmask	= sender->hostmask;
 		activity.instigator.ident	= sender->ident;
 		activity.instigator.nickname	= sender->nickname;
-		activity.message		= extracted_cap;
+		activity.message		= listed;
 		activity.data			= extracted_acknak;
 
 		_irc_engine->NotifyListeners(LN_Cap, connection);
@@ -1272,16 +1947,17 @@ IrcParser::HandleCap(
 	ret = EIrcStatus::OK;
 	goto cleanup;
 
+no_network:
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connections parent network was a nullptr\n";
+	return EIrcStatus::NoOwner;
 parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 what_acknak:
-	std::cerr << fg_red << "Unknown response to a CAP: " << data->data << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Unknown response to a CAP: " << data->data << "\n";
 	ret = EIrcStatus::UnknownResponse;
 	goto cleanup;
 cleanup:
-	FREE(extracted_acknak);
-	FREE(extracted_cap);
 	return ret;
 }
 
@@ -1321,8 +1997,6 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 cleanup:
-	FREE(extracted_nick);
-	FREE(extracted_channel);
 	return ret;
 }
 
@@ -1338,15 +2012,26 @@ IrcParser::HandleJoin(
 	std::shared_ptr<IrcUser>	user = nullptr;
 	std::shared_ptr<IrcChannel>	channel = nullptr;
 	EIrcStatus	ret = EIrcStatus::Unknown;
-	std::string	channel_name;
+	// the data is trimmed down to the name in place, rather than copied
+	const std::string&	channel_name = data->data;
 	irc_activity&	activity = connection->GetActivity();
 
-	if ( data->data[0] != ':' )
-		goto invalid_data;
+	/* :nick!ident@host JOIN :#channel
+	 * :nick!ident@host JOIN #channel account :Real Name	(extended-join)
+	 *
+	 * the colon is optional with a single parameter, and some servers
+	 * omit it; the channel name is the first token either way. Check if
+	 * we're joining a new one, or if another user is joining one we're in */
+	if ( !data->data.empty() && data->data[0] == ':' )
+		data->data.erase(0, 1);
 
-	/* remainder of the string is the channel name - check if we're joining 
-	 * a new one, or if another user is joining one we're in */
-	channel_name = data->data.substr(1);
+	if ( connection->HasCap(CAP_ExtendedJoin) )
+	{
+		size_t	pos = data->data.find(' ');
+
+		if ( pos != std::string::npos )
+			data->data.erase(pos);
+	}
 
 	if ( channel_name.length() < 2 )
 		goto invalid_data;
@@ -1359,6 +2044,9 @@ IrcParser::HandleJoin(
 		{
 			// totally brand new channel
 			_irc_engine->CreateChannel(connection->Id(), channel_name.c_str());
+
+			if (( channel = connection->GetChannel(channel_name.c_str())) == nullptr )
+				goto no_channel_object;
 			/*
 			if (( ret = connection->AddChannel(channel_name.c_str()) == EIrcStatus::OK )
 				channel = connection->GetChannel(channel_name.c_str());
@@ -1372,6 +2060,9 @@ IrcParser::HandleJoin(
 
 		channel->_flags |= CHANFLAG_ACTIVE;
 
+		// the userlist stays empty until 366; don't wait on it forever
+		channel->StartNamesTimer();
+
 		// prepare the activity data, then inform our listeners
 		{
 			activity.instigator.hostmask	= sender->hostmask;
@@ -1391,6 +2082,20 @@ IrcParser::HandleJoin(
 		if ( !(channel->_flags & CHANFLAG_ACTIVE) )
 			goto invalid_channel_state;
 
+		/* returning from a netsplit; the held user is restored, and
+		 * announced with the rest of the netjoin */
+		if ( _irc_engine->Netsplits()->Join(
+			connection,
+			channel_name,
+			sender->nickname,
+			sender->ident,
+			sender->hostmask)
+		)
+		{
+			ret = EIrcStatus::OK;
+			goto cleanup;
+		}
+
 		if ( _irc_engine->CreateUser(
 			connection->Id(), 
 			channel_name.c_str(),
@@ -1519,20 +2224,17 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 kicked_not_found:
-	std::cerr << fg_red << "The extracted kicked nickname '" << extracted_kicked << "' was not found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted kicked nickname '" << extracted_kicked << "' was not found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 delete_failed:
 	// report error?
 	goto cleanup;
 cleanup:
-	FREE(extracted_channel);
-	FREE(extracted_kicked);
-	FREE(extracted_kick_message);
 	return ret;
 }
 
@@ -1584,14 +2286,12 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 nick_not_client:
-	std::cerr << fg_red << "Killed nickname '" << extracted_nickname <<
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Killed nickname '" << extracted_nickname <<
 		"' does not match the current client setting: '" <<
 		connection->Owner()->_client.nickname.c_str() << "'\n";
 	ret = EIrcStatus::NickIsNotClient;
 	goto cleanup;
 cleanup:
-	FREE(extracted_nickname);
-	FREE(extracted_message);
 	return ret;
 }
 
@@ -1618,8 +2318,8 @@ IrcParser::HandleMode(
 	bool		is_set = false;
 	uint32_t	i;
 	uint32_t	len;
-	// must be shared_ptr if a part of a vector!
-	std::vector<std::shared_ptr<mode_data>>	modes;
+	// scratch, like the extracted strings; gone once we return
+	std::vector<mode_data, arena_allocator<mode_data>>	modes((arena_allocator<mode_data>(&_arena)));
 
 	/* Rizon:
 	:$nickname!$ident@$hostmask MODE $nickname :+ix
@@ -1667,12 +2367,12 @@ IrcParser::HandleMode(
 				if ( modes.size() >= network->_server.max_num_modes )
 					goto limit_exceeded;
 
-				std::shared_ptr<mode_data>	mode(new mode_data);
+				mode_data	mode;
 
-				mode->is_enabled	= is_set;
-				mode->mode		= *p;
-				mode->has_data		= false;
-				mode->data		= "";
+				mode.is_enabled	= is_set;
+				mode.mode	= *p;
+				mode.has_data	= false;
+				mode.data	= "";
 
 				modes.push_back(mode);
 			}
@@ -1704,14 +2404,12 @@ IrcParser::HandleMode(
 			// else the character is a continuation of the enable state
 			else
 			{
-				std::shared_ptr<mode_data>	mode(new mode_data);
-
-				mode->is_enabled	= is_set;
-				mode->mode		= *p;
-				mode->data		= "";
+				mode_data	mode;
 
-				if ( ModeHasArgument(connection, is_set, *p) )
-					mode->has_data = true;
+				mode.is_enabled	= is_set;
+				mode.mode	= *p;
+				mode.has_data	= ModeHasArgument(connection, is_set, *p);
+				mode.data	= "";
 
 				modes.push_back(mode);
 			}
@@ -1721,18 +2419,18 @@ IrcParser::HandleMode(
 		str = str_token(p, delim, &last);
 
 		// for every mode, assign the data if it requires any
-		for ( auto m : modes )
+		for ( auto& m : modes )
 		{
 			// only if it needs data; +m, +p, etc. do not have any data assigned!
-			if ( m->has_data )
+			if ( m.has_data )
 			{
 				if ( str == nullptr )
 				{
-					std::cerr << fg_red << "No data remaining for required assignment; server supplied invalid data\n";
+					DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "No data remaining for required assignment; server supplied invalid data\n";
 				}
 				else
 				{
-					m->data	 = str;
+					m.data	 = str;
 				}
 
 				str = str_token(nullptr, delim, &last);
@@ -1751,9 +2449,9 @@ IrcParser::HandleMode(
 		else
 		{
 			// target was a channel, and we have it opened
-			for ( auto m : modes )
+			for ( auto& m : modes )
 			{
-				if ( !m->data.empty() )
+				if ( *m.data != '\0' )
 				{
 					mode_update	umu;
 					uint16_t		update = UM_None;
@@ -1768,7 +2466,7 @@ IrcParser::HandleMode(
 					const char	char_owner = 'q';
 
 					/// @todo extract mode mappings
-					switch ( modes[i]->mode )
+					switch ( m.mode )
 					{
 					case char_voice:	update = UM_Voice; break;
 					case char_halfop:	update = UM_HalfOp; break;
@@ -1781,14 +2479,14 @@ IrcParser::HandleMode(
 
 					if ( update != UM_None )
 					{
-						user = channel->GetUser(m->data.c_str());
+						user = channel->GetUser(m.data);
 						if ( user != nullptr )
 						{
 							umu.erase_existing = false;
 							umu.to_add = UM_None;
 							umu.to_remove = UM_None;
 
-							if ( modes[i]->is_enabled )
+							if ( m.is_enabled )
 								umu.to_add = update;
 							else
 								umu.to_remove = update;
@@ -1820,13 +2518,10 @@ invalid_data:
 	ret = EIrcStatus::InvalidData;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted target '" << extracted_target << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted target '" << extracted_target << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 cleanup:
-	FREE(extracted_target);
-	FREE(extracted_changes);
-	FREE(extracted_affected);
 	return ret;
 }
 
@@ -1843,7 +2538,7 @@ IrcParser::HandleNick(
 	std::shared_ptr<IrcUser>	user = nullptr;
 	EIrcStatus	ret = EIrcStatus::Unknown;
 	irc_activity&	activity = connection->GetActivity();
-	std::string	new_nick;
+	const char*	new_nick = nullptr;
 
 	/* Rizon:
 	:$nickname!$ident@$hostmask NICK :$new_nick
@@ -1854,13 +2549,14 @@ IrcParser::HandleNick(
 
 	network = connection->Owner();
 
-	new_nick = (data->data.substr(1));
+	// past the colon; the rest of the line is the nickname
+	new_nick = data->data.c_str() + 1;
 
 	if ( sender->nickname.compare(network->_client.nickname) == 0 )
 	{
 		// our own nickname has been changed; update our client info
 
-		network->_client.nickname	= new_nick.c_str();
+		network->_client.nickname	= new_nick;
 
 		// prepare the activity data, then inform our listeners
 		{
@@ -1879,7 +2575,7 @@ IrcParser::HandleNick(
 		{
 			if (( user = channel->GetUser(sender->nickname.c_str())) != nullptr )
 			{
-				user->Update(new_nick.c_str(), nullptr, nullptr, nullptr);
+				user->Update(new_nick, nullptr, nullptr, nullptr);
 			}
 			else
 			{
@@ -1968,7 +2664,9 @@ IrcParser::HandleNotice(
 
 				init_sent = true;
 
-				if ( network->_profile_config.auto_identify )
+				// SASL already identified us during registration
+				if ( network->_profile_config.auto_identify
+				    && connection->_sasl_state != ESaslState::Succeeded )
 				{
 					connection->SendIdentify(
 						network->_profile_config.autoident_service.c_str(),
@@ -1981,12 +2679,11 @@ IrcParser::HandleNotice(
 						connection->SendRaw(cmd.c_str());
 					}
 				}
-				if ( network->_network_config.auto_join_channels )
+				if ( network->_network_config.auto_join_channels &&
+				     !network->_network_config.channels.empty() )
 				{
-					for ( auto channel : network->_network_config.channels )
-					{
-						connection->SendJoin(channel.c_str());
-					}
+					// packed into as few JOINs as possible
+					connection->SendJoinList(network->_network_config.channels);
 				}
 			}
 		}
@@ -1999,8 +2696,6 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 cleanup:
-	FREE(extracted_destination);
-	FREE(extracted_message);
 	return ret;
 }
 
@@ -2095,10 +2790,9 @@ IrcParser::HandlePong(
 {
 	irc_activity&	activity = connection->GetActivity();
 
-	// reply from our lag message
-	connection->_lag_sent = 0;
-
-	/** @todo compare recv time with sent time to determine lag */
+	/* replies to our lag probes are timed and consumed on the receive
+	 * thread (IrcConnection::HandleFastPath); only a reply to a PING the
+	 * user sent reaches here */
 
 	return EIrcStatus::OK;
 }
@@ -2202,12 +2896,10 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted channel '" << extracted_destination << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted channel '" << extracted_destination << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 cleanup:
-	FREE(extracted_destination);
-	FREE(extracted_message);
 	return ret;
 }
 
@@ -2224,7 +2916,8 @@ IrcParser::HandleQuit(
 	//std::shared_ptr<IrcNetwork>	network = nullptr;
 	EIrcStatus	ret = EIrcStatus::Unknown;
 	irc_activity&	activity = connection->GetActivity();
-	std::string	quit_message;
+	// the data, once the colon is dropped in place
+	const std::string&	quit_message = data->data;
 	uint32_t	num_affected = 0;
 
 	// no point using parse_parameters, only 1 'field'
@@ -2232,7 +2925,7 @@ IrcParser::HandleQuit(
 		goto invalid_data;
 
 	// either a nul or remainder of string
-	quit_message = data->data.substr(1);
+	data->data.erase(0, 1);
 
 	if ( sender->nickname.compare(connection->Owner()->_client.nickname) == 0 )
 	{
@@ -2251,6 +2944,12 @@ IrcParser::HandleQuit(
 			_irc_engine->NotifyListeners(LN_WeQuit, connection);
 		}
 	}
+	else if ( NetsplitTracker::IsSplitMessage(quit_message) )
+	{
+		/* one of many; removed in bulk, with a single notification, by
+		 * the NetsplitTracker once the rest have arrived */
+		_irc_engine->Netsplits()->Quit(connection, quit_message, sender->nickname);
+	}
 	else
 	{
 		// prepare the activity data, then inform our listeners
@@ -2280,7 +2979,7 @@ IrcParser::HandleQuit(
 		{
 			/* we received the message, so there must/should be at 
 			 * least one channel that is affected.. */
-			std::cerr << fg_red << "Received a QUIT, but no users were affected. Recommend restart, likely corruption\n";
+			DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Received a QUIT, but no users were affected. Recommend restart, likely corruption\n";
 		}
 	}
 
@@ -2288,7 +2987,7 @@ IrcParser::HandleQuit(
 	goto cleanup;
 
 invalid_data:
-	std::cerr << fg_red << "Invalid data: " << data->data.c_str();
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Invalid data: " << data->data.c_str() << "\n";
 	ret = EIrcStatus::InvalidData;
 	goto cleanup;
 cleanup:
@@ -2332,12 +3031,10 @@ parse_failure:
 	ret = EIrcStatus::ParsingError;
 	goto cleanup;
 channel_not_found:
-	std::cerr << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The extracted channel '" << extracted_channel << "' could not be found\n";
 	ret = EIrcStatus::ObjectNotFound;
 	goto cleanup;
 cleanup:
-	FREE(extracted_channel);
-	FREE(extracted_topic);
 	return ret;
 }
 
@@ -2353,17 +3050,17 @@ IrcParser::HasChannelPrefix(
 
 	if ( connection == nullptr )
 	{
-		std::cerr << fg_red << "The supplied connection was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connection was a nullptr\n";
 		return false;
 	}
 	if ( str == nullptr )
 	{
-		std::cerr << fg_red << "The input string was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The input string was a nullptr\n";
 		return false;
 	}
 	if (( network = connection->Owner()) == nullptr )
 	{
-		std::cerr << fg_red << "The supplied connections owning network was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connections owning network was a nullptr\n";
 		return false;
 	}
 
@@ -2388,17 +3085,17 @@ IrcParser::ModeHasArgument(
 
 	if ( connection == nullptr )
 	{
-		std::cerr << fg_red << "The supplied connection was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connection was a nullptr\n";
 		return false;
 	}
 	if ( mode == '\0' )
 	{
-		std::cerr << fg_red << "The supplied mode was a NUL\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied mode was a NUL\n";
 		return false;
 	}
 	if (( network = connection->Owner()) == nullptr )
 	{
-		std::cerr << fg_red << "The supplied connections owning network was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connections owning network was a nullptr\n";
 		return false;
 	}
 	
@@ -2431,12 +3128,12 @@ IrcParser::ParseParam(
 
 	if ( data == nullptr )
 	{
-		std::cerr << fg_red << "The input string was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The input string was a nullptr\n";
 		return nullptr;
 	}
 	if ( *data == nullptr )
 	{
-		std::cerr << fg_red << "The input string started with a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The input string started with a nullptr\n";
 		return nullptr;
 	}
 
@@ -2470,23 +3167,27 @@ IrcParser::ParseParameters(
 {
 	char**		arg_str = nullptr;
 	char*		tmp_str = nullptr;
-	char*		p = (char*)buffer;
-	uint32_t	alloc;
+	char*		p = nullptr;
 	uint32_t	i = num_args;   // copy in case we need to revert our actions
 	va_list		args;
 
 	if ( buffer == nullptr )
 	{
-		std::cerr << fg_red << "The supplied buffer was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied buffer was a nullptr\n";
 		return false;
 	}
 	
 	if ( num_args == 0 )
 	{
-		std::cerr << fg_red << "No arguments were supplied\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "No arguments were supplied\n";
 		return false;
 	}
 
+	/* one copy of the whole line, split in place; every parameter points
+	 * into it, and it all goes when the arena is reset after dispatch */
+	if (( p = _arena.Duplicate(buffer, strlen(buffer))) == nullptr )
+		throw std::bad_alloc();
+
 	// va_start MUST receive the last member passed into the function!
 	va_start(args, num_args);
 
@@ -2509,14 +3210,7 @@ IrcParser::ParseParameters(
 		 * the data (e.g. &extracted_nick, NULL, &extracted_data), so NULLs
 		 * must be acceptable when passed in. */
 		if ( arg_str != nullptr && *arg_str == nullptr )
-		{
-			alloc = strlen(tmp_str) + 1;
-			*arg_str = (char*)MALLOC(alloc);
-			strlcpy(*arg_str, tmp_str, alloc);
-
-			if ( &*arg_str == nullptr )
-				throw std::bad_alloc();
-		}
+			*arg_str = tmp_str;
 	}
 
 	va_end(args);
@@ -2554,7 +3248,7 @@ IrcParser::ParseConnectionQueues(
 
 	if ( connection == nullptr )
 	{
-		std::cerr << fg_red << "The supplied connection was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connection was a nullptr\n";
 		return EIrcStatus::MissingParameter;
 	}
 
@@ -2572,7 +3266,8 @@ IrcParser::ParseConnectionQueues(
 	{
 		ret_code = ProcessNextSendQueueItem(connection);
 	}
-	while ( ret_code != EIrcStatus::QueueEmpty );
+	// a throttled connection has its own timer to come back to the rest
+	while ( ret_code != EIrcStatus::QueueEmpty && ret_code != EIrcStatus::Throttled );
 
 	return EIrcStatus::OK;
 }
@@ -2586,8 +3281,6 @@ IrcParser::ParseNextRecvQueueItem(
 {
 	std::string	queue_str;
 	const char*	err = nullptr;
-	ircbuf_data	buf_data;
-	ircbuf_sender	sender;
 
 	if ( connection == nullptr )
 		goto no_connection;
@@ -2603,19 +3296,44 @@ IrcParser::ParseNextRecvQueueItem(
 			return EIrcStatus::QueueEmpty;
 		}
 
-		queue_str = connection->_recv_queue.front();
+		// taken over, not copied; the connection thread allocated it
+		queue_str = std::move(connection->_recv_queue.front());
 		connection->_recv_queue.pop();
+		connection->_recv_queue_bytes -= (uint32_t)queue_str.length();
 	}
 
-	std::cout << fg_cyan << "Parsing " << fg_white << queue_str.c_str() << "\n";
+	MEM_ACCOUNT(RecvQueues, -(int64_t)queue_str.length(), -1);
+
+	DIAG(EDiagCategory::Parser, ELogLevel::Debug) << fg_cyan << "Parsing " << fg_white << queue_str.c_str() << "\n";
+
+	/* with server-time, message-tags or batch enabled, lines may begin
+	 * with '@tags '. Nothing we handle makes use of them yet, so drop
+	 * them here rather than have every handler skip over them */
+	if ( !queue_str.empty() && queue_str[0] == '@' && connection->HasCap(CAP_TAGGED) )
+	{
+		size_t	pos = queue_str.find(' ');
+
+		if ( pos == std::string::npos )
+			return EIrcStatus::ParsingError;
+
+		queue_str.erase(0, pos + 1);
+	}
 
 	if ( strncmp(queue_str.c_str(), "ERROR :", 7) == 0 )
 	{
 		/* the server can disconnect us, for things like registration
 		 * time-outs. Pass the error string so it can be logged. */
-		err = queue_str.substr(7).c_str();
+		err = queue_str.c_str() + 7;
 		goto srv_error;
 	}
+	else if ( strncmp(queue_str.c_str(), "AUTHENTICATE ", 13) == 0 )
+	{
+		/* unprefixed, like ERROR; the server is ready for our SASL
+		 * credentials ('AUTHENTICATE +') */
+		if ( connection->_sasl_state == ESaslState::Authenticating )
+			return connection->SendSaslCredentials();
+		return EIrcStatus::OK;
+	}
 #if 0	// Code Removed: now done pre-reading the first buffer in EstablishConnection()
 	else if ( !(connection->_state & CS_InitSent) )
 	{
@@ -2631,16 +3349,17 @@ IrcParser::ParseNextRecvQueueItem(
 		uint32_t	len;
 		uint16_t	numeric;
 
-		/* generates errors themselves */
-		if ( ExtractIrcBufData(queue_str.c_str(), &buf_data) != EIrcStatus::OK )
+		/* generates errors themselves. Split into the members, which
+		 * keep their capacity from the lines before */
+		if ( ExtractIrcBufData(queue_str.c_str(), &_buf_data) != EIrcStatus::OK )
 			goto extract_failed;
-		if ( SplitSender(buf_data.sender.c_str(), &sender) != EIrcStatus::OK )
+		if ( SplitSender(_buf_data.sender.c_str(), &_buf_sender) != EIrcStatus::OK )
 			goto split_failed;
-		if ( buf_data.code.length() < 3 )
+		if ( _buf_data.code.length() < 3 )
 			goto invalid_code;
 
 
-		numeric = (uint16_t)atoi(buf_data.code.c_str());
+		numeric = (uint16_t)atoi(_buf_data.code.c_str());
 
 		if ( numeric > 0 && numeric < 1000 )
 		{
@@ -2649,31 +3368,58 @@ IrcParser::ParseNextRecvQueueItem(
 			case 1:		parser_func = &IrcParser::Handle001; goto exec;
 			case 2:		parser_func = &IrcParser::Handle002; goto exec;
 			case 5:		parser_func = &IrcParser::Handle005; goto exec;
+			case 303:	parser_func = &IrcParser::Handle303; goto exec;
+			case 315:	parser_func = &IrcParser::Handle315; goto exec;
 			case 332:	parser_func = &IrcParser::Handle332; goto exec;
 			case 333:	parser_func = &IrcParser::Handle333; goto exec;
 			case 353:	parser_func = &IrcParser::Handle353; goto exec;
+			case 354:	parser_func = &IrcParser::Handle354; goto exec;
 			case 366:	parser_func = &IrcParser::Handle366; goto exec;
 			case 372:	parser_func = &IrcParser::Handle372; goto exec;
 			case 375:	parser_func = &IrcParser::Handle375; goto exec;
-			case 376:	parser_func = &IrcParser::Handle376; goto exec;
+			case 376:	// RPL_ENDOFMOTD
+			case 422:	// ERR_NOMOTD
+				parser_func = &IrcParser::Handle376; goto exec;
 			case 432:	parser_func = &IrcParser::Handle432; goto exec;
 			case 433:	parser_func = &IrcParser::Handle433; goto exec;
+			case BAHAMUT_RPL_LOGON:
+			case BAHAMUT_RPL_NOWON:
+				parser_func = &IrcParser::Handle600; goto exec;
+			case BAHAMUT_RPL_LOGOFF:
+			case BAHAMUT_RPL_NOWOFF:
+				parser_func = &IrcParser::Handle601; goto exec;
+			case BAHAMUT_RPL_WATCHOFF:
+				goto cleanup;
+			case 730:	parser_func = &IrcParser::Handle730; goto exec;	// RPL_MONONLINE
+			case 731:	parser_func = &IrcParser::Handle731; goto exec;	// RPL_MONOFFLINE
+			case 732:	// RPL_MONLIST
+			case 733:	// RPL_ENDOFMONLIST
+				goto cleanup;
+			case 734:	parser_func = &IrcParser::Handle734; goto exec;	// ERR_MONLISTFULL
+			case 902:	// ERR_NICKLOCKED
+			case 904:	// ERR_SASLFAIL
+			case 905:	// ERR_SASLTOOLONG
+			case 906:	// ERR_SASLABORTED
+				parser_func = &IrcParser::Handle904; goto exec;
+			case 903:	// RPL_SASLSUCCESS
+			case 907:	// ERR_SASLALREADY
+				parser_func = &IrcParser::Handle903; goto exec;
 			default:
-				std::cout << fg_magenta << "Unhandled numeric: " << buf_data.code.c_str() << "\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Info) << fg_magenta << "Unhandled numeric: " << _buf_data.code.c_str() << "\n";
 				goto cleanup;
 			}
 		}
 		else
 		{
-			switch ( buf_data.code[0] )
+			switch ( _buf_data.code[0] )
 			{
 			case 'C':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'A':
 						{
-							switch ( buf_data.code[2] )
+							switch ( _buf_data.code[2] )
 							{
 							case 'P':	parser_func = &IrcParser::HandleCap; goto exec;
 							default:
@@ -2686,11 +3432,11 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'I':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'N':
 						{
-							switch ( buf_data.code[2] )
+							switch ( _buf_data.code[2] )
 							{
 							case 'V':	parser_func = &IrcParser::HandleInvite; goto exec;
 							default:
@@ -2703,7 +3449,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'J':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'O':	parser_func = &IrcParser::HandleJoin; goto exec;
 					default:
@@ -2712,11 +3458,11 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'K':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'I':
 						{
-							switch ( buf_data.code[2] )
+							switch ( _buf_data.code[2] )
 							{
 							case 'C':	parser_func = &IrcParser::HandleKick; goto exec;
 							case 'L':	parser_func = &IrcParser::HandleKill; goto exec;
@@ -2730,7 +3476,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'M':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'O':	parser_func = &IrcParser::HandleMode; goto exec;
 					default:
@@ -2739,7 +3485,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'N':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'I':	parser_func = &IrcParser::HandleNick; goto exec;
 					case 'O':	parser_func = &IrcParser::HandleNotice; goto exec;
@@ -2749,7 +3495,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'P':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'A':	parser_func = &IrcParser::HandlePart; goto exec;
 					case 'O':	parser_func = &IrcParser::HandlePong; goto exec;
@@ -2760,7 +3506,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'Q':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'U':	parser_func = &IrcParser::HandleQuit; goto exec;
 					default:
@@ -2769,7 +3515,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			case 'T':
 				{
-					switch ( buf_data.code[1] )
+					switch ( _buf_data.code[1] )
 					{
 					case 'O':	parser_func = &IrcParser::HandleTopic; goto exec;
 					default:
@@ -2778,7 +3524,7 @@ IrcParser::ParseNextRecvQueueItem(
 				}
 			default:
 unhandled_text:
-				std::cout << fg_magenta << "Unhandled text-code: " << buf_data.code.c_str() << "\n";
+				DIAG(EDiagCategory::Parser, ELogLevel::Info) << fg_magenta << "Unhandled text-code: " << _buf_data.code.c_str() << "\n";
 				goto cleanup;
 			}
 		}
@@ -2786,7 +3532,10 @@ exec:
 		//dbgprint("Executing Handler, 0x%p\n", parser_func);
 
 		// calling member function pointers is fun!
-		((IrcParser*)this->*parser_func)(connection, &buf_data, &sender);
+		((IrcParser*)this->*parser_func)(connection, &_buf_data, &_buf_sender);
+
+		// nothing the handler took from the arena outlives it
+		_arena.Reset();
 	}
 
 cleanup:
@@ -2794,17 +3543,17 @@ cleanup:
 	return EIrcStatus::OK;
 
 no_connection:
-	std::cerr << fg_red << "The supplied connection was a nullptr\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connection was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 extract_failed:
 	return EIrcStatus::ParsingError;
 split_failed:
 	return EIrcStatus::ParsingError;
 invalid_code:
-	std::cerr << fg_red << "An invalid code was received: " << buf_data.code.c_str() << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "An invalid code was received: " << _buf_data.code.c_str() << "\n";
 	return EIrcStatus::InvalidData;
 srv_error:
-	std::cerr << fg_red << "The server closed the connection: " << err << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The server closed the connection: " << err << "\n";
 	connection->_state = CS_Disconnected;
 	return EIrcStatus::ServerClosed;
 }
@@ -2818,18 +3567,13 @@ IrcParser::ProcessNextSendQueueItem(
 {
 	if ( connection == nullptr )
 	{
-		std::cerr << fg_red << "The supplied connection was a nullptr\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied connection was a nullptr\n";
 		return EIrcStatus::MissingParameter;
 	}
 
-	if ( connection->_send_queue.empty() )
-	{
-		return EIrcStatus::QueueEmpty;
-	}
-
-	// to add processing...
-
-	return EIrcStatus::OK;
+	/* lines queued since the last pass are written as one batch; if more
+	 * than a batch is waiting, we're called again until the queue is empty */
+	return connection->FlushSendQueue();
 }
 
 
@@ -2837,34 +3581,50 @@ IrcParser::ProcessNextSendQueueItem(
 EIrcStatus
 IrcParser::RunParser()
 {
+	// anything armed while we sleep without a timeout wakes us
+	runtime.Timers()->SetWakeHook(&wake_parser, (void*)this);
+
 	try
 	{
 
 	for ( ;; )
 	{
 #if defined(_WIN32)
-		DWORD	wait_ret;
-
+		// before checking the timers, so a wake in between isn't lost
 		ResetEvent(_sync_event);
+#endif
+
+		/* only wake for the timers if any are armed; the wheel ticks
+		 * at TIMER_WHEEL_TICK_MS, so that is the most we'll sleep */
+		uint32_t	timeout = runtime.Timers()->MsUntilNextTick();
+
+#if defined(_WIN32)
+		DWORD	wait_ret;
 
-		wait_ret = WaitForSingleObject(_sync_event, INFINITE);
+		wait_ret = WaitForSingleObject(_sync_event, timeout == UINT32_MAX ? INFINITE : timeout);
 
-		/* object type can only return _0 or FAILED, as it never
-		 * times out and is not a mutex */
+		/* object type can only return _0, TIMEOUT or FAILED, as it is
+		 * not a mutex */
 		if ( wait_ret == WAIT_FAILED )
 		{
-			std::cerr << fg_red << "WaitForSingleObject() failed for the parser sync event; last error= " << GetLastError() << "\n";
+			DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "WaitForSingleObject() failed for the parser sync event; last error= " << GetLastError() << "\n";
 			return EIrcStatus::OSAPIError;
 		}
-		else if ( wait_ret == WAIT_OBJECT_0 )
+		else if ( wait_ret == WAIT_OBJECT_0 || wait_ret == WAIT_TIMEOUT )
 #else
-		sync_event_wait(&_sync_event);
+		if ( timeout == UINT32_MAX )
+			sync_event_wait(&_sync_event);
+		else
+			sync_event_timed_wait(&_sync_event, timeout);
 #endif
 		{
 			// abort immediately if the app is quitting
 			if ( runtime.IsQuitting() )
 				break;
 
+			// timeouts first, as they may well queue data to send
+			runtime.Timers()->Advance();
+
 			for ( auto c : _irc_engine->Pools()->IrcConnections()->Allocated() )
 			{
 				ParseConnectionQueues(c);
@@ -2875,13 +3635,15 @@ IrcParser::RunParser()
 	}
 	catch ( std::exception& e )
 	{
-		std::cerr << fg_red << "Caught an exception; " << e.what() << "\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Caught an exception; " << e.what() << "\n";
 	}
 	catch ( ... )
 	{
-		std::cerr << fg_red << "Caught an unhandled exception\n";
+		DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Caught an unhandled exception\n";
 	}
 
+	runtime.Timers()->SetWakeHook(nullptr, nullptr);
+
 #if defined(_WIN32)
 	runtime.ThreadStopping(GetCurrentThreadId(), __FUNCTION__);
 #else
@@ -2900,57 +3662,27 @@ IrcParser::SplitSender(
 ) const
 {
 	/* although we modify buffer, we will not alter its length (we only
-	 * replace spaces with nul characters), therefore this function is still
-	 * safe to use with a caller of a CHARSTRINGTYPE->c_str() */
-
-	char*	nickname = (char*)&buffer[0];
-	char*	ident = nullptr;
-	char*	hostmask = nullptr;
+	 * replace separators with nul characters), therefore this function is
+	 * still safe to use with a caller of a CHARSTRINGTYPE->c_str() */
 
 	if ( buffer == nullptr )
 		goto no_buffer;
 	if ( sender == nullptr )
 		goto no_sender;
 
-	ident = strchr(nickname, '!');
-
-	if ( ident == nullptr )
-	{
-		/* message from the server - ideally should be a check with what
-		 * we received on the initial connection, and if it doesn't 
-		 * match it should be regarded as invalid. */
-		sender->nickname	= nickname;
-		return EIrcStatus::OK;
-	}
-
-	// null-out the space, and proceed to the 'first' character
-	*ident = '\0';
-	ident++;
-
-	// copy the data, up to the first space (which is now a nul)
-	sender->nickname	= nickname;
-
-	hostmask = strchr(ident, '@');
-
-	if ( hostmask == nullptr )
+	if ( split_ircbuf_sender((char*)buffer, sender) != LS_OK )
 		goto missing_data;
 
-	*hostmask = '\0';
-	hostmask++;
-
-	sender->ident		= ident;
-	sender->hostmask	= hostmask;
-
 	return EIrcStatus::OK;
 
 no_buffer:
-	std::cerr << fg_red << "The supplied buffer was a nullptr\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied buffer was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 no_sender:
-	std::cerr << fg_red << "The supplied sender struct was a nullptr\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The supplied sender struct was a nullptr\n";
 	return EIrcStatus::MissingParameter;
 missing_data:
-	std::cerr << fg_red << "The hostmask is missing where expected: " << ident << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "The hostmask is missing where expected: " << buffer << "\n";
 	return EIrcStatus::ParsingError;
 }
 
@@ -2966,7 +3698,7 @@ IrcParser::TriggerSync() const
 	return;
 
 evt_failure:
-	std::cerr << fg_red << "Failed to signal the parser event; last error= " << GetLastError() << "\n";
+	DIAG(EDiagCategory::Parser, ELogLevel::Error) << fg_red << "Failed to signal the parser event; last error= " << GetLastError() << "\n";
 
 #elif defined(__linux__) || defined(BSD)
 
@@ -11,8 +11,10 @@
 #include <memory>			// std::shared_ptr
 
 #include <api/Runtime.h>
+#include <api/ScratchArena.h>
 #include "IrcObject.h"
 #include "IrcListener.h"
+#include "irc_line_split.h"
 #include "irc_structs.h"
 #include "irc_status.h"
 
@@ -76,6 +78,22 @@ private:
 	mutable sync_event	_sync_event;
 #endif
 
+	/**
+	 * Scratch memory for the message being handled; parameters, copies and
+	 * containers the handlers need only until they return. Reset after
+	 * every dispatch. Objects the handlers create or update, and listener
+	 * notifications, still use the heap.
+	 */
+	mutable ScratchArena	_arena;
+
+	/**
+	 * The message being handled, split; kept from one message to the next
+	 * so the strings keep their capacity, and splitting doesn't allocate.
+	 * The handlers may modify them in place.
+	 */
+	mutable ircbuf_data	_buf_data;
+	mutable ircbuf_sender	_buf_sender;
+
 
 	/**
 	 * Used for creating a thread for the RunParser() function.
@@ -209,6 +227,38 @@ private:
 		ircbuf_sender* sender
 	);
 
+	/**
+	 * Parses the 303 numeric; an ISON reply, for the PresenceTracker
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle303(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 315 numeric; applies the details our WHOX collected
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle315(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
 	/**
 	 * Parses the 332 numeric
 	 *
@@ -257,6 +307,22 @@ private:
 		ircbuf_sender* sender
 	);
 
+	/**
+	 * Parses the 354 numeric; a WHOX reply, collected until the 315
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle354(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
 	/**
 	 * Parses the 366 numeric
 	 *
@@ -353,6 +419,118 @@ private:
 		ircbuf_sender* sender
 	);
 
+	/**
+	 * Parses the 600 numeric (and 604); a WATCHed nickname is online
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle600(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 601 numeric (and 605); a WATCHed nickname is offline
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle601(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 730 numeric; MONITORed nicknames are online
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle730(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 731 numeric; MONITORed nicknames are offline
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle731(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 734 numeric; the MONITOR list is full
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle734(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 903 numeric (and 907)
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle903(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
+	/**
+	 * Parses the 904 numeric (and 902, 905, 906)
+	 *
+	 * @param connection The connection the data was received from
+	 * @param data The segmented data received into sender, code + data
+	 * @param sender The nickname, ident and hostmask combo
+	 * @return If the processed data was valid, EIrcStatus::Ok is returned.
+	 * @return If parsing/processing fails, returns the relevant EIrcStatus.
+	 */
+	EIrcStatus
+	Handle904(
+		std::shared_ptr<IrcConnection> connection,
+		ircbuf_data* data,
+		ircbuf_sender* sender
+	);
+
 	/**
 	 * Parses CAP
 	 *
@@ -683,11 +861,12 @@ public:
 
 
 	/**
-	 * Parses the next send queue item, which should be a raw IRC message.
+	 * Sends the next batch of send queue items; every line queued since the
+	 * last pass goes out in a single write (up to MAX_LEN_SEND_BATCH).
 	 *
 	 * @param connection The connection containing the send queue to process
-	 * @return Returns IRCS_OK if a queue item was popped and sent off to
-	 * the server
+	 * @return Returns IRCS_OK if a batch was popped and sent off to the
+	 * server
 	 * @return Returns IRCS_QueueEmpty if there are no queue items
 	 * @return Otherwise, the appropriate EIrcStatus is returned
 	 */
@@ -719,6 +898,10 @@ public:
 	 * (:) storing the results in the supplied arguments, by calling
 	 * ParseParam().
 	 *
+	 * The buffer is copied into the message arena and split in place, so
+	 * the results are only valid until the handler returns, and must not
+	 * be freed.
+	 *
 	 * @code
 	 char*    extracted_channel = NULL;
 	 char*    extracted_kicked = NULL;
@@ -727,7 +910,7 @@ public:
 	 if ( !ParseParameters(data->data, 3, &extracted_channel, &extracted_kicked, &extracted_kick_message) )
 		goto parse_failure;
 
-	 // the extracted_* variables now contain an allocated buffer
+	 // the extracted_* variables now point into the message arena
 	 * @endcode
 	 *
 	 * @param[in] buffer The buffer containing the original string from the 
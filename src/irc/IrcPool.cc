@@ -14,6 +14,8 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 
 
 IrcPool::IrcPool()
+: _users(EMemSubsystem::IrcUsers), _channels(EMemSubsystem::IrcChannels),
+  _connections(EMemSubsystem::IrcConnections), _networks(EMemSubsystem::IrcNetworks)
 {
 }
 
@@ -110,6 +112,10 @@ IrcPool::GetUser(
 
 	for ( auto u : _users.Allocated() )
 	{
+		// held by the NetsplitTracker, not in the channel
+		if ( u->IsSplit() )
+			continue;
+
 		if ( u->Nickname().compare(nickname) == 0 )
 		{
 			if ( u->Owner()->Name().compare(channel_name) == 0 )
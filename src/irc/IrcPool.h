@@ -19,6 +19,7 @@
 #include <api/Log.h>
 #include <api/utils.h>			// BUILD_STRING, strlcpy
 #include <api/Allocator.h>		// memory allocation macros
+#include <api/MemoryAccounting.h>	// MEM_ACCOUNT
 
 #include "IrcChannel.h"
 #include "IrcConnection.h"
@@ -111,6 +112,9 @@ private:
 	/** The lock for making modifications per pool */
 	std::mutex	_mutex;
 
+	/** What the objects handed out are accounted against */
+	EMemSubsystem	_subsystem;
+
 
 
 	/**
@@ -210,12 +214,17 @@ private:
 		_used_list.pop();
 		// and remove our reference to it
 		_objects.erase(std::find(_objects.begin(), _objects.end(), object));
+
+		runtime.Accounting()->Add(_subsystem, -(int64_t)sizeof(T), -1);
 	}
 
 
 public:
 
-	ObjectPool() : _pool(nullptr), _get_count(0)
+	ObjectPool(
+		EMemSubsystem subsystem
+	)
+	: _pool(nullptr), _get_count(0), _subsystem(subsystem)
 	{
 	}
 	~ObjectPool()
@@ -263,6 +272,7 @@ public:
 		{
 			// still referenced; reattempt delete later
 			_delete_later.push_back(object);
+			_mutex.unlock();
 			return true;
 		}
 		
@@ -346,6 +356,8 @@ public:
 
 		_mutex.unlock();
 
+		runtime.Accounting()->Add(_subsystem, sizeof(T), 1);
+
 		return ptr;
 	}
 
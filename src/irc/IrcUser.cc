@@ -50,12 +50,23 @@ IrcUser::Cleanup()
 	_nickname.clear();
 	_ident.clear();
 	_hostmask.clear();
+	_account.clear();
+	_realname.clear();
 
 	return EIrcStatus::OK;
 }
 
 
 
+std::string
+IrcUser::Account() const
+{
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+	return _account;
+}
+
+
+
 std::string
 IrcUser::Hostmask() const
 {
@@ -74,6 +85,15 @@ IrcUser::Ident() const
 
 
 
+bool
+IrcUser::IsSplit() const
+{
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+	return (_flags & USERFLAG_SPLIT) != 0;
+}
+
+
+
 std::string
 IrcUser::Nickname() const
 {
@@ -92,6 +112,15 @@ IrcUser::Owner()
 
 
 
+std::string
+IrcUser::RealName() const
+{
+	std::lock_guard<std::recursive_mutex>	lock(_mutex);
+	return _realname;
+}
+
+
+
 EIrcStatus
 IrcUser::Update(
 	const char* new_nickname,
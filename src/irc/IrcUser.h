@@ -24,6 +24,9 @@ class IrcChannel;
 struct mode_update;
 
 
+#define USERFLAG_SPLIT		0x0001	/**< Left in a netsplit; held for the rejoin */
+
+
 
 /**
  * An IRC user, used within all IRC channels
@@ -34,6 +37,8 @@ class SBI_IRC_API IrcUser : public IrcObject
 {
 	// Updates internals directly when parsing relevant data
 	friend class IrcParser;
+	// Detaches and restores users across netsplits
+	friend class NetsplitTracker;
 private:
 	NO_CLASS_ASSIGNMENT(IrcUser);
 	NO_CLASS_COPY(IrcUser);
@@ -43,6 +48,8 @@ private:
 	std::string		_nickname;	/**< The users nickname on the server */
 	std::string		_ident;		/**< The users ident */
 	std::string		_hostmask;	/**< The users hostmask */
+	std::string		_account;	/**< The services account, if logged in and known */
+	std::string		_realname;	/**< The users real name (gecos), if known */
 
 	/** The channel owning this user. Being weak enables the channel to be
 	 * deleted while this/other users are still being accessed. */
@@ -75,6 +82,14 @@ public:
 	Cleanup();
 
 
+	/**
+	 * Retrieves the services account the user is logged in to; empty if
+	 * they are not, or the server has not told us (WHOX).
+	 */
+	std::string
+	Account() const;
+
+
 	/**
 	 * 
 	 */
@@ -89,6 +104,15 @@ public:
 	Ident() const;
 
 
+	/**
+	 * Determines if the user left in a netsplit, and is being held by the
+	 * NetsplitTracker for their return; such users are not in the channel,
+	 * and lookups skip them.
+	 */
+	bool
+	IsSplit() const;
+
+
 	/**
 	 * 
 	 */
@@ -103,6 +127,14 @@ public:
 	Owner();
 
 
+	/**
+	 * Retrieves the users real name; empty until the server has told us
+	 * (WHOX).
+	 */
+	std::string
+	RealName() const;
+
+
 	/**
 	 * Updates the specified user object with the supplied details; NULL values
 	 * will not replace any existing data.
@@ -0,0 +1,524 @@
+
+/**
+ * @file	src/irc/NetsplitTracker.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <cctype>			// isalnum
+
+#include <api/Log.h>
+#include <api/Runtime.h>
+#include <api/interface.h>		// instance()
+#include "NetsplitTracker.h"		// prototypes
+#include "IrcEngine.h"
+#include "IrcConnection.h"
+#include "IrcChannel.h"
+#include "IrcUser.h"
+#include "IrcPool.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/**
+ * Converts a nickname into the form used as its key; rfc1459 casemapping,
+ * as with the PresenceTracker.
+ *
+ * @param[in] nickname The nickname
+ * @return The casemapped nickname
+ */
+static std::string
+netsplit_key(
+	const std::string& nickname
+)
+{
+	std::string	key = nickname;
+
+	for ( auto& c : key )
+	{
+		if ( c >= 'A' && c <= '^' )
+			c += ('a' - 'A');
+	}
+
+	return key;
+}
+
+
+
+/**
+ * Checks a single token is plausibly a server name; dotted, and only the
+ * characters a hostname (or a masked one, '*.net') can contain.
+ *
+ * @param[in] name The start of the token
+ * @param[in] len The length of the token
+ * @return true if the token is a server name
+ */
+static bool
+is_server_name(
+	const char* name,
+	size_t len
+)
+{
+	bool	dotted = false;
+
+	if ( len < 3 || name[0] == '.' || name[len - 1] == '.' )
+		return false;
+
+	for ( size_t i = 0; i < len; i++ )
+	{
+		if ( name[i] == '.' )
+		{
+			if ( name[i - 1] == '.' )
+				return false;
+			dotted = true;
+		}
+		else if ( !isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '*' )
+		{
+			return false;
+		}
+	}
+
+	return dotted;
+}
+
+
+
+NetsplitTracker::NetsplitTracker()
+{
+}
+
+
+
+NetsplitTracker::~NetsplitTracker()
+{
+}
+
+
+
+void
+NetsplitTracker::ApplyQuits(
+	uint32_t connection_id,
+	netsplit_state& state,
+	std::vector<netsplit_event>& events
+)
+{
+	std::map<std::string, netsplit*>	quitting;
+
+	for ( auto& s : state.splits )
+	{
+		for ( auto& q : s.second.quitting )
+			quitting.insert(std::make_pair(q.first, &s.second));
+	}
+
+	if ( quitting.empty() )
+		return;
+
+	/* one pass over every user, rather than a search of every channel for
+	 * each QUIT; the users are detached, not freed, ready for the rejoin */
+	for ( auto u : IRC_ENGINE->Pools()->IrcUsers()->Allocated() )
+	{
+		std::shared_ptr<IrcChannel>	channel;
+		std::shared_ptr<IrcConnection>	owner;
+
+		if ( u->IsSplit() )
+			continue;
+		if (( channel = u->Owner()) == nullptr )
+			continue;
+		if (( owner = channel->Owner()) == nullptr || owner->Id() != connection_id )
+			continue;
+
+		auto	iter = quitting.find(netsplit_key(u->Nickname()));
+
+		if ( iter == quitting.end() )
+			continue;
+
+		{
+			std::lock_guard<std::recursive_mutex>	lock(u->_mutex);
+			u->_flags |= USERFLAG_SPLIT;
+		}
+
+		iter->second->users.insert(std::make_pair(iter->first, u));
+	}
+
+	for ( auto& s : state.splits )
+	{
+		netsplit_event	evt;
+
+		if ( s.second.quitting.empty() )
+			continue;
+
+		evt.type = LN_Netsplit;
+		evt.servers = s.first;
+		for ( auto& q : s.second.quitting )
+			evt.nicknames.push_back(q.second);
+
+		LOG(ELogLevel::Info) << "Netsplit " << s.first << " on connection " <<
+			connection_id << "; " << evt.nicknames.size() << " users quit\n";
+
+		s.second.quitting.clear();
+		events.push_back(evt);
+	}
+}
+
+
+
+void
+NetsplitTracker::Forget(
+	uint32_t connection_id
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	auto	iter = _states.find(connection_id);
+
+	if ( iter == _states.end() )
+		return;
+
+	runtime.Timers()->Cancel(iter->second.quit_timer);
+	runtime.Timers()->Cancel(iter->second.join_timer);
+	runtime.Timers()->Cancel(iter->second.expire_timer);
+
+	for ( auto& s : iter->second.splits )
+		FreeUsers(s.second);
+
+	_states.erase(iter);
+}
+
+
+
+void
+NetsplitTracker::FreeUsers(
+	netsplit& split
+)
+{
+	for ( auto& u : split.users )
+	{
+		// moved, so the pool holds the only other reference
+		IRC_ENGINE->Pools()->IrcUsers()->FreeObject(std::move(u.second));
+	}
+
+	split.users.clear();
+}
+
+
+
+bool
+NetsplitTracker::IsSplitMessage(
+	const std::string& quit_message
+)
+{
+	size_t	pos = quit_message.find(' ');
+
+	if ( pos == std::string::npos )
+		return false;
+	if ( quit_message.find(' ', pos + 1) != std::string::npos )
+		return false;
+
+	// a link to itself can't break
+	if ( quit_message.compare(0, pos, quit_message, pos + 1, std::string::npos) == 0 )
+		return false;
+
+	return is_server_name(quit_message.c_str(), pos)
+	    && is_server_name(quit_message.c_str() + pos + 1, quit_message.length() - pos - 1);
+}
+
+
+
+bool
+NetsplitTracker::Join(
+	std::shared_ptr<IrcConnection> connection,
+	const std::string& channel_name,
+	const std::string& nickname,
+	const std::string& ident,
+	const std::string& hostmask
+)
+{
+	std::vector<netsplit_event>	events;
+	std::string	key = netsplit_key(nickname);
+	bool		restored = false;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		auto	iter = _states.find(connection->Id());
+
+		if ( iter == _states.end() )
+			return false;
+
+		netsplit_state&	state = iter->second;
+
+		// quick rejoin; the split must be applied first
+		if ( state.quit_timer != 0 )
+		{
+			runtime.Timers()->Cancel(state.quit_timer);
+			state.quit_timer = 0;
+			ApplyQuits(connection->Id(), state, events);
+		}
+
+		for ( auto& s : state.splits )
+		{
+			auto	range = s.second.users.equal_range(key);
+
+			for ( auto u = range.first; u != range.second; u++ )
+			{
+				std::shared_ptr<IrcChannel>	channel = u->second->Owner();
+
+				if ( channel == nullptr || channel->Name().compare(channel_name) != 0 )
+					continue;
+
+				if ( u->second->Ident().compare(ident) != 0 
+				  || u->second->Hostmask().compare(hostmask) != 0 )
+				{
+					/* someone else has taken the nickname; theirs is
+					 * a normal JOIN, and the held user is stale */
+					IRC_ENGINE->Pools()->IrcUsers()->FreeObject(std::move(u->second));
+					s.second.users.erase(u);
+					break;
+				}
+
+				{
+					std::lock_guard<std::recursive_mutex>	ulock(u->second->_mutex);
+					u->second->_flags &= ~USERFLAG_SPLIT;
+					// the nickname case may differ
+					u->second->_nickname = nickname;
+				}
+
+				s.second.users.erase(u);
+				s.second.rejoined.insert(std::make_pair(key, nickname));
+				restored = true;
+				break;
+			}
+
+			if ( restored )
+				break;
+		}
+
+		if ( restored && state.join_timer == 0 )
+		{
+			state.join_timer = runtime.Timers()->Arm(
+				NETSPLIT_JOIN_WINDOW_MS, &NetsplitTracker::OnJoinTimer,
+				(void*)(uintptr_t)connection->Id()
+			);
+		}
+	}
+
+	Notify(connection, events);
+
+	return restored;
+}
+
+
+
+void
+NetsplitTracker::Notify(
+	std::shared_ptr<IrcConnection> connection,
+	std::vector<netsplit_event>& events
+)
+{
+	irc_activity&	activity = connection->GetActivity();
+
+	for ( auto& e : events )
+	{
+		activity.channel_name.clear();
+		activity.instigator.nickname.clear();
+		activity.instigator.ident.clear();
+		activity.instigator.hostmask.clear();
+		activity.nickname.clear();
+		activity.message	= e.servers;
+		activity.data		= e.type == LN_Netsplit ? "netsplit" : "netjoin";
+		activity.nicknames.swap(e.nicknames);
+
+		IRC_ENGINE->NotifyListeners(e.type, connection);
+
+		activity.nicknames.clear();
+	}
+}
+
+
+
+void
+NetsplitTracker::OnExpireTimer(
+	timer_id id,
+	void* context
+)
+{
+	NetsplitTracker*	tracker = IRC_ENGINE->Netsplits();
+	uint32_t		connection_id = (uint32_t)(uintptr_t)context;
+	std::lock_guard<std::mutex>	lock(tracker->_mutex);
+	auto	iter = tracker->_states.find(connection_id);
+	time_t	now = time(nullptr);
+
+	if ( iter == tracker->_states.end() )
+		return;
+
+	netsplit_state&	state = iter->second;
+
+	state.expire_timer = 0;
+
+	for ( auto s = state.splits.begin(); s != state.splits.end(); )
+	{
+		if ( (now - s->second.started) * 1000 < NETSPLIT_EXPIRE_MS 
+		  || !s->second.quitting.empty() || !s->second.rejoined.empty() )
+		{
+			++s;
+			continue;
+		}
+
+		LOG(ELogLevel::Info) << "Netsplit " << s->first << " expired; " <<
+			s->second.users.size() << " users did not return\n";
+
+		tracker->FreeUsers(s->second);
+		s = state.splits.erase(s);
+	}
+
+	if ( !state.splits.empty() )
+	{
+		state.expire_timer = runtime.Timers()->Arm(
+			NETSPLIT_EXPIRE_MS, &NetsplitTracker::OnExpireTimer, context
+		);
+	}
+}
+
+
+
+void
+NetsplitTracker::OnJoinTimer(
+	timer_id id,
+	void* context
+)
+{
+	NetsplitTracker*	tracker = IRC_ENGINE->Netsplits();
+	uint32_t		connection_id = (uint32_t)(uintptr_t)context;
+	std::shared_ptr<IrcConnection>	connection = IRC_ENGINE->Pools()->GetConnection(connection_id);
+	std::vector<netsplit_event>	events;
+
+	{
+		std::lock_guard<std::mutex>	lock(tracker->_mutex);
+		auto	iter = tracker->_states.find(connection_id);
+
+		if ( iter == tracker->_states.end() )
+			return;
+
+		netsplit_state&	state = iter->second;
+
+		state.join_timer = 0;
+
+		for ( auto s = state.splits.begin(); s != state.splits.end(); )
+		{
+			if ( !s->second.rejoined.empty() )
+			{
+				netsplit_event	evt;
+
+				evt.type = LN_Netjoin;
+				evt.servers = s->first;
+				for ( auto& r : s->second.rejoined )
+					evt.nicknames.push_back(r.second);
+
+				LOG(ELogLevel::Info) << "Netjoin " << s->first << " on connection " <<
+					connection_id << "; " << evt.nicknames.size() << " users returned\n";
+
+				s->second.rejoined.clear();
+				events.push_back(evt);
+			}
+
+			// healed; everyone is back
+			if ( s->second.users.empty() && s->second.quitting.empty() )
+				s = state.splits.erase(s);
+			else
+				++s;
+		}
+	}
+
+	if ( connection != nullptr )
+		tracker->Notify(connection, events);
+}
+
+
+
+void
+NetsplitTracker::OnQuitTimer(
+	timer_id id,
+	void* context
+)
+{
+	NetsplitTracker*	tracker = IRC_ENGINE->Netsplits();
+	uint32_t		connection_id = (uint32_t)(uintptr_t)context;
+	std::shared_ptr<IrcConnection>	connection = IRC_ENGINE->Pools()->GetConnection(connection_id);
+	std::vector<netsplit_event>	events;
+
+	{
+		std::lock_guard<std::mutex>	lock(tracker->_mutex);
+		auto	iter = tracker->_states.find(connection_id);
+
+		if ( iter == tracker->_states.end() )
+			return;
+
+		iter->second.quit_timer = 0;
+		tracker->ApplyQuits(connection_id, iter->second, events);
+	}
+
+	if ( connection != nullptr )
+		tracker->Notify(connection, events);
+}
+
+
+
+void
+NetsplitTracker::Quit(
+	std::shared_ptr<IrcConnection> connection,
+	const std::string& servers,
+	const std::string& nickname
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	uint32_t	connection_id = connection->Id();
+	auto		iter = _states.find(connection_id);
+
+	if ( iter == _states.end() )
+	{
+		netsplit_state	state;
+
+		state.quit_timer = 0;
+		state.join_timer = 0;
+		state.expire_timer = 0;
+
+		iter = _states.insert(std::make_pair(connection_id, state)).first;
+	}
+
+	netsplit_state&	state = iter->second;
+	auto		split = state.splits.find(servers);
+
+	if ( split == state.splits.end() )
+	{
+		netsplit	ns;
+
+		ns.started = time(nullptr);
+
+		split = state.splits.insert(std::make_pair(servers, ns)).first;
+	}
+
+	split->second.quitting.insert(std::make_pair(netsplit_key(nickname), nickname));
+
+	if ( state.quit_timer == 0 )
+	{
+		state.quit_timer = runtime.Timers()->Arm(
+			NETSPLIT_QUIT_WINDOW_MS, &NetsplitTracker::OnQuitTimer,
+			(void*)(uintptr_t)connection_id
+		);
+	}
+	if ( state.expire_timer == 0 )
+	{
+		state.expire_timer = runtime.Timers()->Arm(
+			NETSPLIT_EXPIRE_MS, &NetsplitTracker::OnExpireTimer,
+			(void*)(uintptr_t)connection_id
+		);
+	}
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,277 @@
+#pragma once
+
+/**
+ * @file	src/irc/NetsplitTracker.h
+ * @author	James Warren
+ * @brief	Collapses the QUIT and JOIN floods of a netsplit into bulk updates
+ */
+
+
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include <api/char_helper.h>
+#include <api/TimerWheel.h>		// timer_id
+#include "IrcListener.h"		// EIrcListenerNotification
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+// forward declarations
+class IrcConnection;
+class IrcUser;
+
+
+/** QUITs for a split are collected for this long before being applied */
+#define NETSPLIT_QUIT_WINDOW_MS		1000
+/** Rejoins are collected for this long into a single netjoin */
+#define NETSPLIT_JOIN_WINDOW_MS		2000
+/** Users of a split are held for rejoining for this long */
+#define NETSPLIT_EXPIRE_MS		(30 * 60 * 1000)
+
+
+/**
+ * A single netsplit; the link between two servers breaking.
+ *
+ * @struct netsplit
+ */
+struct netsplit
+{
+	time_t		started;	/**< When the first QUIT arrived */
+
+	/** QUITs awaiting removal; casemapped nickname to the nickname */
+	std::map<std::string, std::string>	quitting;
+	/** Rejoins awaiting notification; casemapped nickname to the nickname */
+	std::map<std::string, std::string>	rejoined;
+	/** The detached users, keyed by casemapped nickname; one per channel */
+	std::multimap<std::string, std::shared_ptr<IrcUser>>	users;
+};
+
+
+/**
+ * Netsplit state for a single connection.
+ *
+ * @struct netsplit_state
+ */
+struct netsplit_state
+{
+	timer_id	quit_timer;	/**< Applies the pending QUITs, or 0 */
+	timer_id	join_timer;	/**< Announces the pending rejoins, or 0 */
+	timer_id	expire_timer;	/**< Discards old splits, or 0 */
+
+	/** The splits, keyed by the servers ("server1 server2") */
+	std::map<std::string, netsplit>	splits;
+};
+
+
+/**
+ * A collapsed notification, built with the lock held and sent without.
+ *
+ * @struct netsplit_event
+ */
+struct netsplit_event
+{
+	EIrcListenerNotification	type;		/**< LN_Netsplit or LN_Netjoin */
+	std::string			servers;	/**< The servers involved */
+	std::vector<std::string>	nicknames;	/**< The users affected */
+};
+
+
+/**
+ * Detects netsplits on each connection and handles them in bulk.
+ *
+ * A split shows itself as a QUIT for every user behind the broken link,
+ * each with the message 'server1 server2'; when it heals, each of them
+ * JOINs every channel again. Handled one at a time, that's a listener
+ * event, and a scan of every user, per QUIT - and a fresh IrcUser per
+ * JOIN - all arriving at once.
+ *
+ * Instead, QUITs are collected for NETSPLIT_QUIT_WINDOW_MS, and removed
+ * from every channel in a single pass, with one LN_Netsplit. The IrcUser
+ * objects aren't freed but held, hidden from lookups, so the rejoins just
+ * bring them back - details and channel modes intact - with one
+ * LN_Netjoin for each NETSPLIT_JOIN_WINDOW_MS. Anyone not back within
+ * NETSPLIT_EXPIRE_MS is freed.
+ *
+ * @class NetsplitTracker
+ */
+class NetsplitTracker
+{
+	// we are created on the stack in IrcEngine::Netsplits()
+	friend class IrcEngine;
+private:
+	NO_CLASS_ASSIGNMENT(NetsplitTracker);
+	NO_CLASS_COPY(NetsplitTracker);
+
+	/** Synchronization lock for all members */
+	std::mutex		_mutex;
+
+	/** Split state, keyed by connection id */
+	std::map<uint32_t, netsplit_state>	_states;
+
+
+	/**
+	 * Removes the users of every pending QUIT from the connections
+	 * channels, in one pass over the users.
+	 *
+	 * The lock must be held.
+	 *
+	 * @param[in] connection_id The connection
+	 * @param[in] state The connections state
+	 * @param[out] events Receives the LN_Netsplit for each split
+	 */
+	void
+	ApplyQuits(
+		uint32_t connection_id,
+		netsplit_state& state,
+		std::vector<netsplit_event>& events
+	);
+
+
+	/**
+	 * Frees the detached users of a split.
+	 *
+	 * The lock must be held.
+	 */
+	void
+	FreeUsers(
+		netsplit& split
+	);
+
+
+	/**
+	 * Informs the listeners of each event; the lock must NOT be held, as
+	 * listeners may well call back into us.
+	 */
+	void
+	Notify(
+		std::shared_ptr<IrcConnection> connection,
+		std::vector<netsplit_event>& events
+	);
+
+
+	/**
+	 * Timer callback; frees the users of splits that have not healed in
+	 * NETSPLIT_EXPIRE_MS, and re-arms itself while any splits remain.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, cast to a pointer
+	 */
+	static void
+	OnExpireTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Timer callback; sends a LN_Netjoin for each split with rejoins, and
+	 * drops the splits that have fully healed.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, cast to a pointer
+	 */
+	static void
+	OnJoinTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Timer callback; applies the QUITs collected since the first.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, cast to a pointer
+	 */
+	static void
+	OnQuitTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	// private constructor; we want one instance that is controlled
+	NetsplitTracker();
+
+public:
+	~NetsplitTracker();
+
+
+	/**
+	 * Determines if a QUIT message is that of a netsplit; two server
+	 * names separated by a space, and nothing else. Servers prefix their
+	 * users own quit messages, so these can't be faked.
+	 *
+	 * @param[in] quit_message The QUIT message, without the leading colon
+	 * @return true if the message is a netsplit
+	 */
+	static bool
+	IsSplitMessage(
+		const std::string& quit_message
+	);
+
+
+	/**
+	 * Discards all splits for the connection, freeing the users held;
+	 * for when it is deleted.
+	 *
+	 * @param[in] connection_id The connection
+	 */
+	void
+	Forget(
+		uint32_t connection_id
+	);
+
+
+	/**
+	 * Handles a JOIN from another user. If they left in a split, their
+	 * held IrcUser is restored to the channel instead of a new one being
+	 * created, and they are included in the next LN_Netjoin rather than
+	 * getting a LN_Join of their own.
+	 *
+	 * @param[in] connection The connection the JOIN arrived on
+	 * @param[in] channel_name The channel joined
+	 * @param[in] nickname The joining users nickname
+	 * @param[in] ident The joining users ident
+	 * @param[in] hostmask The joining users hostmask
+	 * @return true if the user was restored; false if they weren't in a
+	 * split, and should be handled as a normal JOIN
+	 */
+	bool
+	Join(
+		std::shared_ptr<IrcConnection> connection,
+		const std::string& channel_name,
+		const std::string& nickname,
+		const std::string& ident,
+		const std::string& hostmask
+	);
+
+
+	/**
+	 * Handles a QUIT whose message IsSplitMessage. The user is removed,
+	 * along with the rest of the split, once NETSPLIT_QUIT_WINDOW_MS has
+	 * passed since the first.
+	 *
+	 * @param[in] connection The connection the QUIT arrived on
+	 * @param[in] servers The QUIT message; the servers that split
+	 * @param[in] nickname The quitting users nickname
+	 */
+	void
+	Quit(
+		std::shared_ptr<IrcConnection> connection,
+		const std::string& servers,
+		const std::string& nickname
+	);
+};
+
+
+
+END_NAMESPACE
@@ -0,0 +1,691 @@
+
+/**
+ * @file	src/irc/PresenceTracker.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <set>
+
+#include <api/Log.h>
+#include <api/Runtime.h>
+#include <api/Terminal.h>
+#include <api/interface.h>		// instance()
+#include "PresenceTracker.h"		// prototypes
+#include "IrcEngine.h"
+#include "IrcConnection.h"
+#include "IrcListener.h"		// notification types
+#include "IrcNetwork.h"
+#include "IrcPool.h"
+#include "config_structs.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/**
+ * Converts a nickname into the form used as its key, so the differently
+ * cased forms of a nickname are the same entry. Uses rfc1459 casemapping -
+ * A-Z[]\^ are the uppercase forms of a-z{}|~ - the default, and a superset
+ * of the others.
+ *
+ * @param[in] nickname The nickname
+ * @return The casemapped nickname
+ */
+static std::string
+presence_key(
+	const std::string& nickname
+)
+{
+	std::string	key = nickname;
+
+	for ( auto& c : key )
+	{
+		if ( c >= 'A' && c <= '^' )
+			c += ('a' - 'A');
+	}
+
+	return key;
+}
+
+
+
+/**
+ * Adds a nickname to the tracked list, or marks it wanted again if it was
+ * pending removal.
+ *
+ * @param[in] state The connections state
+ * @param[in] nickname The nickname to track
+ */
+static void
+add_nickname(
+	presence_state& state,
+	const std::string& nickname
+)
+{
+	std::string	key = presence_key(nickname);
+	auto		iter = state.nicks.find(key);
+	presence_entry	entry;
+
+	if ( iter != state.nicks.end() )
+	{
+		iter->second.wanted = true;
+		return;
+	}
+
+	entry.nickname = nickname;
+	entry.presence = EPresence::Unknown;
+	entry.wanted = true;
+	entry.on_server = false;
+
+	state.nicks.insert(std::make_pair(key, entry));
+}
+
+
+
+/**
+ * Splits items into groups that each fit on a single line, after a command
+ * prefix of prefix_len; items are separated by a single character.
+ *
+ * @param[in] prefix_len The length of the command preceding the items
+ * @param[in] item_extra Characters added to each item when sent ('+' or '-')
+ * @param[in] items The items to group
+ * @return The groups, in the order of items
+ */
+static std::vector<std::vector<std::string>>
+group_targets(
+	size_t prefix_len,
+	size_t item_extra,
+	const std::vector<std::string>& items
+)
+{
+	std::vector<std::vector<std::string>>	groups;
+	size_t	len = 0;
+	size_t	add;
+
+	for ( auto& i : items )
+	{
+		add = item_extra + i.length();
+
+		if ( !groups.empty() && !groups.back().empty() )
+			add++;	// separator
+
+		if ( groups.empty() || prefix_len + len + add > MAX_LEN_IRC_MSG )
+		{
+			groups.emplace_back();
+			len = 0;
+			add = item_extra + i.length();
+		}
+
+		groups.back().push_back(i);
+		len += add;
+	}
+
+	return groups;
+}
+
+
+
+/**
+ * Sends a change to the servers list, in as few lines as possible;
+ * 'MONITOR + a,b,c', or 'WATCH +a +b +c' for bahamut.
+ *
+ * @param[in] connection The connection to send on
+ * @param[in] method Monitor or Watch
+ * @param[in] op '+' to add, '-' to remove
+ * @param[in] nicknames The nicknames to add or remove
+ */
+static void
+send_targets(
+	std::shared_ptr<IrcConnection> connection,
+	EPresenceMethod method,
+	char op,
+	const std::vector<std::string>& nicknames
+)
+{
+	std::string	prefix;
+	std::string	line;
+
+	if ( method == EPresenceMethod::Monitor )
+		prefix = std::string("MONITOR ") + op + " ";
+	else
+		prefix = "WATCH ";
+
+	for ( auto& g : group_targets(prefix.length(), method == EPresenceMethod::Watch ? 1 : 0, nicknames) )
+	{
+		line = prefix;
+
+		for ( auto& n : g )
+		{
+			if ( method == EPresenceMethod::Monitor )
+			{
+				if ( line.length() > prefix.length() )
+					line += ',';
+			}
+			else
+			{
+				if ( line.length() > prefix.length() )
+					line += ' ';
+				line += op;
+			}
+			line += n;
+		}
+
+		connection->SendRaw(line.c_str());
+	}
+}
+
+
+
+PresenceTracker::PresenceTracker()
+{
+}
+
+
+
+PresenceTracker::~PresenceTracker()
+{
+}
+
+
+
+void
+PresenceTracker::Forget(
+	uint32_t connection_id
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	auto	iter = _states.find(connection_id);
+
+	if ( iter == _states.end() )
+		return;
+
+	runtime.Timers()->Cancel(iter->second.poll_timer);
+	_states.erase(iter);
+}
+
+
+
+presence_state&
+PresenceTracker::GetState(
+	uint32_t connection_id
+)
+{
+	auto	iter = _states.find(connection_id);
+
+	if ( iter == _states.end() )
+	{
+		presence_state	state;
+
+		state.method = EPresenceMethod::None;
+		state.limit = 0;
+		state.on_server = 0;
+		state.registered = false;
+		state.poll_timer = 0;
+
+		iter = _states.insert(std::make_pair(connection_id, state)).first;
+	}
+
+	return iter->second;
+}
+
+
+
+void
+PresenceTracker::IsonReply(
+	std::shared_ptr<IrcConnection> connection,
+	const char* nicknames
+)
+{
+	std::vector<std::string>	queried;
+	std::vector<std::pair<std::string, EPresence>>	changes;
+	std::set<std::string>	online;
+	std::string	list = nicknames;
+	std::string	nick;
+	presence_entry*	entry;
+	size_t		start = 0;
+	size_t		end;
+
+	// the nicknames that are online; anything else we asked about is not
+	while ( start < list.length() )
+	{
+		if (( end = list.find(' ', start)) == std::string::npos )
+			end = list.length();
+
+		nick = list.substr(start, end - start);
+		if ( !nick.empty() )
+			online.insert(presence_key(nick));
+
+		start = end + 1;
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		auto	iter = _states.find(connection->Id());
+
+		/* not one of ours (the user ran ISON themselves), or we've
+		 * reconnected since it was sent */
+		if ( iter == _states.end() || iter->second.ison_pending.empty() )
+			return;
+
+		// replies come back in the order the ISONs were sent
+		queried = iter->second.ison_pending.front();
+		iter->second.ison_pending.pop_front();
+
+		for ( auto& key : queried )
+		{
+			EPresence	presence = online.count(key) ? EPresence::Online : EPresence::Offline;
+
+			if (( entry = SetPresence(iter->second, key, presence)) != nullptr )
+				changes.push_back(std::make_pair(entry->nickname, presence));
+		}
+	}
+
+	for ( auto& c : changes )
+	{
+		Notify(connection, c.first, c.second, nullptr, nullptr);
+	}
+}
+
+
+
+void
+PresenceTracker::ListFull(
+	std::shared_ptr<IrcConnection> connection,
+	const char* nicknames
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	auto		iter = _states.find(connection->Id());
+	std::string	list = nicknames;
+	std::string	nick;
+	size_t		start = 0;
+	size_t		end;
+
+	if ( iter == _states.end() )
+		return;
+
+	presence_state&	state = iter->second;
+
+	while ( start < list.length() )
+	{
+		if (( end = list.find(',', start)) == std::string::npos )
+			end = list.length();
+
+		nick = list.substr(start, end - start);
+		start = end + 1;
+
+		auto	entry = state.nicks.find(presence_key(nick));
+
+		if ( entry == state.nicks.end() || !entry->second.on_server )
+			continue;
+
+		entry->second.on_server = false;
+		state.on_server--;
+	}
+
+	/* the server holds fewer than it advertised (or other clients on our
+	 * account share the list); don't try to add more until some go */
+	state.limit = state.on_server;
+
+	LOG(ELogLevel::Warn) << "The presence list is full at " << state.limit <<
+		" entries on " << connection->NetworkName() << "; polling the rest\n";
+
+	if ( state.poll_timer == 0 )
+		Poll(connection->Id(), state, connection);
+}
+
+
+
+void
+PresenceTracker::Notify(
+	std::shared_ptr<IrcConnection> connection,
+	const std::string& nickname,
+	EPresence presence,
+	const char* ident,
+	const char* hostmask
+)
+{
+	irc_activity&	activity = connection->GetActivity();
+
+	activity.nickname		= nickname;
+	activity.instigator.nickname	= nickname;
+	activity.instigator.ident	= ident == nullptr ? "" : ident;
+	activity.instigator.hostmask	= hostmask == nullptr ? "" : hostmask;
+	activity.data			= presence == EPresence::Online ? "online" : "offline";
+
+	IRC_ENGINE->NotifyListeners(presence == EPresence::Online ? LN_Online : LN_Offline, connection);
+}
+
+
+
+void
+PresenceTracker::Offline(
+	std::shared_ptr<IrcConnection> connection,
+	const char* nickname
+)
+{
+	std::string	nick;
+	presence_entry*	entry;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		auto	iter = _states.find(connection->Id());
+
+		if ( iter == _states.end() )
+			return;
+		if (( entry = SetPresence(iter->second, presence_key(nickname), EPresence::Offline)) == nullptr )
+			return;
+
+		nick = entry->nickname;
+	}
+
+	Notify(connection, nick, EPresence::Offline, nullptr, nullptr);
+}
+
+
+
+void
+PresenceTracker::OnPollTimer(
+	timer_id id,
+	void* context
+)
+{
+	PresenceTracker*	tracker = IRC_ENGINE->Presence();
+	uint32_t		connection_id = (uint32_t)(uintptr_t)context;
+	std::shared_ptr<IrcConnection>	connection = IRC_ENGINE->Pools()->GetConnection(connection_id);
+	std::lock_guard<std::mutex>	lock(tracker->_mutex);
+	auto	iter = tracker->_states.find(connection_id);
+
+	if ( iter == tracker->_states.end() )
+		return;
+
+	iter->second.poll_timer = 0;
+
+	// disconnected; Registered starts things over
+	if ( connection == nullptr || !connection->IsActive() )
+	{
+		iter->second.registered = false;
+		return;
+	}
+
+	tracker->Poll(connection_id, iter->second, connection);
+}
+
+
+
+void
+PresenceTracker::Online(
+	std::shared_ptr<IrcConnection> connection,
+	const char* nickname,
+	const char* ident,
+	const char* hostmask
+)
+{
+	std::string	nick;
+	presence_entry*	entry;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		auto	iter = _states.find(connection->Id());
+
+		if ( iter == _states.end() )
+			return;
+		if (( entry = SetPresence(iter->second, presence_key(nickname), EPresence::Online)) == nullptr )
+			return;
+
+		nick = entry->nickname;
+	}
+
+	Notify(connection, nick, EPresence::Online, ident, hostmask);
+}
+
+
+
+void
+PresenceTracker::Poll(
+	uint32_t connection_id,
+	presence_state& state,
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	std::vector<std::string>	keys;
+	std::string	line;
+
+	runtime.Timers()->Cancel(state.poll_timer);
+	state.poll_timer = 0;
+
+	for ( auto& n : state.nicks )
+	{
+		if ( n.second.wanted && !n.second.on_server )
+			keys.push_back(n.first);
+	}
+
+	// everything is on the servers list; nothing to poll
+	if ( keys.empty() )
+		return;
+
+	/* if the last poll is still unanswered, the server is struggling;
+	 * don't pile more on, just check back later */
+	if ( state.ison_pending.empty() )
+	{
+		for ( auto& g : group_targets(5, 0, keys) )
+		{
+			line = "ISON";
+			for ( auto& k : g )
+			{
+				line += ' ';
+				line += k;
+			}
+
+			if ( connection->SendRaw(line.c_str()) == EIrcStatus::OK )
+				state.ison_pending.push_back(g);
+		}
+	}
+
+	state.poll_timer = runtime.Timers()->Arm(PRESENCE_POLL_INTERVAL_MS,
+		&PresenceTracker::OnPollTimer, (void*)(uintptr_t)connection_id);
+}
+
+
+
+void
+PresenceTracker::Registered(
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	std::shared_ptr<IrcNetwork>	network = connection->Owner();
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if ( network == nullptr )
+		return;
+
+	presence_state&	state = GetState(connection->Id());
+
+	runtime.Timers()->Cancel(state.poll_timer);
+	state.poll_timer = 0;
+
+	// a new connection; the servers list starts out empty
+	if ( network->_server.monitor )
+		state.method = EPresenceMethod::Monitor;
+	else if ( network->_server.watch )
+		state.method = EPresenceMethod::Watch;
+	else
+		state.method = EPresenceMethod::Ison;
+
+	state.limit = state.method == EPresenceMethod::Ison ? 0 : network->_server.max_watch_list;
+	state.on_server = 0;
+	state.registered = true;
+	state.ison_pending.clear();
+
+	/* the last known presence is kept, so what the server tells us now
+	 * is only reported where it differs from before the reconnect */
+	for ( auto& n : state.nicks )
+	{
+		n.second.on_server = false;
+	}
+
+	for ( auto& n : network->_network_config.monitor )
+	{
+		add_nickname(state, n);
+	}
+
+	Sync(connection->Id(), state, connection);
+}
+
+
+
+presence_entry*
+PresenceTracker::SetPresence(
+	presence_state& state,
+	const std::string& key,
+	EPresence presence
+)
+{
+	auto	iter = state.nicks.find(key);
+
+	// a nickname we've stopped tracking, that the server hasn't yet
+	if ( iter == state.nicks.end() || !iter->second.wanted )
+		return nullptr;
+
+	if ( iter->second.presence == presence )
+		return nullptr;
+
+	iter->second.presence = presence;
+	return &iter->second;
+}
+
+
+
+std::vector<presence_entry>
+PresenceTracker::Status(
+	uint32_t connection_id,
+	EPresenceMethod* method
+)
+{
+	std::vector<presence_entry>	retval;
+	std::lock_guard<std::mutex>	lock(_mutex);
+	auto	iter = _states.find(connection_id);
+
+	if ( method != nullptr )
+		*method = iter == _states.end() ? EPresenceMethod::None : iter->second.method;
+
+	if ( iter == _states.end() )
+		return retval;
+
+	for ( auto& n : iter->second.nicks )
+	{
+		if ( n.second.wanted )
+			retval.push_back(n.second);
+	}
+
+	return retval;
+}
+
+
+
+void
+PresenceTracker::Sync(
+	uint32_t connection_id,
+	presence_state& state,
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	std::vector<std::string>	removes;
+	std::vector<std::string>	adds;
+	bool	poll = false;
+
+	// removals first, as they make room for additions
+	for ( auto iter = state.nicks.begin(); iter != state.nicks.end(); )
+	{
+		if ( iter->second.wanted )
+		{
+			++iter;
+			continue;
+		}
+
+		if ( iter->second.on_server )
+		{
+			removes.push_back(iter->second.nickname);
+			state.on_server--;
+		}
+
+		iter = state.nicks.erase(iter);
+	}
+
+	for ( auto& n : state.nicks )
+	{
+		if ( !n.second.on_server && state.method != EPresenceMethod::Ison
+		    && (state.limit == 0 || state.on_server < state.limit) )
+		{
+			n.second.on_server = true;
+			state.on_server++;
+			adds.push_back(n.second.nickname);
+		}
+
+		if ( !n.second.on_server )
+			poll = true;
+	}
+
+	if ( !removes.empty() )
+		send_targets(connection, state.method, '-', removes);
+	if ( !adds.empty() )
+		send_targets(connection, state.method, '+', adds);
+
+	// polling is the fallback, for whatever the server can't watch
+	if ( poll && state.poll_timer == 0 )
+		Poll(connection_id, state, connection);
+}
+
+
+
+void
+PresenceTracker::Unwatch(
+	std::shared_ptr<IrcConnection> connection,
+	const std::vector<std::string>& nicknames
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	presence_state&	state = GetState(connection->Id());
+
+	for ( auto& n : nicknames )
+	{
+		auto	iter = state.nicks.find(presence_key(n));
+
+		if ( iter != state.nicks.end() )
+			iter->second.wanted = false;
+	}
+
+	// otherwise done on registering, when the servers list is rebuilt
+	if ( state.registered && connection->IsActive() )
+		Sync(connection->Id(), state, connection);
+}
+
+
+
+void
+PresenceTracker::Watch(
+	std::shared_ptr<IrcConnection> connection,
+	const std::vector<std::string>& nicknames
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	presence_state&	state = GetState(connection->Id());
+
+	for ( auto& n : nicknames )
+	{
+		add_nickname(state, n);
+	}
+
+	if ( state.registered && connection->IsActive() )
+		Sync(connection->Id(), state, connection);
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,346 @@
+#pragma once
+
+/**
+ * @file	src/irc/PresenceTracker.h
+ * @author	James Warren
+ * @brief	Tracks whether nicknames are online, via MONITOR/WATCH or ISON
+ */
+
+
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <api/char_helper.h>
+#include <api/TimerWheel.h>		// timer_id
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+// forward declarations
+class IrcConnection;
+
+
+/** Time between ISON polls, for nicknames the server can't watch for us */
+#define PRESENCE_POLL_INTERVAL_MS	60000
+
+
+/**
+ * How presence is being obtained from a server.
+ *
+ * @enum EPresenceMethod
+ */
+enum class EPresenceMethod
+{
+	None,		/**< Not yet registered */
+	Monitor,	/**< IRCv3 MONITOR (ISUPPORT MONITOR=n) */
+	Watch,		/**< WATCH, as on bahamut and derivatives (ISUPPORT WATCH=n) */
+	Ison		/**< No server-side support; ISON polling */
+};
+
+
+/**
+ * Whether a tracked nickname is online.
+ *
+ * @enum EPresence
+ */
+enum class EPresence
+{
+	Unknown,	/**< No answer from the server yet */
+	Online,		/**< The nickname is in use */
+	Offline		/**< The nickname is not in use */
+};
+
+
+/**
+ * A tracked nickname.
+ *
+ * @struct presence_entry
+ */
+struct presence_entry
+{
+	std::string	nickname;	/**< The nickname, as supplied */
+	EPresence	presence;	/**< The last known state */
+	bool		wanted;		/**< Still tracked; cleared to remove on the next sync */
+	bool		on_server;	/**< In the servers MONITOR/WATCH list; polled if not */
+};
+
+
+/**
+ * Presence tracking state for a single connection.
+ *
+ * @struct presence_state
+ */
+struct presence_state
+{
+	EPresenceMethod	method;		/**< How presence is being obtained */
+	uint32_t	limit;		/**< Entries the servers list can hold; 0 if unlimited */
+	uint32_t	on_server;	/**< Entries currently in the servers list */
+	bool		registered;	/**< The connection is registered; lines can be sent */
+	timer_id	poll_timer;	/**< The next ISON poll, or 0 */
+
+	/** Tracked nicknames, keyed by their casemapped form */
+	std::map<std::string, presence_entry>	nicks;
+	/** The keys queried by each ISON sent, in order, awaiting their 303 */
+	std::deque<std::vector<std::string>>	ison_pending;
+};
+
+
+/**
+ * Tracks the presence of nicknames on each connection, and notifies the
+ * listeners (LN_Online, LN_Offline) as it changes.
+ *
+ * The servers own notification lists are used where available - MONITOR,
+ * or WATCH on bahamut-style servers - so presence changes are pushed to us
+ * rather than polled. Changes to the tracked list are sent as the
+ * difference from what the server already has, packed into as few lines as
+ * the message length allows. Only when the server supports neither, or
+ * its list is full, are the remaining nicknames polled with ISON.
+ *
+ * @class PresenceTracker
+ */
+class PresenceTracker
+{
+	// we are created on the stack in IrcEngine::Presence()
+	friend class IrcEngine;
+private:
+	NO_CLASS_ASSIGNMENT(PresenceTracker);
+	NO_CLASS_COPY(PresenceTracker);
+
+	/** Synchronization lock for all members */
+	std::mutex		_mutex;
+
+	/** Tracking state, keyed by connection id */
+	std::map<uint32_t, presence_state>	_states;
+
+
+	/**
+	 * Retrieves the state for the connection, creating it if needed.
+	 *
+	 * The lock must be held.
+	 */
+	presence_state&
+	GetState(
+		uint32_t connection_id
+	);
+
+
+	/**
+	 * Timer callback; polls with ISON, and re-arms itself while there are
+	 * nicknames the server isn't watching for us.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, cast to a pointer
+	 */
+	static void
+	OnPollTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Sends ISON for every wanted nickname not in the servers list, and
+	 * arms the next poll.
+	 *
+	 * The lock must be held.
+	 */
+	void
+	Poll(
+		uint32_t connection_id,
+		presence_state& state,
+		std::shared_ptr<IrcConnection> connection
+	);
+
+
+	/**
+	 * Records a nicknames new presence.
+	 *
+	 * The lock must be held.
+	 *
+	 * @param[in] state The connections state
+	 * @param[in] key The casemapped nickname
+	 * @param[in] presence The new presence
+	 * @return The entry if its presence changed, and the listeners should
+	 * be told; nullptr if unchanged, or not a nickname we track
+	 */
+	presence_entry*
+	SetPresence(
+		presence_state& state,
+		const std::string& key,
+		EPresence presence
+	);
+
+
+	/**
+	 * Brings the servers list in line with the wanted nicknames; removals
+	 * and additions are sent as the difference only. Anything that does
+	 * not fit within the servers limit is left for polling.
+	 *
+	 * The lock must be held.
+	 */
+	void
+	Sync(
+		uint32_t connection_id,
+		presence_state& state,
+		std::shared_ptr<IrcConnection> connection
+	);
+
+
+	/**
+	 * Informs the listeners of a change; the lock must NOT be held, as
+	 * listeners may well call back into us.
+	 */
+	void
+	Notify(
+		std::shared_ptr<IrcConnection> connection,
+		const std::string& nickname,
+		EPresence presence,
+		const char* ident,
+		const char* hostmask
+	);
+
+
+	// private constructor; we want one instance that is controlled
+	PresenceTracker();
+
+public:
+	~PresenceTracker();
+
+
+	/**
+	 * Discards all tracking for the connection; for when it is deleted.
+	 *
+	 * @param[in] connection_id The connection
+	 */
+	void
+	Forget(
+		uint32_t connection_id
+	);
+
+
+	/**
+	 * Handles an ISON reply (303), comparing it against the nicknames the
+	 * oldest outstanding ISON asked about.
+	 *
+	 * @param[in] connection The connection the reply arrived on
+	 * @param[in] nicknames The space separated nicknames that are online
+	 */
+	void
+	IsonReply(
+		std::shared_ptr<IrcConnection> connection,
+		const char* nicknames
+	);
+
+
+	/**
+	 * Handles the servers list being full (MONITOR 734); the nicknames
+	 * that didn't fit are polled instead.
+	 *
+	 * @param[in] connection The connection the reply arrived on
+	 * @param[in] nicknames The comma separated nicknames that were refused
+	 */
+	void
+	ListFull(
+		std::shared_ptr<IrcConnection> connection,
+		const char* nicknames
+	);
+
+
+	/**
+	 * Handles a nickname coming online (MONITOR 730, WATCH 600/604).
+	 *
+	 * @param[in] connection The connection the reply arrived on
+	 * @param[in] nickname The nickname
+	 * @param[in] ident The users ident, if known, otherwise nullptr
+	 * @param[in] hostmask The users hostmask, if known, otherwise nullptr
+	 */
+	void
+	Online(
+		std::shared_ptr<IrcConnection> connection,
+		const char* nickname,
+		const char* ident,
+		const char* hostmask
+	);
+
+
+	/**
+	 * Handles a nickname going offline (MONITOR 731, WATCH 601/605).
+	 *
+	 * @param[in] connection The connection the reply arrived on
+	 * @param[in] nickname The nickname
+	 */
+	void
+	Offline(
+		std::shared_ptr<IrcConnection> connection,
+		const char* nickname
+	);
+
+
+	/**
+	 * Notifies that the connection has completed registration (the end of
+	 * the MOTD), so ISUPPORT is known. The method is chosen, the networks
+	 * configured nicknames added, and the servers list populated from
+	 * scratch - it holds nothing for a new connection.
+	 *
+	 * @param[in] connection The connection that registered
+	 */
+	void
+	Registered(
+		std::shared_ptr<IrcConnection> connection
+	);
+
+
+	/**
+	 * Retrieves a copy of the tracked nicknames and their presence.
+	 *
+	 * @param[in] connection_id The connection
+	 * @param[out] method Receives the method in use
+	 * @return The tracked nicknames; empty if there are none
+	 */
+	std::vector<presence_entry>
+	Status(
+		uint32_t connection_id,
+		EPresenceMethod* method
+	);
+
+
+	/**
+	 * Stops tracking the supplied nicknames; they are removed from the
+	 * servers list on the next sync, which happens straight away if the
+	 * connection is registered.
+	 *
+	 * @param[in] connection The connection
+	 * @param[in] nicknames The nicknames to stop tracking
+	 */
+	void
+	Unwatch(
+		std::shared_ptr<IrcConnection> connection,
+		const std::vector<std::string>& nicknames
+	);
+
+
+	/**
+	 * Starts tracking the supplied nicknames; nicknames already tracked
+	 * are unaffected. They are added to the servers list straight away if
+	 * the connection is registered, otherwise once it is.
+	 *
+	 * @param[in] connection The connection
+	 * @param[in] nicknames The nicknames to track
+	 */
+	void
+	Watch(
+		std::shared_ptr<IrcConnection> connection,
+		const std::vector<std::string>& nicknames
+	);
+};
+
+
+
+END_NAMESPACE
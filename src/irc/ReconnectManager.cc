@@ -0,0 +1,570 @@
+
+/**
+ * @file	src/irc/ReconnectManager.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <algorithm>			// std::rotate
+
+#if defined(_WIN32)
+#	include <process.h>		// _beginthreadex
+#endif
+
+#include <api/Log.h>
+#include <api/Runtime.h>
+#include <api/Diagnostics.h>
+#include <api/interface.h>		// instance()
+#include <api/utils.h>			// get_ms_time, rename_thread
+#include "ReconnectManager.h"		// prototypes
+#include "IrcEngine.h"
+#include "IrcConnection.h"
+#include "IrcNetwork.h"
+#include "IrcPool.h"
+#include "config_structs.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/**
+ * Determines if an unsent line is worth replaying on the new connection;
+ * anything that is part of registration, or joining, is redone anyway, and
+ * keepalives are meaningless across connections.
+ *
+ * @param[in] line The unsent line
+ * @return true if the line should be replayed, otherwise false
+ */
+static bool
+is_replayable(
+	const std::string& line
+)
+{
+	static const char*	skip[] = {
+		"PING ", "PONG ", "QUIT", "NICK ", "USER ", "PASS ", "CAP ", "JOIN "
+	};
+
+	for ( auto s : skip )
+	{
+		if ( line.compare(0, strlen(s), s) == 0 )
+			return false;
+	}
+
+	return !line.empty();
+}
+
+
+
+ReconnectManager::ReconnectManager()
+	: _rng(std::random_device()())
+{
+	_next_admission = 0;
+	_stopped = false;
+}
+
+
+
+ReconnectManager::~ReconnectManager()
+{
+	Stop();
+}
+
+
+
+bool
+ReconnectManager::AttemptThread(
+	ReconnectManager* manager,
+	uint32_t connection_id
+)
+{
+	std::shared_ptr<IrcConnection>	connection;
+	std::shared_ptr<IrcNetwork>	network;
+	std::vector<std::shared_ptr<config_server>>	servers;
+	uint32_t	attempt;
+	EIrcStatus	status;
+
+	connection = IRC_ENGINE->Pools()->GetConnection(connection_id);
+
+	if ( connection == nullptr || (network = connection->Owner()) == nullptr )
+	{
+		// deleted while we were waiting; nothing to reconnect
+		manager->Cancel(connection_id);
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(manager->_mutex);
+		auto	iter = manager->_states.find(connection_id);
+
+		if ( manager->_stopped || iter == manager->_states.end() )
+			return false;
+
+		attempt = iter->second.attempt;
+		servers = manager->BuildRotation(network, attempt);
+	}
+
+	DIAG(EDiagCategory::Network, ELogLevel::Info) << fg_grey << "Reconnecting " << network->Name() <<
+		" (attempt " << (attempt + 1) << ")\n";
+	LOG(ELogLevel::Info) << "Reconnecting " << network->Name() <<
+		", attempt " << (attempt + 1) << "\n";
+
+	/* release the remnants of the old connection. A ping or registration
+	 * timeout schedules us before its disconnect thread has run Cleanup, so
+	 * let that finish first; Cleanup on an already clean connection is a no-op */
+	connection->WaitForDisconnect();
+	connection->Cleanup();
+
+	if (( status = connection->SetupFastest(network, &servers)) != EIrcStatus::OK )
+	{
+		std::lock_guard<std::mutex>	lock(manager->_mutex);
+		auto	iter = manager->_states.find(connection_id);
+
+		// every server in the rotation failed to accept a connection
+		for ( auto& s : servers )
+			manager->RecordResult(server_key(s.get()), false);
+
+		if ( iter != manager->_states.end() )
+		{
+			iter->second.in_progress = false;
+			iter->second.attempt++;
+			manager->Schedule(iter->second);
+		}
+		return false;
+	}
+
+	if ( connection->ConnectToServer() != EIrcStatus::OK )
+	{
+		std::lock_guard<std::mutex>	lock(manager->_mutex);
+		auto	iter = manager->_states.find(connection_id);
+
+		// connected, but the handshake failed; only this server is at fault
+		manager->RecordResult(connection->_params.conn_str, false);
+
+		if ( iter != manager->_states.end() )
+		{
+			iter->second.in_progress = false;
+			iter->second.attempt++;
+			manager->Schedule(iter->second);
+		}
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(manager->_mutex);
+		auto	iter = manager->_states.find(connection_id);
+
+		if ( iter != manager->_states.end() )
+			iter->second.in_progress = false;
+	}
+
+	/* this thread now becomes the receive thread; registration, and the
+	 * re-sync via Registered(), follows from the parser as normal. If the
+	 * registration times out, we're notified again and try the next */
+	connection->EstablishConnection();
+	return true;
+}
+
+
+
+#if defined(_WIN32)
+uint32_t
+#	if IS_VISUAL_STUDIO
+	__stdcall
+#	elif IS_GCC
+	__attribute__((stdcall))
+#	else
+#		error "Unsupported compiler; this requires stdcall"
+#	endif
+#elif defined(__linux__) || defined(BSD)
+void*
+#endif
+ReconnectManager::ExecAttemptThread(
+	void* params
+)
+{
+	reconnect_thread_params*	tparam = (reconnect_thread_params*)params;
+	ReconnectManager*		manager;
+	std::shared_ptr<thread_info>	ti;
+	uint32_t			connection_id;
+
+	{
+		manager		= tparam->manager;
+		connection_id	= tparam->connection_id;
+
+		ti.reset(new thread_info);
+#if defined(_WIN32)
+		ti->thread		= tparam->thread_id;
+		ti->thread_handle	= tparam->thread_handle;
+#else
+		ti->thread		= tparam->thread;
+#endif
+		strlcpy(ti->called_by_function, __func__, sizeof(ti->called_by_function));
+		rename_thread("ircreconnect");
+		runtime.AddManualThread(ti);
+
+		// let the caller know we're done
+		tparam->taken = true;
+	}
+
+	/* once connected, this is the receive thread, and EstablishConnection
+	 * reports the stop itself as it returns */
+	if ( !AttemptThread(manager, connection_id) )
+		runtime.ThreadStopping(ti->thread, __func__);
+
+#if defined(_WIN32)
+	return 0;
+#else
+	return nullptr;
+#endif
+}
+
+
+
+std::vector<std::shared_ptr<config_server>>
+ReconnectManager::BuildRotation(
+	std::shared_ptr<IrcNetwork> network,
+	uint32_t attempt
+)
+{
+	std::vector<std::shared_ptr<config_server>>	all = network->ServersByLatency();
+	std::vector<std::shared_ptr<config_server>>	usable;
+	std::shared_ptr<config_server>	soonest;
+	uint64_t	soonest_time = UINT64_MAX;
+	uint64_t	now = get_ms_time();
+
+	if ( all.empty() )
+		return all;
+
+	/* fastest first on the first attempt; each retry moves the head along,
+	 * so a server that accepts connections but then fails us doesn't keep
+	 * winning the race */
+	std::rotate(all.begin(), all.begin() + (attempt % all.size()), all.end());
+
+	for ( auto& s : all )
+	{
+		auto	iter = _breakers.find(server_key(s.get()));
+
+		if ( iter == _breakers.end() || iter->second.open_until <= now )
+		{
+			// closed, or half-open and due its trial
+			usable.push_back(s);
+		}
+		else if ( iter->second.open_until < soonest_time )
+		{
+			soonest_time = iter->second.open_until;
+			soonest = s;
+		}
+	}
+
+	if ( usable.empty() )
+	{
+		// all open; give the one nearest recovery an early trial
+		usable.push_back(soonest);
+	}
+
+	return usable;
+}
+
+
+
+void
+ReconnectManager::Cancel(
+	uint32_t connection_id
+)
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+	auto	iter = _states.find(connection_id);
+
+	if ( iter == _states.end() )
+		return;
+
+	if ( iter->second.timer != 0 )
+		runtime.Timers()->Cancel(iter->second.timer);
+
+	_states.erase(iter);
+}
+
+
+
+void
+ReconnectManager::ConnectionLost(
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	std::vector<std::string>	channels;
+	std::vector<std::string>	queued;
+
+	if ( connection == nullptr )
+		return;
+
+	// gather outside our lock; these take the connections own
+	channels = connection->GetJoinList();
+	queued = connection->GetSendQueue();
+
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if ( _stopped )
+		return;
+
+	auto	iter = _states.find(connection->Id());
+
+	if ( iter == _states.end() )
+	{
+		reconnect_state	fresh;
+
+		fresh.connection_id = connection->Id();
+		fresh.attempt = 0;
+		fresh.timer = 0;
+		fresh.in_progress = false;
+
+		iter = _states.insert(std::make_pair(fresh.connection_id, fresh)).first;
+	}
+
+	reconnect_state&	state = iter->second;
+
+	/* a failed attempt has no channels of its own; keep what we had from
+	 * the last time it was registered */
+	if ( !channels.empty() )
+		state.channels = channels;
+
+	for ( auto& q : queued )
+	{
+		if ( state.replay.size() >= RECONNECT_MAX_REPLAY )
+			break;
+		if ( is_replayable(q) )
+			state.replay.push_back(q);
+	}
+
+	// already waiting, or mid-attempt (which reschedules itself)
+	if ( state.timer != 0 || state.in_progress )
+		return;
+
+	// drops after registering start the backoff afresh; failures don't
+	Schedule(state);
+}
+
+
+
+void
+ReconnectManager::OnReconnectTimer(
+	timer_id id,
+	void* context
+)
+{
+	ReconnectManager*	manager = IRC_ENGINE->Reconnector();
+	uint32_t		connection_id = (uint32_t)(uintptr_t)context;
+
+	{
+		std::lock_guard<std::mutex>	lock(manager->_mutex);
+		auto	iter = manager->_states.find(connection_id);
+
+		if ( manager->_stopped || iter == manager->_states.end() || iter->second.timer != id )
+			return;
+
+		iter->second.timer = 0;
+		iter->second.in_progress = true;
+	}
+
+	/* connecting blocks; never do it on the parser thread, which is where
+	 * timers are run from */
+	if ( !manager->StartAttemptThread(connection_id) )
+	{
+		std::lock_guard<std::mutex>	lock(manager->_mutex);
+		auto	iter = manager->_states.find(connection_id);
+
+		// try again later, as if the attempt had failed
+		if ( iter != manager->_states.end() )
+		{
+			iter->second.in_progress = false;
+			iter->second.attempt++;
+			manager->Schedule(iter->second);
+		}
+	}
+}
+
+
+
+void
+ReconnectManager::RecordResult(
+	const std::string& server,
+	bool success
+)
+{
+	if ( success )
+	{
+		_breakers.erase(server);
+		return;
+	}
+
+	reconnect_breaker&	breaker = _breakers[server];
+
+	breaker.failures++;
+
+	if ( breaker.failures >= RECONNECT_BREAKER_FAILURES )
+	{
+		if ( breaker.failures == RECONNECT_BREAKER_FAILURES )
+		{
+			LOG(ELogLevel::Warn) << "Server " << server << " failed " <<
+				breaker.failures << " times; not using it for " <<
+				(RECONNECT_BREAKER_OPEN_MS / 1000) << " seconds\n";
+		}
+
+		// failing in half-open re-opens it for the full period
+		breaker.open_until = get_ms_time() + RECONNECT_BREAKER_OPEN_MS;
+	}
+}
+
+
+
+void
+ReconnectManager::Registered(
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	std::vector<std::string>	channels;
+	std::vector<std::string>	replay;
+
+	if ( connection == nullptr )
+		return;
+
+	{
+		std::lock_guard<std::mutex>	lock(_mutex);
+		auto	iter = _states.find(connection->Id());
+
+		// a fresh connection, not one of ours
+		if ( iter == _states.end() )
+			return;
+
+		RecordResult(connection->_params.conn_str, true);
+
+		channels.swap(iter->second.channels);
+		replay.swap(iter->second.replay);
+
+		if ( iter->second.timer != 0 )
+			runtime.Timers()->Cancel(iter->second.timer);
+		_states.erase(iter);
+	}
+
+	LOG(ELogLevel::Info) << "Reconnected to " << connection->_params.conn_str <<
+		"; rejoining " << channels.size() << " channels, replaying " <<
+		replay.size() << " lines\n";
+
+	if ( !channels.empty() )
+		connection->SendJoinList(channels);
+
+	for ( auto& r : replay )
+		connection->SendRaw(r.c_str());
+}
+
+
+
+void
+ReconnectManager::Schedule(
+	reconnect_state& state
+)
+{
+	uint64_t	now = get_ms_time();
+	uint64_t	delay = RECONNECT_BASE_DELAY_MS;
+	uint64_t	when;
+
+	if ( _stopped )
+		return;
+
+	// exponential, capped; the shift is bounded so it can't overflow
+	if ( state.attempt > 0 )
+		delay <<= std::min<uint32_t>(state.attempt, 20);
+	if ( delay > RECONNECT_MAX_DELAY_MS )
+		delay = RECONNECT_MAX_DELAY_MS;
+
+	// equal jitter; half fixed, half random
+	delay = delay / 2 + std::uniform_int_distribution<uint64_t>(0, delay / 2)(_rng);
+
+	/* one admission slot per interval, across every connection; when
+	 * everything drops at once they then return one at a time */
+	when = now + delay;
+	if ( when < _next_admission )
+		when = _next_admission;
+	_next_admission = when + RECONNECT_ADMISSION_MS;
+
+	state.timer = runtime.Timers()->Arm(when - now,
+		&ReconnectManager::OnReconnectTimer,
+		(void*)(uintptr_t)state.connection_id);
+
+	LOG(ELogLevel::Debug) << "Reconnect for connection " << state.connection_id <<
+		" scheduled in " << (when - now) << "ms\n";
+}
+
+
+
+bool
+ReconnectManager::StartAttemptThread(
+	uint32_t connection_id
+)
+{
+	reconnect_thread_params	params;
+
+	params.manager		= this;
+	params.connection_id	= connection_id;
+	params.taken		= false;
+
+#if defined(_WIN32)
+	params.thread_handle = _beginthreadex(nullptr, 0,
+		ExecAttemptThread,
+		&params,
+		CREATE_SUSPENDED,
+		&params.thread_id);
+
+	if ( params.thread_handle == 0 )
+		goto creation_failure;
+
+	ResumeThread((HANDLE)params.thread_handle);
+#else
+	int32_t		err;
+	pthread_attr_t	attr;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	if (( err = pthread_create(&params.thread, &attr, ExecAttemptThread, &params)) != 0 )
+		goto creation_failure;
+#endif
+
+	/* wait for the thread to take its copy; we don't want to exit scope
+	 * before it has a chance to */
+	while ( !params.taken )
+		SLEEP_MILLISECONDS(9);
+
+	return true;
+
+creation_failure:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to create the reconnect thread\n";
+	LOG(ELogLevel::Error) << "Failed to create the reconnect thread\n";
+	return false;
+}
+
+
+
+void
+ReconnectManager::Stop()
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	_stopped = true;
+
+	for ( auto& s : _states )
+	{
+		if ( s.second.timer != 0 )
+			runtime.Timers()->Cancel(s.second.timer);
+	}
+
+	_states.clear();
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,310 @@
+#pragma once
+
+/**
+ * @file	src/irc/ReconnectManager.h
+ * @author	James Warren
+ * @brief	Automatic reconnection of dropped IRC connections
+ */
+
+
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) || defined(BSD)
+#	include <pthread.h>
+#endif
+
+#include <api/char_helper.h>
+#include <api/TimerWheel.h>		// timer_id
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+// forward declarations
+class IrcConnection;
+class IrcNetwork;
+class ReconnectManager;
+struct config_server;
+
+
+/** Delay before the first reconnect attempt; doubles with each failure */
+#define RECONNECT_BASE_DELAY_MS		2000
+/** Upper limit for the reconnect delay */
+#define RECONNECT_MAX_DELAY_MS		300000
+/** Minimum spacing between any two reconnect attempts, across connections */
+#define RECONNECT_ADMISSION_MS		250
+/** Consecutive failures before a servers circuit breaker opens */
+#define RECONNECT_BREAKER_FAILURES	3
+/** How long an open circuit breaker keeps a server out of the rotation */
+#define RECONNECT_BREAKER_OPEN_MS	300000
+/** Most unsent lines that will be replayed after reconnecting */
+#define RECONNECT_MAX_REPLAY		100
+
+
+
+/**
+ * Per-server circuit breaker state.
+ *
+ * Closed (failures below the threshold): the server is used as normal.
+ * Open (open_until in the future): the server is skipped.
+ * Half-open (open_until has passed): the server gets one more attempt; a
+ * failure re-opens it, a success closes it.
+ *
+ * @struct reconnect_breaker
+ */
+struct reconnect_breaker
+{
+	uint32_t	failures;	/**< Consecutive failed attempts */
+	uint64_t	open_until;	/**< get_ms_time() the breaker stays open until */
+};
+
+
+/**
+ * Reconnection state for a single connection.
+ *
+ * @struct reconnect_state
+ */
+struct reconnect_state
+{
+	uint32_t	connection_id;	/**< The connection being reconnected */
+	uint32_t	attempt;	/**< Failed attempts since the last registration */
+	timer_id	timer;		/**< The pending attempt, or 0 */
+	bool		in_progress;	/**< An attempt thread is running */
+
+	/** Channels to rejoin once registered; SendJoinList format */
+	std::vector<std::string>	channels;
+	/** Unsent lines at the time of the drop, to be replayed */
+	std::vector<std::string>	replay;
+};
+
+
+
+/**
+ * Parameters handed to a reconnect attempt thread; taken is set by the thread
+ * once it has copied what it needs.
+ *
+ * @struct reconnect_thread_params
+ */
+struct reconnect_thread_params
+{
+	ReconnectManager*	manager;
+	uint32_t		connection_id;
+	std::atomic<bool>	taken;
+
+#if defined(_WIN32)
+	uintptr_t	thread_handle;
+	uint32_t	thread_id;
+#else
+	pthread_t	thread;
+#endif
+};
+
+
+
+/**
+ * Reconnects connections that were dropped without the user asking,
+ * restoring their channels and anything left unsent once registered.
+ *
+ * Delays grow exponentially per connection with 'equal jitter' (a random
+ * point in the upper half of the delay). On top of that, attempts from all
+ * connections are admitted at most one per RECONNECT_ADMISSION_MS, so when a
+ * shared upstream comes back and every connection wants back in at once,
+ * they arrive spread out rather than as a herd.
+ *
+ * Each attempt races the networks servers (IrcConnection::SetupFastest),
+ * rotated by the attempt number so a failing preferred server doesn't
+ * always go first, and without any whose circuit breaker is open.
+ *
+ * Attempts run on a thread of their own, which becomes the connections
+ * receive thread if it succeeds; the timer callbacks only schedule.
+ *
+ * @class ReconnectManager
+ */
+class ReconnectManager
+{
+	// we are created on the stack in IrcEngine::Reconnector()
+	friend class IrcEngine;
+private:
+	NO_CLASS_ASSIGNMENT(ReconnectManager);
+	NO_CLASS_COPY(ReconnectManager);
+
+	/** Synchronization lock for all members */
+	std::mutex		_mutex;
+
+	/** Connections awaiting (or performing) a reconnect, keyed by id */
+	std::map<uint32_t, reconnect_state>	_states;
+	/** Circuit breakers, keyed by server_key() */
+	std::map<std::string, reconnect_breaker>	_breakers;
+
+	/** Jitter source */
+	std::mt19937		_rng;
+	/** The earliest time the next attempt may be admitted */
+	uint64_t		_next_admission;
+	/** Set when the application is closing; nothing more is scheduled */
+	bool			_stopped;
+
+
+	/**
+	 * Executes a reconnect attempt for a connection; run in its own thread,
+	 * through ExecAttemptThread.
+	 *
+	 * @param[in] manager The ReconnectManager
+	 * @param[in] connection_id The connection to reconnect
+	 * @return true if the attempt connected, and this thread ran as the
+	 * connections receive thread until it closed; false if it never got
+	 * that far
+	 */
+	static bool
+	AttemptThread(
+		ReconnectManager* manager,
+		uint32_t connection_id
+	);
+
+
+	/**
+	 * The attempt thread function; registers the thread with the runtime,
+	 * so it can be waited on like any other, and runs AttemptThread.
+	 *
+	 * @param[in] params A pointer to populated reconnect_thread_params
+	 * cast void
+	 */
+#if defined(_WIN32)
+	static uint32_t __stdcall
+#elif defined(__linux__) || defined(BSD)
+	static void*
+#endif
+	ExecAttemptThread(
+		void* params
+	);
+
+
+	/**
+	 * Builds the server list for an attempt; the networks servers fastest
+	 * first, rotated by attempt, skipping any with an open breaker. If all
+	 * are open, the one closest to half-open is used alone.
+	 *
+	 * The lock must be held.
+	 */
+	std::vector<std::shared_ptr<config_server>>
+	BuildRotation(
+		std::shared_ptr<IrcNetwork> network,
+		uint32_t attempt
+	);
+
+
+	/**
+	 * Timer callback; starts the attempt thread.
+	 *
+	 * @param[in] id The timer that fired
+	 * @param[in] context The connection id, cast to a pointer
+	 */
+	static void
+	OnReconnectTimer(
+		timer_id id,
+		void* context
+	);
+
+
+	/**
+	 * Records the outcome of an attempt against a servers breaker.
+	 *
+	 * The lock must be held.
+	 */
+	void
+	RecordResult(
+		const std::string& server,
+		bool success
+	);
+
+
+	/**
+	 * Arms the timer for the next attempt for state, applying backoff,
+	 * jitter and admission spacing.
+	 *
+	 * The lock must be held.
+	 */
+	void
+	Schedule(
+		reconnect_state& state
+	);
+
+
+	/**
+	 * Creates the thread for an attempt, and waits for it to take its
+	 * parameters.
+	 *
+	 * @param[in] connection_id The connection to reconnect
+	 * @return true if the thread was created
+	 */
+	bool
+	StartAttemptThread(
+		uint32_t connection_id
+	);
+
+
+	// private constructor; we want one instance that is controlled
+	ReconnectManager();
+
+public:
+	~ReconnectManager();
+
+
+	/**
+	 * Cancels any reconnect for the connection; for when the user
+	 * disconnects, or the connection is being deleted.
+	 *
+	 * @param[in] connection_id The connection
+	 */
+	void
+	Cancel(
+		uint32_t connection_id
+	);
+
+
+	/**
+	 * Notifies that the connection dropped unexpectedly. Its channels and
+	 * unsent lines are recorded, and a reconnect is scheduled.
+	 *
+	 * Must be called before the connection is cleaned up, as that erases
+	 * its channel list.
+	 *
+	 * @param[in] connection The connection that dropped
+	 */
+	void
+	ConnectionLost(
+		std::shared_ptr<IrcConnection> connection
+	);
+
+
+	/**
+	 * Notifies that the connection has registered (001 received). If it
+	 * was reconnected, its channels are rejoined with packed JOINs and its
+	 * unsent lines replayed; the backoff and the servers breaker reset.
+	 *
+	 * @param[in] connection The connection that registered
+	 */
+	void
+	Registered(
+		std::shared_ptr<IrcConnection> connection
+	);
+
+
+	/**
+	 * Stops all scheduling; pending attempts are cancelled. Called when
+	 * the application is closing.
+	 */
+	void
+	Stop();
+};
+
+
+
+END_NAMESPACE
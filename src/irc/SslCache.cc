@@ -0,0 +1,189 @@
+
+/**
+ * @file	src/irc/SslCache.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#if defined(USING_OPENSSL_NET)
+
+#include <iostream>			// std::cerr
+
+#include <openssl/err.h>		// openssl error codes/strings
+
+#include <api/Diagnostics.h>		// console output
+#include <api/Log.h>
+#include <api/Runtime.h>
+#include <api/utils.h>			// BUILD_STRING
+#include "SslCache.h"			// prototypes
+#include "nethelper.h"			// openssl_err_callback
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+SslCache::~SslCache()
+{
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	for ( auto s : _sessions )
+		SSL_SESSION_free(s.second);
+	_sessions.clear();
+
+	/* any SSL still alive holds its own reference to its context, so this
+	 * only releases ours; the callback must not reach us once we're gone */
+	for ( auto c : _contexts )
+	{
+		SSL_CTX_set_app_data(c.second, nullptr);
+		SSL_CTX_free(c.second);
+	}
+	_contexts.clear();
+}
+
+
+
+bool
+SslCache::ApplySession(
+	const std::string* key,
+	SSL* ssl
+)
+{
+	std::map<std::string, SSL_SESSION*>::iterator	iter;
+
+	if ( key == nullptr || ssl == nullptr )
+		return false;
+
+	// read back in NewSessionCallback
+	SSL_set_app_data(ssl, key);
+
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if (( iter = _sessions.find(*key)) == _sessions.end() )
+		return false;
+
+	// takes its own reference, so the cache entry can be replaced freely
+	return SSL_set_session(ssl, iter->second) == 1;
+}
+
+
+
+SSL_CTX*
+SslCache::GetContext(
+	const std::string& network,
+	bool allow_invalid_cert,
+	const std::string& client_certificate
+)
+{
+	std::string	key = BUILD_STRING(network.c_str(), allow_invalid_cert ? "|any|" : "|verify|", client_certificate.c_str());
+	std::map<std::string, SSL_CTX*>::iterator	iter;
+	SSL_CTX*	ctx;
+
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if (( iter = _contexts.find(key)) != _contexts.end() )
+		return iter->second;
+
+	if (( ctx = SSL_CTX_new(SSLv23_client_method())) == nullptr )
+		goto openssl_context_failed;
+
+	/* client-side caching only enables the new session callback; we do the
+	 * storing ourselves, keyed by host rather than session id */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, &SslCache::NewSessionCallback);
+	SSL_CTX_set_app_data(ctx, this);
+
+	// presented to the server, and used for SASL EXTERNAL
+	if ( !client_certificate.empty() )
+	{
+		if ( SSL_CTX_use_certificate_chain_file(ctx, client_certificate.c_str()) != 1 )
+			goto openssl_certificate_failed;
+		if ( SSL_CTX_use_PrivateKey_file(ctx, client_certificate.c_str(), SSL_FILETYPE_PEM) != 1 )
+			goto openssl_certificate_failed;
+		if ( SSL_CTX_check_private_key(ctx) != 1 )
+			goto openssl_certificate_failed;
+	}
+
+	_contexts[key] = ctx;
+
+	LOG(ELogLevel::Debug) << "Created shared SSL context for " << key << "\n";
+
+	return ctx;
+
+openssl_context_failed:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to create the OpenSSL SSL context\n";
+	ERR_print_errors_cb(&openssl_err_callback, NULL);
+	return nullptr;
+openssl_certificate_failed:
+	DIAG(EDiagCategory::Network, ELogLevel::Error) << fg_red << "Failed to load the client certificate '" << client_certificate << "'\n";
+	ERR_print_errors_cb(&openssl_err_callback, NULL);
+	SSL_CTX_free(ctx);
+	return nullptr;
+}
+
+
+
+int
+SslCache::NewSessionCallback(
+	SSL* ssl,
+	SSL_SESSION* session
+)
+{
+	SslCache*		cache = (SslCache*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	const std::string*	key = (const std::string*)SSL_get_app_data(ssl);
+
+	if ( cache == nullptr || key == nullptr )
+		return 0;
+
+	cache->StoreSession(*key, session);
+	return 1;
+}
+
+
+
+void
+SslCache::RemoveSession(
+	const std::string& key
+)
+{
+	std::map<std::string, SSL_SESSION*>::iterator	iter;
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if (( iter = _sessions.find(key)) == _sessions.end() )
+		return;
+
+	SSL_SESSION_free(iter->second);
+	_sessions.erase(iter);
+}
+
+
+
+void
+SslCache::StoreSession(
+	const std::string& key,
+	SSL_SESSION* session
+)
+{
+	std::map<std::string, SSL_SESSION*>::iterator	iter;
+	std::lock_guard<std::mutex>	lock(_mutex);
+
+	if (( iter = _sessions.find(key)) != _sessions.end() )
+	{
+		SSL_SESSION_free(iter->second);
+		iter->second = session;
+	}
+	else
+	{
+		_sessions[key] = session;
+	}
+}
+
+
+
+END_NAMESPACE
+
+#endif	// USING_OPENSSL_NET
@@ -0,0 +1,153 @@
+#pragma once
+
+/**
+ * @file	src/irc/SslCache.h
+ * @author	James Warren
+ * @brief	Shared OpenSSL contexts and client session cache for connections
+ */
+
+
+
+#if defined(USING_OPENSSL_NET)
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <openssl/ssl.h>
+
+#include <api/char_helper.h>
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/**
+ * Every IrcConnection used to create (and free) its own SSL_CTX, and perform
+ * a full handshake on every connect - including reconnects to the server it
+ * was just talking to.
+ *
+ * This class holds one SSL_CTX per network and verification policy, shared by
+ * all the connections that use them, and caches the last session received
+ * from each host:port so reconnections can resume it with an abbreviated
+ * handshake.
+ *
+ * The contexts are owned by the cache; connections must never free them.
+ *
+ * @class SslCache
+ */
+class SslCache
+{
+	// we are created on the stack in IrcEngine::SslContexts()
+	friend class IrcEngine;
+private:
+	NO_CLASS_ASSIGNMENT(SslCache);
+	NO_CLASS_COPY(SslCache);
+
+	/** Synchronization lock; connections are set up from multiple threads */
+	std::mutex				_mutex;
+
+	/** The shared contexts, keyed by network group name + policy */
+	std::map<std::string, SSL_CTX*>		_contexts;
+
+	/** The last session received, keyed by 'host:port' */
+	std::map<std::string, SSL_SESSION*>	_sessions;
+
+
+	/**
+	 * OpenSSL callback, executed when a new session is established on an
+	 * SSL created from one of our contexts. Stores the session against
+	 * the key set by ApplySession.
+	 *
+	 * With TLS 1.3, the session arrives after the handshake, which is why
+	 * this is used rather than grabbing it once connected.
+	 *
+	 * @return 1 if the session was stored (we now own the reference), or
+	 * 0 to leave it to OpenSSL
+	 */
+	static int
+	NewSessionCallback(
+		SSL* ssl,
+		SSL_SESSION* session
+	);
+
+
+	/**
+	 * Replaces the stored session for key, freeing any previous one.
+	 *
+	 * @param[in] key The 'host:port' the session is for
+	 * @param[in] session The session, the reference to which we now own
+	 */
+	void
+	StoreSession(
+		const std::string& key,
+		SSL_SESSION* session
+	);
+
+
+	// private constructor; we want one instance that is controlled
+	SslCache()
+	{
+	}
+
+public:
+	~SslCache();
+
+
+	/**
+	 * Prepares ssl to resume the cached session for key, if we have one,
+	 * and associates the key with it so any new session will be stored.
+	 *
+	 * Must be called before the handshake is performed.
+	 *
+	 * @param[in] key The 'host:port' being connected to; must remain valid
+	 * for the lifetime of ssl
+	 * @param[in] ssl The connections SSL, created from one of our contexts
+	 * @return true if a cached session was found and applied, otherwise
+	 * false (a full handshake will occur)
+	 */
+	bool
+	ApplySession(
+		const std::string* key,
+		SSL* ssl
+	);
+
+
+	/**
+	 * Retrieves the context for the supplied network, verification policy
+	 * and client certificate, creating it on first use.
+	 *
+	 * @param[in] network The network group name
+	 * @param[in] allow_invalid_cert The certificate verification policy
+	 * @param[in] client_certificate Path to a PEM file holding the client
+	 * certificate and its private key, or empty for none
+	 * @return A pointer to the shared context, or a nullptr if one could
+	 * not be created (including if the certificate failed to load)
+	 */
+	SSL_CTX*
+	GetContext(
+		const std::string& network,
+		bool allow_invalid_cert,
+		const std::string& client_certificate
+	);
+
+
+	/**
+	 * Discards the cached session for key; used when a resumed connection
+	 * fails, so the next attempt does a full handshake.
+	 *
+	 * @param[in] key The 'host:port' to forget
+	 */
+	void
+	RemoveSession(
+		const std::string& key
+	);
+};
+
+
+
+END_NAMESPACE
+
+#endif	// USING_OPENSSL_NET
@@ -36,6 +36,9 @@ struct config_profile
 	bool		auto_identify;
 	std::string	autoident_password;
 	std::string	autoident_service;
+	std::string	sasl_mechanism;		/**< "PLAIN", "EXTERNAL", or empty to not use SASL */
+	std::string	sasl_account;		/**< PLAIN account name; the nickname if empty */
+	std::string	sasl_password;		/**< PLAIN password */
 	uint16_t	mode;			/**< usermode bitmask */
 	std::vector<std::string>	nicknames;
 
@@ -51,6 +54,9 @@ struct config_profile
 		auto_identify		= profile->auto_identify;
 		autoident_password	= profile->autoident_password;
 		autoident_service	= profile->autoident_service;
+		sasl_mechanism		= profile->sasl_mechanism;
+		sasl_account		= profile->sasl_account;
+		sasl_password		= profile->sasl_password;
 		mode			= profile->mode = mode;
 		for ( auto n : profile->nicknames )
 			nicknames.push_back(n);
@@ -94,8 +100,11 @@ struct config_network
 	bool		auto_connect;
 	bool		auto_exec_commands;
 	bool		auto_join_channels;
+	uint32_t	lag_interval;	// seconds between lag probes; 0 for the default
+	std::string	client_certificate;	// PEM file (certificate + key) for SSL; SASL EXTERNAL
 	std::vector<std::string>	channels;
 	std::vector<std::string>	commands;
+	std::vector<std::string>	monitor;	// nicknames to track the presence of
 	// must be a shared_ptr (not unique), as we copy the entire struct over
 	std::vector<std::shared_ptr<config_server>>	servers;
 
@@ -109,10 +118,14 @@ struct config_network
 		auto_connect		= network->auto_connect;
 		auto_exec_commands	= network->auto_exec_commands;
 		auto_join_channels	= network->auto_join_channels;
+		lag_interval		= network->lag_interval;
+		client_certificate	= network->client_certificate;
 		for ( auto c : network->channels )
 			channels.push_back(c);
 		for ( auto c : network->commands )
 			commands.push_back(c);
+		for ( auto m : network->monitor )
+			monitor.push_back(m);
 		for ( auto c : network->servers )
 			servers.push_back(c);
 		return *this;
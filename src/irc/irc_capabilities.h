@@ -0,0 +1,99 @@
+#pragma once
+
+/**
+ * @file	src/irc/irc_capabilities.h
+ * @author	James Warren
+ * @brief	Defines the IRCv3 capabilities we negotiate with servers
+ */
+
+
+
+#include <cstring>			// strcmp
+#include <api/definitions.h>
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/**
+ * The capabilities we know of, as bit flags; the enabled set for a
+ * connection is held as a single integer so the parser can check for one
+ * with a mask, rather than searching a list of strings per line.
+ *
+ * @enum E_IRC_CAP
+ */
+enum E_IRC_CAP
+{
+	CAP_None = 0x0,			/**< No capabilities */
+	CAP_MultiPrefix = 0x1,		/**< All prefixes in NAMES/WHO, not just the highest */
+	CAP_UserhostInNames = 0x2,	/**< NAMES entries are nick!user@host */
+	CAP_AwayNotify = 0x4,		/**< AWAY is sent when users in common go away */
+	CAP_ExtendedJoin = 0x8,		/**< JOIN carries the account and realname */
+	CAP_AccountNotify = 0x10,	/**< ACCOUNT is sent when users log in/out */
+	CAP_ServerTime = 0x20,		/**< Lines are tagged with the time sent */
+	CAP_MessageTags = 0x40,		/**< Lines may carry arbitrary tags */
+	CAP_Batch = 0x80,		/**< Related lines are grouped with BATCH */
+	CAP_Sasl = 0x100,		/**< SASL authentication during registration */
+	CAP_CapNotify = 0x200		/**< CAP NEW/DEL; implied by CAP LS 302 */
+};
+
+
+/** Every capability we request, if the server offers it */
+#define CAP_WANTED	(CAP_MultiPrefix | CAP_UserhostInNames | CAP_AwayNotify \
+			| CAP_ExtendedJoin | CAP_AccountNotify | CAP_ServerTime \
+			| CAP_MessageTags | CAP_Batch | CAP_Sasl | CAP_CapNotify)
+
+/** Capabilities that cause lines to begin with '@tags' */
+#define CAP_TAGGED	(CAP_ServerTime | CAP_MessageTags | CAP_Batch)
+
+
+/**
+ * Maps a capability name to its flag.
+ *
+ * @struct irc_cap_name
+ */
+struct irc_cap_name
+{
+	const char*	name;
+	E_IRC_CAP	flag;
+};
+
+
+/** The name of each capability, as used in CAP commands */
+static const irc_cap_name	irc_cap_names[] = {
+	{ "multi-prefix", CAP_MultiPrefix },
+	{ "userhost-in-names", CAP_UserhostInNames },
+	{ "away-notify", CAP_AwayNotify },
+	{ "extended-join", CAP_ExtendedJoin },
+	{ "account-notify", CAP_AccountNotify },
+	{ "server-time", CAP_ServerTime },
+	{ "message-tags", CAP_MessageTags },
+	{ "batch", CAP_Batch },
+	{ "sasl", CAP_Sasl },
+	{ "cap-notify", CAP_CapNotify }
+};
+
+
+/**
+ * Looks up the flag for a capability name.
+ *
+ * @param[in] name The capability name, without any value
+ * @return The flag, or CAP_None if it is not one we know
+ */
+inline E_IRC_CAP
+cap_from_name(
+	const char* name
+)
+{
+	for ( auto& c : irc_cap_names )
+	{
+		if ( strcmp(c.name, name) == 0 )
+			return c.flag;
+	}
+
+	return CAP_None;
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,101 @@
+#pragma once
+
+/**
+ * @file	src/irc/irc_fast_path.h
+ * @author	James Warren
+ * @brief	Picks out the lines handled on receipt, ahead of the recv queue
+ */
+
+
+
+#include <cstring>			// strchr, strncmp
+#include <api/definitions.h>
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/**
+ * The lines answered by the receiving thread as they're framed, rather than
+ * waiting their turn behind everything in the recv queue.
+ *
+ * @enum E_FAST_PATH
+ */
+enum E_FAST_PATH
+{
+	FP_None = 0,		/**< Anything else; queued for the parser */
+	FP_Ping,		/**< PING; answered with a PONG */
+	FP_Pong,		/**< PONG; possibly the reply to our lag probe */
+	FP_Error		/**< ERROR; the server is closing the link */
+};
+
+
+/**
+ * Determines whether a line is handled on the fast path. Any message tags and
+ * prefix are skipped, so tagged and prefixed lines are recognised too.
+ *
+ * Kept free of any connection state, so the classification can be exercised
+ * on its own (see tools/bench/fast_path_latency.cc).
+ *
+ * @param[in] line The received line, with the CR-LF already removed
+ * @param[out] params Set to the parameters following the command, for all
+ * but FP_None; for FP_Error, past the leading ':' if present
+ * @return The fast path command, or FP_None if the line is to be queued
+ */
+inline E_FAST_PATH
+fast_path_command(
+	const char* line,
+	const char** params
+)
+{
+	const char*	cmd = line;
+
+	// server-time tags a PONG like anything else; we've no use for them here
+	if ( *cmd == '@' )
+	{
+		if (( cmd = strchr(cmd, ' ')) == nullptr )
+			return FP_None;
+		cmd++;
+	}
+
+	// servers rarely prefix these, but they're allowed to
+	if ( *cmd == ':' )
+	{
+		if (( cmd = strchr(cmd, ' ')) == nullptr )
+			return FP_None;
+		cmd++;
+	}
+
+	switch ( *cmd )
+	{
+	case 'P':
+		if ( strncmp(cmd, "PING ", 5) == 0 )
+		{
+			*params = cmd + 5;
+			return FP_Ping;
+		}
+		if ( strncmp(cmd, "PONG ", 5) == 0 )
+		{
+			*params = cmd + 5;
+			return FP_Pong;
+		}
+		break;
+	case 'E':
+		if ( strncmp(cmd, "ERROR ", 6) == 0 )
+		{
+			*params = cmd + 6;
+			if ( **params == ':' )
+				(*params)++;
+			return FP_Error;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return FP_None;
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,132 @@
+#pragma once
+
+/**
+ * @file	src/irc/irc_line_split.h
+ * @author	James Warren
+ * @brief	Splits a received line into its sender, code and parameters
+ */
+
+
+
+#include <cstring>			// strchr
+#include <api/definitions.h>
+#include "irc_structs.h"		// ircbuf_data, ircbuf_sender
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/**
+ * The outcome of splitting a received line; anything but LS_OK is a line the
+ * parser rejects.
+ *
+ * @enum E_LINE_SPLIT
+ */
+enum E_LINE_SPLIT
+{
+	LS_OK = 0,		/**< Split successfully */
+	LS_MissingData,		/**< No code, or nothing following it */
+	LS_MissingCode,		/**< The code is empty */
+	LS_MissingHostmask	/**< A user sender without an '@' */
+};
+
+
+/*
+ * These hold no parser state, so the receive path can be exercised on its
+ * own (see tools/bench/parser_arena.cc); IrcParser validates and reports.
+ *
+ * The parts are assigned into the existing strings, so a caller that keeps
+ * the structures from one line to the next keeps their capacity too, and
+ * once it is large enough, splitting a line allocates nothing.
+ */
+
+
+/**
+ * Splits a line into its sender, code and data; the line has nuls written
+ * over the separating spaces.
+ *
+ * @param[in] buffer The line, without its CR-LF or any message tags
+ * @param[out] data The structure to assign the parts to
+ * @return The outcome; data is incomplete unless LS_OK
+ */
+inline E_LINE_SPLIT
+split_ircbuf_data(
+	char* buffer,
+	ircbuf_data* data
+)
+{
+	char*	sender = buffer;
+	char*	code;
+	char*	code_data;
+
+	// ignore the IRC standard prefix, if supplied
+	if ( *sender == ':' )
+		sender++;
+
+	if (( code = strchr(sender, ' ')) == nullptr )
+		return LS_MissingData;
+
+	// nul-out the space, and proceed to the 'first' character
+	*code++ = '\0';
+
+	if (( code_data = strchr(code, ' ')) == nullptr )
+		return LS_MissingData;
+
+	*code_data++ = '\0';
+
+	if ( *code == '\0' )
+		return LS_MissingCode;
+
+	data->sender.assign(sender, code - sender - 1);
+	data->code.assign(code, code_data - code - 1);
+	data->data.assign(code_data);
+
+	return LS_OK;
+}
+
+
+/**
+ * Splits a sender into its nickname, ident and hostmask; the sender has nuls
+ * written over the '!' and '@', unless it is rejected. A server has only a
+ * nickname, so the ident and hostmask are emptied.
+ *
+ * @param[in] buffer The sender, as split_ircbuf_data assigned it
+ * @param[out] sender The structure to assign the parts to
+ * @return The outcome; sender is incomplete unless LS_OK
+ */
+inline E_LINE_SPLIT
+split_ircbuf_sender(
+	char* buffer,
+	ircbuf_sender* sender
+)
+{
+	char*	ident;
+	char*	hostmask;
+
+	if (( ident = strchr(buffer, '!')) == nullptr )
+	{
+		/* message from the server - ideally should be a check with what
+		 * we received on the initial connection, and if it doesn't
+		 * match it should be regarded as invalid. */
+		sender->nickname.assign(buffer);
+		sender->ident.clear();
+		sender->hostmask.clear();
+		return LS_OK;
+	}
+
+	// left untouched if rejected, so the whole sender can be reported
+	if (( hostmask = strchr(ident, '@')) == nullptr )
+		return LS_MissingHostmask;
+
+	*ident++ = '\0';
+	*hostmask++ = '\0';
+
+	sender->nickname.assign(buffer, ident - buffer - 1);
+	sender->ident.assign(ident, hostmask - ident - 1);
+	sender->hostmask.assign(hostmask);
+
+	return LS_OK;
+}
+
+
+END_NAMESPACE
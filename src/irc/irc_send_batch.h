@@ -0,0 +1,258 @@
+#pragma once
+
+/**
+ * @file	src/irc/irc_send_batch.h
+ * @author	James Warren
+ * @brief	Queues outbound lines, and writes them to the socket in batches
+ */
+
+
+
+#include <queue>
+#include <string>
+#include <utility>			// std::pair
+#include <vector>
+
+#if defined(USING_OPENSSL_NET)
+#	include <openssl/bio.h>
+#endif
+
+#include <api/definitions.h>
+#include "nethelper.h"			// wait_socket
+#include "IrcEngine.h"			// MAX_LEN_IRC_MSG
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+/** The size at which queued outbound lines are written without waiting for
+ * the next parser pass; well under the 16K TLS record limit, so each batch
+ * is a single record and a single socket write */
+#define MAX_LEN_SEND_BATCH		4096
+
+
+/**
+ * The outcome of write_send_batch.
+ *
+ * @enum E_SEND_RESULT
+ */
+enum E_SEND_RESULT
+{
+	SR_Complete = 0,	/**< The whole batch has been written */
+	SR_Stalled,		/**< The socket is full; call again with the same batch */
+	SR_Failed		/**< The write failed; the connection is unusable */
+};
+
+
+/*
+ * These hold no connection state, so the send path can be exercised on its
+ * own (see tools/bench/autojoin_writes.cc); IrcConnection supplies its queue
+ * and socket, and does the locking.
+ */
+
+
+/**
+ * Packs channels into as few JOIN lines as the line length, and the servers
+ * target limit, allow. Keys are positional, so keyed channels must come
+ * first in the list.
+ *
+ * @param[in] channels Pairs of channel name and key; the key is empty if
+ * the channel has none
+ * @param[in] max_joins The number of channels to pack, from the front
+ * @param[in] max_targets The most channels per line; 0 if unlimited
+ * @param[out] lines The vector to append the JOIN lines to, without CR-LF
+ */
+inline void
+pack_join_lines(
+	const std::vector<std::pair<std::string, std::string>>& channels,
+	size_t max_joins,
+	uint32_t max_targets,
+	std::vector<std::string>& lines
+)
+{
+	std::string	names;
+	std::string	keys;
+	std::string	line;
+	const size_t	prefix_len = 5;		// "JOIN "
+	uint32_t	in_line = 0;
+	size_t		len = 0;
+	size_t		i;
+
+	/* one iteration past the end, so the final line is sent by the same
+	 * code that sends a full one */
+	for ( i = 0; i <= max_joins; i++ )
+	{
+		if ( i < max_joins )
+		{
+			// length of the line with this channel (and key) added
+			len = prefix_len + names.length() + 1 + channels[i].first.length();
+			if ( !channels[i].second.empty() )
+				len += keys.length() + 1 + channels[i].second.length();
+			else if ( !keys.empty() )
+				len += keys.length() + 1;
+		}
+
+		if ( in_line > 0 &&
+		     ( i == max_joins || len > MAX_LEN_IRC_MSG ||
+		     ( max_targets != 0 && in_line == max_targets )))
+		{
+			line = "JOIN ";
+			line += names;
+			if ( !keys.empty() )
+			{
+				line += " ";
+				line += keys;
+			}
+
+			lines.push_back(line);
+
+			names.clear();
+			keys.clear();
+			in_line = 0;
+		}
+
+		if ( i == max_joins )
+			break;
+
+		if ( !names.empty() )
+			names += ",";
+		names += channels[i].first;
+
+		if ( !channels[i].second.empty() )
+		{
+			if ( !keys.empty() )
+				keys += ",";
+			keys += channels[i].second;
+		}
+
+		in_line++;
+	}
+}
+
+
+/**
+ * Appends a line, and its CR-LF, to the send queue.
+ *
+ * @param[in] queue The send queue
+ * @param[in,out] queue_bytes The total length of the lines in the queue
+ * @param[in] line The line to queue, without a CR-LF
+ * @param[in] length The length of line
+ * @return true if the queue has reached MAX_LEN_SEND_BATCH, and should be
+ * written without waiting for the next parser pass
+ */
+inline bool
+queue_send_line(
+	std::queue<std::string>& queue,
+	uint32_t& queue_bytes,
+	const char* line,
+	uint32_t length
+)
+{
+	std::string	crlf_line;
+
+	crlf_line.reserve(length + 2);
+	crlf_line.append(line, length);
+	crlf_line += "\r\n";
+
+	queue.push(std::move(crlf_line));
+	queue_bytes += length + 2;
+
+	return queue_bytes >= MAX_LEN_SEND_BATCH;
+}
+
+
+/**
+ * Moves lines from the front of the send queue onto the end of batch; always
+ * the first, then the rest for as long as they fit within limit.
+ *
+ * @param[in] queue The send queue; must not be empty
+ * @param[in,out] queue_bytes The total length of the lines in the queue
+ * @param[in,out] batch The batch to append to
+ * @param[in] limit The most the batch can hold, unless a single line is more
+ * @return The number of lines taken
+ */
+inline uint32_t
+take_send_batch(
+	std::queue<std::string>& queue,
+	uint32_t& queue_bytes,
+	std::string& batch,
+	uint32_t limit
+)
+{
+	uint32_t	num_lines = 0;
+
+	batch.reserve(batch.length() + limit + MAX_LEN_IRC_MSG_CRLF);
+
+	do
+	{
+		batch += queue.front();
+		queue_bytes -= (uint32_t)queue.front().length();
+		queue.pop();
+		num_lines++;
+	}
+	while ( !queue.empty() && (batch.length() + queue.front().length()) <= limit );
+
+	return num_lines;
+}
+
+
+#if defined(USING_OPENSSL_NET)
+
+/**
+ * Writes the rest of batch to the socket. SSL writes are all-or-nothing; a
+ * plain socket may take part of one, so this keeps going until the whole
+ * batch is handed over.
+ *
+ * A socket that can't take any more is waited on for at most wait_ms; if it
+ * is still full, SR_Stalled is returned, and the call must be repeated with
+ * the same batch, as SSL requires.
+ *
+ * @param[in] bio The socket
+ * @param[in] batch The batch being written
+ * @param[in,out] written The bytes of batch already written
+ * @param[in] wait_ms The most to wait for the socket to become writable
+ * @param[in,out] writes Incremented for every successful write
+ * @return The outcome; on SR_Failed, the OpenSSL error queue holds why
+ */
+inline E_SEND_RESULT
+write_send_batch(
+	BIO* bio,
+	const std::string& batch,
+	size_t& written,
+	uint32_t wait_ms,
+	uint64_t& writes
+)
+{
+	int32_t		ret;
+
+	while ( written < batch.length() )
+	{
+		if (( ret = BIO_write(bio, batch.c_str() + written, (int32_t)(batch.length() - written))) <= 0 )
+		{
+			int	fd = -1;
+
+			if ( !BIO_should_retry(bio) )
+				return SR_Failed;
+
+			/* the kernel buffer is full, or SSL wants to read first
+			 * (renegotiation); wait for the socket rather than
+			 * spinning on the write */
+			if ( BIO_get_fd(bio, &fd) <= 0 || fd == -1 )
+				return SR_Failed;
+			if ( !wait_socket(fd, !BIO_should_read(bio), wait_ms) )
+				return SR_Stalled;
+
+			continue;
+		}
+
+		writes++;
+		written += ret;
+	}
+
+	return SR_Complete;
+}
+
+#endif	// USING_OPENSSL_NET
+
+
+END_NAMESPACE
@@ -47,6 +47,9 @@ enum class EIrcStatus
 	NoMoreNicks,		// There are no nicknames left to use
 	OpenSSLError,		// OpenSSL encountered an error
 	LookupFailed,		// DNS lookup failed
+	ConnectFailed,		// No server could be connected to
+	Throttled,		// Sending deferred to respect the current send rate
+	TimedOut,		// An operation did not complete in the time allowed
 	Unknown			// Placeholder/default; should never see this reported
 };
 
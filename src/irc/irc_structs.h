@@ -74,6 +74,9 @@ struct irc_activity
 	/** A single affected nickname (more than one will be vectorized) */
 	std::string			nickname;
 
+	/** The affected nicknames, where there are many (netsplits) */
+	std::vector<std::string>	nicknames;
+
 	/** Holds NOTICE, PRIVMSG, KICK, KILL, PART, QUIT, etc. messages */
 	std::string			message;
 	
@@ -128,7 +131,7 @@ struct mode_data
 	bool		is_enabled;	/**< enabling mode (+) or disabling (-) */
 	bool		has_data;	/**< whether there should be data with this mode */
 	char		mode;		/**< the mode itself (m, v, q, o, etc.) */
-	std::string	data;		/**< data associated with the mode - can be a nick, hostmask, etc. */
+	const char*	data;		/**< data associated with the mode - can be a nick, hostmask, etc.; points into the message being parsed, so only valid while it's handled */
 };
 
 
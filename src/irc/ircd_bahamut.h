@@ -17,5 +17,19 @@ BEGIN_NAMESPACE(APP_NAMESPACE)
 
 // add server-specific variables and functions here
 
+/* WATCH; the servers notification list, advertised as WATCH=<limit> in
+ * ISUPPORT. 'WATCH +nick -nick ...' adds and removes, space separated; each
+ * addition is answered with RPL_NOWON or RPL_NOWOFF, and changes thereafter
+ * with RPL_LOGON and RPL_LOGOFF.
+ *
+ * :irc.example.org 604 trez nick ident host 1400000000 :is online
+ * :irc.example.org 605 trez nick * * 0 :is offline
+ */
+#define BAHAMUT_RPL_LOGON		600
+#define BAHAMUT_RPL_LOGOFF		601
+#define BAHAMUT_RPL_WATCHOFF		602
+#define BAHAMUT_RPL_NOWON		604
+#define BAHAMUT_RPL_NOWOFF		605
+
 
 END_NAMESPACE
@@ -65,6 +65,13 @@ struct irc_server
 	uint16_t	max_len_nick;		/**< maximum length of a clients nickname */
 	uint16_t	max_len_topic;		/**< maximum length of a channel topic  */
 	uint16_t	max_num_modes;		/**< maximum number of modes in a single MODE command */
+	uint16_t	max_targets_join;	/**< maximum channels in a single JOIN command (TARGMAX); 0 if unlimited */
+	uint16_t	max_targets_notice;	/**< maximum targets in a single NOTICE (TARGMAX/MAXTARGETS); 0 if unknown */
+	uint16_t	max_targets_privmsg;	/**< maximum targets in a single PRIVMSG (TARGMAX/MAXTARGETS); 0 if unknown */
+	bool		whox;			/**< server supports WHOX (WHO with field selection) */
+	bool		monitor;		/**< server supports MONITOR */
+	bool		watch;			/**< server supports WATCH (bahamut) */
+	uint16_t	max_watch_list;		/**< entries allowed in the MONITOR/WATCH list; 0 if unlimited */
 
 	/** @todo different channel prefixes have different limits */
 	uint16_t	max_num_channels;	/**< The channel limit */
@@ -9,6 +9,7 @@
 
 
 #include <string>		// string handling, char_traits
+#include <cstring>		// memcmp, memset
 
 #if defined(_WIN32)
 #	include <WS2tcpip.h>		// WinSock2 & sockaddr_in6, needed before openssl
@@ -17,6 +18,10 @@
 #	endif
 #else
 #	include <netdb.h>		// getnameinfo
+#	include <fcntl.h>		// fcntl, O_NONBLOCK
+#	include <unistd.h>		// close
+#	include <errno.h>		// EINPROGRESS
+#	include <poll.h>		// poll
 #endif
 
 #if defined(USING_OPENSSL_NET)
@@ -36,6 +41,110 @@
 BEGIN_NAMESPACE(APP_NAMESPACE)
 
 
+
+void
+close_socket(
+	intptr_t sock
+)
+{
+#if defined(_WIN32)
+	closesocket((SOCKET)sock);
+#else
+	close((int)sock);
+#endif
+}
+
+
+
+/**
+ * Switches a socket between blocking and non-blocking mode.
+ */
+static bool
+set_socket_blocking(
+	intptr_t sock,
+	bool blocking
+)
+{
+#if defined(_WIN32)
+	u_long	mode = blocking ? 0 : 1;
+	return ioctlsocket((SOCKET)sock, FIONBIO, &mode) == 0;
+#else
+	int	flags = fcntl((int)sock, F_GETFL, 0);
+
+	if ( flags == -1 )
+		return false;
+
+	flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+	return fcntl((int)sock, F_SETFL, flags) == 0;
+#endif
+}
+
+
+
+/**
+ * Creates a non-blocking socket and starts connecting it to the candidate.
+ *
+ * @return The socket, or -1 if the attempt failed immediately
+ */
+static intptr_t
+start_connect(
+	const connect_candidate& candidate
+)
+{
+	sockaddr_union	sa;
+	socklen_t	len;
+	intptr_t	sock;
+
+	memset(&sa, 0, sizeof(sa));
+
+	if ( candidate.ip.family == AF_INET6 )
+	{
+		sa.sin6.sin6_family	= AF_INET6;
+		sa.sin6.sin6_port	= htons(candidate.port);
+		sa.sin6.sin6_addr	= candidate.ip.data.ip6;
+		len = sizeof(sa.sin6);
+	}
+	else
+	{
+		sa.sin.sin_family	= AF_INET;
+		sa.sin.sin_port		= htons(candidate.port);
+		sa.sin.sin_addr		= candidate.ip.data.ip4;
+		len = sizeof(sa.sin);
+	}
+
+#if defined(_WIN32)
+	SOCKET	s = socket(sa.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if ( s == INVALID_SOCKET )
+		return -1;
+	sock = (intptr_t)s;
+#else
+	if (( sock = socket(sa.sa.sa_family, SOCK_STREAM, IPPROTO_TCP)) == -1 )
+		return -1;
+#endif
+
+	if ( !set_socket_blocking(sock, false) )
+		goto failed;
+
+	if ( connect(sock, &sa.sa, len) != 0 )
+	{
+#if defined(_WIN32)
+		if ( WSAGetLastError() != WSAEWOULDBLOCK )
+			goto failed;
+#else
+		if ( errno != EINPROGRESS )
+			goto failed;
+#endif
+	}
+
+	return sock;
+
+failed:
+	close_socket(sock);
+	return -1;
+}
+
+
+
 int32_t
 host_to_ipv4(
 	const char* hostname,
@@ -111,6 +220,289 @@ host_to_ipv4(
 
 
 
+int32_t
+host_to_addresses(
+	const char* hostname,
+	std::vector<ip_address>& addresses
+)
+{
+	struct addrinfo		hints = { 0 };
+	struct addrinfo*	result = NULL;
+	struct addrinfo*	rp = NULL;
+	int32_t		res;
+
+	// both families; only interested in one entry per address
+	hints.ai_family		= AF_UNSPEC;
+	hints.ai_socktype	= SOCK_STREAM;
+
+	if (( res = getaddrinfo(hostname, NULL, &hints, &result)) != 0 )
+	{
+		LOG(ELogLevel::Warn) << "Error " << res 
+			<< " (" << gai_strerror(res) 
+			<< ") looking up " << hostname 
+			<< "\n";
+		return res;
+	}
+
+	for ( rp = result; rp != NULL; rp = rp->ai_next )
+	{
+		struct ip_address	ip;
+		bool			duplicate = false;
+
+		memset(&ip, 0, sizeof(ip));
+		ip.family = rp->ai_family;
+
+		if ( rp->ai_family == AF_INET )
+			ip.data.ip4 = ((struct sockaddr_in*)rp->ai_addr)->sin_addr;
+		else if ( rp->ai_family == AF_INET6 )
+			ip.data.ip6 = ((struct sockaddr_in6*)rp->ai_addr)->sin6_addr;
+		else
+			continue;
+
+		for ( auto a : addresses )
+		{
+			if ( a.family == ip.family && memcmp(&a.data, &ip.data, sizeof(ip.data)) == 0 )
+			{
+				duplicate = true;
+				break;
+			}
+		}
+
+		if ( !duplicate )
+			addresses.push_back(ip);
+	}
+
+	freeaddrinfo(result);
+	return 0;
+}
+
+
+
+int32_t
+address_to_host(
+	const ip_address& ip,
+	std::string& hostname
+)
+{
+	union sockaddr_union	sa;
+	socklen_t	sa_len;
+	char		host[NI_MAXHOST];
+	int32_t		res;
+
+	memset(&sa, 0, sizeof(sa));
+
+	if ( ip.family == AF_INET )
+	{
+		sa.sin.sin_family	= AF_INET;
+		sa.sin.sin_addr		= ip.data.ip4;
+		sa_len			= sizeof(sa.sin);
+	}
+	else if ( ip.family == AF_INET6 )
+	{
+		sa.sin6.sin6_family	= AF_INET6;
+		sa.sin6.sin6_addr	= ip.data.ip6;
+		sa_len			= sizeof(sa.sin6);
+	}
+	else
+	{
+		return EAI_FAMILY;
+	}
+
+	/* no NI_NAMEREQD; an address without a PTR record comes back in its
+	 * numeric form, which is still a usable answer */
+	if (( res = getnameinfo(&sa.sa, sa_len, host, sizeof(host), NULL, 0, 0)) != 0 )
+	{
+		LOG(ELogLevel::Warn) << "Error " << res
+			<< " (" << gai_strerror(res)
+			<< ") reverse resolving an address\n";
+		return res;
+	}
+
+	hostname = host;
+	return 0;
+}
+
+
+
+intptr_t
+race_connect(
+	const std::vector<connect_candidate>& candidates,
+	uint32_t stagger_ms,
+	uint32_t timeout_ms,
+	size_t* winner,
+	uint64_t* latency_ms
+)
+{
+	std::vector<intptr_t>	socks(candidates.size(), -1);
+	std::vector<uint64_t>	started_at(candidates.size(), 0);
+	uint64_t	start = get_ms_time();
+	uint64_t	next_start = start;
+	uint64_t	now;
+	size_t		started = 0;
+	size_t		failed = 0;
+	size_t		i;
+	intptr_t	result = -1;
+
+	while ( result == -1 )
+	{
+#if defined(_WIN32)
+		std::vector<WSAPOLLFD>		pfds;
+#else
+		std::vector<struct pollfd>	pfds;
+#endif
+		std::vector<size_t>		pfd_index;	// candidate index of each pfds entry
+		uint64_t	wait_ms;
+		int		res;
+
+		now = get_ms_time();
+
+		if ( now - start >= timeout_ms )
+			break;
+
+		/* start the next attempt if it's due, or if everything in
+		 * progress has already failed - no sense waiting around */
+		if ( started < candidates.size() && ( now >= next_start || failed == started ))
+		{
+			started_at[started] = now;
+
+			if (( socks[started] = start_connect(candidates[started])) == -1 )
+				failed++;
+
+			started++;
+			next_start = now + stagger_ms;
+			continue;
+		}
+
+		if ( failed == candidates.size() )
+			break;
+
+		/* poll rather than select; descriptors beyond FD_SETSIZE are
+		 * entirely possible with enough networks and logs open */
+		for ( i = 0; i < started; i++ )
+		{
+			if ( socks[i] == -1 )
+				continue;
+
+			pfds.resize(pfds.size() + 1);
+			pfds.back().fd		= (decltype(pfds.back().fd))socks[i];
+			pfds.back().events	= POLLOUT;
+			pfds.back().revents	= 0;
+			pfd_index.push_back(i);
+		}
+
+		// wake for the next attempt, or the overall timeout
+		wait_ms = timeout_ms - (now - start);
+		if ( started < candidates.size() && next_start - now < wait_ms )
+			wait_ms = next_start - now;
+
+#if defined(_WIN32)
+		res = WSAPoll(pfds.data(), (ULONG)pfds.size(), (INT)wait_ms);
+#else
+		res = poll(pfds.data(), (nfds_t)pfds.size(), (int)wait_ms);
+#endif
+		if ( res <= 0 )
+			continue;
+
+		now = get_ms_time();
+
+		for ( size_t p = 0; p < pfds.size(); p++ )
+		{
+			int		err = 0;
+			socklen_t	err_len = sizeof(err);
+
+			if ( pfds[p].revents == 0 )
+				continue;
+
+			i = pfd_index[p];
+
+			// writable (or POLLERR/POLLHUP) means the connect completed; check how
+			if ( getsockopt(socks[i], SOL_SOCKET, SO_ERROR, (char*)&err, &err_len) != 0 || err != 0 )
+			{
+				close_socket(socks[i]);
+				socks[i] = -1;
+				failed++;
+				continue;
+			}
+
+			result = socks[i];
+			socks[i] = -1;
+			*winner = i;
+			*latency_ms = now - started_at[i];
+			break;
+		}
+	}
+
+	// cancel everything that didn't win
+	for ( auto s : socks )
+	{
+		if ( s != -1 )
+			close_socket(s);
+	}
+
+	if ( result != -1 && !set_socket_blocking(result, true) )
+	{
+		close_socket(result);
+		result = -1;
+	}
+
+	return result;
+}
+
+
+
+bool
+wait_socket(
+	intptr_t sock,
+	bool for_write,
+	uint32_t timeout_ms
+)
+{
+#if defined(_WIN32)
+	WSAPOLLFD	pfd;
+#else
+	struct pollfd	pfd;
+#endif
+	int		res;
+
+	pfd.fd		= (decltype(pfd.fd))sock;
+	pfd.events	= for_write ? POLLOUT : POLLIN;
+	pfd.revents	= 0;
+
+	do
+	{
+#if defined(_WIN32)
+		res = WSAPoll(&pfd, 1, (INT)timeout_ms);
+#else
+		res = poll(&pfd, 1, (int)timeout_ms);
+#endif
+	}
+#if defined(_WIN32)
+	while ( 0 );
+#else
+	while ( res == -1 && errno == EINTR );
+#endif
+
+	// POLLERR/POLLHUP count; the next call will report the actual error
+	return res > 0;
+}
+
+
+
+bool
+ip_address_to_string(
+	const ip_address& ip,
+	char* dest,
+	uint32_t dest_size
+)
+{
+	if ( ip.family != AF_INET && ip.family != AF_INET6 )
+		return false;
+
+	return inet_ntop(ip.family, (void*)&ip.data, dest, dest_size) != nullptr;
+}
+
+
+
 bool
 ipv4_to_host(
 	const char* ipv4_address,
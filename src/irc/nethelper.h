@@ -25,6 +25,9 @@
 #	include <arpa/inet.h>	// inet_ntop, inet_pton
 #endif
 
+#include <string>
+#include <vector>
+
 #include <api/char_helper.h>
 
 
@@ -62,6 +65,25 @@ union sockaddr_union
 };
 
 
+/** Delay between starting each parallel connection attempt (RFC 8305) */
+#define CONNECT_ATTEMPT_DELAY_MS	250
+/** Time allowed for any parallel connection attempt to succeed */
+#define CONNECT_RACE_TIMEOUT_MS		30000
+
+
+/**
+ * A single address to attempt a connection to, as part of race_connect.
+ *
+ * @struct connect_candidate
+ */
+struct connect_candidate
+{
+	ip_address	ip;		/**< The address to connect to */
+	uint16_t	port;		/**< The port to connect to */
+	uint32_t	server_index;	/**< Caller-defined; the server this address belongs to */
+};
+
+
 
 /**
  * Validates and looks up the supplied @a hostname. On success, the first IP
@@ -134,6 +156,128 @@ host_to_ipv4(
 );
 
 
+/**
+ * Looks up every IPv4 and IPv6 address for hostname, in the order returned by
+ * the system resolver (which honours the hosts file, and RFC 6724 ordering
+ * where the platform implements it). Duplicates, from multiple socket types,
+ * are removed.
+ *
+ * This is a blocking call; use the DnsResolver for a cached, coalesced
+ * lookup.
+ *
+ * @param[in] hostname The hostname to lookup
+ * @param[out] addresses The vector to append the resolved addresses to
+ * @return 0 on success (even if no addresses were returned), otherwise the
+ * getaddrinfo error code
+ * @sa host_to_ipv4, DnsResolver
+ */
+SBI_IRC_API
+int32_t
+host_to_addresses(
+	const char* hostname,
+	std::vector<ip_address>& addresses
+);
+
+
+/**
+ * Looks up the hostname for an IPv4 or IPv6 address. If there is no name for
+ * the address, its numeric form is returned instead.
+ *
+ * This is a blocking call; use the DnsResolver for a cached, coalesced
+ * lookup.
+ *
+ * @param[in] ip The address to reverse-lookup
+ * @param[out] hostname The string to assign the hostname to
+ * @return 0 on success, otherwise the getnameinfo error code
+ * @sa host_to_addresses, DnsResolver
+ */
+SBI_IRC_API
+int32_t
+address_to_host(
+	const ip_address& ip,
+	std::string& hostname
+);
+
+
+/**
+ * Closes a socket returned by race_connect, if the caller decides not to use
+ * it after all.
+ *
+ * @param[in] sock The socket to close
+ */
+SBI_IRC_API
+void
+close_socket(
+	intptr_t sock
+);
+
+
+/**
+ * Connects to the first candidate that accepts a TCP connection, in the style
+ * of RFC 8305 (Happy Eyeballs). Attempts start in the order supplied, each
+ * stagger_ms after the last - or immediately, if every attempt in progress
+ * has already failed - and the first to complete wins; the rest are closed.
+ *
+ * Order the candidates by preference, interleaving address families, before
+ * calling.
+ *
+ * @param[in] candidates The addresses to try
+ * @param[in] stagger_ms The delay between starting each attempt
+ * @param[in] timeout_ms The maximum time to wait for any attempt
+ * @param[out] winner The index in candidates of the connected address
+ * @param[out] latency_ms The time the winning attempt took to connect
+ * @return The connected socket, in blocking mode, which the caller now owns;
+ * or -1 if no attempt succeeded within the timeout
+ */
+SBI_IRC_API
+intptr_t
+race_connect(
+	const std::vector<connect_candidate>& candidates,
+	uint32_t stagger_ms,
+	uint32_t timeout_ms,
+	size_t* winner,
+	uint64_t* latency_ms
+);
+
+
+/**
+ * Waits until a socket is ready to be written to (or read from), for use
+ * when a write or read reports it should be retried; rather than spinning
+ * on the call until the kernel buffer drains.
+ *
+ * @param[in] sock The socket to wait on
+ * @param[in] for_write true to wait until writable, false until readable
+ * @param[in] timeout_ms The maximum time to wait
+ * @return true if the socket is ready, or has an error pending for the next
+ * call to report; false if the wait timed out or failed
+ */
+SBI_IRC_API
+bool
+wait_socket(
+	intptr_t sock,
+	bool for_write,
+	uint32_t timeout_ms
+);
+
+
+/**
+ * Converts the supplied ip_address to its string form; dotted-quad for IPv4,
+ * or the RFC 5952 representation for IPv6.
+ *
+ * @param[in] ip The address to convert
+ * @param[out] dest The buffer to copy the string to
+ * @param[in] dest_size The size of dest; INET6_ADDRSTRLEN is sufficient
+ * @return true if the address was converted, otherwise false
+ */
+SBI_IRC_API
+bool
+ip_address_to_string(
+	const ip_address& ip,
+	char* dest,
+	uint32_t dest_size
+);
+
+
 /**
  * Performs a reverse lookup on the input ipv4_address.
  *
@@ -0,0 +1,356 @@
+
+/**
+ * @file	src/irc/rpc_commands.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ */
+
+
+
+#include <algorithm>			// std::sort
+#include <stdexcept>			// std::runtime_error
+
+#include <api/interface.h>		// instance()
+#include <api/utils.h>			// BUILD_STRING
+#include "rpc_commands.h"
+#include "IrcEngine.h"
+#include "IrcChannel.h"
+#include "IrcConnection.h"
+#include "IrcPool.h"
+#include "PresenceTracker.h"
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+json_spirit::Value
+irc_Broadcast(
+	const json_spirit::Array& params,
+	bool help
+)
+{
+	std::shared_ptr<IrcConnection>	connection;
+	std::vector<std::string>	targets;
+	std::string	type;
+	std::string	message;
+	EIrcStatus	status;
+
+	if ( help || params.size() != 4 )
+	{
+		throw std::runtime_error(
+			"irc_broadcast connection_id privmsg|notice [target,...] message\n"
+			"Sends message to every target, with as many targets per line as the server allows."
+		);
+	}
+
+	type	= params[1].get_str();
+	message	= params[3].get_str();
+
+	for ( auto t : params[2].get_array() )
+		targets.push_back(t.get_str());
+
+	connection = IRC_ENGINE->Pools()->GetConnection((uint32_t)params[0].get_uint64());
+
+	if ( connection == nullptr )
+		throw std::runtime_error("Invalid connection id");
+
+	if ( type == "privmsg" )
+		status = connection->SendPrivmsgList(targets, message.c_str());
+	else if ( type == "notice" )
+		status = connection->SendNoticeList(targets, message.c_str());
+	else
+		throw std::runtime_error("Invalid message type; must be privmsg or notice");
+
+	if ( status != EIrcStatus::OK )
+	{
+		throw std::runtime_error(BUILD_STRING(
+			"Broadcast failed; status ", std::to_string((int)status).c_str()));
+	}
+
+	return (uint64_t)targets.size();
+}
+
+
+
+/**
+ * Builds the JSON object for the lag statistics of a single connection.
+ *
+ * @param[in] connection The connection
+ * @return The object, ready to be returned or added to an array
+ */
+static json_spirit::Object
+lag_object(
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	json_spirit::Object	obj;
+	irc_lag_stats		stats = connection->GetLagStats();
+
+	obj.push_back(json_spirit::Pair("connection_id", (uint64_t)connection->Id()));
+	obj.push_back(json_spirit::Pair("network", connection->NetworkName()));
+	obj.push_back(json_spirit::Pair("last_ms", (uint64_t)stats.last_ms));
+	obj.push_back(json_spirit::Pair("average_ms", (uint64_t)stats.average_ms));
+	obj.push_back(json_spirit::Pair("min_ms", (uint64_t)stats.min_ms));
+	obj.push_back(json_spirit::Pair("p50_ms", (uint64_t)stats.p50_ms));
+	obj.push_back(json_spirit::Pair("p95_ms", (uint64_t)stats.p95_ms));
+	obj.push_back(json_spirit::Pair("samples", (uint64_t)stats.samples));
+	obj.push_back(json_spirit::Pair("probes", (uint64_t)stats.probes));
+	obj.push_back(json_spirit::Pair("send_limit", (uint64_t)stats.send_limit));
+	obj.push_back(json_spirit::Pair("send_spacing_ms", (uint64_t)stats.send_spacing_ms));
+	obj.push_back(json_spirit::Pair("degraded", stats.send_spacing_ms != 0));
+
+	return obj;
+}
+
+
+
+json_spirit::Value
+irc_Lag(
+	const json_spirit::Array& params,
+	bool help
+)
+{
+	std::shared_ptr<IrcConnection>	connection;
+	json_spirit::Array	arr;
+
+	if ( help || params.size() > 1 )
+	{
+		throw std::runtime_error(
+			"irc_lag [connection_id]\n"
+			"Returns the lag statistics and send rate of the connection, or of all connections."
+		);
+	}
+
+	if ( params.size() == 1 )
+	{
+		connection = IRC_ENGINE->Pools()->GetConnection((uint32_t)params[0].get_uint64());
+
+		if ( connection == nullptr )
+			throw std::runtime_error("Invalid connection id");
+
+		return lag_object(connection);
+	}
+
+	for ( auto c : IRC_ENGINE->Pools()->IrcConnections()->Allocated() )
+	{
+		arr.push_back(lag_object(c));
+	}
+
+	return arr;
+}
+
+
+
+/**
+ * Orders channels largest first, for memory_object.
+ */
+static bool
+channel_bytes_greater(
+	const std::pair<size_t, std::shared_ptr<IrcChannel>>& a,
+	const std::pair<size_t, std::shared_ptr<IrcChannel>>& b
+)
+{
+	return a.first > b.first;
+}
+
+
+
+/**
+ * Builds the JSON object for the memory held by a single connection.
+ *
+ * @param[in] connection The connection
+ * @return The object, ready to be returned or added to an array
+ */
+static json_spirit::Object
+memory_object(
+	std::shared_ptr<IrcConnection> connection
+)
+{
+	json_spirit::Object	obj;
+	json_spirit::Array	arr;
+	irc_queue_stats		stats = connection->GetQueueStats();
+	uint64_t		channel_bytes = 0;
+	std::vector<std::pair<size_t, std::shared_ptr<IrcChannel>>>	channels;
+
+	for ( auto c : IRC_ENGINE->Pools()->IrcChannels()->Allocated() )
+	{
+		if ( c->Owner() == connection )
+			channels.push_back(std::make_pair(c->MemoryUsage(), c));
+	}
+
+	std::sort(channels.begin(), channels.end(), channel_bytes_greater);
+
+	for ( auto& c : channels )
+	{
+		json_spirit::Object	entry;
+
+		entry.push_back(json_spirit::Pair("name", c.second->Name()));
+		entry.push_back(json_spirit::Pair("users", (uint64_t)c.second->NumberOfUsers()));
+		entry.push_back(json_spirit::Pair("bytes", (uint64_t)c.first));
+		arr.push_back(entry);
+
+		channel_bytes += c.first;
+	}
+
+	obj.push_back(json_spirit::Pair("connection_id", (uint64_t)connection->Id()));
+	obj.push_back(json_spirit::Pair("network", connection->NetworkName()));
+	obj.push_back(json_spirit::Pair("recv_queue_lines", (uint64_t)stats.recv_lines));
+	obj.push_back(json_spirit::Pair("recv_queue_bytes", (uint64_t)stats.recv_bytes));
+	obj.push_back(json_spirit::Pair("send_queue_lines", (uint64_t)stats.send_lines));
+	obj.push_back(json_spirit::Pair("send_queue_bytes", (uint64_t)stats.send_bytes));
+	obj.push_back(json_spirit::Pair("channel_bytes", channel_bytes));
+	obj.push_back(json_spirit::Pair("channels", arr));
+
+	return obj;
+}
+
+
+
+json_spirit::Value
+irc_Memory(
+	const json_spirit::Array& params,
+	bool help
+)
+{
+	std::shared_ptr<IrcConnection>	connection;
+	json_spirit::Array	arr;
+
+	if ( help || params.size() > 1 )
+	{
+		throw std::runtime_error(
+			"irc_memory [connection_id]\n"
+			"Returns the queue depths and estimated channel sizes of the connection, or of all connections."
+		);
+	}
+
+	if ( params.size() == 1 )
+	{
+		connection = IRC_ENGINE->Pools()->GetConnection((uint32_t)params[0].get_uint64());
+
+		if ( connection == nullptr )
+			throw std::runtime_error("Invalid connection id");
+
+		return memory_object(connection);
+	}
+
+	for ( auto c : IRC_ENGINE->Pools()->IrcConnections()->Allocated() )
+	{
+		arr.push_back(memory_object(c));
+	}
+
+	return arr;
+}
+
+
+
+json_spirit::Value
+irc_Monitor(
+	const json_spirit::Array& params,
+	bool help
+)
+{
+	std::shared_ptr<IrcConnection>	connection;
+	std::vector<std::string>	add;
+	std::vector<std::string>	remove;
+	std::vector<presence_entry>	entries;
+	std::string	nick;
+	EPresenceMethod	method;
+	json_spirit::Object	obj;
+	json_spirit::Array	arr;
+
+	if ( help || params.size() < 1 )
+	{
+		throw std::runtime_error(
+			"irc_monitor connection_id [+nickname|-nickname ...]\n"
+			"Tracks (+) or stops tracking (-) the presence of nicknames, then returns whether each tracked nickname is online."
+		);
+	}
+
+	connection = IRC_ENGINE->Pools()->GetConnection((uint32_t)params[0].get_uint64());
+
+	if ( connection == nullptr )
+		throw std::runtime_error("Invalid connection id");
+
+	for ( size_t i = 1; i < params.size(); i++ )
+	{
+		nick = params[i].get_str();
+
+		if ( nick.length() < 2 || (nick[0] != '+' && nick[0] != '-') )
+			throw std::runtime_error(BUILD_STRING("Invalid nickname change '", nick.c_str(), "'; expected +nickname or -nickname"));
+
+		if ( nick[0] == '+' )
+			add.push_back(nick.substr(1));
+		else
+			remove.push_back(nick.substr(1));
+	}
+
+	if ( !remove.empty() )
+		IRC_ENGINE->Presence()->Unwatch(connection, remove);
+	if ( !add.empty() )
+		IRC_ENGINE->Presence()->Watch(connection, add);
+
+	entries = IRC_ENGINE->Presence()->Status(connection->Id(), &method);
+
+	for ( auto& e : entries )
+	{
+		json_spirit::Object	entry;
+
+		entry.push_back(json_spirit::Pair("nickname", e.nickname));
+		entry.push_back(json_spirit::Pair("presence",
+			e.presence == EPresence::Online ? "online" :
+			e.presence == EPresence::Offline ? "offline" : "unknown"));
+		entry.push_back(json_spirit::Pair("watched_by_server", e.on_server));
+		arr.push_back(entry);
+	}
+
+	obj.push_back(json_spirit::Pair("method",
+		method == EPresenceMethod::Monitor ? "monitor" :
+		method == EPresenceMethod::Watch ? "watch" :
+		method == EPresenceMethod::Ison ? "ison" : "none"));
+	obj.push_back(json_spirit::Pair("nicknames", arr));
+
+	return obj;
+}
+
+
+
+json_spirit::Value
+irc_TlsStats(
+	const json_spirit::Array& params,
+	bool help
+)
+{
+	std::shared_ptr<IrcConnection>	connection;
+	json_spirit::Object	obj;
+	irc_tls_stats		stats;
+
+	if ( help || params.size() != 1 )
+	{
+		throw std::runtime_error(
+			"irc_tls_stats connection_id\n"
+			"Returns the SSL handshake timings and session resumption count for the connection."
+		);
+	}
+
+	connection = IRC_ENGINE->Pools()->GetConnection((uint32_t)params[0].get_uint64());
+
+	if ( connection == nullptr )
+		throw std::runtime_error("Invalid connection id");
+
+	stats = connection->GetTlsStats();
+
+	obj.push_back(json_spirit::Pair("handshakes", (uint64_t)stats.handshakes));
+	obj.push_back(json_spirit::Pair("resumed", (uint64_t)stats.resumed));
+	obj.push_back(json_spirit::Pair("last_handshake_ms", stats.last_handshake_ms));
+	obj.push_back(json_spirit::Pair("avg_handshake_ms", stats.handshakes == 0 ?
+		(uint64_t)0 : stats.total_handshake_ms / stats.handshakes));
+
+	return obj;
+}
+
+
+
+END_NAMESPACE
@@ -0,0 +1,111 @@
+#pragma once
+
+/**
+ * @file	src/irc/rpc_commands.h
+ * @author	James Warren
+ * @brief	IRC RPC functions, as they cannot be class members
+ */
+
+
+
+#if defined(USING_JSON_SPIRIT_RPC)
+#	include <json_spirit/json_spirit_utils.h>
+#endif
+
+#include <api/definitions.h>
+
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+
+
+/* Same convention as the API and GUI; the member function being wrapped is
+ * prefixed with 'irc_' */
+
+
+
+/**
+ * Sends a PRIVMSG or NOTICE to multiple targets on a connection, packed into
+ * as few lines as the server allows.
+ *
+ * Parameters: connection id, "privmsg"|"notice", [targets], message
+ *
+ * @sa IrcConnection::SendPrivmsgList, IrcConnection::SendNoticeList
+ */
+SBI_IRC_API
+json_spirit::Value
+irc_Broadcast(
+	const json_spirit::Array& params,
+	bool help
+);
+
+
+/**
+ * Retrieves the lag statistics of one connection, or of every connection if
+ * no id is given; the average and percentile lag, and how far the send rate
+ * is currently backed off.
+ *
+ * Parameters: [connection id]
+ *
+ * @sa IrcConnection::GetLagStats
+ */
+SBI_IRC_API
+json_spirit::Value
+irc_Lag(
+	const json_spirit::Array& params,
+	bool help
+);
+
+
+/**
+ * Retrieves the memory held by one connection, or by every connection if no
+ * id is given; the depth of its queues, and the estimated size of each of
+ * its channels, largest first.
+ *
+ * Parameters: [connection id]
+ *
+ * @sa IrcConnection::GetQueueStats, IrcChannel::MemoryUsage
+ */
+SBI_IRC_API
+json_spirit::Value
+irc_Memory(
+	const json_spirit::Array& params,
+	bool help
+);
+
+
+/**
+ * Adds or removes nicknames tracked for presence on a connection, and
+ * retrieves whether each tracked nickname is online.
+ *
+ * Parameters: connection id, [+nickname|-nickname ...]
+ *
+ * @sa PresenceTracker::Watch, PresenceTracker::Unwatch
+ */
+SBI_IRC_API
+json_spirit::Value
+irc_Monitor(
+	const json_spirit::Array& params,
+	bool help
+);
+
+
+/**
+ * Retrieves the TLS handshake statistics for a connection; the duration of
+ * the last handshake, the average, and how many resumed a cached session.
+ *
+ * Parameters: connection id
+ *
+ * @sa IrcConnection::GetTlsStats
+ */
+SBI_IRC_API
+json_spirit::Value
+irc_TlsStats(
+	const json_spirit::Array& params,
+	bool help
+);
+
+
+
+END_NAMESPACE
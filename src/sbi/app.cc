@@ -25,7 +25,7 @@
 #include <api/utils.h>			// utility functions
 #include <api/Runtime.h>		// application runtime
 #include <api/Log.h>			// logging
-#include <api/Terminal.h>		// output
+#include <api/Diagnostics.h>		// output
 #include <api/Allocator.h>		// memory debug log name
 #include <api/Configuration.h>		// configuration
 #include <api/RpcServer.h>		// RPC
@@ -99,10 +99,10 @@ app_init(
 	sa.sa_flags = SA_SIGINFO;
 
 	if ( sigaction(SIGSEGV, &sa, NULL) == -1 )
-		std::cerr << fg_red << "Unable to trap the SIGINT signal\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Unable to trap the SIGINT signal\n";
 
 	if ( getcwd(curdir, sizeof(curdir)) == nullptr )
-		std::cerr << fg_red << "getcwd failed - error: " << errno << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "getcwd failed - error: " << errno << "\n";
 
 	get_current_binary_path(curpath, sizeof(curpath));
 #endif	// __linux__
@@ -138,7 +138,7 @@ app_init(
 	 * line override - so I guess we won't support that! */
 	parse_commandline(argc, argv);
 	// only execute if debug logging
-	if ( runtime.Logger()->LogLevel() == ELogLevel::Debug )
+	if ( LOG_ENABLED(ELogLevel::Debug) )
 	{
 		// Log configuration
 		runtime.Config()->Dump();
@@ -275,11 +275,11 @@ app_init(
 
 	if ( !runtime.Config()->ui.enable_terminal )
 	{
+		// nothing will see the console; don't even format for it
+		runtime.Diagnostics()->SetEnabled(false);
 #if defined(_WIN32)
 		HWND	console_wnd = GetConsoleWindow();
 		ShowWindow(console_wnd, SW_HIDE);
-#else
-		std::cout << "'show_terminal' setting ignored for this operating system\n";
 #endif
 	}
 	
@@ -289,7 +289,7 @@ app_init(
 
 
 	end_time = get_ms_time();
-	std::cout << "Application startup completed in " << (end_time - start_time) << "ms\n";
+	DIAG(EDiagCategory::Runtime, ELogLevel::Info) << "Application startup completed in " << (end_time - start_time) << "ms\n";
 	LOG(ELogLevel::Info) << "Application startup completed in " << (end_time - start_time) << "ms\n";
 }
 
@@ -301,7 +301,7 @@ app_stop()
 	// will block, waiting for threads to finish
 	runtime.DoShutdown();
 
-	std::cout << "Application closure and cleanup complete\n";
+	DIAG(EDiagCategory::Runtime, ELogLevel::Info) << "Application closure and cleanup complete\n";
 	LOG(ELogLevel::Info) << "Application closure and cleanup complete\n";
 
 	runtime.Logger()->Flush();
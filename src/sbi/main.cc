@@ -12,11 +12,14 @@
 #include <iostream>		// cerr
 
 #include <cstdlib>		// EXIT_FAILURE, EXIT_SUCCESS
+#include <cstring>		// strcmp
 
 #include <api/types.h>		// Standard data types
 #include <api/Runtime.h>	// application runtime
-#include <api/Terminal.h>	// Output colour
+#include <api/Diagnostics.h>	// console output
+#include <api/HeapProfiler.h>	// closing the dump thread
 #include <api/Log.h>		// Logging class
+#include <api/log_binary.h>	// binary log decoding
 #include "app.h"		// Core Application
 
 
@@ -35,6 +38,13 @@ main(
 
 	using namespace APP_NAMESPACE;
 
+	/* standalone tool mode; renders a binary log as text, without starting
+	 * anything else up */
+	if ( argc == 3 && strcmp(argv[1], "--decode-log") == 0 )
+	{
+		return logbin_decode(argv[2], stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 
 	/* initialize the application. These are the core essentials; if an
 	 * error or exception is raised, we cannot continue with normal startup
@@ -51,19 +61,19 @@ main(
 	}
 	catch ( std::runtime_error& e )
 	{
-		std::cerr << fg_red << "Initialization runtime error:\n\t" << e.what() << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Initialization runtime error:\n\t" << e.what() << "\n";
 		LOG(ELogLevel::Error) << "Initialization runtime error:\n\t" << e.what() << "\n";
 		goto abort;
 	}
 	catch ( std::exception& e )
 	{
-		std::cerr << fg_red << "Uncaught exception in initialization:\n\t" << e.what() << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Uncaught exception in initialization:\n\t" << e.what() << "\n";
 		LOG(ELogLevel::Error) << "Uncaught exception in initialization:\n\t" << e.what() << "\n";
 		goto abort;
 	}
 	catch ( ... )
 	{
-		std::cerr << fg_red << "Unhandled exception in initialization";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Unhandled exception in initialization\n";
 		LOG(ELogLevel::Error) << "Unhandled exception in initialization";
 		goto abort;
 	}
@@ -77,19 +87,19 @@ main(
 	 * not throw exceptions ourselves outside of this */
 	catch ( std::runtime_error& e )
 	{
-		std::cerr << fg_red << "runtime error:\n\t" << e.what() << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "runtime error:\n\t" << e.what() << "\n";
 		LOG(ELogLevel::Error) << "runtime error:\n\t" << e.what() << "\n";
 		goto abort;
 	}
 	catch ( std::exception& e )
 	{
-		std::cerr << fg_red << "Uncaught exception in execution:\n\t" << e.what() << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Uncaught exception in execution:\n\t" << e.what() << "\n";
 		LOG(ELogLevel::Error) << "Uncaught exception in execution:\n\t" << e.what() << "\n";
 		goto abort;
 	}
 	catch ( ... )
 	{
-		std::cerr << fg_red << "Unhandled exception in execution";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Unhandled exception in execution\n";
 		LOG(ELogLevel::Error) << "Unhandled exception in execution";
 		goto abort;
 	}
@@ -101,19 +111,19 @@ main(
 	}
 	catch ( std::runtime_error& e )
 	{
-		std::cerr << fg_red << "Shutdown runtime error:\n\t" << e.what() << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Shutdown runtime error:\n\t" << e.what() << "\n";
 		LOG(ELogLevel::Error) << "Shutdown runtime error:\n\t" << e.what() << "\n";
 		goto abort;
 	}
 	catch ( std::exception& e )
 	{
-		std::cerr << fg_red << "Uncaught exception in shutdown:\n\t" << e.what() << "\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Uncaught exception in shutdown:\n\t" << e.what() << "\n";
 		LOG(ELogLevel::Error) << "Uncaught exception in shutdown:\n\t" << e.what() << "\n";
 		goto abort;
 	}
 	catch ( ... )
 	{
-		std::cerr << fg_red << "Unhandled exception in shutdown\n";
+		DIAG(EDiagCategory::Runtime, ELogLevel::Error) << fg_red << "Unhandled exception in shutdown\n";
 		LOG(ELogLevel::Error) << "Unhandled exception in shutdown\n";
 		goto abort;
 	}
@@ -122,6 +132,12 @@ main(
 	exit_status = EXIT_SUCCESS;
 
 abort:
+	// anything still queued for the console goes out first
+	runtime.Diagnostics()->Close();
+#if defined(USING_HEAP_PROFILER)
+	runtime.HeapProfile()->Close();
+#endif
+
 	/* special case: should be done in app_stop(), but if an exception is
 	 * raised there, then we'll never be able to log it! */
 	runtime.Logger()->Close();
@@ -0,0 +1,412 @@
+
+/**
+ * @file	tools/bench/autojoin_writes.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ *
+ * Counts the socket writes and TLS records a 200-channel autojoin costs,
+ * sending a line at a time (as SendBypass did for every line) against the
+ * batches FlushSendQueue writes, with and without the multi-target JOIN
+ * packing. A real TLS connection is made over a socketpair, with a throwaway
+ * self-signed certificate; writes are counted at the socket BIO, records by
+ * the SSL message callback.
+ *
+ * The lines go through the send path IrcConnection uses, in
+ * src/irc/irc_send_batch.h: SendJoinList's JOIN packing, AddToSendQueue's
+ * queueing, and FlushSendQueue's batching and writes, over an SSL BIO as the
+ * connection holds. The locking, throttling and timers around them are left
+ * out; nothing here is lagging. nethelper.cc is compiled in for wait_socket.
+ *
+ * Standalone; build and run with:
+ *	g++ -std=c++11 -O2 -DNDEBUG -DUSING_OPENSSL_NET -DLOG_COMPILE_LEVEL=0 -I../../src \
+ *		autojoin_writes.cc ../../src/irc/nethelper.cc -o autojoin_writes -lssl -lcrypto -pthread
+ *	./autojoin_writes [channels]
+ *
+ * 200 channels, OpenSSL 3.0:
+ *	                              lines  socket writes  TLS records   bytes sent
+ *	line per write (before)         200            200          200         8090
+ *	batched                         200              1            1         3712
+ *	batched, packed JOINs             5              1            1         2542
+ */
+
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <api/utils.h>
+#include <irc/irc_send_batch.h>
+
+
+
+using namespace APP_NAMESPACE;
+
+
+/** As IrcConnection::FlushSendQueue; never reached, the socketpair keeps up */
+#define SEND_POLL_MS		50
+
+
+static unsigned long	socket_writes;
+static unsigned long	socket_bytes;
+static unsigned long	tls_records;
+
+
+
+// as src/api/utils.cc; all nethelper.cc needs of the runtime
+uint64_t
+APP_NAMESPACE::get_ms_time()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t
+APP_NAMESPACE::strlcpy(
+	char* dest,
+	const char* src,
+	uint32_t dest_size
+)
+{
+	uint32_t	len = (uint32_t)strlen(src);
+
+	if ( dest_size != 0 )
+	{
+		uint32_t	n = len < dest_size - 1 ? len : dest_size - 1;
+
+		memcpy(dest, src, n);
+		dest[n] = '\0';
+	}
+
+	return len;
+}
+
+
+
+/**
+ * BIO callback on the socket BIO; every completed write is one send(2).
+ */
+static long
+count_writes(
+	BIO* bio,
+	int oper,
+	const char* argp,
+	size_t len,
+	int argi,
+	long argl,
+	int ret,
+	size_t* processed
+)
+{
+	(void)bio; (void)argp; (void)len; (void)argi; (void)argl;
+
+	if ( oper == (BIO_CB_WRITE | BIO_CB_RETURN) && ret > 0 )
+	{
+		socket_writes++;
+		socket_bytes += *processed;
+	}
+
+	return ret;
+}
+
+
+
+/**
+ * SSL message callback; called with SSL3_RT_HEADER for every record header
+ * written or read.
+ */
+static void
+count_records(
+	int write_p,
+	int version,
+	int content_type,
+	const void* buf,
+	size_t len,
+	SSL* ssl,
+	void* arg
+)
+{
+	(void)version; (void)buf; (void)len; (void)ssl; (void)arg;
+
+	if ( write_p && content_type == SSL3_RT_HEADER )
+		tls_records++;
+}
+
+
+
+/**
+ * Reads and discards everything sent, until the client closes.
+ */
+static void
+server_thread(
+	SSL* ssl
+)
+{
+	char	buf[16384];
+
+	if ( SSL_accept(ssl) <= 0 )
+	{
+		ERR_print_errors_fp(stderr);
+		return;
+	}
+
+	while ( SSL_read(ssl, buf, sizeof(buf)) > 0 )
+		;
+}
+
+
+
+/**
+ * Creates a throwaway key and self-signed certificate for the server.
+ */
+static bool
+make_certificate(
+	SSL_CTX* ctx
+)
+{
+	EVP_PKEY_CTX*	kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+	EVP_PKEY*	key = nullptr;
+	X509*		cert = X509_new();
+	bool		retval = false;
+
+	if ( kctx == nullptr || cert == nullptr )
+		goto cleanup;
+	if ( EVP_PKEY_keygen_init(kctx) <= 0 ||
+	     EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, 2048) <= 0 ||
+	     EVP_PKEY_keygen(kctx, &key) <= 0 )
+		goto cleanup;
+
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_get_notBefore(cert), 0);
+	X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+	X509_set_pubkey(cert, key);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+		(const unsigned char*)"bench", -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+
+	if ( X509_sign(cert, key, EVP_sha256()) <= 0 )
+		goto cleanup;
+
+	retval = SSL_CTX_use_certificate(ctx, cert) == 1 && SSL_CTX_use_PrivateKey(ctx, key) == 1;
+
+cleanup:
+	X509_free(cert);
+	EVP_PKEY_free(key);
+	EVP_PKEY_CTX_free(kctx);
+	return retval;
+}
+
+
+
+/**
+ * The autojoin as it was queued before JOIN packing; one line per channel.
+ */
+static std::vector<std::string>
+single_joins(
+	unsigned channels
+)
+{
+	std::vector<std::string>	lines;
+
+	for ( unsigned i = 0; i < channels; i++ )
+		lines.push_back("JOIN #channel-" + std::to_string(i));
+
+	return lines;
+}
+
+
+
+/**
+ * The autojoin packed into multi-target JOIN lines, as SendJoinList does;
+ * no keys, and no target limit.
+ */
+static std::vector<std::string>
+packed_joins(
+	unsigned channels
+)
+{
+	std::vector<std::pair<std::string, std::string>>	keyed;
+	std::vector<std::string>	lines;
+
+	for ( unsigned i = 0; i < channels; i++ )
+		keyed.push_back(std::make_pair("#channel-" + std::to_string(i), std::string()));
+
+	pack_join_lines(keyed, keyed.size(), 0, lines);
+
+	return lines;
+}
+
+
+
+/**
+ * Writes one batch, as FlushSendQueue does once it has it; fails the run on
+ * anything but a complete write.
+ */
+static void
+write_batch(
+	BIO* bio,
+	const std::string& batch
+)
+{
+	size_t		written = 0;
+	uint64_t	writes = 0;
+
+	if ( write_send_batch(bio, batch, written, SEND_POLL_MS, writes) != SR_Complete )
+	{
+		fprintf(stderr, "FAIL: batch write did not complete\n");
+		ERR_print_errors_fp(stderr);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+
+/**
+ * Sends the lines as SendBypass did (batch = false), a write each; or as
+ * AddToSendQueue queues them, writing a batch whenever the queue reaches the
+ * batch size, then emptying it as the parsers next pass does.
+ */
+static void
+send_lines(
+	BIO* bio,
+	const std::vector<std::string>& lines,
+	bool batch
+)
+{
+	std::queue<std::string>	queue;
+	uint32_t	queue_bytes = 0;
+	std::string	buf;
+
+	for ( auto& l : lines )
+	{
+		if ( !batch )
+		{
+			write_batch(bio, l + "\r\n");
+			continue;
+		}
+
+		if ( queue_send_line(queue, queue_bytes, l.c_str(), (uint32_t)l.length()) )
+		{
+			take_send_batch(queue, queue_bytes, buf, MAX_LEN_SEND_BATCH);
+			write_batch(bio, buf);
+			buf.clear();
+		}
+	}
+
+	while ( !queue.empty() )
+	{
+		take_send_batch(queue, queue_bytes, buf, MAX_LEN_SEND_BATCH);
+		write_batch(bio, buf);
+		buf.clear();
+	}
+}
+
+
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	unsigned	channels = argc > 1 ? (unsigned)atoi(argv[1]) : 200;
+	struct
+	{
+		const char*			name;
+		std::vector<std::string>	lines;
+		bool				batch;
+	} runs[] = {
+		{ "line per write (before)",  single_joins(channels), false },
+		{ "batched",                  single_joins(channels), true },
+		{ "batched, packed JOINs",    packed_joins(channels), true }
+	};
+
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	printf("%u channel autojoin\n\n", channels);
+	printf("%-26s %8s %14s %12s %12s\n", "", "lines", "socket writes", "TLS records", "bytes sent");
+
+	for ( auto& run : runs )
+	{
+		SSL_CTX*	sctx = SSL_CTX_new(SSLv23_server_method());
+		SSL_CTX*	cctx = SSL_CTX_new(SSLv23_client_method());
+		SSL*		server;
+		SSL*		client;
+		BIO*		sock_bio;
+		BIO*		ssl_bio;
+		int		fds[2];
+
+		if ( sctx == nullptr || cctx == nullptr || !make_certificate(sctx) )
+			goto ssl_error;
+		if ( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 )
+		{
+			perror("socketpair");
+			return EXIT_FAILURE;
+		}
+
+		server = SSL_new(sctx);
+		SSL_set_fd(server, fds[1]);
+
+		client = SSL_new(cctx);
+		sock_bio = BIO_new_socket(fds[0], BIO_NOCLOSE);
+		BIO_set_callback_ex(sock_bio, count_writes);
+		SSL_set_bio(client, sock_bio, sock_bio);
+		SSL_set_msg_callback(client, count_records);
+
+		{
+			std::thread	t(server_thread, server);
+
+			if ( SSL_connect(client) <= 0 )
+			{
+				t.detach();
+				goto ssl_error;
+			}
+
+			// the connection writes through an SSL BIO, not SSL_write
+			ssl_bio = BIO_new(BIO_f_ssl());
+			BIO_set_ssl(ssl_bio, client, BIO_NOCLOSE);
+
+			// only count what the autojoin costs, not the handshake
+			socket_writes = socket_bytes = tls_records = 0;
+
+			send_lines(ssl_bio, run.lines, run.batch);
+
+			printf("%-26s %8zu %14lu %12lu %12lu\n", run.name, run.lines.size(),
+				socket_writes, tls_records, socket_bytes);
+
+			SSL_shutdown(client);
+			shutdown(fds[0], SHUT_WR);
+			t.join();
+			BIO_free(ssl_bio);
+		}
+
+		SSL_free(client);
+		SSL_free(server);
+		SSL_CTX_free(cctx);
+		SSL_CTX_free(sctx);
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	return EXIT_SUCCESS;
+
+ssl_error:
+	ERR_print_errors_fp(stderr);
+	return EXIT_FAILURE;
+}
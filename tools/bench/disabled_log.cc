@@ -0,0 +1,292 @@
+
+/**
+ * @file	tools/bench/disabled_log.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ *
+ * Times what a LOG(ELogLevel::Debug) costs on the recv path when Debug is not
+ * enabled, as IrcConnection::AddToRecvQueue has for every line received.
+ *
+ * The recv path is timed bare, then with the statement as LOG() used to
+ * expand - a LogLine constructed and every operand formatted into the threads
+ * stream, only to be discarded in the destructor - then as it expands now,
+ * with the level checked first so none of the operands are evaluated, and
+ * lastly with LOG_COMPILE_LEVEL below Debug, where the statement folds away.
+ *
+ * The real Log and LogLine are compiled in, at their default level (Warn),
+ * with just enough of the Runtime and the rest for them to link; the log is
+ * never opened, so nothing is written. LOG() is the macro from src/api/Log.h;
+ * the compiled out case redefines LOG_COMPILE_LEVEL around its one function,
+ * as a build with it set lower would have it.
+ *
+ * Standalone; build and run with:
+ *	g++ -std=c++11 -O2 -DNDEBUG -I../../src disabled_log.cc \
+ *		../../src/api/Log.cc ../../src/api/log_binary.cc ../../src/api/MemoryAccounting.cc \
+ *		../../src/api/TimerWheel.cc ../../src/api/Diagnostics.cc ../../src/api/utils.cc \
+ *		-o disabled_log -pthread
+ *	./disabled_log [lines]
+ */
+
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <string>
+
+#include <api/Runtime.h>
+#include <api/Diagnostics.h>
+#include <api/Log.h>
+#include <api/MemoryAccounting.h>
+#include <api/TimerWheel.h>
+
+
+
+using namespace APP_NAMESPACE;
+
+
+/** Repetitions of each run; the fastest is reported */
+#define BENCH_RUNS	5
+
+
+// as src/api/Runtime.cc, for the parts the log needs
+Runtime	&APP_NAMESPACE::runtime = Runtime::Instance();
+
+Runtime::Runtime()
+{
+}
+
+Runtime::~Runtime()
+{
+}
+
+MemoryAccounting*
+Runtime::Accounting() const
+{
+	static MemoryAccounting	accounting;
+	return &accounting;
+}
+
+DiagnosticsSink*
+Runtime::Diagnostics() const
+{
+	static DiagnosticsSink	diagnostics;
+	return &diagnostics;
+}
+
+class Log*
+Runtime::Logger() const
+{
+	static class Log	log;
+	return &log;
+}
+
+TimerWheel*
+Runtime::Timers() const
+{
+	static TimerWheel	timers;
+	return &timers;
+}
+
+
+
+/**
+ * The recv queue, as IrcConnection holds it.
+ */
+struct recv_queue
+{
+	std::mutex			mutex;
+	std::queue<std::string>		lines;
+	size_t				bytes;
+};
+
+
+enum EBenchMode
+{
+	Mode_NoLog,
+	Mode_Before,
+	Mode_Gated,
+	Mode_CompiledOut
+};
+
+
+
+/**
+ * The debug statement as LOG() used to expand; a LogLine, whatever the level.
+ */
+static void
+log_before(
+	recv_queue* queue,
+	const char* data
+)
+{
+	LogLine(ELogLevel::Debug, __FILE__, __func__, __LINE__) << "Recv on " << queue << ": " << data << "\n";
+}
+
+
+/**
+ * The debug statement as LOG() expands now.
+ */
+static void
+log_gated(
+	recv_queue* queue,
+	const char* data
+)
+{
+	LOG(ELogLevel::Debug) << "Recv on " << queue << ": " << data << "\n";
+}
+
+
+// as a build with LOG_COMPILE_LEVEL set to Info
+#pragma push_macro("LOG_COMPILE_LEVEL")
+#undef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL	3
+
+/**
+ * The debug statement as LOG() expands with Debug not compiled in.
+ */
+static void
+log_compiled_out(
+	recv_queue* queue,
+	const char* data
+)
+{
+	LOG(ELogLevel::Debug) << "Recv on " << queue << ": " << data << "\n";
+}
+
+#pragma pop_macro("LOG_COMPILE_LEVEL")
+
+
+
+/**
+ * AddToRecvQueue reduced to its work, and the debug statement in the form
+ * being timed. The parser's side is done straight after, so the queue stays
+ * short.
+ */
+static void
+add_to_recv_queue(
+	recv_queue* queue,
+	const char* data,
+	EBenchMode mode
+)
+{
+	size_t	length = strlen(data);
+
+	{
+		std::lock_guard<std::mutex>	lock(queue->mutex);
+
+		queue->lines.push(data);
+		queue->bytes += length;
+	}
+
+	switch ( mode )
+	{
+	case Mode_Before:
+		log_before(queue, data);
+		break;
+	case Mode_Gated:
+		log_gated(queue, data);
+		break;
+	case Mode_CompiledOut:
+		log_compiled_out(queue, data);
+		break;
+	default:
+		break;
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(queue->mutex);
+
+		queue->bytes -= queue->lines.front().length();
+		queue->lines.pop();
+	}
+}
+
+
+
+/**
+ * Runs the recv path over the lines, returning the nanoseconds per line.
+ */
+static double
+run(
+	unsigned lines,
+	EBenchMode mode
+)
+{
+	recv_queue	queue;
+	const char*	line = ":nick!user@host.example.net PRIVMSG #channel :a line of chatter from a busy channel";
+
+	queue.bytes = 0;
+
+	auto	start = std::chrono::steady_clock::now();
+
+	for ( unsigned i = 0; i < lines; i++ )
+		add_to_recv_queue(&queue, line, mode);
+
+	auto	end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)lines;
+}
+
+
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	unsigned	lines = argc > 1 ? (unsigned)atoi(argv[1]) : 2000000;
+	struct
+	{
+		const char*	name;
+		EBenchMode	mode;
+	} runs[] = {
+		{ "no LOG()", Mode_NoLog },
+		{ "LOG() before", Mode_Before },
+		{ "LOG() level checked", Mode_Gated },
+		{ "LOG() compiled out", Mode_CompiledOut }
+	};
+	double		baseline = 0;
+
+	if ( runtime.Logger()->IsEnabled(ELogLevel::Debug) )
+	{
+		fprintf(stderr, "Debug is enabled by default; nothing would be filtered\n");
+		return EXIT_FAILURE;
+	}
+
+	// warm up; the first lines pay for the allocator and the stream
+	run(lines / 10, Mode_Before);
+
+	printf("%u lines received, Debug filtered, best of %u runs\n\n", lines, BENCH_RUNS);
+	printf("%-22s %12s %14s\n", "", "ns per line", "LOG() cost");
+
+	for ( auto& r : runs )
+	{
+		double	ns = run(lines, r.mode);
+
+		// the best of several, as the differences are down to noise
+		for ( unsigned i = 1; i < BENCH_RUNS; i++ )
+		{
+			double	again = run(lines, r.mode);
+
+			if ( again < ns )
+				ns = again;
+		}
+
+		if ( r.mode == Mode_NoLog )
+		{
+			baseline = ns;
+			printf("%-22s %12.1f\n", r.name, ns);
+			continue;
+		}
+
+		printf("%-22s %12.1f %11.1f ns\n", r.name, ns, ns - baseline);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,415 @@
+/**
+ * @file	tools/bench/dns_resolver.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ *
+ * Checks the DnsResolver against stub lookup functions, installed with
+ * SetLookupFunctions; each stub sleeps for a while, as a real server would,
+ * and counts how often it is called.
+ *
+ * Covered are the cache (case insensitive, and negative), expiry, blocking
+ * callers coalescing on a single lookup, asynchronous lookups running on
+ * several workers at once and joining with blocking callers, and reverse
+ * lookups of both families sharing the cache. The program fails if any check
+ * does not hold; nothing is sent to the network, as the default lookup
+ * functions fail the run if they are ever called.
+ *
+ * The real DnsResolver is compiled in, with LOG() compiled out and just enough
+ * of the rest for it to link.
+ *
+ * Standalone; build and run with:
+ *	g++ -std=c++11 -O2 -DNDEBUG -DLOG_COMPILE_LEVEL=0 -I../../src dns_resolver.cc \
+ *		../../src/irc/DnsResolver.cc -o dns_resolver -pthread
+ *	./dns_resolver
+ */
+
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+
+#include <api/utils.h>
+#include <irc/DnsResolver.h>
+
+
+
+using namespace APP_NAMESPACE;
+typedef std::chrono::steady_clock	bench_clock;
+
+
+/** How long each stubbed lookup takes */
+#define STUB_DELAY_MS		100
+/** Threads resolving the same name at once */
+#define COALESCE_THREADS	8
+
+
+static std::mutex			stub_mutex;
+/** Calls made to the stubs, by name (or address, for reverse lookups) */
+static std::map<std::string, unsigned>	stub_calls;
+static unsigned				failures;
+
+
+
+// as src/api/utils.cc
+uint64_t
+APP_NAMESPACE::get_ms_time()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+		bench_clock::now().time_since_epoch()).count();
+}
+
+
+// as src/irc/nethelper.cc
+bool
+APP_NAMESPACE::ip_address_to_string(
+	const ip_address& ip,
+	char* dest,
+	uint32_t dest_size
+)
+{
+	if ( ip.family != AF_INET && ip.family != AF_INET6 )
+		return false;
+
+	return inet_ntop(ip.family, (void*)&ip.data, dest, dest_size) != nullptr;
+}
+
+
+// the defaults; never to be reached with the stubs in place
+int32_t
+APP_NAMESPACE::host_to_addresses(
+	const char* hostname,
+	std::vector<ip_address>&
+)
+{
+	fprintf(stderr, "FAIL: real lookup of %s\n", hostname);
+	exit(EXIT_FAILURE);
+}
+
+int32_t
+APP_NAMESPACE::address_to_host(
+	const ip_address&,
+	std::string&
+)
+{
+	fprintf(stderr, "FAIL: real reverse lookup\n");
+	exit(EXIT_FAILURE);
+}
+
+
+BEGIN_NAMESPACE(APP_NAMESPACE)
+
+/* the resolver can only be made by the engine; this stands in for it, as
+ * IrcEngine::Resolver() */
+class IrcEngine
+{
+public:
+	static DnsResolver*
+	Resolver()
+	{
+		static DnsResolver	resolver;
+		return &resolver;
+	}
+};
+
+END_NAMESPACE
+
+
+
+static ip_address
+make_address(
+	const char* text
+)
+{
+	ip_address	ip;
+
+	memset(&ip, 0, sizeof(ip));
+	ip.family = strchr(text, ':') == nullptr ? AF_INET : AF_INET6;
+	inet_pton(ip.family, text, &ip.data);
+	return ip;
+}
+
+
+
+static unsigned
+calls(
+	const char* name
+)
+{
+	std::lock_guard<std::mutex>	lock(stub_mutex);
+	return stub_calls[name];
+}
+
+
+
+static void
+check(
+	bool condition,
+	const char* what
+)
+{
+	printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+	if ( !condition )
+		failures++;
+}
+
+
+
+/**
+ * Resolves names ending .invalid to an error, anything else to two addresses
+ * that are derived from the name; so the result can be verified.
+ */
+static int32_t
+stub_lookup(
+	const char* hostname,
+	std::vector<ip_address>& addresses
+)
+{
+	std::string	name = hostname;
+	char		text[INET6_ADDRSTRLEN];
+
+	{
+		std::lock_guard<std::mutex>	lock(stub_mutex);
+		stub_calls[name]++;
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(STUB_DELAY_MS));
+
+	if ( name.size() > 8 && name.compare(name.size() - 8, 8, ".invalid") == 0 )
+		return EAI_NONAME;
+
+	snprintf(text, sizeof(text), "192.0.2.%u", (unsigned)(name.size() % 250));
+	addresses.push_back(make_address(text));
+	snprintf(text, sizeof(text), "2001:db8::%x", (unsigned)name.size());
+	addresses.push_back(make_address(text));
+	return 0;
+}
+
+
+
+/**
+ * Names every address 'host-<address>.example', except those in 198.51.100.0/24
+ * which have no name.
+ */
+static int32_t
+stub_reverse(
+	const ip_address& ip,
+	std::string& hostname
+)
+{
+	char	text[INET6_ADDRSTRLEN];
+
+	ip_address_to_string(ip, text, sizeof(text));
+
+	{
+		std::lock_guard<std::mutex>	lock(stub_mutex);
+		stub_calls[text]++;
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(STUB_DELAY_MS));
+
+	if ( strncmp(text, "198.51.100.", 11) == 0 )
+		return EAI_NONAME;
+
+	hostname = std::string("host-") + text + ".example";
+	return 0;
+}
+
+
+
+/** Expected from stub_lookup for name */
+static bool
+is_stub_result(
+	const char* name,
+	const std::vector<ip_address>& addresses
+)
+{
+	std::vector<ip_address>	expected;
+	char			text[INET6_ADDRSTRLEN];
+
+	snprintf(text, sizeof(text), "192.0.2.%u", (unsigned)(strlen(name) % 250));
+	expected.push_back(make_address(text));
+	snprintf(text, sizeof(text), "2001:db8::%x", (unsigned)strlen(name));
+	expected.push_back(make_address(text));
+
+	if ( addresses.size() != expected.size() )
+		return false;
+
+	for ( size_t i = 0; i < expected.size(); i++ )
+	{
+		if ( addresses[i].family != expected[i].family
+		    || memcmp(&addresses[i].data, &expected[i].data, sizeof(expected[i].data)) != 0 )
+			return false;
+	}
+
+	return true;
+}
+
+
+
+static std::atomic<unsigned>	async_done;
+static std::atomic<unsigned>	async_good;
+static std::thread::id		async_caller;
+static std::atomic<bool>	async_on_caller;
+
+static void
+async_callback(
+	const std::string& hostname,
+	int32_t error,
+	const std::vector<ip_address>& addresses,
+	void* context
+)
+{
+	if ( error == 0 && is_stub_result(hostname.c_str(), addresses) && context == &async_done )
+		async_good++;
+	if ( std::this_thread::get_id() == async_caller )
+		async_on_caller = true;
+	async_done++;
+}
+
+
+
+static void
+wait_async(
+	unsigned count
+)
+{
+	bench_clock::time_point	give_up = bench_clock::now() + std::chrono::seconds(10);
+
+	while ( async_done < count && bench_clock::now() < give_up )
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+
+
+int
+main()
+{
+	DnsResolver*	resolver = IrcEngine::Resolver();
+	std::vector<ip_address>	addresses;
+	std::string	hostname;
+	bench_clock::time_point	start;
+	int64_t		elapsed;
+	int32_t		error;
+
+	resolver->SetLookupFunctions(&stub_lookup, &stub_reverse);
+
+	// blocking, cached, case insensitive
+	error = resolver->Resolve("irc.example.net", addresses);
+	check(error == 0 && is_stub_result("irc.example.net", addresses), "resolves through the stub");
+	addresses.clear();
+	error = resolver->Resolve("IRC.Example.NET", addresses);
+	check(error == 0 && is_stub_result("irc.example.net", addresses), "second lookup has the same result");
+	check(calls("irc.example.net") == 1, "second lookup is answered from the cache");
+
+	// negative caching
+	addresses.clear();
+	error = resolver->Resolve("gone.invalid", addresses);
+	check(error == EAI_NONAME && addresses.empty(), "failure is returned");
+	error = resolver->Resolve("gone.invalid", addresses);
+	check(error == EAI_NONAME && calls("gone.invalid") == 1, "failure is cached");
+
+	// concurrent blocking callers share one lookup
+	{
+		std::vector<std::thread>	threads;
+		std::atomic<unsigned>		good(0);
+
+		for ( unsigned i = 0; i < COALESCE_THREADS; i++ )
+		{
+			threads.push_back(std::thread([resolver, &good]()
+			{
+				std::vector<ip_address>	result;
+
+				if ( resolver->Resolve("busy.example.net", result) == 0
+				    && is_stub_result("busy.example.net", result) )
+					good++;
+			}));
+		}
+		for ( auto& t : threads )
+			t.join();
+
+		check(good == COALESCE_THREADS, "every concurrent caller has the result");
+		check(calls("busy.example.net") == 1, "concurrent callers share one lookup");
+	}
+
+	// expiry
+	resolver->SetTtl(STUB_DELAY_MS / 2, STUB_DELAY_MS / 2);
+	addresses.clear();
+	resolver->Resolve("short.example.net", addresses);
+	std::this_thread::sleep_for(std::chrono::milliseconds(STUB_DELAY_MS));
+	addresses.clear();
+	error = resolver->Resolve("short.example.net", addresses);
+	check(error == 0 && calls("short.example.net") == 2, "expired entries are looked up again");
+	resolver->SetTtl(DNS_DEFAULT_TTL_MS, DNS_DEFAULT_NEGATIVE_TTL_MS);
+
+	// asynchronous lookups run side by side
+	{
+		const char*	names[] = {
+			"a.example.net", "bb.example.net", "ccc.example.net", "dddd.example.net"
+		};
+
+		async_caller = std::this_thread::get_id();
+		start = bench_clock::now();
+		for ( auto n : names )
+			resolver->ResolveAsync(n, &async_callback, &async_done);
+		check(async_done == 0, "uncached async lookups do not complete in the caller");
+
+		wait_async(4);
+		elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(bench_clock::now() - start).count();
+		check(async_good == 4 && !async_on_caller, "async lookups call back with the result");
+		check(elapsed < STUB_DELAY_MS * 3, "async lookups are performed in parallel");
+		printf("      4 async lookups of %u ms took %lld ms\n", STUB_DELAY_MS, (long long)elapsed);
+
+		resolver->ResolveAsync("bb.example.net", &async_callback, &async_done);
+		check(async_done == 5 && async_on_caller, "cached async lookup calls back in the caller");
+		check(calls("bb.example.net") == 1, "cached async lookup is not looked up again");
+	}
+
+	// a blocking caller joins an async lookup already in progress
+	resolver->ResolveAsync("warm.example.net", nullptr, nullptr);
+	addresses.clear();
+	error = resolver->Resolve("warm.example.net", addresses);
+	check(error == 0 && is_stub_result("warm.example.net", addresses), "blocking caller has the async result");
+	check(calls("warm.example.net") == 1, "blocking caller joins the async lookup");
+
+	// reverse lookups, both families
+	error = resolver->ReverseResolve(make_address("203.0.113.7"), hostname);
+	check(error == 0 && hostname == "host-203.0.113.7.example", "IPv4 reverse lookup");
+	hostname.clear();
+	error = resolver->ReverseResolve(make_address("2001:DB8::7"), hostname);
+	check(error == 0 && hostname == "host-2001:db8::7.example", "IPv6 reverse lookup");
+	hostname.clear();
+	resolver->ReverseResolve(make_address("203.0.113.7"), hostname);
+	check(hostname == "host-203.0.113.7.example" && calls("203.0.113.7") == 1, "reverse lookup is cached");
+	hostname = "unchanged";
+	error = resolver->ReverseResolve(make_address("198.51.100.1"), hostname);
+	resolver->ReverseResolve(make_address("198.51.100.1"), hostname);
+	check(error == EAI_NONAME && hostname == "unchanged" && calls("198.51.100.1") == 1, "reverse failure is cached");
+
+	// changing the functions starts afresh
+	resolver->SetLookupFunctions(&stub_lookup, &stub_reverse);
+	addresses.clear();
+	resolver->Resolve("irc.example.net", addresses);
+	check(calls("irc.example.net") == 2, "changing lookup functions flushes the cache");
+
+	resolver->Stop();
+
+	if ( failures != 0 )
+	{
+		printf("%u checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("all checks passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,318 @@
+
+/**
+ * @file	tools/bench/fast_path_latency.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ *
+ * Measures how long a PING waits for its PONG when it arrives behind a burst
+ * of queued lines, answered on receipt through fast_path_command (as
+ * IrcConnection::HandleFastPath does) against waiting its turn in the recv
+ * queue for the parser, as it did before.
+ *
+ * The send is stubbed, recording the time the PONG would have gone out; the
+ * parser thread does a representative amount of work per line - splitting it
+ * into its prefix, command and parameters, and looking up the target - so
+ * the queued figure is a fair estimate of a real backlog.
+ *
+ * The classification itself is checked first, against tagged, prefixed and
+ * lookalike lines; the program fails if any are wrong.
+ *
+ * Standalone; build and run with:
+ *	g++ -std=c++11 -O2 -I../../src fast_path_latency.cc -o fast_path_latency -pthread
+ *	./fast_path_latency [queued lines]
+ */
+
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <irc/irc_fast_path.h>
+
+
+
+using namespace APP_NAMESPACE;
+typedef std::chrono::steady_clock	bench_clock;
+
+
+/** Repetitions of each run; the median is reported */
+#define BENCH_RUNS	5
+
+
+/** When the stubbed send was last called */
+static std::atomic<int64_t>	pong_sent_ns;
+/** What the stubbed send was last given, as it would be written */
+static char			pong_line[512];
+
+
+
+/**
+ * Stands in for IrcConnection::SendBypass; records the time, and formats the
+ * line as the real one would before writing it.
+ */
+static void
+stub_send_pong(
+	const char* params
+)
+{
+	snprintf(pong_line, sizeof(pong_line), "PONG %s\r\n", params);
+	pong_sent_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		bench_clock::now().time_since_epoch()).count();
+}
+
+
+
+/**
+ * The recv queue, as IrcConnection holds it; lines are copied in by the
+ * receiving thread and taken off one at a time by the parser.
+ */
+struct recv_queue
+{
+	std::mutex			mutex;
+	std::condition_variable		cond;
+	std::queue<std::string>		lines;
+};
+
+
+
+/**
+ * Splits a line as the parser does, and looks up the target; returns true
+ * when the line was a PING, having sent the PONG.
+ */
+static bool
+parse_line(
+	const std::string& line,
+	std::unordered_map<std::string, unsigned>& targets
+)
+{
+	std::vector<std::string>	tokens;
+	size_t				pos = 0;
+	size_t				next;
+
+	if ( line[0] == ':' )
+		pos = line.find(' ') + 1;
+
+	while ( pos < line.length() )
+	{
+		if ( line[pos] == ':' )
+		{
+			tokens.push_back(line.substr(pos + 1));
+			break;
+		}
+		if (( next = line.find(' ', pos)) == std::string::npos )
+			next = line.length();
+		tokens.push_back(line.substr(pos, next - pos));
+		pos = next + 1;
+	}
+
+	if ( tokens.empty() )
+		return false;
+
+	if ( tokens[0] == "PING" && tokens.size() > 1 )
+	{
+		stub_send_pong(tokens[1].c_str());
+		return true;
+	}
+	if ( tokens.size() > 1 )
+		targets[tokens[1]]++;
+
+	return false;
+}
+
+
+
+/**
+ * The parser thread; works through the queue until it has handled a PING.
+ */
+static void
+parser_thread(
+	recv_queue* queue,
+	bool* found_ping
+)
+{
+	std::unordered_map<std::string, unsigned>	targets;
+	std::string					line;
+
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex>	lock(queue->mutex);
+
+			while ( queue->lines.empty() )
+				queue->cond.wait(lock);
+
+			line = std::move(queue->lines.front());
+			queue->lines.pop();
+		}
+
+		if ( parse_line(line, targets) )
+		{
+			*found_ping = true;
+			return;
+		}
+	}
+}
+
+
+
+/**
+ * Queues the burst, then frames the PING; returns the nanoseconds from the
+ * PING being framed to the PONG being sent.
+ */
+static int64_t
+run(
+	unsigned queued,
+	bool fast_path
+)
+{
+	recv_queue	queue;
+	bool		found_ping = false;
+	const char*	ping = ":irc.example.net PING :irc.example.net";
+	const char*	params;
+	int64_t		framed_ns;
+	int64_t		sent_ns = 0;
+
+	for ( unsigned i = 0; i < queued; i++ )
+	{
+		queue.lines.push(":nick" + std::to_string(i % 500) + "!user@host.example.net PRIVMSG #channel-"
+			+ std::to_string(i % 40) + " :a line of chatter from a busy channel, number " + std::to_string(i));
+	}
+
+	pong_sent_ns = 0;
+
+	std::thread	t(parser_thread, &queue, &found_ping);
+
+	framed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		bench_clock::now().time_since_epoch()).count();
+
+	if ( fast_path && fast_path_command(ping, &params) == FP_Ping )
+	{
+		stub_send_pong(params);
+		sent_ns = pong_sent_ns;
+
+		if ( strcmp(pong_line, "PONG :irc.example.net\r\n") != 0 )
+		{
+			fprintf(stderr, "unexpected reply: %s", pong_line);
+			exit(EXIT_FAILURE);
+		}
+
+		// the parser still needs something to stop on
+		ping = "PING :done";
+	}
+
+	{
+		std::lock_guard<std::mutex>	lock(queue.mutex);
+		queue.lines.push(ping);
+	}
+	queue.cond.notify_one();
+
+	t.join();
+
+	if ( !found_ping )
+	{
+		fprintf(stderr, "the parser never reached the PING\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ( sent_ns == 0 )
+		sent_ns = pong_sent_ns;
+
+	return sent_ns - framed_ns;
+}
+
+
+
+/**
+ * Checks the classification of lines that should, and shouldn't, take the
+ * fast path.
+ *
+ * @return The number of failures
+ */
+static unsigned
+check_classification()
+{
+	struct
+	{
+		const char*	line;
+		E_FAST_PATH	expected;
+		const char*	params;
+	} cases[] = {
+		{ "PING :irc.example.net", FP_Ping, ":irc.example.net" },
+		{ ":irc.example.net PING :irc.example.net", FP_Ping, ":irc.example.net" },
+		{ "@time=2014-01-01T00:00:00.000Z PING :x", FP_Ping, ":x" },
+		{ "@time=2014-01-01T00:00:00.000Z :irc.example.net PONG irc.example.net :LAG1234", FP_Pong, "irc.example.net :LAG1234" },
+		{ "ERROR :Closing Link: host (Ping timeout)", FP_Error, "Closing Link: host (Ping timeout)" },
+		{ "ERROR nocolon", FP_Error, "nocolon" },
+		{ ":nick!user@host PRIVMSG #chan :PING me", FP_None, nullptr },
+		{ "PINGX :nope", FP_None, nullptr },
+		{ "PING", FP_None, nullptr },
+		{ "@tags-without-a-command", FP_None, nullptr },
+		{ ":prefix-without-a-command", FP_None, nullptr },
+		{ "ERRORS :nope", FP_None, nullptr }
+	};
+	unsigned	failures = 0;
+
+	for ( auto& c : cases )
+	{
+		const char*	params = nullptr;
+		E_FAST_PATH	got = fast_path_command(c.line, &params);
+
+		if ( got != c.expected || (c.params != nullptr && (params == nullptr || strcmp(params, c.params) != 0)) )
+		{
+			printf("FAIL: '%s' gave %d '%s', expected %d '%s'\n", c.line, got,
+				params ? params : "", c.expected, c.params ? c.params : "");
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	unsigned	queued = argc > 1 ? (unsigned)atoi(argv[1]) : 50000;
+	unsigned	failures;
+
+	if (( failures = check_classification()) != 0 )
+	{
+		printf("%u classification failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("classification: ok\n\n");
+
+	printf("PING behind %u queued lines, median of %u runs\n\n", queued, BENCH_RUNS);
+	printf("%-24s %16s\n", "", "PONG latency");
+
+	for ( int fast_path = 0; fast_path < 2; fast_path++ )
+	{
+		std::vector<int64_t>	times;
+
+		for ( unsigned i = 0; i < BENCH_RUNS; i++ )
+			times.push_back(run(queued, fast_path != 0));
+
+		std::sort(times.begin(), times.end());
+
+		printf("%-24s %13.3f ms\n", fast_path ? "fast path" : "queued (before)",
+			times[BENCH_RUNS / 2] / 1e6);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,625 @@
+
+/**
+ * @file	tools/bench/parser_arena.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ *
+ * Counts the heap allocations the parser makes for replayed MODE, JOIN and
+ * PRIVMSG lines, as IrcParser::ParseNextRecvQueueItem handled them before
+ * the message arena, and as it does now.
+ *
+ * Before: each line copied out of the recv queue, and split into a fresh
+ * ircbuf_data and ircbuf_sender; the parameters copied out one MALLOC each,
+ * the modes held in a vector of shared_ptrs, and the JOIN channel name taken
+ * with substr. Now: the line moved out of the queue, and split into the
+ * parsers own ircbuf_data and ircbuf_sender, which keep their capacity; the
+ * parameters split in place in one arena copy, the modes held by value in an
+ * arena-backed vector, and the JOIN channel name trimmed in place.
+ *
+ * The line splitting is the real split_ircbuf_data and split_ircbuf_sender
+ * (src/irc/irc_line_split.h), and the real ScratchArena is compiled in. The
+ * dispatch and handler bodies are reduced to their parsing, as IrcParser.cc
+ * can't be linked without the rest of the engine; what the handlers go on to
+ * do with the objects and listeners isn't counted.
+ *
+ * Every malloc made from the program is counted by wrapping it at link time,
+ * and operator new is replaced so the strings and containers are counted too;
+ * GCC must be told malloc isn't its builtin, or it moves the calls across the
+ * counter reads. The results of both are compared, so the harness fails if
+ * the two extract anything different.
+ *
+ * Standalone, with GNU ld; build and run with:
+ *	g++ -std=c++11 -O2 -fno-builtin-malloc -I../../src parser_arena.cc ../../src/api/ScratchArena.cc \
+ *		-Wl,--wrap=malloc -o parser_arena
+ *	./parser_arena [lines]
+ */
+
+
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <api/ScratchArena.h>
+#include <irc/irc_line_split.h>
+
+
+
+using namespace APP_NAMESPACE;
+
+
+/** The modes in each replayed MODE line */
+#define MODES_PER_LINE	6
+
+
+static uint64_t		num_mallocs;
+
+extern "C" void*	__real_malloc(size_t size);
+
+extern "C" void*
+__wrap_malloc(
+	size_t size
+)
+{
+	num_mallocs++;
+	return __real_malloc(size);
+}
+
+
+/* the library's operator new calls malloc from outside our wrap. Delete
+ * isn't inlined, or GCC sees new paired with free and complains */
+void*
+operator new(
+	size_t size
+)
+{
+	void*	p = malloc(size == 0 ? 1 : size);
+
+	if ( p == nullptr )
+		throw std::bad_alloc();
+	return p;
+}
+
+__attribute__((noinline)) void
+operator delete(
+	void* p
+) noexcept
+{
+	free(p);
+}
+
+
+
+/** mode_data, as it was; the data held as a copy, where now it points in */
+struct old_mode_data
+{
+	bool		is_enabled;
+	bool		has_data;
+	char		mode;
+	std::string	data;
+};
+
+
+
+/**
+ * As IrcParser::ParseParam; splits off the next parameter in place.
+ */
+static char*
+parse_param(
+	char** data
+)
+{
+	char*	p;
+
+	if ( **data == ':' )
+	{
+		p = *data;
+		*data += strlen(*data);
+		return (p + 1);
+	}
+
+	p = *data;
+
+	while ( **data != '\0' && **data != ' ' )
+		(*data)++;
+
+	if ( **data == ' ' )
+		*(*data)++ = '\0';
+
+	return p;
+}
+
+
+
+/**
+ * As IrcParser::ParseParameters was; the buffer is split in place (despite
+ * being const), and each wanted parameter copied with MALLOC.
+ */
+static bool
+old_parse_parameters(
+	const char* buffer,
+	uint32_t num_args,
+	...
+)
+{
+	char**		arg_str;
+	char*		tmp_str;
+	char*		p = (char*)buffer;
+	uint32_t	alloc;
+	uint32_t	i = num_args;
+	va_list		args;
+
+	va_start(args, num_args);
+
+	while ( i-- > 0 )
+	{
+		arg_str = (char**)va_arg(args, char**);
+
+		if ( i == 0 )
+			tmp_str = *p == ':' ? p+1 : p;
+		else
+			tmp_str = parse_param(&p);
+
+		if ( arg_str != nullptr && *arg_str == nullptr )
+		{
+			alloc = strlen(tmp_str) + 1;
+			*arg_str = (char*)malloc(alloc);
+			memcpy(*arg_str, tmp_str, alloc);
+		}
+	}
+
+	va_end(args);
+	return true;
+}
+
+
+
+/**
+ * As IrcParser::ParseParameters is; one copy of the line into the arena,
+ * split in place, with the parameters pointing into it.
+ */
+static bool
+arena_parse_parameters(
+	ScratchArena& arena,
+	const char* buffer,
+	uint32_t num_args,
+	...
+)
+{
+	char**		arg_str;
+	char*		tmp_str;
+	char*		p;
+	uint32_t	i = num_args;
+	va_list		args;
+
+	if (( p = arena.Duplicate(buffer, strlen(buffer))) == nullptr )
+		return false;
+
+	va_start(args, num_args);
+
+	while ( i-- > 0 )
+	{
+		arg_str = (char**)va_arg(args, char**);
+
+		if ( i == 0 )
+			tmp_str = *p == ':' ? p+1 : p;
+		else
+			tmp_str = parse_param(&p);
+
+		if ( arg_str != nullptr && *arg_str == nullptr )
+			*arg_str = tmp_str;
+	}
+
+	va_end(args);
+	return true;
+}
+
+
+
+/**
+ * The figures of one scheme; the allocations, and a checksum of what was
+ * extracted, to compare the schemes by.
+ */
+struct run_result
+{
+	uint64_t	recv_mallocs;		/**< Dequeueing and splitting the line */
+	uint64_t	param_mallocs;		/**< Extracting the parameters */
+	uint64_t	handler_mallocs;	/**< The rest of the handler */
+	uint64_t	checksum;
+};
+
+
+
+/**
+ * Adds a string to a checksum.
+ */
+static void
+sum(
+	uint64_t& checksum,
+	const char* str
+)
+{
+	while ( *str != '\0' )
+		checksum = checksum * 31 + (unsigned char)*str++;
+	checksum = checksum * 31 + '|';
+}
+
+
+/**
+ * Adds the sender to a checksum, as every handler reads it.
+ */
+static void
+sum_sender(
+	uint64_t& checksum,
+	const ircbuf_sender* sender
+)
+{
+	sum(checksum, sender->nickname.c_str());
+	sum(checksum, sender->ident.c_str());
+	sum(checksum, sender->hostmask.c_str());
+}
+
+
+
+/**
+ * HandleMode, as it was.
+ */
+static void
+old_handle_mode(
+	ircbuf_data* data,
+	run_result& res
+)
+{
+	char*		channel = nullptr;
+	char*		modestr = nullptr;
+	char*		targets = nullptr;
+	char*		p;
+	bool		is_set = true;
+	uint64_t	before = num_mallocs;
+
+	old_parse_parameters(data->data.c_str(), 3, &channel, &modestr, &targets);
+	res.param_mallocs += num_mallocs - before;
+
+	{
+		std::vector<std::shared_ptr<old_mode_data>>	modes;
+
+		for ( const char* m = modestr; *m != '\0'; m++ )
+		{
+			if ( *m == '+' || *m == '-' )
+			{
+				is_set = (*m == '+');
+				continue;
+			}
+
+			std::shared_ptr<old_mode_data>	mode(new old_mode_data);
+
+			mode->is_enabled = is_set;
+			mode->mode = *m;
+			mode->has_data = true;
+			modes.push_back(mode);
+		}
+
+		p = targets;
+		for ( auto& m : modes )
+			m->data = parse_param(&p);
+
+		sum(res.checksum, channel);
+		for ( auto& m : modes )
+			sum(res.checksum, m->data.c_str());
+	}
+
+	free(channel);
+	free(modestr);
+	free(targets);
+}
+
+
+/**
+ * HandleMode, as it is now.
+ */
+static void
+arena_handle_mode(
+	ScratchArena& arena,
+	ircbuf_data* data,
+	run_result& res
+)
+{
+	char*		channel = nullptr;
+	char*		modestr = nullptr;
+	char*		targets = nullptr;
+	char*		p;
+	bool		is_set = true;
+	uint64_t	before = num_mallocs;
+
+	arena_parse_parameters(arena, data->data.c_str(), 3, &channel, &modestr, &targets);
+	res.param_mallocs += num_mallocs - before;
+
+	std::vector<mode_data, arena_allocator<mode_data>>	modes((arena_allocator<mode_data>(&arena)));
+
+	for ( const char* m = modestr; *m != '\0'; m++ )
+	{
+		if ( *m == '+' || *m == '-' )
+		{
+			is_set = (*m == '+');
+			continue;
+		}
+
+		mode_data	mode;
+
+		mode.is_enabled = is_set;
+		mode.mode = *m;
+		mode.has_data = true;
+		mode.data = "";
+		modes.push_back(mode);
+	}
+
+	p = targets;
+	for ( auto& m : modes )
+		m.data = parse_param(&p);
+
+	sum(res.checksum, channel);
+	for ( auto& m : modes )
+		sum(res.checksum, m.data);
+}
+
+
+/**
+ * HandleJoin, as it was; the channel name copied out with substr.
+ */
+static void
+old_handle_join(
+	ircbuf_data* data,
+	run_result& res
+)
+{
+	std::string	channel_name;
+
+	channel_name = data->data.substr(data->data[0] == ':' ? 1 : 0);
+
+	sum(res.checksum, channel_name.c_str());
+}
+
+
+/**
+ * HandleJoin, as it is now; the data trimmed down to the name in place.
+ */
+static void
+arena_handle_join(
+	ircbuf_data* data,
+	run_result& res
+)
+{
+	const std::string&	channel_name = data->data;
+
+	if ( !data->data.empty() && data->data[0] == ':' )
+		data->data.erase(0, 1);
+
+	sum(res.checksum, channel_name.c_str());
+}
+
+
+/**
+ * HandlePrivmsg, as it was.
+ */
+static void
+old_handle_privmsg(
+	ircbuf_data* data,
+	run_result& res
+)
+{
+	char*		target = nullptr;
+	char*		message = nullptr;
+	uint64_t	before = num_mallocs;
+
+	old_parse_parameters(data->data.c_str(), 2, &target, &message);
+	res.param_mallocs += num_mallocs - before;
+
+	sum(res.checksum, target);
+	sum(res.checksum, message);
+
+	free(target);
+	free(message);
+}
+
+
+/**
+ * HandlePrivmsg, as it is now.
+ */
+static void
+arena_handle_privmsg(
+	ScratchArena& arena,
+	ircbuf_data* data,
+	run_result& res
+)
+{
+	char*		target = nullptr;
+	char*		message = nullptr;
+	uint64_t	before = num_mallocs;
+
+	arena_parse_parameters(arena, data->data.c_str(), 2, &target, &message);
+	res.param_mallocs += num_mallocs - before;
+
+	sum(res.checksum, target);
+	sum(res.checksum, message);
+}
+
+
+
+/**
+ * ParseNextRecvQueueItem as it was, over the whole queue; the line copied
+ * out, and split into a fresh pair of structures.
+ */
+static run_result
+run_old(
+	std::queue<std::string>& recv_queue
+)
+{
+	run_result	res = { 0, 0, 0, 0 };
+	uint64_t	before;
+
+	while ( !recv_queue.empty() )
+	{
+		std::string	queue_str;
+		ircbuf_data	buf_data;
+		ircbuf_sender	sender;
+
+		before = num_mallocs;
+		queue_str = recv_queue.front();
+		recv_queue.pop();
+
+		if ( split_ircbuf_data((char*)queue_str.c_str(), &buf_data) != LS_OK
+		    || split_ircbuf_sender((char*)buf_data.sender.c_str(), &sender) != LS_OK )
+			abort();
+		res.recv_mallocs += num_mallocs - before;
+
+		sum_sender(res.checksum, &sender);
+
+		before = num_mallocs;
+		if ( buf_data.code == "MODE" )
+			old_handle_mode(&buf_data, res);
+		else if ( buf_data.code == "JOIN" )
+			old_handle_join(&buf_data, res);
+		else
+			old_handle_privmsg(&buf_data, res);
+		res.handler_mallocs += num_mallocs - before;
+	}
+
+	return res;
+}
+
+
+/**
+ * ParseNextRecvQueueItem as it is now, over the whole queue; the line moved
+ * out, split into the structures kept across lines, and the arena reset
+ * after dispatch.
+ */
+static run_result
+run_arena(
+	std::queue<std::string>& recv_queue,
+	ScratchArena& arena
+)
+{
+	run_result	res = { 0, 0, 0, 0 };
+	uint64_t	before;
+	ircbuf_data	buf_data;
+	ircbuf_sender	sender;
+
+	while ( !recv_queue.empty() )
+	{
+		std::string	queue_str;
+
+		before = num_mallocs;
+		queue_str = std::move(recv_queue.front());
+		recv_queue.pop();
+
+		if ( split_ircbuf_data((char*)queue_str.c_str(), &buf_data) != LS_OK
+		    || split_ircbuf_sender((char*)buf_data.sender.c_str(), &sender) != LS_OK )
+			abort();
+		res.recv_mallocs += num_mallocs - before;
+
+		sum_sender(res.checksum, &sender);
+
+		before = num_mallocs;
+		if ( buf_data.code == "MODE" )
+			arena_handle_mode(arena, &buf_data, res);
+		else if ( buf_data.code == "JOIN" )
+			arena_handle_join(&buf_data, res);
+		else
+			arena_handle_privmsg(arena, &buf_data, res);
+		res.handler_mallocs += num_mallocs - before;
+
+		arena.Reset();
+	}
+
+	return res;
+}
+
+
+
+/**
+ * Prints one schemes figures, per line.
+ */
+static void
+print_result(
+	const char* name,
+	const run_result& res,
+	unsigned count
+)
+{
+	uint64_t	handler = res.handler_mallocs - res.param_mallocs;
+
+	printf("%-18s %10.2f %12.2f %10.2f %10.2f\n", name,
+		res.recv_mallocs / (double)count,
+		res.param_mallocs / (double)count,
+		handler / (double)count,
+		(res.recv_mallocs + res.handler_mallocs) / (double)count);
+}
+
+
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	unsigned	count = argc > 1 ? (unsigned)atoi(argv[1]) : 100000;
+	std::queue<std::string>	old_queue;
+	std::queue<std::string>	arena_queue;
+	ScratchArena	arena;
+	run_result	old_res;
+	run_result	arena_res;
+
+	/* a third each of MODE, JOIN and PRIVMSG, from a rotating set of
+	 * users; the JOINs alternate between names that fit in a strings own
+	 * buffer and ones that don't */
+	for ( unsigned i = 0; i < count; i++ )
+	{
+		std::string	nick = "nick" + std::to_string(i % 500);
+		std::string	line = ":" + nick + "!~" + nick + "@host-" + std::to_string(i % 500) + ".example.net ";
+
+		switch ( i % 3 )
+		{
+		case 0:
+			line += "MODE #channel-" + std::to_string(i % 40) + " +ooo-vvv";
+			for ( unsigned m = 0; m < MODES_PER_LINE; m++ )
+				line += " nick" + std::to_string((i + m) % 500);
+			break;
+		case 1:
+			line += (i & 1) ? "JOIN :#channel-" : "JOIN :#a-rather-longer-channel-";
+			line += std::to_string(i % 40);
+			break;
+		default:
+			line += "PRIVMSG #channel-" + std::to_string(i % 40) + " :a line of chatter from a busy channel";
+			break;
+		}
+
+		old_queue.push(line);
+	}
+	arena_queue = old_queue;
+
+	old_res = run_old(old_queue);
+	arena_res = run_arena(arena_queue, arena);
+
+	if ( old_res.checksum != arena_res.checksum )
+	{
+		printf("FAIL: the two schemes extracted different data\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%u lines; MODE (%u modes), JOIN and PRIVMSG in turn. Allocations per line:\n\n",
+		count, MODES_PER_LINE);
+	printf("%-18s %10s %12s %10s %10s\n", "", "receive", "parameters", "handler", "total");
+	print_result("before", old_res, count);
+	print_result("arena, reused", arena_res, count);
+	printf("\narena blocks obtained: %llu\n", (unsigned long long)arena.BlockAllocations());
+
+	return EXIT_SUCCESS;
+}
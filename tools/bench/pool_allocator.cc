@@ -0,0 +1,350 @@
+
+/**
+ * @file	tools/bench/pool_allocator.cc
+ * @author	James Warren
+ * @copyright	James Warren, 2014
+ * @license	Zlib (see LICENCE or http://opensource.org/licenses/Zlib)
+ *
+ * Compares the PoolAllocator against the system malloc, for throughput and
+ * peak resident size, under the pattern we allocate in: connection threads
+ * allocating each received line, and the parser thread freeing them, having
+ * made short-lived copies of parameters from each - so nearly every block is
+ * freed on a different thread to the one that allocated it.
+ *
+ * The real PoolAllocator is compiled in, with just enough of the Runtime for
+ * it to be found. Each run is made in a child process of its own, so the peak
+ * resident size (VmHWM) is that of the one allocator; the lines are checked as
+ * they're consumed, and a run fails if any were corrupted.
+ *
+ * Standalone, on Linux; build and run with:
+ *	g++ -std=c++11 -O2 -DNDEBUG -DUSING_POOL_ALLOCATOR -I../../src pool_allocator.cc \
+ *		../../src/api/PoolAllocator.cc -o pool_allocator -pthread
+ *	./pool_allocator [lines per producer]
+ */
+
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <api/Runtime.h>
+#include <api/PoolAllocator.h>
+
+
+
+using namespace APP_NAMESPACE;
+
+
+/** Connection threads producing lines */
+#define BENCH_PRODUCERS		4
+/** Runs of each allocator; the medians are reported */
+#define BENCH_RUNS		3
+
+
+// as src/api/Runtime.cc, for the parts the allocator needs
+Runtime	&APP_NAMESPACE::runtime = Runtime::Instance();
+
+Runtime::Runtime()
+{
+}
+
+Runtime::~Runtime()
+{
+}
+
+PoolAllocator*
+Runtime::PoolAlloc() const
+{
+	static PoolAllocator	allocator;
+	return &allocator;
+}
+
+
+
+static bool			use_pool;
+static unsigned			lines_per_producer;
+
+static std::mutex		queue_mutex;
+static std::queue<char*>	queue;
+
+
+
+static void*
+bench_alloc(
+	size_t size
+)
+{
+	return use_pool ? runtime.PoolAlloc()->Alloc(size) : malloc(size);
+}
+
+
+static void*
+bench_realloc(
+	void* memory,
+	size_t size
+)
+{
+	return use_pool ? runtime.PoolAlloc()->Realloc(memory, size) : realloc(memory, size);
+}
+
+
+static void
+bench_free(
+	void* memory
+)
+{
+	if ( use_pool )
+		runtime.PoolAlloc()->Free(memory);
+	else
+		free(memory);
+}
+
+
+
+/**
+ * A connection thread; allocates lines of varying length, filled with a
+ * character of its own, and queues them for the parser.
+ */
+static void
+producer_thread(
+	unsigned id
+)
+{
+	for ( unsigned i = 0; i < lines_per_producer; i++ )
+	{
+		size_t	len = 8 + (i * 7) % 300;
+		char*	line;
+
+		if (( line = (char*)bench_alloc(len)) == nullptr )
+			abort();
+
+		memset(line, 'a' + id, len - 1);
+		line[len - 1] = '\0';
+
+		std::lock_guard<std::mutex>	lock(queue_mutex);
+		queue.push(line);
+	}
+}
+
+
+
+/**
+ * The parser thread; checks each line, copies part of it out and grows the
+ * copy, then frees both.
+ */
+static void
+consumer_thread()
+{
+	unsigned long	total = (unsigned long)lines_per_producer * BENCH_PRODUCERS;
+	unsigned long	got = 0;
+
+	while ( got < total )
+	{
+		char*	line = nullptr;
+		char*	copy;
+		size_t	len;
+
+		{
+			std::lock_guard<std::mutex>	lock(queue_mutex);
+
+			if ( !queue.empty() )
+			{
+				line = queue.front();
+				queue.pop();
+			}
+		}
+
+		if ( line == nullptr )
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		len = strlen(line);
+		for ( size_t i = 1; i < len; i++ )
+		{
+			if ( line[i] != line[0] )
+				abort();
+		}
+
+		// a parameter, then the whole line, as a handler might
+		if (( copy = (char*)bench_alloc(len / 3 + 1)) == nullptr )
+			abort();
+		memcpy(copy, line, len / 3);
+		copy[len / 3] = '\0';
+
+		if (( copy = (char*)bench_realloc(copy, len + 1)) == nullptr )
+			abort();
+		memcpy(copy, line, len + 1);
+		if ( strcmp(copy, line) != 0 )
+			abort();
+
+		bench_free(copy);
+		bench_free(line);
+		got++;
+	}
+}
+
+
+
+/**
+ * Gets a figure from /proc/self/status, in kB.
+ */
+static unsigned long
+status_kb(
+	const char* name
+)
+{
+	FILE*		fp;
+	char		line[256];
+	size_t		len = strlen(name);
+	unsigned long	retval = 0;
+
+	if (( fp = fopen("/proc/self/status", "r")) == nullptr )
+		return 0;
+
+	while ( fgets(line, sizeof(line), fp) != nullptr )
+	{
+		if ( strncmp(line, name, len) == 0 && line[len] == ':' )
+		{
+			retval = strtoul(line + len + 1, nullptr, 10);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return retval;
+}
+
+
+
+/**
+ * Runs the workload in a child process; the result is written back through
+ * a pipe.
+ *
+ * @return true if the run completed, with elapsed and hwm set
+ */
+static bool
+run(
+	bool pool,
+	double* elapsed_ms,
+	unsigned long* hwm_kb
+)
+{
+	int	fds[2];
+	int	status;
+	pid_t	pid;
+	double	result[2];
+
+	if ( pipe(fds) != 0 )
+		return false;
+
+	if (( pid = fork()) == 0 )
+	{
+		std::vector<std::thread>	producers;
+		char*				b;
+
+		use_pool = pool;
+
+		auto	start = std::chrono::steady_clock::now();
+
+		for ( unsigned i = 0; i < BENCH_PRODUCERS; i++ )
+			producers.push_back(std::thread(producer_thread, i));
+
+		std::thread	consumer(consumer_thread);
+
+		for ( auto& t : producers )
+			t.join();
+		consumer.join();
+
+		// and across the boundary to, and back from, a large allocation
+		b = (char*)bench_alloc(10);
+		strcpy(b, "hello");
+		if (( b = (char*)bench_realloc(b, 2000)) == nullptr || strcmp(b, "hello") != 0 )
+			abort();
+		if (( b = (char*)bench_realloc(b, 20)) == nullptr || strcmp(b, "hello") != 0 )
+			abort();
+		bench_free(b);
+
+		result[0] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		result[1] = (double)status_kb("VmHWM");
+
+		if ( write(fds[1], result, sizeof(result)) != sizeof(result) )
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+
+	if ( pid == -1 || read(fds[0], result, sizeof(result)) != sizeof(result) )
+	{
+		close(fds[0]);
+		if ( pid != -1 )
+			waitpid(pid, &status, 0);
+		return false;
+	}
+
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	*elapsed_ms = result[0];
+	*hwm_kb = (unsigned long)result[1];
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	double		ms[2][BENCH_RUNS];
+	unsigned long	hwm[2][BENCH_RUNS];
+
+	lines_per_producer = argc > 1 ? (unsigned)atoi(argv[1]) : 500000;
+
+	printf("%u producers x %u lines, 1 consumer; median of %u runs\n\n",
+		BENCH_PRODUCERS, lines_per_producer, BENCH_RUNS);
+
+	// interleaved, so neither gets the quieter machine
+	for ( unsigned i = 0; i < BENCH_RUNS; i++ )
+	{
+		for ( int pool = 0; pool < 2; pool++ )
+		{
+			if ( !run(pool != 0, &ms[pool][i], &hwm[pool][i]) )
+			{
+				printf("FAIL: the %s run did not complete\n", pool ? "pool" : "malloc");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	printf("%-16s %12s %14s\n", "", "elapsed", "peak RSS");
+
+	for ( int pool = 0; pool < 2; pool++ )
+	{
+		std::sort(ms[pool], ms[pool] + BENCH_RUNS);
+		std::sort(hwm[pool], hwm[pool] + BENCH_RUNS);
+
+		printf("%-16s %9.0f ms %11lu kB\n", pool ? "PoolAllocator" : "system malloc",
+			ms[pool][BENCH_RUNS / 2], hwm[pool][BENCH_RUNS / 2]);
+	}
+
+	printf("\npool time vs malloc: %+.1f%%\n",
+		(ms[1][BENCH_RUNS / 2] - ms[0][BENCH_RUNS / 2]) * 100.0 / ms[0][BENCH_RUNS / 2]);
+
+	return EXIT_SUCCESS;
+}